@@ -0,0 +1,474 @@
+/* SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) 2025 Debojeet Das
+ *
+ * epserver: event driven HTTP server on mTCP over FLASH. Every request is
+ * answered from memory with a body of a fixed size, so the numbers
+ * measure the stack and not a filesystem. Pair it with epwget.
+ */
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include <mtcp_api.h>
+#include <mtcp_epoll.h>
+#include <http_parsing.h>
+#include <log.h>
+
+#define MAX_CPUS 16
+#define MAX_EVENTS 8192
+#define HTTP_HEADER_LEN 1024
+#define ACCEPT_BATCH 64
+#define LISTEN_BACKLOG 4096
+
+struct conn {
+	char rbuf[HTTP_HEADER_LEN + 1]; /* find_http_header() writes one past */
+	int rlen;
+	bool keep_alive;
+	const char *resp; /* response being written, NULL if none */
+	size_t resp_len;
+	size_t resp_off;
+};
+
+struct server_stats {
+	uint64_t conns;
+	uint64_t requests;
+	uint64_t bytes;
+	uint64_t errors;
+} __attribute__((aligned(64)));
+
+struct thread_context {
+	mctx_t mctx;
+	int ep;
+	int listener;
+	struct conn *conns;
+	struct server_stats *stats;
+};
+
+struct appconf {
+	const char *conf_file;
+	int num_cores;
+	int port;
+	size_t body_size;
+} app_conf;
+
+static int max_conns;
+static volatile bool done[MAX_CPUS];
+static pthread_t app_thread[MAX_CPUS];
+static struct server_stats stats[MAX_CPUS];
+
+/* the two possible answers, built once */
+static char *resp_keep_alive, *resp_close;
+static size_t resp_keep_alive_len, resp_close_len;
+
+// clang-format off
+static const char *epserver_options[] = {
+	"-f <file>\tmTCP configuration file (default: epserver.conf)",
+	"-N <num>\tNumber of cores (default: all, up to 16)",
+	"-p <port>\tListening port (default: 80)",
+	"-s <bytes>\tResponse body size (default: 64)",
+	NULL
+};
+// clang-format on
+
+static void usage(const char *prog)
+{
+	int i;
+
+	fprintf(stderr, "Usage: %s [options]\n", prog);
+	for (i = 0; epserver_options[i]; i++)
+		fprintf(stderr, "  %s\n", epserver_options[i]);
+}
+
+static int parse_app_args(int argc, char **argv, struct appconf *conf)
+{
+	int c;
+
+	conf->conf_file = "epserver.conf";
+	conf->num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if (conf->num_cores > MAX_CPUS)
+		conf->num_cores = MAX_CPUS;
+	conf->port = 80;
+	conf->body_size = 64;
+
+	while ((c = getopt(argc, argv, "hf:N:p:s:")) != -1)
+		switch (c) {
+		case 'f':
+			conf->conf_file = optarg;
+			break;
+		case 'N':
+			conf->num_cores = atoi(optarg);
+			break;
+		case 'p':
+			conf->port = atoi(optarg);
+			break;
+		case 's':
+			conf->body_size = strtoul(optarg, NULL, 10);
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+
+	if (conf->num_cores <= 0 || conf->num_cores > MAX_CPUS) {
+		log_error("Number of cores must be within 1-%d", MAX_CPUS);
+		return -1;
+	}
+	if (conf->port <= 0 || conf->port > 65535) {
+		log_error("Invalid port %d", conf->port);
+		return -1;
+	}
+
+	return 0;
+}
+
+static char *build_response(size_t body_size, bool keep_alive, size_t *len)
+{
+	char hdr[256];
+	char *resp;
+	int hlen;
+
+	hlen = snprintf(hdr, sizeof(hdr),
+			"HTTP/1.1 200 OK\r\n"
+			"Server: epserver/flash\r\n"
+			"Content-Type: application/octet-stream\r\n"
+			"Content-Length: %zu\r\n"
+			"Connection: %s\r\n\r\n",
+			body_size, keep_alive ? "keep-alive" : "close");
+
+	resp = malloc(hlen + body_size);
+	if (!resp)
+		return NULL;
+
+	memcpy(resp, hdr, hlen);
+	memset(resp + hlen, 'x', body_size);
+	*len = hlen + body_size;
+	return resp;
+}
+
+static void close_connection(struct thread_context *ctx, int sockid)
+{
+	mtcp_epoll_ctl(ctx->mctx, ctx->ep, MTCP_EPOLL_CTL_DEL, sockid, NULL);
+	mtcp_close(ctx->mctx, sockid);
+}
+
+static void set_events(struct thread_context *ctx, int sockid, uint32_t events)
+{
+	struct mtcp_epoll_event ev;
+
+	ev.events = events;
+	ev.data.sockid = sockid;
+	mtcp_epoll_ctl(ctx->mctx, ctx->ep, MTCP_EPOLL_CTL_MOD, sockid, &ev);
+}
+
+/* push as much of the pending response as the send buffer takes;
+ * returns 1 when it is all out, 0 if it has to wait, -1 on error */
+static int send_response(struct thread_context *ctx, int sockid, struct conn *c)
+{
+	ssize_t ret;
+
+	while (c->resp_off < c->resp_len) {
+		ret = mtcp_write(ctx->mctx, sockid, c->resp + c->resp_off, c->resp_len - c->resp_off);
+		if (ret < 0)
+			return (errno == EAGAIN) ? 0 : -1;
+		if (ret == 0)
+			return 0;
+		c->resp_off += ret;
+		ctx->stats->bytes += ret;
+	}
+
+	c->resp = NULL;
+	return 1;
+}
+
+/* answer every complete request in the buffer; returns -1 if the
+ * connection is to be closed */
+static int process_requests(struct thread_context *ctx, int sockid, struct conn *c)
+{
+	int hdr_len;
+	int ret;
+
+	while (!c->resp && c->rlen > 0) {
+		hdr_len = find_http_header(c->rbuf, c->rlen);
+		if (hdr_len <= 0) {
+			/* a header that does not fit is not served */
+			return (c->rlen >= HTTP_HEADER_LEN) ? -1 : 0;
+		}
+
+		if (strncmp(c->rbuf, HTTP_GET, sizeof(HTTP_GET) - 1)) {
+			ctx->stats->errors++;
+			return -1;
+		}
+
+		/* HTTP/1.1 keeps the connection unless told otherwise,
+		 * HTTP/1.0 only when asked to */
+		if (strstr(c->rbuf, HTTPV1_STR))
+			c->keep_alive = !strcasestr(c->rbuf, "\nConnection: close");
+		else
+			c->keep_alive = strcasestr(c->rbuf, "\nConnection: keep-alive") != NULL;
+
+		c->rlen -= hdr_len;
+		memmove(c->rbuf, c->rbuf + hdr_len, c->rlen);
+
+		if (c->keep_alive) {
+			c->resp = resp_keep_alive;
+			c->resp_len = resp_keep_alive_len;
+		} else {
+			c->resp = resp_close;
+			c->resp_len = resp_close_len;
+		}
+		c->resp_off = 0;
+		ctx->stats->requests++;
+
+		ret = send_response(ctx, sockid, c);
+		if (ret < 0)
+			return -1;
+		if (ret == 0) {
+			set_events(ctx, sockid, MTCP_EPOLLOUT);
+			return 0;
+		}
+		if (!c->keep_alive)
+			return -1;
+	}
+
+	return 0;
+}
+
+static void handle_read(struct thread_context *ctx, int sockid)
+{
+	struct conn *c = &ctx->conns[sockid];
+	ssize_t rd;
+
+	for (;;) {
+		rd = mtcp_read(ctx->mctx, sockid, c->rbuf + c->rlen, HTTP_HEADER_LEN - c->rlen);
+		if (rd > 0) {
+			c->rlen += rd;
+			if (process_requests(ctx, sockid, c) < 0)
+				break;
+			if (c->resp || c->rlen >= HTTP_HEADER_LEN)
+				return;
+			continue;
+		}
+		if (rd < 0 && errno == EAGAIN)
+			return;
+		/* closed by the peer or broken */
+		break;
+	}
+
+	close_connection(ctx, sockid);
+}
+
+static void handle_write(struct thread_context *ctx, int sockid)
+{
+	struct conn *c = &ctx->conns[sockid];
+	int ret;
+
+	if (!c->resp)
+		return;
+
+	ret = send_response(ctx, sockid, c);
+	if (ret == 0)
+		return;
+	if (ret < 0 || !c->keep_alive) {
+		close_connection(ctx, sockid);
+		return;
+	}
+
+	set_events(ctx, sockid, MTCP_EPOLLIN);
+	/* pipelined requests that came in meanwhile */
+	if (process_requests(ctx, sockid, c) < 0)
+		close_connection(ctx, sockid);
+}
+
+static void accept_connections(struct thread_context *ctx)
+{
+	struct mtcp_epoll_event ev;
+	int sockids[ACCEPT_BATCH];
+	int n, i;
+
+	while ((n = mtcp_accept_many(ctx->mctx, ctx->listener, sockids, NULL, ACCEPT_BATCH)) > 0) {
+		for (i = 0; i < n; i++) {
+			if (sockids[i] >= max_conns) {
+				log_error("Socket id %d exceeds max_concurrency", sockids[i]);
+				mtcp_close(ctx->mctx, sockids[i]);
+				continue;
+			}
+			memset(&ctx->conns[sockids[i]], 0, sizeof(struct conn));
+			mtcp_setsock_nonblock(ctx->mctx, sockids[i]);
+			ev.events = MTCP_EPOLLIN;
+			ev.data.sockid = sockids[i];
+			mtcp_epoll_ctl(ctx->mctx, ctx->ep, MTCP_EPOLL_CTL_ADD, sockids[i], &ev);
+		}
+		ctx->stats->conns += n;
+	}
+
+	if (n < 0 && errno != EAGAIN)
+		log_error("mtcp_accept_many() failed: %s", strerror(errno));
+}
+
+static int create_listening_socket(struct thread_context *ctx)
+{
+	struct mtcp_epoll_event ev;
+	struct sockaddr_in saddr;
+	int sockid;
+
+	sockid = mtcp_socket(ctx->mctx, AF_INET, SOCK_STREAM, 0);
+	if (sockid < 0) {
+		log_error("Failed to create listening socket");
+		return -1;
+	}
+	if (mtcp_setsock_nonblock(ctx->mctx, sockid) < 0) {
+		log_error("Failed to set socket in nonblocking mode");
+		return -1;
+	}
+
+	saddr.sin_family = AF_INET;
+	saddr.sin_addr.s_addr = INADDR_ANY;
+	saddr.sin_port = htons(app_conf.port);
+	if (mtcp_bind(ctx->mctx, sockid, (struct sockaddr *)&saddr, sizeof(saddr)) < 0) {
+		log_error("Failed to bind to port %d", app_conf.port);
+		return -1;
+	}
+	if (mtcp_listen(ctx->mctx, sockid, LISTEN_BACKLOG) < 0) {
+		log_error("mtcp_listen() failed");
+		return -1;
+	}
+
+	ev.events = MTCP_EPOLLIN;
+	ev.data.sockid = sockid;
+	mtcp_epoll_ctl(ctx->mctx, ctx->ep, MTCP_EPOLL_CTL_ADD, sockid, &ev);
+
+	return sockid;
+}
+
+static void *server_routine(void *arg)
+{
+	int core = (int)(intptr_t)arg;
+	struct mtcp_epoll_event *events;
+	struct thread_context ctx = { 0 };
+	int nevents, sockid, i;
+
+	mtcp_core_affinitize(core);
+
+	ctx.mctx = mtcp_create_context(core);
+	if (!ctx.mctx) {
+		log_error("Failed to create mtcp context on core %d", core);
+		return NULL;
+	}
+	ctx.stats = &stats[core];
+
+	ctx.ep = mtcp_epoll_create(ctx.mctx, MAX_EVENTS);
+	events = calloc(MAX_EVENTS, sizeof(struct mtcp_epoll_event));
+	ctx.conns = calloc(max_conns, sizeof(struct conn));
+	if (ctx.ep < 0 || !events || !ctx.conns) {
+		log_error("Failed to set up core %d", core);
+		goto out;
+	}
+
+	ctx.listener = create_listening_socket(&ctx);
+	if (ctx.listener < 0)
+		goto out;
+
+	log_info("Core %d serving on port %d", core, app_conf.port);
+
+	while (!done[core]) {
+		nevents = mtcp_epoll_wait(ctx.mctx, ctx.ep, events, MAX_EVENTS, -1);
+		if (nevents < 0) {
+			if (errno != EINTR)
+				log_error("mtcp_epoll_wait() failed: %s", strerror(errno));
+			break;
+		}
+
+		for (i = 0; i < nevents; i++) {
+			sockid = events[i].data.sockid;
+			if (sockid == ctx.listener) {
+				accept_connections(&ctx);
+			} else if (events[i].events & MTCP_EPOLLERR) {
+				ctx.stats->errors++;
+				close_connection(&ctx, sockid);
+			} else if (events[i].events & MTCP_EPOLLIN) {
+				handle_read(&ctx, sockid);
+			} else if (events[i].events & MTCP_EPOLLOUT) {
+				handle_write(&ctx, sockid);
+			}
+		}
+	}
+
+out:
+	free(ctx.conns);
+	free(events);
+	mtcp_destroy_context(ctx.mctx);
+	return NULL;
+}
+
+/* mTCP delivers the signal to one thread, which passes it on */
+static void int_exit(int sig)
+{
+	int i;
+
+	for (i = 0; i < app_conf.num_cores; i++) {
+		if (app_thread[i] == pthread_self())
+			done[i] = true;
+		else if (!done[i])
+			pthread_kill(app_thread[i], sig);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct server_stats total = { 0 };
+	struct mtcp_conf mcfg;
+	int i;
+
+	if (parse_app_args(argc, argv, &app_conf) < 0)
+		return EXIT_FAILURE;
+
+	resp_keep_alive = build_response(app_conf.body_size, true, &resp_keep_alive_len);
+	resp_close = build_response(app_conf.body_size, false, &resp_close_len);
+	if (!resp_keep_alive || !resp_close) {
+		log_error("Failed to allocate the response");
+		return EXIT_FAILURE;
+	}
+
+	if (mtcp_init(app_conf.conf_file)) {
+		log_error("Failed to initialize mtcp with %s", app_conf.conf_file);
+		return EXIT_FAILURE;
+	}
+
+	mtcp_getconf(&mcfg);
+	mcfg.num_cores = app_conf.num_cores;
+	mtcp_setconf(&mcfg);
+	max_conns = mcfg.max_concurrency;
+
+	mtcp_register_signal(SIGINT, int_exit);
+
+	for (i = 0; i < app_conf.num_cores; i++) {
+		if (pthread_create(&app_thread[i], NULL, server_routine, (void *)(intptr_t)i)) {
+			log_error("Failed to create server thread %d", i);
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (i = 0; i < app_conf.num_cores; i++) {
+		pthread_join(app_thread[i], NULL);
+		total.conns += stats[i].conns;
+		total.requests += stats[i].requests;
+		total.bytes += stats[i].bytes;
+		total.errors += stats[i].errors;
+	}
+
+	log_info("Served %lu connections, %lu requests, %lu bytes, %lu errors", total.conns, total.requests, total.bytes,
+		 total.errors);
+
+	mtcp_destroy();
+	free(resp_keep_alive);
+	free(resp_close);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,232 @@
+# SPDX-License-Identifier: Apache-2.0
+# Copyright (c) 2025 Debojeet Das
+#
+# HTTP benchmark of mTCP over FLASH: epserver on one end of a veth pair,
+# epwget on the other, both behind a monitor started for the run.
+#
+#   sudo python3 examples/epwget/http-bench.py -n 2 -d 10
+#
+# Runs one connection per request (connections/s) and keep-alive
+# (requests/s) by default, and prints connections/s, requests/s and
+# latency percentiles for each. Run it from the repository root after
+# building; --json saves the results as a baseline.
+
+import argparse
+import json
+import os
+import pty
+import re
+import shutil
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+
+SERVER_IP = "10.0.0.1"
+CLIENT_IP = "10.0.0.2"
+PREFIX = 24
+PORT = 80
+
+RESULT_RE = re.compile(r"^RESULT (.*)$", re.M)
+
+
+def run(cmd, check=True):
+    return subprocess.run(cmd, check=check, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+
+
+def link_exists(ifname):
+    return os.path.exists(f"/sys/class/net/{ifname}")
+
+
+def mac_of(ifname):
+    with open(f"/sys/class/net/{ifname}/address") as fh:
+        return fh.read().strip()
+
+
+def setup_veth(srv_if, cli_if, queues):
+    run(["ip", "link", "add", srv_if, "numtxqueues", str(queues), "numrxqueues", str(queues), "type", "veth",
+         "peer", "name", cli_if, "numtxqueues", str(queues), "numrxqueues", str(queues)])
+    for ifname, ip in ((srv_if, SERVER_IP), (cli_if, CLIENT_IP)):
+        run(["ip", "addr", "add", f"{ip}/{PREFIX}", "dev", ifname])
+        run(["ip", "link", "set", ifname, "up"])
+
+
+def teardown_veth(srv_if):
+    run(["ip", "link", "del", srv_if], check=False)
+
+
+def monitor_config(srv_if, cli_if, cores):
+    def umem(umem_id, ifname, ip):
+        return {
+            "umem_id": umem_id,
+            "nf": [{
+                "nf_id": 0,
+                "nf_ip": ip,
+                "nf_port": PORT,
+                "thread": [{"thread_id": t, "queue": t} for t in range(cores)],
+            }],
+            "ifname": ifname,
+            "xdp_flags": "d",
+            "bind_flags": "c",
+            "mode": "b",
+            "custom_xsk": False,
+            "frags_enabled": False,
+        }
+
+    return {"umem": [umem(0, srv_if, SERVER_IP), umem(1, cli_if, CLIENT_IP)], "route": {"0": []}}
+
+
+def start_monitor(build, cfg_path):
+    """The monitor only takes commands on its TUI, so drive it over a pty."""
+    master, slave = pty.openpty()
+    env = dict(os.environ, TERM=os.environ.get("TERM", "xterm"))
+    proc = subprocess.Popen([os.path.join(build, "monitor", "monitor")], stdin=slave, stdout=slave, stderr=slave,
+                            env=env, start_new_session=True)
+    os.close(slave)
+
+    # the prompt comes up a second after the UDS server
+    time.sleep(2)
+    os.write(master, f"load config {cfg_path}\r".encode())
+    time.sleep(2)
+    if proc.poll() is not None:
+        sys.exit("error: monitor exited, is the FLASH setup in place?")
+    return proc, master
+
+
+def stop(proc, timeout=10):
+    if proc.poll() is None:
+        proc.send_signal(signal.SIGINT)
+        try:
+            proc.wait(timeout=timeout)
+        except subprocess.TimeoutExpired:
+            proc.kill()
+            proc.wait()
+
+
+def prepare_dir(base, name, template, ifname, cores, peer_ip, peer_mac):
+    """An mTCP working directory: its .conf plus config/arp.conf."""
+    wd = os.path.join(base, name)
+    os.makedirs(os.path.join(wd, "config"))
+
+    with open(template) as fh:
+        conf = fh.read()
+    conf = re.sub(r"^port = .*$", f"port = {ifname}", conf, flags=re.M)
+    conf = re.sub(r"^stat_print = .*$", f"stat_print = {ifname}", conf, flags=re.M)
+    conf = re.sub(r"^num_cores = .*$", f"num_cores = {cores}", conf, flags=re.M)
+    with open(os.path.join(wd, os.path.basename(template)), "w") as fh:
+        fh.write(conf)
+
+    # no ARP round trip inside the measurement
+    with open(os.path.join(wd, "config", "arp.conf"), "w") as fh:
+        fh.write(f"ARP_ENTRY 1\n{peer_ip}/32 {peer_mac}\n")
+
+    return wd
+
+
+def start_server(build, wd, args):
+    log = open(os.path.join(wd, "epserver.log"), "w")
+    proc = subprocess.Popen([os.path.join(os.path.abspath(build), "examples", "epserver", "epserver"),
+                             "-f", "epserver.conf", "-N", str(args.cores), "-p", str(PORT), "-s", str(args.body)],
+                            cwd=wd, stdout=log, stderr=subprocess.STDOUT)
+
+    deadline = time.time() + 30
+    while time.time() < deadline:
+        with open(os.path.join(wd, "epserver.log")) as fh:
+            if fh.read().count("serving on port") >= args.cores:
+                return proc
+        if proc.poll() is not None:
+            break
+        time.sleep(0.5)
+
+    stop(proc)
+    sys.exit(f"error: epserver did not come up, see {wd}/epserver.log")
+
+
+def run_client(build, wd, args, reqs_per_conn):
+    cmd = [os.path.join(os.path.abspath(build), "examples", "epwget", "epwget"), "-f", "epwget.conf",
+           "-N", str(args.cores), "-s", SERVER_IP, "-p", str(PORT), "-c", str(args.concurrency),
+           "-r", str(reqs_per_conn), "-d", str(args.duration)]
+    out = subprocess.run(cmd, cwd=wd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True,
+                         timeout=args.duration + 60).stdout
+    with open(os.path.join(wd, f"epwget-r{reqs_per_conn}.log"), "w") as fh:
+        fh.write(out)
+
+    m = RESULT_RE.search(out)
+    if not m:
+        sys.exit(f"error: no RESULT from epwget, see {wd}/epwget-r{reqs_per_conn}.log")
+    return {k: float(v) for k, v in (kv.split("=") for kv in m.group(1).split())}
+
+
+def main():
+    ap = argparse.ArgumentParser(description="mTCP over FLASH HTTP benchmark")
+    ap.add_argument("-b", "--build", default="build", help="meson build directory")
+    ap.add_argument("-n", "--cores", type=int, default=1, help="cores (and veth queues) per side")
+    ap.add_argument("-d", "--duration", type=int, default=10, help="seconds per run")
+    ap.add_argument("-c", "--concurrency", type=int, default=100, help="concurrent connections")
+    ap.add_argument("-s", "--body", type=int, default=64, help="response body size in bytes")
+    ap.add_argument("-r", "--reqs-per-conn", default="1,0",
+                    help="comma separated requests per connection, 0 keeps connections open")
+    ap.add_argument("--ifaces", default="veth0,veth1", help="server and client interfaces")
+    ap.add_argument("--keep", action="store_true", help="keep the working directory")
+    ap.add_argument("--json", help="write the results to this file")
+    args = ap.parse_args()
+
+    if os.geteuid() != 0:
+        sys.exit("error: needs root for the veth pair and the monitor")
+
+    srv_if, cli_if = args.ifaces.split(",")
+    created = False
+    if not link_exists(srv_if):
+        setup_veth(srv_if, cli_if, args.cores)
+        created = True
+
+    base = tempfile.mkdtemp(prefix="flash-http-bench-")
+    here = os.path.dirname(os.path.abspath(__file__))
+    cfg_path = os.path.join(base, "monitor.json")
+    with open(cfg_path, "w") as fh:
+        json.dump(monitor_config(srv_if, cli_if, args.cores), fh, indent=4)
+
+    srv_wd = prepare_dir(base, "server", os.path.join(here, "..", "epserver", "epserver.conf"), srv_if, args.cores,
+                         CLIENT_IP, mac_of(cli_if))
+    cli_wd = prepare_dir(base, "client", os.path.join(here, "epwget.conf"), cli_if, args.cores, SERVER_IP,
+                         mac_of(srv_if))
+
+    monitor = server = None
+    results = []
+    try:
+        monitor, pty_fd = start_monitor(args.build, cfg_path)
+        server = start_server(args.build, srv_wd, args)
+
+        for r in (int(x) for x in args.reqs_per_conn.split(",")):
+            res = run_client(args.build, cli_wd, args, r)
+            res.update(reqs_per_conn=r, cores=args.cores, concurrency=args.concurrency, body=args.body)
+            results.append(res)
+    finally:
+        if server:
+            stop(server)
+        if monitor:
+            stop(monitor)
+            os.close(pty_fd)
+        if created:
+            teardown_veth(srv_if)
+
+    print(f"\n{'req/conn':>8} {'conns/s':>12} {'req/s':>12} {'p50 us':>9} {'p90 us':>9} {'p99 us':>9} "
+          f"{'p99.9 us':>9} {'errors':>7}")
+    for res in results:
+        print(f"{res['reqs_per_conn'] or 'inf':>8} {res['conns_per_sec']:>12.1f} {res['req_per_sec']:>12.1f} "
+              f"{res['p50_us']:>9.1f} {res['p90_us']:>9.1f} {res['p99_us']:>9.1f} {res['p999_us']:>9.1f} "
+              f"{int(res['errors']):>7}")
+
+    if args.json:
+        with open(args.json, "w") as fh:
+            json.dump(results, fh, indent=4)
+
+    if args.keep:
+        print(f"\nlogs in {base}")
+    else:
+        shutil.rmtree(base)
+
+
+if __name__ == "__main__":
+    main()
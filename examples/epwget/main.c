@@ -0,0 +1,588 @@
+/* SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) 2025 Debojeet Das
+ *
+ * epwget: HTTP load generator on mTCP over FLASH. Every core keeps its
+ * share of the concurrent connections busy with GET requests, opening a
+ * new connection after a given number of requests, and records the time
+ * from sending a request to having read the whole response. Prints
+ * connections/s, requests/s and latency percentiles once per second and
+ * for the whole run; the last line, prefixed RESULT, is for scripts.
+ */
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include <mtcp_api.h>
+#include <mtcp_epoll.h>
+#include <http_parsing.h>
+#include <log.h>
+
+#define MAX_CPUS 16
+#define MAX_EVENTS 8192
+#define HTTP_HEADER_LEN 1024
+#define RECV_BUF_LEN 8192
+#define REQUEST_LEN 256
+
+/* latency histogram: 2^LAT_SUB_BITS linear buckets per power of two,
+ * i.e. within 1.6% of the recorded value */
+#define LAT_SUB_BITS 6
+#define LAT_SUB_COUNT (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS ((64 - LAT_SUB_BITS + 1) * LAT_SUB_COUNT)
+
+struct conn {
+	bool connected;
+	bool header_done;
+	int requests; /* sent on this connection */
+	long body_len; /* -1 until the header is in */
+	long body_read;
+	int hdr_len;
+	uint64_t sent_ns;
+	char hbuf[HTTP_HEADER_LEN + 1]; /* find_http_header() writes one past */
+};
+
+struct client_stats {
+	uint64_t conns; /* completed */
+	uint64_t requests;
+	uint64_t bytes;
+	uint64_t errors;
+	uint64_t lat[LAT_BUCKETS]; /* ns */
+	uint64_t lat_max;
+} __attribute__((aligned(64)));
+
+struct thread_context {
+	mctx_t mctx;
+	int ep;
+	int active; /* open connections */
+	int target; /* connections to keep open */
+	struct conn *conns;
+	struct client_stats *stats;
+};
+
+struct appconf {
+	const char *conf_file;
+	int num_cores;
+	in_addr_t daddr;
+	int port;
+	const char *url;
+	int concurrency;
+	int reqs_per_conn; /* 0: never close */
+	int duration;
+} app_conf;
+
+static int max_conns;
+static volatile bool done[MAX_CPUS];
+static pthread_t app_thread[MAX_CPUS];
+static struct client_stats stats[MAX_CPUS];
+
+static char request[REQUEST_LEN];
+static int request_len;
+
+// clang-format off
+static const char *epwget_options[] = {
+	"-f <file>\tmTCP configuration file (default: epwget.conf)",
+	"-N <num>\tNumber of cores (default: all, up to 16)",
+	"-s <ip>\tServer address (required)",
+	"-p <port>\tServer port (default: 80)",
+	"-u <url>\tRequested path (default: /)",
+	"-c <num>\tConcurrent connections over all cores (default: 100)",
+	"-r <num>\tRequests per connection, 0 for no limit (default: 1)",
+	"-d <sec>\tDuration of the run (default: 10)",
+	NULL
+};
+// clang-format on
+
+static void usage(const char *prog)
+{
+	int i;
+
+	fprintf(stderr, "Usage: %s -s <ip> [options]\n", prog);
+	for (i = 0; epwget_options[i]; i++)
+		fprintf(stderr, "  %s\n", epwget_options[i]);
+}
+
+static int parse_app_args(int argc, char **argv, struct appconf *conf)
+{
+	int c;
+
+	conf->conf_file = "epwget.conf";
+	conf->num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if (conf->num_cores > MAX_CPUS)
+		conf->num_cores = MAX_CPUS;
+	conf->daddr = INADDR_NONE;
+	conf->port = 80;
+	conf->url = "/";
+	conf->concurrency = 100;
+	conf->reqs_per_conn = 1;
+	conf->duration = 10;
+
+	while ((c = getopt(argc, argv, "hf:N:s:p:u:c:r:d:")) != -1)
+		switch (c) {
+		case 'f':
+			conf->conf_file = optarg;
+			break;
+		case 'N':
+			conf->num_cores = atoi(optarg);
+			break;
+		case 's':
+			conf->daddr = inet_addr(optarg);
+			break;
+		case 'p':
+			conf->port = atoi(optarg);
+			break;
+		case 'u':
+			conf->url = optarg;
+			break;
+		case 'c':
+			conf->concurrency = atoi(optarg);
+			break;
+		case 'r':
+			conf->reqs_per_conn = atoi(optarg);
+			break;
+		case 'd':
+			conf->duration = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+
+	if (conf->daddr == INADDR_NONE) {
+		usage(argv[0]);
+		return -1;
+	}
+	if (conf->num_cores <= 0 || conf->num_cores > MAX_CPUS) {
+		log_error("Number of cores must be within 1-%d", MAX_CPUS);
+		return -1;
+	}
+	if (conf->concurrency < conf->num_cores || conf->reqs_per_conn < 0 || conf->duration <= 0) {
+		log_error("Need at least one connection per core, a non-negative request count and a duration");
+		return -1;
+	}
+
+	return 0;
+}
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/*----------------------------------------------------------------------------*/
+static inline int lat_bucket(uint64_t v)
+{
+	int shift;
+
+	if (v < LAT_SUB_COUNT)
+		return v;
+	shift = 63 - __builtin_clzll(v) - LAT_SUB_BITS;
+	return ((shift + 1) << LAT_SUB_BITS) + ((v >> shift) & (LAT_SUB_COUNT - 1));
+}
+
+/* lowest value that lands in bucket b */
+static inline uint64_t lat_value(int b)
+{
+	int shift = (b >> LAT_SUB_BITS) - 1;
+
+	if (shift < 0)
+		return b;
+	return (uint64_t)(LAT_SUB_COUNT + (b & (LAT_SUB_COUNT - 1))) << shift;
+}
+
+static void lat_record(struct client_stats *st, uint64_t ns)
+{
+	st->lat[lat_bucket(ns)]++;
+	if (ns > st->lat_max)
+		st->lat_max = ns;
+}
+
+/* value at quantile q of a histogram holding cnt samples */
+static uint64_t lat_quantile(const uint64_t *lat, uint64_t cnt, double q)
+{
+	uint64_t rank = (uint64_t)(q * cnt);
+	uint64_t seen = 0;
+	int b;
+
+	for (b = 0; b < LAT_BUCKETS; b++) {
+		seen += lat[b];
+		if (seen > rank)
+			return lat_value(b);
+	}
+	return 0;
+}
+/*----------------------------------------------------------------------------*/
+static int create_connection(struct thread_context *ctx)
+{
+	struct mtcp_epoll_event ev;
+	struct sockaddr_in addr;
+	int sockid;
+	int ret;
+
+	sockid = mtcp_socket(ctx->mctx, AF_INET, SOCK_STREAM, 0);
+	if (sockid < 0) {
+		log_error("Failed to create socket");
+		return -1;
+	}
+	if (sockid >= max_conns) {
+		log_error("Socket id %d exceeds max_concurrency", sockid);
+		mtcp_close(ctx->mctx, sockid);
+		return -1;
+	}
+	if (mtcp_setsock_nonblock(ctx->mctx, sockid) < 0) {
+		log_error("Failed to set socket in nonblocking mode");
+		mtcp_close(ctx->mctx, sockid);
+		return -1;
+	}
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = app_conf.daddr;
+	addr.sin_port = htons(app_conf.port);
+	ret = mtcp_connect(ctx->mctx, sockid, (struct sockaddr *)&addr, sizeof(addr));
+	if (ret < 0 && errno != EINPROGRESS) {
+		if (errno != EAGAIN)
+			log_error("mtcp_connect() failed: %s", strerror(errno));
+		mtcp_close(ctx->mctx, sockid);
+		return -1;
+	}
+
+	memset(&ctx->conns[sockid], 0, offsetof(struct conn, hbuf));
+	ctx->active++;
+
+	ev.events = MTCP_EPOLLOUT;
+	ev.data.sockid = sockid;
+	mtcp_epoll_ctl(ctx->mctx, ctx->ep, MTCP_EPOLL_CTL_ADD, sockid, &ev);
+
+	return sockid;
+}
+
+static void close_connection(struct thread_context *ctx, int sockid)
+{
+	mtcp_epoll_ctl(ctx->mctx, ctx->ep, MTCP_EPOLL_CTL_DEL, sockid, NULL);
+	mtcp_close(ctx->mctx, sockid);
+	ctx->active--;
+}
+
+static void set_events(struct thread_context *ctx, int sockid, uint32_t events)
+{
+	struct mtcp_epoll_event ev;
+
+	ev.events = events;
+	ev.data.sockid = sockid;
+	mtcp_epoll_ctl(ctx->mctx, ctx->ep, MTCP_EPOLL_CTL_MOD, sockid, &ev);
+}
+
+static int send_request(struct thread_context *ctx, int sockid)
+{
+	struct conn *c = &ctx->conns[sockid];
+	ssize_t wr;
+
+	c->header_done = false;
+	c->hdr_len = 0;
+	c->body_len = -1;
+	c->body_read = 0;
+	c->sent_ns = now_ns();
+
+	/* a request is far below the send buffer of a fresh connection */
+	wr = mtcp_write(ctx->mctx, sockid, request, request_len);
+	if (wr < request_len)
+		return -1;
+
+	c->requests++;
+	set_events(ctx, sockid, MTCP_EPOLLIN);
+	return 0;
+}
+
+/* the response is in: count it and either ask again or hang up */
+static void complete_request(struct thread_context *ctx, int sockid)
+{
+	struct conn *c = &ctx->conns[sockid];
+
+	lat_record(ctx->stats, now_ns() - c->sent_ns);
+	ctx->stats->requests++;
+
+	if (app_conf.reqs_per_conn && c->requests >= app_conf.reqs_per_conn) {
+		ctx->stats->conns++;
+		close_connection(ctx, sockid);
+		return;
+	}
+
+	if (send_request(ctx, sockid) < 0) {
+		ctx->stats->errors++;
+		close_connection(ctx, sockid);
+	}
+}
+
+static void handle_read(struct thread_context *ctx, int sockid)
+{
+	struct conn *c = &ctx->conns[sockid];
+	char buf[RECV_BUF_LEN];
+	int scode, ver;
+	ssize_t rd;
+	int prev, n;
+
+	for (;;) {
+		rd = mtcp_read(ctx->mctx, sockid, buf, sizeof(buf));
+		if (rd < 0 && errno == EAGAIN)
+			return;
+		if (rd <= 0)
+			break;
+		ctx->stats->bytes += rd;
+
+		if (c->header_done) {
+			c->body_read += rd;
+		} else {
+			prev = c->hdr_len;
+			n = (rd < HTTP_HEADER_LEN - prev) ? rd : HTTP_HEADER_LEN - prev;
+			memcpy(c->hbuf + prev, buf, n);
+			c->hdr_len += n;
+
+			n = find_http_header(c->hbuf, c->hdr_len);
+			if (n <= 0) {
+				if (c->hdr_len >= HTTP_HEADER_LEN)
+					break;
+				continue;
+			}
+
+			/* both check errno for strtol() failures */
+			errno = 0;
+			if (!http_parse_first_resp_line(c->hbuf, n, &scode, &ver) || scode != 200)
+				break;
+			c->body_len = http_header_long_val(c->hbuf, CONTENT_LENGTH_HDR, sizeof(CONTENT_LENGTH_HDR) - 1);
+			if (c->body_len < 0)
+				break;
+			c->header_done = true;
+			/* the header ended in this read, the rest is body */
+			c->body_read = rd - (n - prev);
+		}
+
+		if (c->body_read >= c->body_len) {
+			complete_request(ctx, sockid);
+			return;
+		}
+	}
+
+	/* the server hung up early or sent garbage */
+	ctx->stats->errors++;
+	close_connection(ctx, sockid);
+}
+
+static void handle_write(struct thread_context *ctx, int sockid)
+{
+	struct conn *c = &ctx->conns[sockid];
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	if (c->connected)
+		return;
+
+	if (mtcp_getsockopt(ctx->mctx, sockid, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+		ctx->stats->errors++;
+		close_connection(ctx, sockid);
+		return;
+	}
+
+	c->connected = true;
+	if (send_request(ctx, sockid) < 0) {
+		ctx->stats->errors++;
+		close_connection(ctx, sockid);
+	}
+}
+
+static void *client_routine(void *arg)
+{
+	int core = (int)(intptr_t)arg;
+	struct mtcp_epoll_event *events;
+	struct thread_context ctx = { 0 };
+	int nevents, sockid, i;
+
+	mtcp_core_affinitize(core);
+
+	ctx.mctx = mtcp_create_context(core);
+	if (!ctx.mctx) {
+		log_error("Failed to create mtcp context on core %d", core);
+		return NULL;
+	}
+	ctx.stats = &stats[core];
+
+	/* spread the connections, the first cores take the remainder */
+	ctx.target = app_conf.concurrency / app_conf.num_cores + (core < app_conf.concurrency % app_conf.num_cores);
+	if (ctx.target > max_conns)
+		ctx.target = max_conns;
+
+	/* source ports that the NIC hashes back to this core */
+	if (mtcp_init_rss(ctx.mctx, INADDR_ANY, 1, app_conf.daddr, htons(app_conf.port)) < 0) {
+		log_error("Failed to set up the address pool of core %d", core);
+		goto out_ctx;
+	}
+
+	ctx.ep = mtcp_epoll_create(ctx.mctx, MAX_EVENTS);
+	events = calloc(MAX_EVENTS, sizeof(struct mtcp_epoll_event));
+	ctx.conns = calloc(max_conns, sizeof(struct conn));
+	if (ctx.ep < 0 || !events || !ctx.conns) {
+		log_error("Failed to set up core %d", core);
+		goto out;
+	}
+
+	while (!done[core]) {
+		while (ctx.active < ctx.target) {
+			if (create_connection(&ctx) < 0)
+				break;
+		}
+
+		nevents = mtcp_epoll_wait(ctx.mctx, ctx.ep, events, MAX_EVENTS, 100);
+		if (nevents < 0) {
+			if (errno != EINTR)
+				log_error("mtcp_epoll_wait() failed: %s", strerror(errno));
+			break;
+		}
+
+		for (i = 0; i < nevents; i++) {
+			sockid = events[i].data.sockid;
+			if (events[i].events & MTCP_EPOLLERR) {
+				ctx.stats->errors++;
+				close_connection(&ctx, sockid);
+			} else if (events[i].events & MTCP_EPOLLIN) {
+				handle_read(&ctx, sockid);
+			} else if (events[i].events & MTCP_EPOLLOUT) {
+				handle_write(&ctx, sockid);
+			}
+		}
+	}
+
+out:
+	free(ctx.conns);
+	free(events);
+out_ctx:
+	mtcp_destroy_context(ctx.mctx);
+	return NULL;
+}
+/*----------------------------------------------------------------------------*/
+static void sum_stats(struct client_stats *total)
+{
+	int i, b;
+
+	memset(total, 0, sizeof(*total));
+	for (i = 0; i < app_conf.num_cores; i++) {
+		total->conns += stats[i].conns;
+		total->requests += stats[i].requests;
+		total->bytes += stats[i].bytes;
+		total->errors += stats[i].errors;
+		for (b = 0; b < LAT_BUCKETS; b++)
+			total->lat[b] += stats[i].lat[b];
+		if (stats[i].lat_max > total->lat_max)
+			total->lat_max = stats[i].lat_max;
+	}
+}
+
+/* rates over secs seconds and latency percentiles of the requests in
+ * cur but not in prev */
+static void print_stats(const char *tag, const struct client_stats *cur, const struct client_stats *prev, double secs)
+{
+	static uint64_t lat[LAT_BUCKETS];
+	uint64_t reqs = cur->requests - prev->requests;
+	int b;
+
+	for (b = 0; b < LAT_BUCKETS; b++)
+		lat[b] = cur->lat[b] - prev->lat[b];
+
+	printf("[%s] conns/s %.1f req/s %.1f Mbps %.2f errors %lu | latency us p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f\n", tag,
+	       (cur->conns - prev->conns) / secs, reqs / secs, (cur->bytes - prev->bytes) * 8 / secs / 1e6,
+	       cur->errors - prev->errors, lat_quantile(lat, reqs, 0.5) / 1e3, lat_quantile(lat, reqs, 0.9) / 1e3,
+	       lat_quantile(lat, reqs, 0.99) / 1e3, lat_quantile(lat, reqs, 0.999) / 1e3);
+	fflush(stdout);
+}
+
+/* mTCP delivers the signal to one thread, which passes it on */
+static void int_exit(int sig)
+{
+	int i;
+
+	for (i = 0; i < app_conf.num_cores; i++) {
+		if (app_thread[i] == pthread_self())
+			done[i] = true;
+		else if (!done[i])
+			pthread_kill(app_thread[i], sig);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static struct client_stats zero, prev, cur;
+	struct mtcp_conf mcfg;
+	uint64_t start, last, now;
+	int i;
+
+	if (parse_app_args(argc, argv, &app_conf) < 0)
+		return EXIT_FAILURE;
+
+	request_len = snprintf(request, sizeof(request),
+			       "GET %s HTTP/1.1\r\n"
+			       "User-Agent: epwget/flash\r\n"
+			       "Host: %s\r\n"
+			       "Connection: %s\r\n\r\n",
+			       app_conf.url, inet_ntoa(*(struct in_addr *)&app_conf.daddr),
+			       (app_conf.reqs_per_conn == 1) ? "close" : "keep-alive");
+	if (request_len >= (int)sizeof(request)) {
+		log_error("URL too long");
+		return EXIT_FAILURE;
+	}
+
+	if (mtcp_init(app_conf.conf_file)) {
+		log_error("Failed to initialize mtcp with %s", app_conf.conf_file);
+		return EXIT_FAILURE;
+	}
+
+	mtcp_getconf(&mcfg);
+	mcfg.num_cores = app_conf.num_cores;
+	mtcp_setconf(&mcfg);
+	max_conns = mcfg.max_concurrency;
+
+	mtcp_register_signal(SIGINT, int_exit);
+
+	for (i = 0; i < app_conf.num_cores; i++) {
+		if (pthread_create(&app_thread[i], NULL, client_routine, (void *)(intptr_t)i)) {
+			log_error("Failed to create client thread %d", i);
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* the counters are read without the threads stopping, which is
+	 * close enough for a once per second report */
+	start = last = now_ns();
+	while ((now = now_ns()) - start < app_conf.duration * 1000000000ULL) {
+		sleep(1);
+		now = now_ns();
+		sum_stats(&cur);
+		print_stats("1s", &cur, &prev, (now - last) / 1e9);
+		prev = cur;
+		last = now;
+	}
+
+	for (i = 0; i < app_conf.num_cores; i++)
+		done[i] = true;
+	for (i = 0; i < app_conf.num_cores; i++)
+		pthread_join(app_thread[i], NULL);
+
+	sum_stats(&cur);
+	print_stats("total", &cur, &zero, (now - start) / 1e9);
+	printf("RESULT conns_per_sec=%.1f req_per_sec=%.1f p50_us=%.1f p90_us=%.1f p99_us=%.1f p999_us=%.1f max_us=%.1f "
+	       "errors=%lu\n",
+	       cur.conns / ((now - start) / 1e9), cur.requests / ((now - start) / 1e9),
+	       lat_quantile(cur.lat, cur.requests, 0.5) / 1e3, lat_quantile(cur.lat, cur.requests, 0.9) / 1e3,
+	       lat_quantile(cur.lat, cur.requests, 0.99) / 1e3, lat_quantile(cur.lat, cur.requests, 0.999) / 1e3,
+	       cur.lat_max / 1e3, cur.errors);
+
+	mtcp_destroy();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,164 @@
+/* SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) 2025 Debojeet Das
+ *
+ * autoscale-ramp: the monitor's autoscaler against a simulated load ramp
+ *
+ * Feeds autoscale_decide() the samples an NF would produce while the
+ * offered load climbs from zero to a peak and back, one sample per monitor
+ * interval. Each thread serves up to -c packets per second. An RX ring
+ * fills as the load nears what the active threads can serve, and what they
+ * cannot serve is dropped. Prints the controller's state for every sample,
+ * then how many packets it dropped and how many thread seconds it used
+ * against always running every thread. No NIC or monitor needed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include <flash_monitor.h>
+#include <log.h>
+
+#define SAMPLE_MS 500
+
+static struct {
+	int max;
+	int min;
+	double thread_mpps;
+	double peak_mpps;
+	int seconds;
+	bool quiet;
+} opts = { 8, 1, 1.0, 0, 120, false };
+
+/* up for the first half, down for the second */
+static double offered_mpps(uint64_t t_ms)
+{
+	double half = opts.seconds * MS_PER_S / 2.0;
+	double x = t_ms < half ? t_ms / half : (opts.seconds * MS_PER_S - t_ms) / half;
+
+	return opts.peak_mpps * x;
+}
+
+static unsigned int rx_occupancy(double load)
+{
+	if (load >= 1.0)
+		return 100;
+	/* queueing delay explodes near capacity */
+	return (unsigned int)(100 * load * load * load * load);
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [-t max_threads] [-m min_threads] [-c thread_mpps] [-p peak_mpps] [-d seconds] [-q]\n"
+	       "  -t  threads in the NF's config (default 8)\n"
+	       "  -m  min_threads (default 1)\n"
+	       "  -c  Mpps one thread serves (default 1.0)\n"
+	       "  -p  peak offered load in Mpps (default 90%% of all threads)\n"
+	       "  -d  length of the ramp in seconds (default 120)\n"
+	       "  -q  summary only\n",
+	       prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct autoscale_state st = { 0 };
+	uint64_t offered_total = 0, dropped_total = 0;
+	double thread_s = 0, ideal_thread_s = 0;
+	int ups = 0, downs = 0, peak_active = 0;
+	int opt;
+
+	log_set_level_from_env();
+
+	while ((opt = getopt(argc, argv, "t:m:c:p:d:qh")) != -1) {
+		switch (opt) {
+		case 't':
+			opts.max = atoi(optarg);
+			break;
+		case 'm':
+			opts.min = atoi(optarg);
+			break;
+		case 'c':
+			opts.thread_mpps = atof(optarg);
+			break;
+		case 'p':
+			opts.peak_mpps = atof(optarg);
+			break;
+		case 'd':
+			opts.seconds = atoi(optarg);
+			break;
+		case 'q':
+			opts.quiet = true;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (opts.max < 1 || opts.min < 1 || opts.min > opts.max || opts.thread_mpps <= 0 || opts.seconds < 1) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (opts.peak_mpps <= 0)
+		opts.peak_mpps = 0.9 * opts.max * opts.thread_mpps;
+
+	/* the monitor starts an NF on all of its threads */
+	st.min = opts.min;
+	st.max = opts.max;
+	st.active = opts.max;
+
+	if (!opts.quiet)
+		printf("%8s %10s %7s %10s %5s %10s %10s %6s\n", "t s", "offered", "active", "served", "rx %", "drops",
+		       "thread pps", "step");
+
+	for (uint64_t t = SAMPLE_MS; t <= (uint64_t)opts.seconds * MS_PER_S; t += SAMPLE_MS) {
+		double offered = offered_mpps(t) * 1E6 * SAMPLE_MS / MS_PER_S;
+		double capacity = st.active * opts.thread_mpps * 1E6 * SAMPLE_MS / MS_PER_S;
+		double served = offered < capacity ? offered : capacity;
+		struct autoscale_sample s = {
+			.rx_pct = rx_occupancy(offered / capacity),
+			.rx_pkts = (uint64_t)served,
+			.drops = (uint64_t)(offered - served),
+			.interval_ms = SAMPLE_MS,
+		};
+		int step, needed;
+
+		offered_total += (uint64_t)offered;
+		dropped_total += s.drops;
+		thread_s += st.active * SAMPLE_MS / (double)MS_PER_S;
+		needed = (int)(offered_mpps(t) / opts.thread_mpps) + 1;
+		ideal_thread_s += (needed < opts.min ? opts.min : needed > opts.max ? opts.max : needed) * SAMPLE_MS /
+				  (double)MS_PER_S;
+
+		step = autoscale_decide(&st, &s, t);
+
+		if (!opts.quiet)
+			printf("%8.1f %10.2f %7d %10.2f %5u %10lu %10lu %6s\n", t / (double)MS_PER_S, offered_mpps(t),
+			       st.active, served * MS_PER_S / SAMPLE_MS / 1E6, s.rx_pct, s.drops, st.thread_pps,
+			       step > 0 ? "+1" : step < 0 ? "-1" : "");
+
+		if (step) {
+			/* what autoscale_nf() does once the NIC is steered */
+			st.active += step;
+			st.hot = 0;
+			st.cold = 0;
+			st.last_change_ms = t;
+			if (step > 0)
+				ups++;
+			else
+				downs++;
+		}
+		if (st.active > peak_active)
+			peak_active = st.active;
+	}
+
+	printf("\nRamp to %.2f Mpps over %d s, %d to %d threads of %.2f Mpps\n", opts.peak_mpps, opts.seconds, opts.min,
+	       opts.max, opts.thread_mpps);
+	printf("Scaled up %d, down %d times, at most %d threads\n", ups, downs, peak_active);
+	printf("Dropped %lu of %lu packets (%.4f%%)\n", dropped_total, offered_total,
+	       offered_total ? 100.0 * dropped_total / offered_total : 0);
+	printf("Thread seconds: %.1f, %.1f with every thread, %.1f at ideal\n", thread_s,
+	       opts.max * (double)opts.seconds, ideal_thread_s);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,291 @@
+/* SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) 2025 Debojeet Das
+ *
+ * bridge: unit-test for an NF attached to two UMEMs, e.g. of two NICs
+ *
+ * The NF runs with the same nf_id in the UMEM of --umem-id and in the UMEM
+ * of -U. Frames cannot move between UMEMs, so every frame received on one
+ * side is copied into a frame allocated on the other, sent there, and the
+ * original is dropped. Thread i serves socket i of both UMEMs. Both sides
+ * allocate frames, so the NF runs in tx-first mode.
+ */
+#include <signal.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include <flash_nf.h>
+#include <flash_params.h>
+#include <log.h>
+
+volatile bool done = false;
+struct config *cfg[2] = { NULL };
+struct nf *nf[2] = { NULL };
+
+static void int_exit(int sig)
+{
+	log_info("Received Signal: %d", sig);
+	done = true;
+}
+
+struct appconf {
+	int cpu_start;
+	int cpu_end;
+	int stats_cpu;
+	int peer_umem_id;
+} app_conf;
+
+// clang-format off
+static const char *bridge_options[] = {
+    "-U <num>\tUMEM of the other side (required)",
+    "-c <num>\tStart CPU (default: 0)",
+    "-e <num>\tEnd CPU (default: 0)",
+    "-s <num>\tStats CPU (default: 1)",
+    NULL
+};
+// clang-format on
+
+static int parse_app_args(int argc, char **argv, struct appconf *app_conf, int shift)
+{
+	int c;
+	opterr = 0;
+
+	app_conf->cpu_start = 0;
+	app_conf->cpu_end = 0;
+	app_conf->stats_cpu = 1;
+	app_conf->peer_umem_id = -1;
+
+	argc -= shift;
+	argv += shift;
+
+	while ((c = getopt(argc, argv, "hU:c:e:s:")) != -1)
+		switch (c) {
+		case 'h':
+			printf("Usage: %s -h\n", argv[-shift]);
+			return -1;
+		case 'U':
+			app_conf->peer_umem_id = atoi(optarg);
+			break;
+		case 'c':
+			app_conf->cpu_start = atoi(optarg);
+			break;
+		case 'e':
+			app_conf->cpu_end = atoi(optarg);
+			break;
+		case 's':
+			app_conf->stats_cpu = atoi(optarg);
+			break;
+		default:
+			printf("Usage: %s -h\n", argv[-shift]);
+			return -1;
+		}
+
+	if (app_conf->peer_umem_id < 0) {
+		log_error("ERROR: -U <umem-id> of the other side is required");
+		return -1;
+	}
+
+	return 0;
+}
+
+struct sock_args {
+	int socket_id;
+};
+
+/* Copy what one side received into frames of the other side and send them there. */
+static int bridge(struct config *rx_cfg, struct socket *rx, struct config *tx_cfg, struct socket *tx, struct xskvec *rxvecs,
+		  struct xskvec *txvecs)
+{
+	uint32_t i, nrecv, nalloc, len;
+
+	nrecv = flash__recvmsg(rx_cfg, rx, rxvecs, rx_cfg->xsk->batch_size);
+	if (!nrecv)
+		return 0;
+
+	nalloc = flash__allocmsg(tx_cfg, tx, txvecs, nrecv);
+	for (i = 0; i < nalloc; i++) {
+		len = rxvecs[i].len < txvecs[i].len ? rxvecs[i].len : txvecs[i].len;
+		memcpy(txvecs[i].data, rxvecs[i].data, len);
+		txvecs[i].len = len;
+		txvecs[i].options = rxvecs[i].options;
+	}
+
+	if ((nalloc && flash__sendmsg(tx_cfg, tx, txvecs, nalloc) != nalloc) ||
+	    flash__dropmsg(rx_cfg, rx, rxvecs, nrecv) != nrecv) {
+		log_error("errno: %d/\"%s\"", errno, strerror(errno));
+		return -1;
+	}
+
+	return nrecv;
+}
+
+static void *socket_routine(void *arg)
+{
+	int ret;
+	nfds_t nfds = 2;
+	struct socket *xsk[2];
+	struct pollfd fds[2] = {};
+	struct xskvec *rxvecs, *txvecs;
+	struct sock_args *a = (struct sock_args *)arg;
+
+	log_debug("Socket ID: %d", a->socket_id);
+	xsk[0] = nf[0]->thread[a->socket_id]->socket;
+	xsk[1] = nf[1]->thread[a->socket_id]->socket;
+
+	rxvecs = calloc(cfg[0]->xsk->batch_size, sizeof(struct xskvec));
+	txvecs = calloc(cfg[0]->xsk->batch_size, sizeof(struct xskvec));
+	if (!rxvecs || !txvecs) {
+		log_error("Failed to allocate xskvecs arrays");
+		free(rxvecs);
+		free(txvecs);
+		return NULL;
+	}
+
+	for (int i = 0; i < 2; i++) {
+		fds[i].fd = xsk[i]->fd;
+		fds[i].events = POLLIN;
+	}
+
+	for (;;) {
+		ret = flash__poll(cfg[0], xsk[0], fds, nfds);
+		if (!(ret > 0 || ret == -2))
+			continue;
+
+		if (bridge(cfg[0], xsk[0], cfg[1], xsk[1], rxvecs, txvecs) < 0 ||
+		    bridge(cfg[1], xsk[1], cfg[0], xsk[0], rxvecs, txvecs) < 0)
+			break;
+
+		if (done)
+			break;
+	}
+
+	free(rxvecs);
+	free(txvecs);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	int shift, nr_sockets;
+	struct sock_args *args;
+	struct stats_conf stats_cfg[2] = { { NULL } };
+	cpu_set_t cpuset;
+	pthread_t socket_thread, stats_thread;
+
+	cfg[0] = calloc(1, sizeof(struct config));
+	if (!cfg[0]) {
+		log_error("ERROR: Memory allocation failed");
+		exit(EXIT_FAILURE);
+	}
+
+	cfg[0]->app_name = "Unit Test: Bridge Between Two UMEMs";
+	cfg[0]->app_options = bridge_options;
+	cfg[0]->done = &done;
+
+	shift = flash__parse_cmdline_args(argc, argv, cfg[0]);
+	if (shift < 0)
+		goto out_cfg;
+
+	if (parse_app_args(argc, argv, &app_conf, shift) < 0)
+		goto out_cfg;
+
+	if (cfg[0]->rx_first) {
+		log_error("ERROR: tx_first should be enabled in bridge");
+		goto out_cfg;
+	}
+
+	if (app_conf.peer_umem_id == cfg[0]->umem_id) {
+		log_error("ERROR: -U should name another UMEM than --umem-id");
+		goto out_cfg;
+	}
+
+	cfg[1] = flash__clone_config(cfg[0], app_conf.peer_umem_id);
+	if (!cfg[1])
+		goto out_cfg;
+
+	if (flash__configure_nf(&nf[0], cfg[0]) < 0)
+		goto out_cfg;
+
+	if (flash__configure_nf(&nf[1], cfg[1]) < 0)
+		goto out_cfg_close;
+
+	if (cfg[0]->total_sockets != cfg[1]->total_sockets)
+		log_warn("UMEM %d has %d sockets, UMEM %d has %d, bridging the first %d", cfg[0]->umem_id, cfg[0]->total_sockets,
+			 cfg[1]->umem_id, cfg[1]->total_sockets,
+			 cfg[0]->total_sockets < cfg[1]->total_sockets ? cfg[0]->total_sockets : cfg[1]->total_sockets);
+	nr_sockets = cfg[0]->total_sockets < cfg[1]->total_sockets ? cfg[0]->total_sockets : cfg[1]->total_sockets;
+
+	log_info("Control Plane setup done...");
+
+	signal(SIGINT, int_exit);
+	signal(SIGTERM, int_exit);
+	signal(SIGABRT, int_exit);
+
+	log_info("Starting Data Path...");
+
+	args = calloc(nr_sockets, sizeof(struct sock_args));
+	if (!args) {
+		log_error("ERROR: Memory allocation failed for sock_args");
+		goto out_cfg_close;
+	}
+
+	for (int i = 0; i < nr_sockets; i++) {
+		args[i].socket_id = i;
+
+		if (pthread_create(&socket_thread, NULL, socket_routine, &args[i])) {
+			log_error("Error creating socket thread");
+			goto out_args;
+		}
+
+		CPU_ZERO(&cpuset);
+		CPU_SET((i % (app_conf.cpu_end - app_conf.cpu_start + 1)) + app_conf.cpu_start, &cpuset);
+		if (pthread_setaffinity_np(socket_thread, sizeof(cpu_set_t), &cpuset) != 0) {
+			log_error("ERROR: Unable to set thread affinity: %s", strerror(errno));
+			goto out_args;
+		}
+
+		if (pthread_detach(socket_thread) != 0) {
+			log_error("ERROR: Unable to detach thread: %s", strerror(errno));
+			goto out_args;
+		}
+	}
+
+	/* one statistics thread per side */
+	for (int i = 0; i < 2; i++) {
+		stats_cfg[i].nf = nf[i];
+		stats_cfg[i].cfg = cfg[i];
+
+		if (pthread_create(&stats_thread, NULL, flash__stats_thread, &stats_cfg[i])) {
+			log_error("Error creating statistics thread");
+			goto out_args;
+		}
+		CPU_ZERO(&cpuset);
+		CPU_SET(app_conf.stats_cpu, &cpuset);
+		if (pthread_setaffinity_np(stats_thread, sizeof(cpu_set_t), &cpuset) != 0) {
+			log_error("ERROR: Unable to set thread affinity: %s", strerror(errno));
+			goto out_args;
+		}
+
+		if (pthread_detach(stats_thread) != 0) {
+			log_error("ERROR: Unable to detach thread: %s", strerror(errno));
+			goto out_args;
+		}
+	}
+
+	flash__wait_all(cfg, 2);
+	flash__xsk_close(cfg[0], nf[0]);
+	flash__xsk_close(cfg[1], nf[1]);
+
+	exit(EXIT_SUCCESS);
+
+out_args:
+	done = true;
+	free(args);
+out_cfg_close:
+	sleep(1);
+	flash__xsk_close(cfg[0], nf[0]);
+	flash__xsk_close(cfg[1], nf[1]);
+out_cfg:
+	free(cfg[1]);
+	free(cfg[0]);
+	exit(EXIT_FAILURE);
+}
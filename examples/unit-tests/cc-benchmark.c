@@ -0,0 +1,374 @@
+/* SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) 2025 Debojeet Das
+ *
+ * cc-benchmark: mTCP congestion control modules over a simulated bottleneck
+ *
+ * The modules run against bare tcp_streams through the same hooks ProcessACK
+ * and the retransmission timer call, in virtual TSC time. The sender side
+ * mirrors mTCP's ACK path, including the rewind of snd_nxt on a triple
+ * duplicate ACK, so retransmissions count every segment sent twice.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "tcp_stream.h"
+#include "tcp_in.h"
+#include "tcp_cc.h"
+#include "clock.h"
+
+#define MSS 1448
+#define RUN_SEC 20
+#define MIN_RTO_MS 200
+#define SEQ_RING (1 << 16) /* segments tracked per flow, must be a power of 2 */
+
+struct scenario {
+	const char *name;
+	uint64_t rate_mbps;
+	uint32_t rtt_ms;
+	double buffer_bdp; /* bottleneck buffer, in bandwidth delay products */
+	double loss;	   /* random loss probability per packet */
+	int flows;
+};
+
+static const struct scenario scenarios[] = {
+	{ "1 flow, 1G/10ms, 1 BDP", 1000, 10, 1.0, 0, 1 },
+	{ "1 flow, 0.01% loss", 1000, 10, 1.0, 0.0001, 1 },
+	{ "4 flows, 1G/10ms, 1 BDP", 1000, 10, 1.0, 0, 4 },
+	{ "1 flow, 1G/10ms, 0.1 BDP", 1000, 10, 0.1, 0, 1 },
+};
+
+static const char *modules[] = { "reno", "cubic", "bbr" };
+
+/* a data segment in the bottleneck queue or on the wire */
+struct pkt {
+	int flow;
+	uint32_t seq;
+	uint64_t sent;	 /* tsc the sender sent it, echoed back like a timestamp */
+	uint64_t arrive; /* tsc its ack reaches the sender */
+};
+
+/* one sender/receiver pair, with just enough of a tcp_stream for the modules */
+struct flow {
+	tcp_stream stream;
+	struct tcp_send_vars snd;
+	struct tcp_recv_vars rcv;
+
+	uint32_t max_sent; /* highest sequence sent so far */
+	uint32_t last_ack;
+	uint32_t dup_acks;
+	uint64_t pace_due; /* tsc the pacer lets the next segment out, 0 if not paced */
+	uint64_t rto_at;   /* tsc of the retransmission timeout, 0 if disarmed */
+	uint32_t rto_ms;
+
+	uint32_t rcv_nxt;
+	uint8_t received[SEQ_RING]; /* receiver side out-of-order segments */
+	uint8_t sacked[SEQ_RING];   /* what the sender learned of them */
+
+	uint64_t acked;
+	uint64_t retrans;
+	uint64_t rtt_sum; /* in cycles */
+	uint64_t rtt_cnt;
+};
+
+struct link {
+	uint64_t hz;
+	uint64_t rate; /* bytes per second */
+	uint64_t prop; /* round trip propagation, in cycles */
+	uint64_t buffer;
+	double loss;
+	uint64_t free_at; /* tsc the bottleneck finishes its backlog */
+	uint64_t drops;
+
+	struct pkt *ring;
+	uint32_t mask;
+	uint32_t head;
+	uint32_t tail;
+};
+
+struct result {
+	double mbps;
+	double rtt_ms;
+	uint64_t retrans;
+	uint64_t drops;
+	double fairness;
+};
+
+static inline uint32_t Slot(uint32_t seq)
+{
+	return (seq / MSS) & (SEQ_RING - 1);
+}
+
+static void FlowInit(struct flow *f, int id, const struct tcp_cc_ops *ops)
+{
+	memset(f, 0, sizeof(*f));
+	f->stream.id = id;
+	f->stream.sndvar = &f->snd;
+	f->stream.rcvvar = &f->rcv;
+
+	/* what HandleActiveOpen leaves behind */
+	f->snd.mss = f->snd.eff_mss = MSS;
+	f->snd.cwnd = MSS * TCP_INIT_CWND;
+	f->snd.ssthresh = MSS * 10;
+	f->snd.peer_wnd = UINT32_MAX / 2;
+	f->rto_ms = MIN_RTO_MS;
+
+	TCPCCInit(&f->stream, ops, 0);
+}
+
+/* queue a segment at the bottleneck, returns false if it was dropped */
+static bool LinkSend(struct link *l, int flow, uint32_t seq, uint64_t now)
+{
+	uint64_t backlog = l->free_at > now ? (l->free_at - now) * l->rate / l->hz : 0;
+	struct pkt *p;
+
+	if (backlog + MSS > l->buffer || (l->loss > 0 && drand48() < l->loss)) {
+		l->drops++;
+		return false;
+	}
+
+	if (l->tail - l->head > l->mask) {
+		fprintf(stderr, "ERROR: packet ring overflow\n");
+		exit(EXIT_FAILURE);
+	}
+
+	l->free_at = (l->free_at > now ? l->free_at : now) + (uint64_t)MSS * l->hz / l->rate;
+
+	p = &l->ring[l->tail++ & l->mask];
+	p->flow = flow;
+	p->seq = seq;
+	p->sent = now;
+	p->arrive = l->free_at + l->prop;
+
+	return true;
+}
+
+/* send what cwnd and the pacer allow, the way FlushTCPSendingBuffer does */
+static void FlowSend(struct flow *f, int id, struct link *l, uint64_t now)
+{
+	struct tcp_send_vars *snd = &f->snd;
+	uint64_t slack = l->hz * PACING_TICK_US / 1000000;
+	int64_t window;
+	uint32_t seq;
+
+	f->pace_due = 0;
+	for (;;) {
+		seq = f->stream.snd_nxt;
+		if (seq != f->max_sent && f->sacked[Slot(seq)]) {
+			f->stream.snd_nxt += MSS;
+			continue;
+		}
+
+		window = (int64_t)(snd->cwnd < snd->peer_wnd ? snd->cwnd : snd->peer_wnd) - (int64_t)(seq - snd->snd_una);
+		if (window <= 0 || (window < MSS && seq != snd->snd_una))
+			return;
+
+#if PACING_ENABLED
+		if (!CanSendNow(&f->stream.pacer, now, slack, MSS, &f->pace_due))
+			return;
+		f->pace_due = 0;
+#else
+		(void)slack;
+#endif
+
+		if (seq == f->max_sent)
+			f->max_sent += MSS;
+		else
+			f->retrans++;
+		f->stream.snd_nxt += MSS;
+
+		LinkSend(l, id, seq, now);
+		if (!f->rto_at)
+			f->rto_at = now + f->rto_ms * l->hz / 1000;
+	}
+}
+
+/* ack arrival at the sender, the subset of ProcessACK the modules see */
+static void FlowAck(struct flow *f, struct link *l, const struct pkt *p, uint64_t now)
+{
+	struct tcp_send_vars *snd = &f->snd;
+	struct tcp_recv_vars *rcv = &f->rcv;
+	uint32_t ack, rmlen;
+	int32_t m;
+
+	/* receiver: cumulative ack plus one SACK block for the segment */
+	if (p->seq == f->rcv_nxt) {
+		f->rcv_nxt += MSS;
+		while (f->received[Slot(f->rcv_nxt)]) {
+			f->received[Slot(f->rcv_nxt)] = 0;
+			f->rcv_nxt += MSS;
+		}
+	} else if ((int32_t)(p->seq - f->rcv_nxt) > 0) {
+		f->received[Slot(p->seq)] = 1;
+		f->sacked[Slot(p->seq)] = 1;
+	}
+	ack = f->rcv_nxt;
+
+	if ((int32_t)(ack - f->stream.snd_nxt) < 0 && ack == f->last_ack) {
+		if (++f->dup_acks == 3) {
+			snd->cc_ops->on_loss(&f->stream, now);
+			f->stream.snd_nxt = ack;
+		} else if (f->dup_acks > 3) {
+			snd->cwnd += MSS;
+		}
+	} else {
+		f->dup_acks = 0;
+		f->last_ack = ack;
+	}
+
+	/* fast retransmission exit */
+	if ((int32_t)(ack - f->stream.snd_nxt) > 0) {
+		snd->cwnd = snd->ssthresh;
+		f->stream.snd_nxt = ack;
+	}
+
+	if ((int32_t)(ack - snd->snd_una) <= 0)
+		return;
+
+	rmlen = ack - snd->snd_una;
+	while (snd->snd_una != ack) {
+		f->sacked[Slot(snd->snd_una)] = 0;
+		snd->snd_una += MSS;
+	}
+	f->acked += rmlen;
+
+	/* srtt in ms << 3 as EstimateRTT keeps it, from the echoed send time */
+	f->rtt_sum += now - p->sent;
+	f->rtt_cnt++;
+	m = (now - p->sent) * 1000 / l->hz;
+	if (m == 0)
+		m = 1;
+	if (rcv->srtt == 0) {
+		rcv->srtt = m << 3;
+		rcv->rttvar = m << 1;
+	} else {
+		m -= rcv->srtt >> 3;
+		rcv->srtt += m;
+		rcv->rttvar += (m < 0 ? -m : m) - (rcv->rttvar >> 2);
+	}
+	f->rto_ms = (rcv->srtt >> 3) + rcv->rttvar;
+	if (f->rto_ms < MIN_RTO_MS)
+		f->rto_ms = MIN_RTO_MS;
+
+	snd->cc_ops->on_ack(&f->stream, rmlen, now);
+
+	f->rto_at = snd->snd_una != f->max_sent ? now + f->rto_ms * l->hz / 1000 : 0;
+}
+
+static void FlowTimeout(struct flow *f, struct link *l, uint64_t now)
+{
+	f->snd.cc_ops->on_timer(&f->stream, now);
+	f->stream.snd_nxt = f->snd.snd_una;
+	f->dup_acks = 0;
+	f->rto_ms *= 2;
+	f->rto_at = now + f->rto_ms * l->hz / 1000;
+}
+
+static int run(const struct scenario *sc, const char *module, struct result *res)
+{
+	const struct tcp_cc_ops *ops = TCPCCFind(module);
+	struct flow *flows;
+	struct link l;
+	uint64_t now = 0, end, next, bdp, slots, rtt_sum = 0, rtt_cnt = 0;
+	double sum = 0, sq = 0, x;
+	int i;
+
+	if (!ops)
+		return -1;
+
+	memset(&l, 0, sizeof(l));
+	l.hz = GetTSCHz();
+	l.rate = sc->rate_mbps * 1000000 / 8;
+	l.prop = sc->rtt_ms * l.hz / 1000;
+	bdp = l.rate * sc->rtt_ms / 1000;
+	l.buffer = bdp * sc->buffer_bdp;
+	l.loss = sc->loss;
+	for (slots = 64; slots < 4 * (bdp + l.buffer) / MSS; slots <<= 1)
+		;
+	l.mask = slots - 1;
+	l.ring = calloc(slots, sizeof(*l.ring));
+	flows = calloc(sc->flows, sizeof(*flows));
+	if (!l.ring || !flows)
+		return -1;
+
+	srand48(1);
+	for (i = 0; i < sc->flows; i++) {
+		FlowInit(&flows[i], i, ops);
+		FlowSend(&flows[i], i, &l, now);
+	}
+
+	end = (uint64_t)RUN_SEC * l.hz;
+	while (now < end) {
+		next = end;
+		if (l.head != l.tail)
+			next = l.ring[l.head & l.mask].arrive;
+		for (i = 0; i < sc->flows; i++) {
+			if (flows[i].pace_due && flows[i].pace_due < next)
+				next = flows[i].pace_due;
+			if (flows[i].rto_at && flows[i].rto_at < next)
+				next = flows[i].rto_at;
+		}
+		now = next;
+
+		while (l.head != l.tail && l.ring[l.head & l.mask].arrive <= now) {
+			struct pkt *p = &l.ring[l.head++ & l.mask];
+
+			FlowAck(&flows[p->flow], &l, p, now);
+		}
+
+		for (i = 0; i < sc->flows; i++) {
+			if (flows[i].rto_at && flows[i].rto_at <= now)
+				FlowTimeout(&flows[i], &l, now);
+			FlowSend(&flows[i], i, &l, now);
+		}
+	}
+
+	memset(res, 0, sizeof(*res));
+	for (i = 0; i < sc->flows; i++) {
+		x = flows[i].acked * 8.0 / RUN_SEC / 1E6;
+		sum += x;
+		sq += x * x;
+		res->retrans += flows[i].retrans;
+		rtt_sum += flows[i].rtt_sum;
+		rtt_cnt += flows[i].rtt_cnt;
+	}
+	res->mbps = sum;
+	res->rtt_ms = rtt_cnt ? rtt_sum * 1000.0 / rtt_cnt / l.hz : 0;
+	res->drops = l.drops;
+	res->fairness = sq > 0 ? sum * sum / (sc->flows * sq) : 0;
+
+	free(flows);
+	free(l.ring);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct result res;
+	size_t i, j;
+
+	(void)argc;
+	(void)argv;
+
+	for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+		printf("%s\n", scenarios[i].name);
+		printf("  %-8s %-14s %-14s %-10s %-10s %-8s\n", "cc", "goodput(Mbps)", "avg rtt(ms)", "retrans", "drops",
+		       "jain");
+
+		for (j = 0; j < sizeof(modules) / sizeof(modules[0]); j++) {
+			if (run(&scenarios[i], modules[j], &res)) {
+				fprintf(stderr, "ERROR: %s run failed\n", modules[j]);
+				return EXIT_FAILURE;
+			}
+
+			printf("  %-8s %-14.1f %-14.2f %-10lu %-10lu %-8.3f\n", modules[j], res.mbps, res.rtt_ms, res.retrans,
+			       res.drops, res.fairness);
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
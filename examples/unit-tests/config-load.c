@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) 2025 Debojeet Das
+ *
+ * config-load: check a monitor config and time loading it
+ *
+ * Loads the config the way "load config" in the monitor does, without
+ * configuring the NIC. Every problem in it is logged with its path. A valid
+ * config is then loaded -n more times from its compiled topology, and the
+ * time of the first load is printed next to the average of the others.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <flash_monitor.h>
+#include <log.h>
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [-n loads] [-k] <config.json>\n"
+	       "  -n  loads from the compiled topology (default 100)\n"
+	       "  -k  keep the compiled topology, else it is removed at the end\n",
+	       prog);
+}
+
+int main(int argc, char **argv)
+{
+	int loads = 100, opt, umems, nfs = 0, sockets = 0;
+	struct NFGroup *nfg;
+	char topo[PATH_MAX];
+	uint64_t start, first, cached;
+	bool keep = false;
+
+	log_set_level_from_env();
+
+	while ((opt = getopt(argc, argv, "n:kh")) != -1) {
+		switch (opt) {
+		case 'n':
+			loads = atoi(optarg);
+			break;
+		case 'k':
+			keep = true;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (optind != argc - 1 || loads < 1) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	/* time a full parse, not a load from an earlier run */
+	snprintf(topo, sizeof(topo), "%s.topo", argv[optind]);
+	unlink(topo);
+
+	start = now_ns();
+	nfg = load_config(argv[optind]);
+	first = now_ns() - start;
+	if (!nfg)
+		return EXIT_FAILURE;
+
+	umems = nfg->umem_count;
+	for (int i = 0; i < nfg->umem_count; i++) {
+		nfs += nfg->umem[i]->nf_count;
+		sockets += nfg->umem[i]->cfg->total_sockets;
+	}
+	free_nf_group(nfg);
+
+	start = now_ns();
+	for (int i = 0; i < loads; i++) {
+		nfg = load_config(argv[optind]);
+		if (!nfg)
+			return EXIT_FAILURE;
+		free_nf_group(nfg);
+	}
+	cached = (now_ns() - start) / loads;
+
+	printf("%s: %d UMEMs, %d NFs, %d sockets\n", argv[optind], umems, nfs, sockets);
+	printf("Parsed in %.1f us, loaded from %s in %.1f us on average over %d loads\n", first / 1E3, topo,
+	       cached / 1E3, loads);
+
+	if (!keep)
+		unlink(topo);
+
+	return EXIT_SUCCESS;
+}
@@ -150,6 +150,8 @@ static void *socket_routine(void *arg)
 			continue;
 
 		nrecv = flash__recvmsg(cfg, xsk, xskvecs, cfg->xsk->batch_size);
+		/* the monitor may add or remove edges while we run */
+		next_size = __atomic_load_n(&cfg->next_size, __ATOMIC_RELAXED);
 		for (i = 0; i < nrecv; i++) {
 			char *pkt = xskvecs[i].data;
 
@@ -0,0 +1,320 @@
+/* SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) 2025 Debojeet Das
+ *
+ * nf-bringup: monitor control plane latency with many NFs starting at once
+ *
+ * Every client thread plays an NF: it connects to the monitor and fetches
+ * its configuration, then waits until all clients of the round are up
+ * before sending FLASH__CLOSE_CONN. Needs a running monitor with a config
+ * loaded. -p picks the protocol:
+ *   boot    one FLASH__BOOTSTRAP exchange, as flash__configure_nf() does
+ *   legacy  the per-command sequence, one round trip per value and socket
+ *   query   legacy without FLASH__CREATE_SOCKET
+ * boot and legacy create the NF's AF_XDP sockets, so each client needs its
+ * own NF entry; query clients can share one entry.
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <net/if.h>
+#include <netinet/in.h>
+
+#include <flash_defines.h>
+#include <flash_uds.h>
+#include <log.h>
+
+#define MAX_LEVELS 16
+#define DEFAULT_LEVELS "1,10,50,100,200,500"
+
+struct client {
+	pthread_t thread;
+	int id;
+	double start;
+	double end;
+	int ret;
+};
+
+static struct {
+	int umem_id;
+	int nf_count;
+	int rounds;
+	bool boot;
+	bool sockets;
+} opts = { 0, 1, 3, true, true };
+
+static pthread_barrier_t start_barrier, up_barrier;
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1E6 + ts.tv_nsec / 1E3;
+}
+
+static int recv_int(int sockfd, int *val)
+{
+	return flash__recv_data(sockfd, val, sizeof(int)) == sizeof(int) ? 0 : -1;
+}
+
+static int query_int(int sockfd, int cmd, int *val)
+{
+	if (flash__send_cmd(sockfd, cmd) < 0)
+		return -1;
+	return recv_int(sockfd, val);
+}
+
+static int bootstrap(int sockfd, struct nf_data *data)
+{
+	union {
+		struct flash_msg_hdr hdr;
+		uint8_t buf[FLASH__MSG_MAX_LEN];
+	} msg;
+	int fds[FLASH__MSG_MAX_FDS];
+
+	flash__msg_init(&msg.hdr, 0);
+	flash__msg_put(&msg.hdr, sizeof(msg), FLASH__BOOT_UMEM_ID, &data->umem_id, sizeof(int));
+	flash__msg_put(&msg.hdr, sizeof(msg), FLASH__BOOT_NF_ID, &data->nf_id, sizeof(int));
+
+	if (flash__send_cmd(sockfd, FLASH__BOOTSTRAP) < 0 || flash__send_msg(sockfd, &msg.hdr, NULL) < 0)
+		return -1;
+	if (flash__recv_msg(sockfd, &msg.hdr, sizeof(msg), fds, FLASH__MSG_MAX_FDS) < 0)
+		return -1;
+
+	for (uint32_t i = 0; i < msg.hdr.nr_fds; i++)
+		close(fds[i]);
+
+	return msg.hdr.status ? -1 : 0;
+}
+
+static int bring_up(int sockfd, struct nf_data *data)
+{
+	char ifname[IF_NAMESIZE];
+	int fd, val, nthreads, mode, n;
+	uint64_t umem_size;
+	bool frags;
+
+	if (flash__send_cmd(sockfd, FLASH__GET_UMEM) < 0 || flash__send_data(sockfd, data, sizeof(*data)) < 0)
+		return -1;
+	if (flash__recv_fd(sockfd, &fd) < 0)
+		return -1;
+	close(fd);
+	if (recv_int(sockfd, &nthreads) < 0 ||
+	    flash__recv_data(sockfd, &umem_size, sizeof(umem_size)) != sizeof(umem_size) || recv_int(sockfd, &val) < 0)
+		return -1;
+
+	if (query_int(sockfd, FLASH__GET_UMEM_OFFSET, &val) < 0)
+		return -1;
+
+	for (int i = 0; opts.sockets && i < nthreads; i++) {
+		if (flash__send_cmd(sockfd, FLASH__CREATE_SOCKET) < 0 || flash__recv_fd(sockfd, &fd) < 0)
+			return -1;
+		close(fd);
+		if (recv_int(sockfd, &val) < 0)
+			return -1;
+	}
+
+	if (query_int(sockfd, FLASH__GET_ROUTE_INFO, &val) < 0 || query_int(sockfd, FLASH__GET_BIND_FLAGS, &val) < 0 ||
+	    query_int(sockfd, FLASH__GET_XDP_FLAGS, &val) < 0 || query_int(sockfd, FLASH__GET_MODE, &mode) < 0)
+		return -1;
+	if ((mode & FLASH__POLL) && query_int(sockfd, FLASH__GET_POLL_TIMEOUT, &val) < 0)
+		return -1;
+
+	if (flash__send_cmd(sockfd, FLASH__GET_FRAGS_ENABLED) < 0 || flash__recv_data(sockfd, &frags, sizeof(bool)) < 0)
+		return -1;
+	if (flash__send_cmd(sockfd, FLASH__GET_IFNAME) < 0 || flash__recv_data(sockfd, ifname, IF_NAMESIZE) < 0)
+		return -1;
+
+	if (flash__send_cmd(sockfd, FLASH__GET_POLLOUT_STATUS) < 0 || flash__recv_fd(sockfd, &fd) < 0)
+		return -1;
+	close(fd);
+	if (recv_int(sockfd, &val) < 0)
+		return -1;
+
+	if (query_int(sockfd, FLASH__GET_PREV_NF, &n) < 0)
+		return -1;
+	for (int i = 0; i < n; i++) {
+		if (recv_int(sockfd, &val) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static void *client_thread(void *arg)
+{
+	struct client *c = arg;
+	struct nf_data data = { .umem_id = opts.umem_id, .nf_id = c->id % opts.nf_count };
+	int sockfd;
+
+	pthread_barrier_wait(&start_barrier);
+
+	c->start = now_us();
+	sockfd = flash__start_uds_client();
+	if (sockfd < 0)
+		c->ret = -1;
+	else
+		c->ret = opts.boot ? bootstrap(sockfd, &data) : bring_up(sockfd, &data);
+	c->end = now_us();
+
+	/* keep every NF of the round connected until all are up */
+	pthread_barrier_wait(&up_barrier);
+
+	if (sockfd >= 0) {
+		flash__send_cmd(sockfd, FLASH__CLOSE_CONN);
+		close(sockfd);
+	}
+	return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static int run_round(int nclients, double *lat, double *wall)
+{
+	struct client *clients;
+	double first = 0, last = 0;
+	int failed = 0;
+
+	clients = calloc(nclients, sizeof(struct client));
+	if (!clients)
+		return -1;
+
+	pthread_barrier_init(&start_barrier, NULL, nclients);
+	pthread_barrier_init(&up_barrier, NULL, nclients);
+
+	for (int i = 0; i < nclients; i++) {
+		clients[i].id = i;
+		if (pthread_create(&clients[i].thread, NULL, client_thread, &clients[i])) {
+			log_error("Error creating client thread %d", i);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (int i = 0; i < nclients; i++) {
+		pthread_join(clients[i].thread, NULL);
+		if (clients[i].ret < 0)
+			failed++;
+		lat[i] = clients[i].end - clients[i].start;
+		if (i == 0 || clients[i].start < first)
+			first = clients[i].start;
+		if (clients[i].end > last)
+			last = clients[i].end;
+	}
+	*wall = last - first;
+
+	pthread_barrier_destroy(&start_barrier);
+	pthread_barrier_destroy(&up_barrier);
+	free(clients);
+
+	/* let the monitor tear the round down before the next one */
+	usleep(200000);
+
+	return failed;
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [-u umem_id] [-n nf_count] [-c levels] [-r rounds] [-p boot|legacy|query]\n"
+	       "  -u  UMEM the clients attach to (default 0)\n"
+	       "  -n  NF entries of that UMEM in the loaded config, clients take nf_id = i %% n (default 1)\n"
+	       "  -c  comma separated numbers of concurrent NFs (default " DEFAULT_LEVELS ")\n"
+	       "  -r  rounds per level (default 3)\n"
+	       "  -p  bring-up protocol (default boot), boot and legacy need one NF entry per client\n",
+	       prog);
+}
+
+int main(int argc, char **argv)
+{
+	char levels_str[256] = DEFAULT_LEVELS;
+	int levels[MAX_LEVELS], nlevels = 0;
+	char *tok, *save;
+	int opt;
+
+	log_set_level_from_env();
+	/* the monitor drops clients it cannot serve */
+	signal(SIGPIPE, SIG_IGN);
+
+	while ((opt = getopt(argc, argv, "u:n:c:r:p:h")) != -1) {
+		switch (opt) {
+		case 'u':
+			opts.umem_id = atoi(optarg);
+			break;
+		case 'n':
+			opts.nf_count = atoi(optarg);
+			break;
+		case 'c':
+			snprintf(levels_str, sizeof(levels_str), "%s", optarg);
+			break;
+		case 'r':
+			opts.rounds = atoi(optarg);
+			break;
+		case 'p':
+			opts.boot = strcmp(optarg, "boot") == 0;
+			opts.sockets = strcmp(optarg, "query") != 0;
+			if (!opts.boot && opts.sockets && strcmp(optarg, "legacy") != 0) {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (opts.nf_count < 1 || opts.rounds < 1) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for (tok = strtok_r(levels_str, ",", &save); tok && nlevels < MAX_LEVELS; tok = strtok_r(NULL, ",", &save)) {
+		levels[nlevels] = atoi(tok);
+		if (levels[nlevels] > 0)
+			nlevels++;
+	}
+
+	printf("%6s %10s %10s %10s %10s %10s %8s\n", "NFs", "wall ms", "NFs/s", "p50 us", "p99 us", "max us", "failed");
+
+	for (int l = 0; l < nlevels; l++) {
+		int n = levels[l], failed = 0;
+		double wall, wall_sum = 0;
+		double *lat;
+
+		if (opts.sockets && n > opts.nf_count) {
+			log_warn("Skipping %d NFs: creating sockets needs as many NF entries (-n %d)", n, opts.nf_count);
+			continue;
+		}
+
+		lat = calloc((size_t)n * opts.rounds, sizeof(double));
+		if (!lat)
+			return EXIT_FAILURE;
+
+		for (int r = 0; r < opts.rounds; r++) {
+			int ret = run_round(n, lat + (size_t)r * n, &wall);
+			if (ret < 0)
+				return EXIT_FAILURE;
+			failed += ret;
+			wall_sum += wall;
+		}
+
+		qsort(lat, (size_t)n * opts.rounds, sizeof(double), cmp_double);
+		wall = wall_sum / opts.rounds;
+		printf("%6d %10.2f %10.0f %10.1f %10.1f %10.1f %8d\n", n, wall / 1E3, n / (wall / 1E6),
+		       lat[(size_t)n * opts.rounds / 2], lat[(size_t)n * opts.rounds * 99 / 100],
+		       lat[(size_t)n * opts.rounds - 1], failed);
+		free(lat);
+	}
+
+	return EXIT_SUCCESS;
+}
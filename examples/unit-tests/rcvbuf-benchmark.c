@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) 2025 Debojeet Das
+ *
+ * rcvbuf-benchmark: mTCP receive buffer throughput, mirrored vs. compacting
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "tcp_ring_buffer.h"
+
+#define MSS 1448
+#define READ_SIZE (64 * 1024)
+#define TOTAL_BYTES (1ULL * 1024 * 1024 * 1024)
+#define MB (1024 * 1024)
+
+static const int windows_mb[] = { 1, 2, 4, 8, 10 };
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1E9;
+}
+
+/*
+ * Mimic a bulk receiver that lags behind the sender: the stack keeps the
+ * window topped up with MSS sized segments while the application reads
+ * READ_SIZE bytes at a time through the same head pointer mtcp_read()
+ * copies from, so the buffer runs nearly full and keeps hitting its tail. Every 8-byte word of the
+ * payload holds its own stream offset, so a broken wrap shows up as a
+ * mismatch.
+ */
+static int run(size_t window, bool mirror, double *gbps)
+{
+	rb_manager_t rbm;
+	struct tcp_ring_buffer *buff;
+	uint8_t seg[MSS], *app;
+	uint64_t put = 0, got = 0;
+	uint32_t seq = 0;
+	double start, end;
+	size_t n, i;
+	int ret;
+
+	rbm = RBManagerCreate(NULL, window, 1, mirror);
+	if (!rbm)
+		return -1;
+
+	buff = RBInit(rbm, seq);
+	app = malloc(READ_SIZE);
+	if (!buff || !app)
+		return -1;
+
+	start = now_sec();
+
+	while (got < TOTAL_BYTES) {
+		while ((size_t)buff->merged_len + MSS <= window) {
+			for (i = 0; i < MSS; i += 8)
+				*(uint64_t *)(seg + i) = put + i;
+			ret = RBPut(rbm, buff, seg, MSS, seq);
+			if (ret != MSS)
+				return -1;
+			seq += MSS;
+			put += MSS;
+		}
+
+		n = buff->merged_len < READ_SIZE ? (size_t)buff->merged_len : READ_SIZE;
+		memcpy(app, buff->head, n);
+		if (*(uint64_t *)app != got || *(uint64_t *)(app + n - 8) != got + n - 8) {
+			fprintf(stderr, "ERROR: data mismatch at byte %lu\n", got);
+			return -1;
+		}
+		RBRemove(rbm, buff, n, AT_APP);
+		got += n;
+	}
+
+	end = now_sec();
+	*gbps = (got * 8) / (end - start) / 1E9;
+
+	RBFree(rbm, buff);
+	free(app);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	double compact, mirrored;
+	size_t i;
+
+	(void)argc;
+	(void)argv;
+
+	printf("%-10s %-18s %-18s\n", "window", "compact (Gbps)", "mirrored (Gbps)");
+
+	for (i = 0; i < sizeof(windows_mb) / sizeof(windows_mb[0]); i++) {
+		size_t window = (size_t)windows_mb[i] * MB;
+
+		if (run(window, false, &compact) || run(window, true, &mirrored)) {
+			fprintf(stderr, "ERROR: %d MB run failed\n", windows_mb[i]);
+			return EXIT_FAILURE;
+		}
+
+		printf("%-10d %-18.2f %-18.2f\n", windows_mb[i], compact, mirrored);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -19,7 +19,7 @@ bool done = false;
 struct config *cfg = NULL;
 struct nf *nf;
 
-#define FLASH_MAX_SOCKETS 8
+#define CHAIN_MAX_SOCKETS 8
 
 ///////////// owner ring buffer /////////////
 #define struct_size(p, member, count)                                            \
@@ -56,7 +56,7 @@ struct owner_queue {
 };
 
 // Pointer to store array of owner queues it is equal to number of sockets - 1D array
-struct owner_queue *owner_queues[FLASH_MAX_SOCKETS];
+struct owner_queue *owner_queues[CHAIN_MAX_SOCKETS];
 
 ///////////// guest ring buffer /////////////
 
@@ -72,7 +72,7 @@ struct guest_queue {
 };
 
 // Pointer to store array of guest queues - 2D array
-struct guest_queue *guest_queues[FLASH_MAX_SOCKETS][FLASH_MAX_SOCKETS];
+struct guest_queue *guest_queues[CHAIN_MAX_SOCKETS][CHAIN_MAX_SOCKETS];
 
 ///////////// guest ring buffer operations /////////////
 
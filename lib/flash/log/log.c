@@ -23,7 +23,9 @@
  */
 
 #include "log.h"
+#include "log_ring.h"
 
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -218,43 +220,53 @@ void log_set_level_from_env(void)
 
 #ifdef FAST_LOG_TO_FILE
 
-char fast_log_buffer[FAST_LOG_BATCH_SIZE][FAST_LOG_SIZE];
-int fast_log_index = 0;
+static FILE *fast_log_fp[FAST_LOG_MAX_NF];
+static pthread_mutex_t fast_log_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static void fast_log_dump_in_file(int nf_id, int count)
+static FILE *fast_log_file(int nf_id)
 {
-	char filename[FAST_LOG_SIZE];
-	snprintf(filename, sizeof(filename), FAST_LOG_DIR "nf-%d.log", nf_id);
-	FILE *fp = fopen(filename, "a");
-	if (fp) {
-		for (int i = 0; i < count; i++) {
-			fprintf(fp, "%s\n", fast_log_buffer[i]);
-		}
-		fclose(fp);
-	} else {
-		log_error("Error opening string log file");
+	char filename[256];
+	FILE *fp = __atomic_load_n(&fast_log_fp[nf_id], __ATOMIC_ACQUIRE);
+
+	if (fp)
+		return fp;
+
+	pthread_mutex_lock(&fast_log_lock);
+	fp = fast_log_fp[nf_id];
+	if (!fp) {
+		snprintf(filename, sizeof(filename), FAST_LOG_DIR "nf-%d.log", nf_id);
+		fp = fopen(filename, "a");
+		if (fp)
+			__atomic_store_n(&fast_log_fp[nf_id], fp, __ATOMIC_RELEASE);
+		else
+			log_error("Error opening string log file");
 	}
+	pthread_mutex_unlock(&fast_log_lock);
+
+	return fp;
 }
 
 void fast_log(int nf_id, const char *fmt, ...)
 {
 	va_list args;
+	FILE *fp;
+
+	if (nf_id < 0 || nf_id >= FAST_LOG_MAX_NF)
+		return;
+
+	fp = fast_log_file(nf_id);
+	if (!fp)
+		return;
+
 	va_start(args, fmt);
-	vsnprintf(fast_log_buffer[fast_log_index++], FAST_LOG_SIZE, fmt, args);
+	log_ring_vprintf(fp, LOG_RING_NEWLINE, fmt, args);
 	va_end(args);
-
-	if (fast_log_index >= FAST_LOG_BATCH_SIZE) {
-		fast_log_dump_in_file(nf_id, FAST_LOG_BATCH_SIZE);
-		fast_log_index = 0;
-	}
 }
 
 void fast_log_flush(int nf_id)
 {
-	if (fast_log_index > 0) {
-		fast_log_dump_in_file(nf_id, fast_log_index);
-		fast_log_index = 0;
-	}
+	(void)nf_id;
+	log_ring_flush();
 }
 
 #endif
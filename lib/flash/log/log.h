@@ -43,13 +43,13 @@ void log_log(int level, const char *file, int line, const char *caller, const ch
 #define FAST_LOG_TO_FILE
 
 #ifdef FAST_LOG_TO_FILE
-#define FAST_LOG_BATCH_SIZE 1024
-#define FAST_LOG_SIZE 256
+#define FAST_LOG_MAX_NF 256
 #define FAST_LOG_DIR "flash_nf_logs/"
 
-/* Log a string to a file named after the nf_id
-   The log is buffered and written in batches for efficiency
-   Call fast_log_flush(nf_id) to flush the buffer to the file
+/* Log a line to a file named after the nf_id
+   The arguments go to the calling thread's log ring (log_ring.h) and are
+   formatted and written by its consumer thread, so fmt must be a literal
+   Call fast_log_flush(nf_id) to write out everything logged so far
    NOTE: Manually clear the file contents before starting logging for a new run
 */
 void fast_log(int nf_id, const char *fmt, ...);
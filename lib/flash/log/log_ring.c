@@ -0,0 +1,646 @@
+/* SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) 2025 Debojeet Das
+ *
+ * Binary per-thread log ring, see log_ring.h.
+ */
+
+#include "log_ring.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LOG_RING_MASK (LOG_RING_SIZE - 1)
+#define LOG_SLOT_SIZE 128
+#define LOG_OUT_SIZE 4096
+
+/* "%s" argument values that are not blob offsets */
+#define LOG_STR_NULL UINT64_MAX
+#define LOG_STR_EMPTY (UINT64_MAX - 1)
+
+_Static_assert((LOG_RING_SIZE & LOG_RING_MASK) == 0, "LOG_RING_SIZE must be a power of two");
+
+struct log_rec {
+	const char *fmt;
+	FILE *fp;
+	uint16_t flags;
+	uint16_t nargs;
+	uint16_t nslots; /* slots after this one holding "%s" bytes */
+	uint16_t pad;
+	uint64_t arg[LOG_RING_MAX_ARGS];
+};
+
+union log_slot {
+	struct log_rec rec;
+	char str[LOG_SLOT_SIZE];
+} __attribute__((aligned(64)));
+
+_Static_assert(sizeof(union log_slot) == LOG_SLOT_SIZE, "a record must fit in one slot");
+
+struct log_ring {
+	/* written by the owning thread */
+	uint64_t head __attribute__((aligned(64)));
+	uint64_t tail_cache;
+	uint64_t records;
+	uint64_t dropped;
+	uint64_t truncated;
+
+	/* written by the consumer */
+	uint64_t tail __attribute__((aligned(64)));
+	struct log_ring *next;
+	int dead; /* owner exited */
+
+	union log_slot slot[LOG_RING_SIZE];
+};
+
+/* length modifiers */
+enum { LEN_NONE, LEN_HH, LEN_H, LEN_L, LEN_LL, LEN_J, LEN_Z, LEN_T, LEN_LD };
+
+/* what a conversion takes */
+enum { ARG_NONE, ARG_INT, ARG_DBL, ARG_STR, ARG_PTR, ARG_SKIP };
+
+struct fmt_spec {
+	const char *start; /* the '%' */
+	const char *end; /* past the conversion character */
+	int width_star;
+	int prec_star;
+	int len;
+	int type;
+};
+
+static __thread struct log_ring *tls_ring;
+
+/* rings, newest first; threads push, only the consumer unlinks */
+static struct log_ring *ring_list;
+
+/* serializes consumers: the thread and log_ring_flush() callers */
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct log_ring_stats retired; /* of unlinked rings, under drain_lock */
+
+static pthread_mutex_t ctl_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+static pthread_t consumer;
+static int consumer_on;
+static int consumer_stop;
+static int exiting;
+
+/*----------------------------------------------------------------------------*/
+static inline void counter_inc(uint64_t *cnt)
+{
+	/* single writer, read by log_ring_get_stats() */
+	__atomic_store_n(cnt, *cnt + 1, __ATOMIC_RELAXED);
+}
+
+/* parse the conversion at p, which points at a '%' that is not "%%" */
+static const char *parse_spec(const char *p, struct fmt_spec *s)
+{
+	s->start = p++;
+	s->width_star = 0;
+	s->prec_star = 0;
+	s->len = LEN_NONE;
+
+	while (*p && strchr("-+ #0'", *p))
+		p++;
+	if (*p == '*') {
+		s->width_star = 1;
+		p++;
+	}
+	while (*p >= '0' && *p <= '9')
+		p++;
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			s->prec_star = 1;
+			p++;
+		}
+		while (*p >= '0' && *p <= '9')
+			p++;
+	}
+
+	switch (*p) {
+	case 'h':
+		s->len = (p[1] == 'h') ? LEN_HH : LEN_H;
+		p += (p[1] == 'h') ? 2 : 1;
+		break;
+	case 'l':
+		s->len = (p[1] == 'l') ? LEN_LL : LEN_L;
+		p += (p[1] == 'l') ? 2 : 1;
+		break;
+	case 'q':
+		s->len = LEN_LL;
+		p++;
+		break;
+	case 'j':
+		s->len = LEN_J;
+		p++;
+		break;
+	case 'z':
+		s->len = LEN_Z;
+		p++;
+		break;
+	case 't':
+		s->len = LEN_T;
+		p++;
+		break;
+	case 'L':
+		s->len = LEN_LD;
+		p++;
+		break;
+	}
+
+	switch (*p) {
+	case 'd':
+	case 'i':
+	case 'o':
+	case 'u':
+	case 'x':
+	case 'X':
+	case 'c':
+		s->type = ARG_INT;
+		break;
+	case 'e':
+	case 'E':
+	case 'f':
+	case 'F':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		s->type = ARG_DBL;
+		break;
+	case 's':
+		/* wide strings are not copied */
+		s->type = (s->len == LEN_L) ? ARG_SKIP : ARG_STR;
+		break;
+	case 'p':
+		s->type = ARG_PTR;
+		break;
+	case 'n':
+		s->type = ARG_SKIP;
+		break;
+	default:
+		s->type = ARG_NONE;
+		break;
+	}
+
+	if (*p)
+		p++;
+	s->end = p;
+	return p;
+}
+/*----------------------------------------------------------------------------*/
+static uint64_t fetch_int(int len, va_list *ap)
+{
+	switch (len) {
+	case LEN_L:
+		return (uint64_t)va_arg(*ap, long);
+	case LEN_LL:
+		return (uint64_t)va_arg(*ap, long long);
+	case LEN_J:
+		return (uint64_t)va_arg(*ap, intmax_t);
+	case LEN_Z:
+		return (uint64_t)va_arg(*ap, size_t);
+	case LEN_T:
+		return (uint64_t)va_arg(*ap, ptrdiff_t);
+	default:
+		return (uint64_t)(int64_t)va_arg(*ap, int);
+	}
+}
+
+/* fill rec and the string blob from the arguments, FALSE if some were cut */
+static int capture(struct log_rec *rec, char *blob, size_t *blob_len, const char *fmt, va_list *ap)
+{
+	struct fmt_spec s;
+	const char *p = fmt;
+	size_t used = 0;
+	int whole = 1;
+	double d;
+
+	rec->nargs = 0;
+	while ((p = strchr(p, '%'))) {
+		if (p[1] == '%') {
+			p += 2;
+			continue;
+		}
+		p = parse_spec(p, &s);
+
+		if (rec->nargs + s.width_star + s.prec_star + (s.type != ARG_NONE) > LOG_RING_MAX_ARGS) {
+			whole = 0;
+			break;
+		}
+		if (s.width_star)
+			rec->arg[rec->nargs++] = (uint64_t)(int64_t)va_arg(*ap, int);
+		if (s.prec_star)
+			rec->arg[rec->nargs++] = (uint64_t)(int64_t)va_arg(*ap, int);
+
+		switch (s.type) {
+		case ARG_INT:
+			rec->arg[rec->nargs++] = fetch_int(s.len, ap);
+			break;
+		case ARG_DBL:
+			if (s.len == LEN_LD)
+				d = (double)va_arg(*ap, long double);
+			else
+				d = va_arg(*ap, double);
+			memcpy(&rec->arg[rec->nargs++], &d, sizeof(d));
+			break;
+		case ARG_STR: {
+			const char *str = va_arg(*ap, const char *);
+			size_t n;
+
+			if (!str) {
+				rec->arg[rec->nargs++] = LOG_STR_NULL;
+				break;
+			}
+			n = strlen(str);
+			if (used + n + 1 > LOG_RING_MAX_STR) {
+				whole = 0;
+				if (used == LOG_RING_MAX_STR) {
+					rec->arg[rec->nargs++] = LOG_STR_EMPTY;
+					break;
+				}
+				n = LOG_RING_MAX_STR - used - 1;
+			}
+			memcpy(blob + used, str, n);
+			blob[used + n] = '\0';
+			rec->arg[rec->nargs++] = used;
+			used += n + 1;
+			break;
+		}
+		case ARG_PTR:
+		case ARG_SKIP:
+			rec->arg[rec->nargs++] = (uint64_t)(uintptr_t)va_arg(*ap, void *);
+			break;
+		}
+	}
+
+	*blob_len = used;
+	return whole;
+}
+/*----------------------------------------------------------------------------*/
+/* the text of one conversion of a record, returns bytes written to out;
+ * spec is rebuilt from the record's format, which the compiler checked */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+static int format_spec(char *out, size_t room, const struct fmt_spec *s, const struct log_rec *rec, const char *blob,
+		       int *argi)
+{
+	char spec[64];
+	size_t n = 0;
+	const char *p;
+	uint64_t v;
+	double d;
+	int ret = 0;
+
+	if (s->end - s->start >= (ptrdiff_t)sizeof(spec) - 24) {
+		*argi += s->width_star + s->prec_star + (s->type != ARG_NONE);
+		return 0;
+	}
+
+	/* resolve '*' from the recorded arguments */
+	for (p = s->start; p < s->end; p++) {
+		if (*p != '*') {
+			spec[n++] = *p;
+			continue;
+		}
+		if (*argi >= rec->nargs)
+			return -1;
+		v = rec->arg[(*argi)++];
+		if (p > s->start && p[-1] == '.' && (int)v < 0)
+			n--; /* negative precision: as if there were none */
+		else
+			n += snprintf(spec + n, sizeof(spec) - n, "%d", (int)v);
+	}
+	spec[n] = '\0';
+
+	if (s->type == ARG_NONE)
+		return 0;
+	if (*argi >= rec->nargs)
+		return -1;
+	v = rec->arg[(*argi)++];
+
+	switch (s->type) {
+	case ARG_INT:
+		switch (s->len) {
+		case LEN_L:
+			ret = snprintf(out, room, spec, (long)v);
+			break;
+		case LEN_LL:
+			ret = snprintf(out, room, spec, (long long)v);
+			break;
+		case LEN_J:
+			ret = snprintf(out, room, spec, (intmax_t)v);
+			break;
+		case LEN_Z:
+			ret = snprintf(out, room, spec, (size_t)v);
+			break;
+		case LEN_T:
+			ret = snprintf(out, room, spec, (ptrdiff_t)v);
+			break;
+		default:
+			ret = snprintf(out, room, spec, (int)v);
+			break;
+		}
+		break;
+	case ARG_DBL:
+		memcpy(&d, &v, sizeof(d));
+		if (s->len == LEN_LD)
+			ret = snprintf(out, room, spec, (long double)d);
+		else
+			ret = snprintf(out, room, spec, d);
+		break;
+	case ARG_STR:
+		if (v == LOG_STR_NULL)
+			ret = snprintf(out, room, spec, "(null)");
+		else
+			ret = snprintf(out, room, spec, (v == LOG_STR_EMPTY) ? "" : blob + v);
+		break;
+	case ARG_PTR:
+		ret = snprintf(out, room, spec, (void *)(uintptr_t)v);
+		break;
+	}
+
+	if (ret < 0)
+		return 0;
+	return ((size_t)ret >= room) ? (int)room - 1 : ret;
+}
+#pragma GCC diagnostic pop
+
+static void format_rec(const struct log_rec *rec, const char *blob)
+{
+	char out[LOG_OUT_SIZE];
+	const char *p = rec->fmt;
+	const char *pct;
+	struct fmt_spec s;
+	size_t len = 0;
+	size_t n;
+	int argi = 0;
+	int ret;
+
+	/* one byte is kept for the newline */
+	while (*p && len < sizeof(out) - 2) {
+		pct = strchr(p, '%');
+		n = pct ? (size_t)(pct - p) : strlen(p);
+		if (n > sizeof(out) - 2 - len)
+			n = sizeof(out) - 2 - len;
+		memcpy(out + len, p, n);
+		len += n;
+		p += n;
+		if (!pct || p != pct)
+			continue;
+
+		if (pct[1] == '%') {
+			out[len++] = '%';
+			p += 2;
+			continue;
+		}
+		p = parse_spec(pct, &s);
+		ret = format_spec(out + len, sizeof(out) - 1 - len, &s, rec, blob, &argi);
+		if (ret < 0) {
+			/* the record ran out of arguments */
+			n = (sizeof(out) - 2 - len < 3) ? sizeof(out) - 2 - len : 3;
+			memcpy(out + len, "...", n);
+			len += n;
+			break;
+		}
+		len += ret;
+	}
+
+	if (rec->flags & LOG_RING_NEWLINE)
+		out[len++] = '\n';
+	if (len && fwrite(out, 1, len, rec->fp) != len)
+		clearerr(rec->fp);
+}
+/*----------------------------------------------------------------------------*/
+static int drain_ring(struct log_ring *r)
+{
+	char blob[LOG_RING_MAX_STR + LOG_SLOT_SIZE];
+	uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	uint64_t tail = r->tail;
+	const struct log_rec *rec;
+	int cnt = 0;
+	int i;
+
+	while (tail != head) {
+		rec = &r->slot[tail & LOG_RING_MASK].rec;
+		for (i = 0; i < rec->nslots; i++)
+			memcpy(blob + i * LOG_SLOT_SIZE, r->slot[(tail + 1 + i) & LOG_RING_MASK].str, LOG_SLOT_SIZE);
+		format_rec(rec, blob);
+
+		tail += 1 + rec->nslots;
+		__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+		cnt++;
+	}
+
+	return cnt;
+}
+
+static void retire_ring(struct log_ring *r, struct log_ring *prev)
+{
+	struct log_ring *expected = r;
+
+	if (!prev && !__atomic_compare_exchange_n(&ring_list, &expected, r->next, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		/* a thread pushed in front of it meanwhile */
+		for (prev = ring_list; prev->next != r; prev = prev->next)
+			;
+	}
+	if (prev)
+		prev->next = r->next;
+
+	retired.records += r->records;
+	retired.dropped += r->dropped;
+	retired.truncated += r->truncated;
+	retired.rings++;
+	free(r);
+}
+
+/* one pass over every ring, returns the number of records written */
+static int drain_all(void)
+{
+	struct log_ring *r, *prev = NULL, *next;
+	int cnt = 0;
+
+	pthread_mutex_lock(&drain_lock);
+	for (r = __atomic_load_n(&ring_list, __ATOMIC_ACQUIRE); r; r = next) {
+		next = r->next;
+		cnt += drain_ring(r);
+		/* the owner is gone: nothing more can show up */
+		if (__atomic_load_n(&r->dead, __ATOMIC_ACQUIRE)) {
+			drain_ring(r);
+			retire_ring(r, prev);
+			continue;
+		}
+		prev = r;
+	}
+	pthread_mutex_unlock(&drain_lock);
+
+	return cnt;
+}
+
+static void *consumer_main(void *arg)
+{
+	(void)arg;
+
+	while (!__atomic_load_n(&consumer_stop, __ATOMIC_ACQUIRE)) {
+		if (!drain_all())
+			usleep(LOG_RING_IDLE_US);
+	}
+
+	return NULL;
+}
+/*----------------------------------------------------------------------------*/
+static void stop_consumer(void)
+{
+	pthread_mutex_lock(&ctl_lock);
+	if (consumer_on) {
+		__atomic_store_n(&consumer_stop, 1, __ATOMIC_RELEASE);
+		pthread_join(consumer, NULL);
+		__atomic_store_n(&consumer_on, 0, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&ctl_lock);
+
+	drain_all();
+	fflush(NULL);
+}
+
+static void at_exit(void)
+{
+	__atomic_store_n(&exiting, 1, __ATOMIC_RELEASE);
+	stop_consumer();
+}
+
+static void start_consumer(void)
+{
+	pthread_mutex_lock(&ctl_lock);
+	if (!consumer_on && !__atomic_load_n(&exiting, __ATOMIC_ACQUIRE)) {
+		consumer_stop = 0;
+		/* without a consumer, records wait for log_ring_flush() */
+		if (pthread_create(&consumer, NULL, consumer_main, NULL) == 0)
+			__atomic_store_n(&consumer_on, 1, __ATOMIC_RELEASE);
+		else
+			__atomic_store_n(&exiting, 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&ctl_lock);
+}
+
+static void ring_exit(void *arg)
+{
+	struct log_ring *r = arg;
+
+	__atomic_store_n(&r->dead, 1, __ATOMIC_RELEASE);
+}
+
+static void init(void)
+{
+	pthread_key_create(&ring_key, ring_exit);
+	atexit(at_exit);
+}
+
+static struct log_ring *register_ring(void)
+{
+	struct log_ring *r;
+
+	pthread_once(&init_once, init);
+
+	if (posix_memalign((void **)&r, 64, sizeof(*r)))
+		return NULL;
+	memset(r, 0, offsetof(struct log_ring, slot));
+
+	r->next = __atomic_load_n(&ring_list, __ATOMIC_ACQUIRE);
+	while (!__atomic_compare_exchange_n(&ring_list, &r->next, r, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+		;
+	pthread_setspecific(ring_key, r);
+
+	tls_ring = r;
+	return r;
+}
+/*----------------------------------------------------------------------------*/
+int log_ring_vprintf(FILE *fp, int flags, const char *fmt, va_list ap)
+{
+	struct log_ring *r = tls_ring;
+	char blob[LOG_RING_MAX_STR];
+	struct log_rec rec;
+	size_t blob_len;
+	uint64_t head;
+	va_list aq;
+	int whole;
+	int i;
+
+	if (!r) {
+		r = register_ring();
+		if (!r)
+			return -1;
+	}
+	if (!__atomic_load_n(&consumer_on, __ATOMIC_RELAXED) && !__atomic_load_n(&exiting, __ATOMIC_RELAXED))
+		start_consumer();
+
+	rec.fmt = fmt;
+	rec.fp = fp;
+	rec.flags = flags;
+	rec.pad = 0;
+	va_copy(aq, ap);
+	whole = capture(&rec, blob, &blob_len, fmt, &aq);
+	va_end(aq);
+	rec.nslots = (blob_len + LOG_SLOT_SIZE - 1) / LOG_SLOT_SIZE;
+
+	head = r->head;
+	if (head + 1 + rec.nslots - r->tail_cache > LOG_RING_SIZE) {
+		r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+		if (head + 1 + rec.nslots - r->tail_cache > LOG_RING_SIZE) {
+			counter_inc(&r->dropped);
+			return -1;
+		}
+	}
+
+	memcpy(&r->slot[head & LOG_RING_MASK].rec, &rec, offsetof(struct log_rec, arg) + rec.nargs * sizeof(uint64_t));
+	for (i = 0; i < rec.nslots; i++)
+		memcpy(r->slot[(head + 1 + i) & LOG_RING_MASK].str, blob + i * LOG_SLOT_SIZE,
+		       (blob_len - i * LOG_SLOT_SIZE < LOG_SLOT_SIZE) ? blob_len - i * LOG_SLOT_SIZE : LOG_SLOT_SIZE);
+	__atomic_store_n(&r->head, head + 1 + rec.nslots, __ATOMIC_RELEASE);
+
+	counter_inc(&r->records);
+	if (!whole)
+		counter_inc(&r->truncated);
+	return 0;
+}
+
+int log_ring_printf(FILE *fp, int flags, const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = log_ring_vprintf(fp, flags, fmt, ap);
+	va_end(ap);
+
+	return ret;
+}
+
+void log_ring_flush(void)
+{
+	drain_all();
+	fflush(NULL);
+}
+
+void log_ring_get_stats(struct log_ring_stats *st)
+{
+	struct log_ring *r;
+
+	pthread_mutex_lock(&drain_lock);
+	*st = retired;
+	for (r = __atomic_load_n(&ring_list, __ATOMIC_ACQUIRE); r; r = r->next) {
+		st->records += __atomic_load_n(&r->records, __ATOMIC_RELAXED);
+		st->dropped += __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+		st->truncated += __atomic_load_n(&r->truncated, __ATOMIC_RELAXED);
+		st->rings++;
+	}
+	pthread_mutex_unlock(&drain_lock);
+}
+
+void log_ring_stop(void)
+{
+	stop_consumer();
+}
@@ -0,0 +1,79 @@
+/* SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) 2025 Debojeet Das
+ *
+ * Binary per-thread log ring.
+ *
+ * The calling thread does not format anything: a record keeps the format
+ * string pointer, which doubles as the format id, and the raw arguments,
+ * and lands in a single-producer ring owned by that thread. A background
+ * consumer drains every ring and does the printf work off the datapath.
+ * Registering a thread's ring is the only step that is not wait-free and
+ * it happens once. A full ring drops the record and counts it.
+ *
+ * The format string must stay valid for the life of the process (string
+ * literals, in practice). "%s" arguments are copied into the record, so
+ * they may point to stack buffers; "%n" is not supported.
+ */
+
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* records per thread, a power of two */
+#define LOG_RING_SIZE 4096
+/* integer, pointer or double arguments per record */
+#define LOG_RING_MAX_ARGS 12
+/* bytes of "%s" arguments per record, longer ones are truncated */
+#define LOG_RING_MAX_STR 512
+/* consumer nap when every ring is empty */
+#define LOG_RING_IDLE_US 1000
+
+/* record ending options */
+#define LOG_RING_NEWLINE 0x1 /* append '\n' after the formatted text */
+
+struct log_ring_stats {
+	uint64_t records; /* accepted */
+	uint64_t dropped; /* ring full */
+	uint64_t truncated; /* too many arguments or string bytes */
+	uint32_t rings; /* threads that have logged */
+};
+
+/**
+ * Queue a record for fp on the calling thread's ring.
+ *
+ * @param fp      Stream the consumer writes the formatted text to.
+ * @param flags   LOG_RING_* options.
+ * @param fmt     printf format, also the record's id.
+ * @param ap      Arguments for fmt.
+ * @return 0 on success, -1 if the record was dropped.
+ */
+int log_ring_vprintf(FILE *fp, int flags, const char *fmt, va_list ap);
+
+/**
+ * log_ring_vprintf() with a variable argument list.
+ */
+int log_ring_printf(FILE *fp, int flags, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+/**
+ * Format and write out everything queued so far by any thread and
+ * fflush() the streams written to. Runs on the calling thread.
+ */
+void log_ring_flush(void);
+
+/**
+ * Totals over all rings, including those of exited threads.
+ *
+ * @param st      Filled in.
+ */
+void log_ring_get_stats(struct log_ring_stats *st);
+
+/**
+ * Drain the rings and stop the consumer. Also run at exit; a later
+ * record starts a new consumer.
+ */
+void log_ring_stop(void);
+
+#endif /* LOG_RING_H */
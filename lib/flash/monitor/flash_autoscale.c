@@ -0,0 +1,252 @@
+/* SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) 2025 Debojeet Das
+ *
+ * Autoscaler: grows and shrinks the set of an NF's threads that get traffic
+ *
+ * The monitor created every socket, so it sees their rings without asking
+ * the NF: RX ring occupancy and the RX producer (packets received) from its
+ * own mapping of the ring, and drops from XDP_STATISTICS. An NF saturates
+ * when an RX ring fills up or the kernel starts dropping; it has room to
+ * spare when one thread fewer would still run below AUTOSCALE_SPARE_PCT of
+ * the per-thread rate it saturated at.
+ *
+ * The config's threads are the most an NF can use and "min_threads" the
+ * least. Scaling moves the NIC's RSS spread over the NF's queues, which must
+ * be consecutive, with ethtool -X, and tells the NF with FLASH__SCALE. Only
+ * an NF that is the single NIC facing NF (no previous NF) of every UMEM on
+ * its interface is scaled, the RSS table belongs to the whole interface.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <log.h>
+
+#include "flash_monitor.h"
+
+#define AUTOSCALE_INTERVAL_MS 500
+#define AUTOSCALE_HIGH_PCT 50
+#define AUTOSCALE_SPARE_PCT 60
+#define AUTOSCALE_IDLE_PCT 5
+#define AUTOSCALE_UP_SAMPLES 2
+#define AUTOSCALE_DOWN_SAMPLES 10
+#define AUTOSCALE_COOLDOWN_MS 2000
+
+/**
+ * Decide on one sample.
+ *
+ * @return 1 to add a thread, -1 to remove one, 0 to stay.
+ */
+int autoscale_decide(struct autoscale_state *st, const struct autoscale_sample *s, uint64_t now_ms)
+{
+	uint64_t pps = s->interval_ms ? s->rx_pkts * MS_PER_S / s->interval_ms : 0;
+	bool hot = s->rx_pct >= AUTOSCALE_HIGH_PCT || s->drops;
+	bool cold;
+
+	/* what one thread manages when all of them are busy */
+	if (hot && st->active > 0 && pps / st->active > st->thread_pps)
+		st->thread_pps = pps / st->active;
+
+	if (st->thread_pps)
+		cold = !hot && pps * 100 < st->thread_pps * (st->active - 1) * AUTOSCALE_SPARE_PCT;
+	else
+		cold = s->rx_pct <= AUTOSCALE_IDLE_PCT && !s->drops;
+
+	st->hot = hot ? st->hot + 1 : 0;
+	st->cold = cold ? st->cold + 1 : 0;
+
+	if (now_ms - st->last_change_ms < AUTOSCALE_COOLDOWN_MS)
+		return 0;
+	if (st->hot >= AUTOSCALE_UP_SAMPLES && st->active < st->max)
+		return 1;
+	if (st->cold >= AUTOSCALE_DOWN_SAMPLES && st->active > st->min)
+		return -1;
+	return 0;
+}
+
+static uint64_t elapsed_us(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/* Spread the NIC's RSS over n queues starting at first. */
+static int steer_queues(char *ifname, int first, int n)
+{
+	char ethtool[] = "ethtool", rxfh_flag[] = "-X", start_flag[] = "start", equal_flag[] = "equal";
+	char first_str[12], n_str[12];
+	int status;
+	pid_t pid;
+
+	snprintf(first_str, sizeof(first_str), "%d", first);
+	snprintf(n_str, sizeof(n_str), "%d", n);
+
+	pid = fork();
+	if (pid < 0)
+		return -1;
+	if (pid == 0) {
+		char *argv[] = { ethtool, rxfh_flag, ifname, start_flag, first_str, equal_flag, n_str, NULL };
+		if (freopen("/dev/null", "w", stdout) == NULL)
+			log_error("Error in freopen");
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+
+	if (waitpid(pid, &status, 0) < 0)
+		return -1;
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+static bool can_steer(struct NFGroup *nfg, struct umem *umem, struct nf *nf)
+{
+	for (int i = 1; i < nf->thread_count; i++) {
+		if (nf->thread[i]->ifqueue != nf->thread[0]->ifqueue + i) {
+			log_warn("NF %d: queues are not consecutive, not autoscaling", nf->id);
+			return false;
+		}
+	}
+
+	/* other UMEMs may share the interface and its RSS table */
+	for (int u = 0; u < nfg->umem_count; u++) {
+		struct umem *other = nfg->umem[u];
+
+		if (other != umem && strcmp(other->cfg->ifname, umem->cfg->ifname))
+			continue;
+		for (int i = 0; i < other->nf_count; i++) {
+			if (other->nf[i] != nf && other->nf[i]->prev_size == 0) {
+				log_warn("NF %d: NF %d of UMEM %d also takes traffic from %s, not autoscaling", nf->id,
+					 other->nf[i]->id, other->id, umem->cfg->ifname);
+				return false;
+			}
+		}
+	}
+
+	if (nf->prev_size != 0) {
+		log_warn("NF %d: gets its traffic from other NFs, not autoscaling", nf->id);
+		return false;
+	}
+	return true;
+}
+
+static struct autoscale_state *autoscale_init(struct nf *nf)
+{
+	struct autoscale_state *st = calloc(1, sizeof(struct autoscale_state));
+
+	if (!st)
+		return NULL;
+	st->rx_prod = calloc(nf->thread_count, sizeof(uint32_t));
+	st->stats = calloc(nf->thread_count, sizeof(struct xdp_statistics));
+	if (!st->rx_prod || !st->stats) {
+		free(st->rx_prod);
+		free(st->stats);
+		free(st);
+		return NULL;
+	}
+	st->min = nf->min_threads;
+	st->max = nf->thread_count;
+	st->active = nf->active_threads;
+	return st;
+}
+
+static void sample_nf(struct nf *nf, struct autoscale_state *st, struct autoscale_sample *s, uint64_t now_ms)
+{
+	memset(s, 0, sizeof(*s));
+	s->interval_ms = st->last_sample_ms ? now_ms - st->last_sample_ms : 0;
+	st->last_sample_ms = now_ms;
+
+	for (int i = 0; i < nf->current_thread_count; i++) {
+		struct socket *socket = nf->thread[i]->socket;
+		struct xdp_statistics stats;
+		socklen_t optlen = sizeof(stats);
+		uint32_t prod, cons;
+
+		if (!socket || !socket->rx.ring)
+			continue;
+
+		prod = __atomic_load_n(socket->rx.producer, __ATOMIC_ACQUIRE);
+		cons = __atomic_load_n(socket->rx.consumer, __ATOMIC_ACQUIRE);
+		if (i < st->active && (prod - cons) * 100 / socket->rx.size > s->rx_pct)
+			s->rx_pct = (prod - cons) * 100 / socket->rx.size;
+		s->rx_pkts += prod - st->rx_prod[i];
+		st->rx_prod[i] = prod;
+
+		if (getsockopt(socket->fd, SOL_XDP, XDP_STATISTICS, &stats, &optlen) == 0) {
+			s->drops += (stats.rx_dropped - st->stats[i].rx_dropped) +
+				    (stats.rx_ring_full - st->stats[i].rx_ring_full) +
+				    (stats.rx_fill_ring_empty_descs - st->stats[i].rx_fill_ring_empty_descs);
+			st->stats[i] = stats;
+		}
+	}
+
+	/* the first sample only sets the baseline */
+	if (!s->interval_ms) {
+		s->rx_pkts = 0;
+		s->drops = 0;
+	}
+}
+
+/**
+ * Sample one NF and scale it if needed.
+ *
+ * @return 1 if the NF's active threads changed, 0 otherwise.
+ */
+int autoscale_nf(struct NFGroup *nfg, struct umem *umem, struct nf *nf, uint64_t now_ms)
+{
+	struct autoscale_state *st = nf->autoscale;
+	struct autoscale_sample s;
+	struct timespec start;
+	int step, target;
+
+	if (nf->min_threads >= nf->thread_count)
+		return 0;
+
+	/* a new instance may come with new sockets, start counting afresh */
+	if (nf->current_thread_count == 0) {
+		if (st)
+			st->last_sample_ms = 0;
+		return 0;
+	}
+
+	if (!st) {
+		st = nf->autoscale = autoscale_init(nf);
+		if (!st)
+			return 0;
+		st->disabled = !can_steer(nfg, umem, nf);
+	}
+	if (st->disabled || now_ms - st->last_sample_ms < AUTOSCALE_INTERVAL_MS)
+		return 0;
+
+	sample_nf(nf, st, &s, now_ms);
+	if (!s.interval_ms)
+		return 0;
+	log_debug("AUTOSCALE nf=%d rx=%u%% pkts=%lu drops=%lu active=%d", nf->id, s.rx_pct, s.rx_pkts, s.drops, st->active);
+
+	step = autoscale_decide(st, &s, now_ms);
+	if (!step)
+		return 0;
+
+	target = st->active + step;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (steer_queues(umem->cfg->ifname, nf->thread[0]->ifqueue, target) < 0) {
+		log_error("AUTOSCALE nf=%d: could not steer %s to %d queues, disabling", nf->id, umem->cfg->ifname, target);
+		st->disabled = true;
+		return 0;
+	}
+
+	log_info("AUTOSCALE nf=%d umem=%d threads %d -> %d rx=%u%% pps=%lu drops=%lu thread_pps=%lu steer=%luus", nf->id,
+		 umem->id, st->active, target, s.rx_pct, s.rx_pkts * MS_PER_S / s.interval_ms, s.drops, st->thread_pps,
+		 elapsed_us(&start));
+
+	st->active = target;
+	st->hot = 0;
+	st->cold = 0;
+	st->last_change_ms = now_ms;
+	nf->active_threads = target;
+	__atomic_add_fetch(&nf->scale_gen, 1, __ATOMIC_RELEASE);
+	return 1;
+}
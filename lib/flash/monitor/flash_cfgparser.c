@@ -2,8 +2,11 @@
  * Copyright (c) 2025 Debojeet Das
  */
 
+#include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <log.h>
@@ -46,312 +49,927 @@ static void configure_nic(char *ifname, int total_queues, int mode)
 	}
 }
 
-static __u32 get_flags(char *flag)
+static int get_flags(const char *flag, __u32 *flags)
 {
-	if (strlen(flag) != 1) {
-		log_error("Invalid xdp flag: %s", flag);
-		exit(EXIT_FAILURE);
-	}
+	if (strlen(flag) != 1)
+		return -1;
+
 	switch (flag[0]) {
 	case 's':
-		return XDP_FLAGS_SKB_MODE;
+		*flags = XDP_FLAGS_SKB_MODE;
+		return 0;
 	case 'd':
-		return XDP_FLAGS_DRV_MODE;
+		*flags = XDP_FLAGS_DRV_MODE;
+		return 0;
 	case 'h':
-		return XDP_FLAGS_HW_MODE;
+		*flags = XDP_FLAGS_HW_MODE;
+		return 0;
 	case 'c':
-		return XDP_COPY;
+		*flags = XDP_COPY;
+		return 0;
 	case 'z':
-		return XDP_ZEROCOPY;
+		*flags = XDP_ZEROCOPY;
+		return 0;
 	case 'b':
-		return FLASH__BUSY_POLL;
+		*flags = FLASH__BUSY_POLL;
+		return 0;
 	case 'm':
-		return FLASH__NO_NEED_WAKEUP;
+		*flags = FLASH__NO_NEED_WAKEUP;
+		return 0;
 	case 'p':
-		return FLASH__POLL;
+		*flags = FLASH__POLL;
+		return 0;
 	}
 
-	log_error("Invalid flag: %s", flag);
-	exit(EXIT_FAILURE);
+	return -1;
 }
 
-struct NFGroup *parse_json(const char *filename)
+enum cfg_type {
+	CFG_INT,
+	CFG_STRING,
+	CFG_BOOL,
+	CFG_ARRAY,
+	CFG_OBJECT,
+};
+
+/* A key of a config object. min and max bound an integer's value, a string's length or an array's size. */
+struct cfg_field {
+	const char *name;
+	enum cfg_type type;
+	bool required;
+	long min;
+	long max;
+};
+
+static const struct cfg_field umem_schema[] = {
+	{ "umem_id", CFG_INT, true, 0, INT_MAX },
+	{ "ifname", CFG_STRING, true, 1, IF_NAMESIZE - 1 },
+	{ "xdp_flags", CFG_STRING, true, 1, 1 },
+	{ "bind_flags", CFG_STRING, true, 1, 1 },
+	{ "mode", CFG_STRING, true, 0, 1 },
+	{ "poll_timeout", CFG_INT, false, 0, INT_MAX },
+	{ "custom_xsk", CFG_BOOL, true, 0, 0 },
+	{ "frags_enabled", CFG_BOOL, true, 0, 0 },
+	{ "umem_scale", CFG_INT, false, 1, UINT16_MAX },
+	{ "warm_pool", CFG_BOOL, false, 0, 0 },
+	{ "nf", CFG_ARRAY, true, 1, INT_MAX },
+	{ "route", CFG_OBJECT, false, 0, 0 },
+	{ NULL, 0, false, 0, 0 },
+};
+
+static const struct cfg_field nf_schema[] = {
+	{ "nf_id", CFG_INT, true, 0, FLASH_MAX_NF - 1 },
+	{ "nf_ip", CFG_STRING, true, 1, INET_ADDRSTRLEN - 1 },
+	{ "nf_port", CFG_INT, true, 0, UINT16_MAX },
+	{ "thread", CFG_ARRAY, true, 1, FLASH_MAX_SOCKETS },
+	{ "min_threads", CFG_INT, false, 1, INT_MAX },
+	{ NULL, 0, false, 0, 0 },
+};
+
+static const struct cfg_field thread_schema[] = {
+	{ "thread_id", CFG_INT, true, 0, INT_MAX },
+	{ "queue", CFG_INT, true, 0, UINT8_MAX },
+	{ NULL, 0, false, 0, 0 },
+};
+
+/* the keys expand_nf() reads from an NF template, the rest are copied to every replica */
+static const struct cfg_field template_schema[] = {
+	{ "nf_id", CFG_INT, true, 0, FLASH_MAX_NF - 1 },
+	{ "nf_port", CFG_INT, true, 0, UINT16_MAX },
+	{ "replicas", CFG_INT, false, 1, FLASH_MAX_NF },
+	{ "queues", CFG_ARRAY, false, 2, 2 },
+	{ NULL, 0, false, 0, 0 },
+};
+
+static int check_field(const cJSON *item, const struct cfg_field *f, const char *path)
 {
-	FILE *file = fopen(filename, "r");
-	if (file == NULL) {
-		log_error("Unable to open file");
-		return NULL;
+	long len;
+
+	switch (f->type) {
+	case CFG_INT:
+		if (!cJSON_IsNumber(item) || item->valuedouble < f->min || item->valuedouble > f->max ||
+		    item->valuedouble != (double)(long)item->valuedouble) {
+			log_error("%s: '%s' must be an integer from %ld to %ld", path, f->name, f->min, f->max);
+			return 1;
+		}
+		return 0;
+	case CFG_STRING:
+		len = cJSON_IsString(item) ? (long)strlen(item->valuestring) : -1;
+		if (len < f->min || len > f->max) {
+			log_error("%s: '%s' must be a string of %ld to %ld characters", path, f->name, f->min, f->max);
+			return 1;
+		}
+		return 0;
+	case CFG_BOOL:
+		if (!cJSON_IsBool(item)) {
+			log_error("%s: '%s' must be true or false", path, f->name);
+			return 1;
+		}
+		return 0;
+	case CFG_ARRAY:
+		len = cJSON_IsArray(item) ? cJSON_GetArraySize(item) : -1;
+		if (len < f->min || len > f->max) {
+			log_error("%s: '%s' must be an array of %ld to %ld entries", path, f->name, f->min,
+				  f->max);
+			return 1;
+		}
+		return 0;
+	case CFG_OBJECT:
+		if (!cJSON_IsObject(item)) {
+			log_error("%s: '%s' must be an object", path, f->name);
+			return 1;
+		}
+		return 0;
 	}
 
-	fseek(file, 0, SEEK_END);
-	long length = ftell(file);
-	fseek(file, 0, SEEK_SET);
-	char *json_data = (char *)calloc(1, length + 1);
-	if (fread(json_data, 1, length, file) <= 0) {
-		log_error("Error in reading json file");
-		exit(EXIT_FAILURE);
+	return 1;
+}
+
+/*
+ * Check obj against schema and log every problem with its path in the
+ * config. With strict, keys the schema does not know are errors too, which
+ * catches misspelt optional keys.
+ *
+ * @return the number of problems found.
+ */
+static int check_object(const cJSON *obj, const struct cfg_field *schema, const char *path, bool strict)
+{
+	const struct cfg_field *f;
+	const cJSON *item;
+	int errors = 0;
+
+	if (!cJSON_IsObject(obj)) {
+		log_error("%s: must be an object", path);
+		return 1;
 	}
-	json_data[length] = '\0';
-	fclose(file);
 
-	cJSON *root = cJSON_Parse(json_data);
-	if (!root) {
-		log_error("Error parsing JSON");
-		return NULL;
+	for (f = schema; f->name; f++) {
+		item = cJSON_GetObjectItemCaseSensitive(obj, f->name);
+		if (item) {
+			errors += check_field(item, f, path);
+		} else if (f->required) {
+			log_error("%s: missing '%s'", path, f->name);
+			errors++;
+		}
 	}
 
-	free(json_data);
+	if (!strict)
+		return errors;
 
-	int mode = 0, num_queues = 0;
-	char ifname[IF_NAMESIZE];
-	// Extract "umem" array
-	cJSON *umem_array = cJSON_GetObjectItem(root, "umem");
-	if (!cJSON_IsArray(umem_array)) {
-		log_error("Invalid or missing 'umem' array");
-		cJSON_Delete(root);
-		return NULL;
+	cJSON_ArrayForEach(item, obj)
+	{
+		for (f = schema; f->name && strcmp(f->name, item->string); f++)
+			;
+		if (!f->name) {
+			log_error("%s: unknown key '%s'", path, item->string);
+			errors++;
+		}
 	}
 
-	cJSON *route = cJSON_GetObjectItem(root, "route");
+	return errors;
+}
 
-	// Allocate memory for NFGroup
-	struct NFGroup *nf_group = (struct NFGroup *)calloc(1, sizeof(struct NFGroup));
-	nf_group->umem_count = cJSON_GetArraySize(umem_array);
-	nf_group->umem = (struct umem **)calloc(nf_group->umem_count, sizeof(struct umem *));
+static int get_int(const cJSON *obj, const char *name)
+{
+	return cJSON_GetObjectItemCaseSensitive(obj, name)->valueint;
+}
 
-	// create a 2D prev array to store previous xsk ids for each umem
-	int *prev[FLASH_MAX_XSK] = { 0 };
-	int prev_size[FLASH_MAX_XSK] = { 0 };
-	// Iterate over each "umem" entry
-	for (int i = 0; i < nf_group->umem_count; i++) {
-		cJSON *umem_obj = cJSON_GetArrayItem(umem_array, i);
-		nf_group->umem[i] = (struct umem *)calloc(1, sizeof(struct umem));
-		nf_group->umem[i]->id = cJSON_GetObjectItem(umem_obj, "umem_id")->valueint;
-
-		// ifname
-		cJSON *ifname_obj = cJSON_GetObjectItem(umem_obj, "ifname");
-		if (!cJSON_IsString(ifname_obj)) {
-			log_error("Invalid or missing 'ifname'");
-			cJSON_Delete(root);
-			return NULL;
-		}
-		char *_ifname = strdup(ifname_obj->valuestring);
-
-		nf_group->umem[i]->cfg = calloc(1, sizeof(struct config));
-		strncpy(nf_group->umem[i]->cfg->ifname, _ifname, IF_NAMESIZE - 1);
-		log_info("ifname: %s", nf_group->umem[i]->cfg->ifname);
-		nf_group->umem[i]->cfg->umem_id = nf_group->umem[i]->id;
-		nf_group->umem[i]->cfg->nf_id = -1;
-		nf_group->umem[i]->cfg->umem = calloc(1, sizeof(struct umem_config));
-		nf_group->umem[i]->cfg->xsk = calloc(1, sizeof(struct xsk_config));
-
-		cJSON *umem_scale = cJSON_GetObjectItem(umem_obj, "umem_scale");
-		if (!cJSON_IsNumber(umem_scale)) {
-			nf_group->umem[i]->cfg->umem_scale = 1;
-		} else {
-			nf_group->umem[i]->cfg->umem_scale = (uint16_t)umem_scale->valueint;
-		}
+/*
+ * Append the NFs an entry of the nf array stands for to out. An NF template
+ * has "replicas": N, for N NFs with consecutive IDs and ports from its
+ * nf_id and nf_port, and "queues": [first, last], which splits the queues
+ * evenly over the replicas with one thread per queue. Every other key is
+ * copied to each replica. A route entry of the template's nf_id, in the
+ * UMEM's route or else the config's, is copied to the replicas that have
+ * none there. A template that cannot be expanded is left out.
+ */
+static int expand_nf(cJSON *nf, cJSON *umem_route, cJSON *route, cJSON *out, const char *path)
+{
+	cJSON *queues, *replicas, *threads, *copy, *entry = NULL;
+	int errors, n, first, last, per, id, port;
+	char key[16];
+
+	replicas = cJSON_GetObjectItemCaseSensitive(nf, "replicas");
+	queues = cJSON_GetObjectItemCaseSensitive(nf, "queues");
+	if (!replicas && !queues) {
+		cJSON_AddItemToArray(out, nf);
+		return 0;
+	}
 
-		// Extract "xdp_flags"
-		cJSON *xdp_flags_obj = cJSON_GetObjectItem(umem_obj, "xdp_flags");
-		if (!cJSON_IsString(xdp_flags_obj)) {
-			log_error("Invalid or missing 'xdp_flags'");
-			cJSON_Delete(root);
-			return NULL;
-		}
-		char *xdp_flags = strdup(xdp_flags_obj->valuestring);
-		nf_group->umem[i]->cfg->xsk->xdp_flags = get_flags(xdp_flags);
-		log_info("xdp_flags: %s", xdp_flags);
-
-		// Extract "bind_flags"
-		cJSON *bind_flags_obj = cJSON_GetObjectItem(umem_obj, "bind_flags");
-		if (!cJSON_IsString(bind_flags_obj)) {
-			log_error("Invalid or missing 'bind_flags'");
-			cJSON_Delete(root);
-			return NULL;
-		}
-		char *bind_flags = strdup(bind_flags_obj->valuestring);
-		nf_group->umem[i]->cfg->xsk->bind_flags = get_flags(bind_flags);
-		log_info("bind_flags: %s", bind_flags);
-
-		if (xdp_flags[0] == 's' && bind_flags[0] == 'z') {
-			log_error("Invalid combination of xdp_flags and bind_flags");
-			cJSON_Delete(root);
-			return NULL;
+	errors = check_object(nf, template_schema, path, false);
+	if (!errors && queues) {
+		for (int i = 0; i < 2; i++)
+			errors += check_field(cJSON_GetArrayItem(queues, i), &thread_schema[1], path);
+	}
+	if (!errors && cJSON_GetObjectItemCaseSensitive(nf, "thread")) {
+		log_error("%s: 'thread' and 'queues' cannot be used together", path);
+		errors++;
+	}
+	if (!errors && !queues) {
+		log_error("%s: 'replicas' needs 'queues'", path);
+		errors++;
+	}
+	if (errors) {
+		cJSON_Delete(nf);
+		return errors;
+	}
+
+	n = replicas ? replicas->valueint : 1;
+	first = cJSON_GetArrayItem(queues, 0)->valueint;
+	last = cJSON_GetArrayItem(queues, 1)->valueint;
+	if (last < first || (last - first + 1) % n) {
+		log_error("%s: queues %d to %d do not split evenly over %d replicas", path, first, last, n);
+		cJSON_Delete(nf);
+		return 1;
+	}
+	per = (last - first + 1) / n;
+	id = get_int(nf, "nf_id");
+	port = get_int(nf, "nf_port");
+
+	snprintf(key, sizeof(key), "%d", id);
+	if (umem_route)
+		entry = cJSON_GetObjectItemCaseSensitive(umem_route, key);
+	if (entry)
+		route = umem_route;
+	else if (route)
+		entry = cJSON_GetObjectItemCaseSensitive(route, key);
+
+	cJSON_DeleteItemFromObjectCaseSensitive(nf, "replicas");
+	cJSON_DeleteItemFromObjectCaseSensitive(nf, "queues");
+
+	for (int r = 0; r < n; r++) {
+		copy = cJSON_Duplicate(nf, true);
+		threads = cJSON_CreateArray();
+		for (int t = 0; t < per; t++) {
+			cJSON *thread = cJSON_CreateObject();
+
+			cJSON_AddNumberToObject(thread, "thread_id", t);
+			cJSON_AddNumberToObject(thread, "queue", first + r * per + t);
+			cJSON_AddItemToArray(threads, thread);
 		}
+		cJSON_ReplaceItemInObjectCaseSensitive(copy, "nf_id", cJSON_CreateNumber(id + r));
+		cJSON_ReplaceItemInObjectCaseSensitive(copy, "nf_port", cJSON_CreateNumber(port + r));
+		cJSON_AddItemToObject(copy, "thread", threads);
+		cJSON_AddItemToArray(out, copy);
+
+		snprintf(key, sizeof(key), "%d", id + r);
+		if (r && entry && !cJSON_GetObjectItemCaseSensitive(route, key))
+			cJSON_AddItemToObject(route, key, cJSON_Duplicate(entry, true));
+	}
 
-		// Extract "mode"
-		cJSON *mode_obj = cJSON_GetObjectItem(umem_obj, "mode");
-		if (!cJSON_IsString(mode_obj)) {
-			log_error("Invalid or missing 'mode'");
-			cJSON_Delete(root);
-			return NULL;
+	if (n > 1)
+		log_info("%s: NFs %d-%d on queues %d-%d", path, id, id + n - 1, first, last);
+	cJSON_Delete(nf);
+	return 0;
+}
+
+/* A route target is an NF ID, or "first-last" for every NF ID in between. */
+static int expand_route(cJSON *entry, const char *path)
+{
+	cJSON *out = cJSON_CreateArray(), *item;
+	int first, last, end, errors = 0;
+
+	while ((item = cJSON_DetachItemFromArray(entry, 0))) {
+		if (!cJSON_IsString(item)) {
+			cJSON_AddItemToArray(out, item);
+			continue;
 		}
-		char *_mode = strdup(mode_obj->valuestring);
-		if (strlen(_mode) == 0) {
-			nf_group->umem[i]->cfg->xsk->bind_flags |= XDP_USE_NEED_WAKEUP;
+		end = 0;
+		if (sscanf(item->valuestring, "%d-%d%n", &first, &last, &end) != 2 || item->valuestring[end] ||
+		    first < 0 || last < first || last >= FLASH_MAX_NF) {
+			log_error("%s.%s: '%s' is not an NF ID range", path, entry->string, item->valuestring);
+			errors++;
 		} else {
-			nf_group->umem[i]->cfg->xsk->mode = get_flags(_mode);
-			if (nf_group->umem[i]->cfg->xsk->mode == FLASH__POLL) {
-				cJSON *poll_timeout_obj = cJSON_GetObjectItem(umem_obj, "poll_timeout");
-				if (!cJSON_IsNumber(poll_timeout_obj)) {
-					log_error("Invalid or missing 'poll_timeout'");
-					cJSON_Delete(root);
-					return NULL;
-				}
-				nf_group->umem[i]->cfg->xsk->poll_timeout = (uint32_t)poll_timeout_obj->valueint;
+			for (int v = first; v <= last; v++)
+				cJSON_AddItemToArray(out, cJSON_CreateNumber(v));
+		}
+		cJSON_Delete(item);
+	}
+
+	while ((item = cJSON_DetachItemFromArray(out, 0)))
+		cJSON_AddItemToArray(entry, item);
+	cJSON_Delete(out);
+
+	return errors;
+}
+
+static int expand_templates(cJSON *root)
+{
+	cJSON *umem_array = cJSON_GetObjectItemCaseSensitive(root, "umem");
+	cJSON *route = cJSON_GetObjectItemCaseSensitive(root, "route");
+	cJSON *umem_obj, *umem_route, *nf_array, *out, *nf, *entry;
+	char path[64];
+	int errors = 0, i = 0, j;
+
+	if (!cJSON_IsObject(route))
+		route = NULL;
+	if (!cJSON_IsArray(umem_array))
+		umem_array = NULL;
+
+	cJSON_ArrayForEach(umem_obj, umem_array)
+	{
+		umem_route = cJSON_GetObjectItemCaseSensitive(umem_obj, "route");
+		if (!cJSON_IsObject(umem_route))
+			umem_route = NULL;
+
+		nf_array = cJSON_GetObjectItemCaseSensitive(umem_obj, "nf");
+		if (cJSON_IsArray(nf_array)) {
+			out = cJSON_CreateArray();
+			for (j = 0; (nf = cJSON_DetachItemFromArray(nf_array, 0)); j++) {
+				snprintf(path, sizeof(path), "umem[%d].nf[%d]", i, j);
+				errors += expand_nf(nf, umem_route, route, out, path);
 			}
+			cJSON_ReplaceItemInObjectCaseSensitive(umem_obj, "nf", out);
 		}
-		log_info("mode: %s", _mode);
-
-		// Extract "custom_xsk" array
-		cJSON *custom_xsk_bool = cJSON_GetObjectItem(umem_obj, "custom_xsk");
-		if (!cJSON_IsBool(custom_xsk_bool)) {
-			log_error("Invalid or missing 'custom_xsk'");
-			cJSON_Delete(root);
-			return NULL;
+
+		snprintf(path, sizeof(path), "umem[%d].route", i);
+		cJSON_ArrayForEach(entry, umem_route)
+		{
+			if (cJSON_IsArray(entry))
+				errors += expand_route(entry, path);
 		}
-		nf_group->umem[i]->cfg->custom_xsk = custom_xsk_bool->valueint ? true : false;
+		i++;
+	}
 
-		if (nf_group->umem[i]->cfg->custom_xsk) {
-			log_warn("PLEASE MAKE SURE YOU LOADED CUSTOM XDP PROGRAM!");
-		} else {
-			log_info("USING DEFAULT XDP PROGRAM");
+	cJSON_ArrayForEach(entry, route)
+	{
+		if (cJSON_IsArray(entry))
+			errors += expand_route(entry, "route");
+	}
+
+	return errors;
+}
+
+/* The keys of a UMEM entry, its flags, and that its umem_id is not used by an entry before it. */
+static int check_umem(const cJSON *umem_obj, const cJSON *umem_array, const char *path)
+{
+	__u32 xdp = 0, bind = 0, mode = 0;
+	const cJSON *item;
+	int errors;
+
+	errors = check_object(umem_obj, umem_schema, path, true);
+	if (errors)
+		return errors;
+
+	if (get_flags(cJSON_GetObjectItemCaseSensitive(umem_obj, "xdp_flags")->valuestring, &xdp)) {
+		log_error("%s: invalid 'xdp_flags'", path);
+		errors++;
+	}
+	if (get_flags(cJSON_GetObjectItemCaseSensitive(umem_obj, "bind_flags")->valuestring, &bind)) {
+		log_error("%s: invalid 'bind_flags'", path);
+		errors++;
+	} else if (xdp == XDP_FLAGS_SKB_MODE && bind == XDP_ZEROCOPY) {
+		log_error("%s: zero copy needs driver or hardware 'xdp_flags'", path);
+		errors++;
+	}
+	item = cJSON_GetObjectItemCaseSensitive(umem_obj, "mode");
+	if (item->valuestring[0] && get_flags(item->valuestring, &mode)) {
+		log_error("%s: invalid 'mode'", path);
+		errors++;
+	} else if (item->valuestring[0] && mode == FLASH__POLL &&
+		   !cJSON_GetObjectItemCaseSensitive(umem_obj, "poll_timeout")) {
+		log_error("%s: mode 'p' needs 'poll_timeout'", path);
+		errors++;
+	}
+
+	for (const cJSON *prev = umem_array->child; prev != umem_obj; prev = prev->next) {
+		item = cJSON_GetObjectItemCaseSensitive(prev, "umem_id");
+		if (cJSON_IsNumber(item) && item->valueint == get_int(umem_obj, "umem_id")) {
+			log_error("%s: umem_id %d is used twice", path, item->valueint);
+			errors++;
+			break;
 		}
+	}
+
+	return errors;
+}
 
-		// Extract "frags_enabled" array
-		cJSON *frags_enabled_bool = cJSON_GetObjectItem(umem_obj, "frags_enabled");
-		if (!cJSON_IsBool(frags_enabled_bool)) {
-			log_error("Invalid or missing 'frags_enabled'");
-			cJSON_Delete(root);
-			return NULL;
+static bool umem_has_nf(const cJSON *umem_obj, int nf_id)
+{
+	const cJSON *nf_obj;
+
+	cJSON_ArrayForEach(nf_obj, cJSON_GetObjectItemCaseSensitive(umem_obj, "nf"))
+	{
+		if (get_int(nf_obj, "nf_id") == nf_id)
+			return true;
+	}
+	return false;
+}
+
+/* The route entry of an NF of a UMEM: the UMEM's own, else the config's. */
+static const cJSON *route_entry(const cJSON *umem_obj, const cJSON *route, int nf_id)
+{
+	const cJSON *entry;
+	char key[16];
+
+	snprintf(key, sizeof(key), "%d", nf_id);
+	entry = cJSON_GetObjectItemCaseSensitive(cJSON_GetObjectItemCaseSensitive(umem_obj, "route"), key);
+	return entry ?: cJSON_GetObjectItemCaseSensitive(route, key);
+}
+
+static bool same_route(const cJSON *a, const cJSON *b)
+{
+	const cJSON *x = a->child, *y = b->child;
+
+	for (; x && y; x = x->next, y = y->next) {
+		if (x->valueint != y->valueint)
+			return false;
+	}
+	return !x && !y;
+}
+
+/*
+ * The entries of the config's route, or of a UMEM's when umem_obj is set,
+ * which only has entries for NFs of that UMEM.
+ */
+static int check_route(const cJSON *route, const cJSON *umem_obj, const bool *defined, const char *path)
+{
+	const cJSON *entry, *item;
+	int errors = 0;
+
+	cJSON_ArrayForEach(entry, route)
+	{
+		char *end;
+		long from = strtol(entry->string, &end, 10);
+
+		if (*end || end == entry->string || from < 0 || from >= FLASH_MAX_NF) {
+			log_error("%s: '%s' is not an NF ID", path, entry->string);
+			errors++;
+			continue;
 		}
-		nf_group->umem[i]->cfg->frags_enabled = frags_enabled_bool->valueint ? true : false;
-
-		// Extract "nf" array
-		cJSON *nf_array = cJSON_GetObjectItem(umem_obj, "nf");
-		if (!cJSON_IsArray(nf_array)) {
-			log_error("Invalid or missing 'nf' array");
-			cJSON_Delete(root);
-			return NULL;
+		if (!cJSON_IsArray(entry) || cJSON_GetArraySize(entry) > FLASH_MAX_EDGES) {
+			log_error("%s.%s: must be an array of up to %d NF IDs", path, entry->string, FLASH_MAX_EDGES);
+			errors++;
+			continue;
+		}
+		if (umem_obj && !umem_has_nf(umem_obj, from)) {
+			log_error("%s: NF %ld is not in this UMEM", path, from);
+			errors++;
+		} else if (!defined[from]) {
+			/* an NF that is not in this config may still be run by hand */
+			log_warn("%s: NF %ld is not in any UMEM", path, from);
 		}
-		nf_group->umem[i]->nf_count = cJSON_GetArraySize(nf_array);
-		nf_group->umem[i]->current_nf_count = 0;
-		nf_group->umem[i]->nf = (struct nf **)calloc(nf_group->umem[i]->nf_count, sizeof(struct nf *));
-
-		int total_threads = 0;
 
-		// Iterate over each "nf" entry
-		for (int j = 0; j < nf_group->umem[i]->nf_count; j++) {
-			cJSON *nf_obj = cJSON_GetArrayItem(nf_array, j);
-			nf_group->umem[i]->nf[j] = (struct nf *)calloc(1, sizeof(struct nf));
-			nf_group->umem[i]->nf[j]->id = cJSON_GetObjectItem(nf_obj, "nf_id")->valueint;
-			nf_group->umem[i]->nf[j]->is_up = false;
-			cJSON *ip_obj = cJSON_GetObjectItem(nf_obj, "nf_ip");
-			if (!cJSON_IsString(ip_obj)) {
-				log_error("Invalid or missing 'nf_ip'");
-				cJSON_Delete(root);
-				return NULL;
-			}
-			strncpy(nf_group->umem[i]->nf[j]->ip, ip_obj->valuestring, INET_ADDRSTRLEN - 1);
-			nf_group->umem[i]->nf[j]->ip[INET_ADDRSTRLEN - 1] = '\0'; // Ensure null-termination
-			cJSON *port_obj = cJSON_GetObjectItem(nf_obj, "nf_port");
-			if (!cJSON_IsNumber(port_obj)) {
-				log_error("Invalid or missing 'nf_port'");
-				cJSON_Delete(root);
-				return NULL;
+		cJSON_ArrayForEach(item, entry)
+		{
+			if (!cJSON_IsNumber(item) || item->valuedouble < 0 || item->valuedouble >= FLASH_MAX_NF ||
+			    item->valuedouble != item->valueint) {
+				log_error("%s.%s: next NFs must be NF IDs from 0 to %d", path, entry->string, FLASH_MAX_NF - 1);
+				errors++;
+				continue;
 			}
-			nf_group->umem[i]->nf[j]->port = (uint16_t)port_obj->valueint;
+			if (!defined[item->valueint])
+				log_warn("%s.%s: next NF %d is not in any UMEM", path, entry->string, item->valueint);
+		}
+	}
 
-			log_info("nf_id: %d, nf_ip: %s, nf_port: %d", nf_group->umem[i]->nf[j]->id, nf_group->umem[i]->nf[j]->ip,
-				 nf_group->umem[i]->nf[j]->port);
+	return errors;
+}
 
-			char nf_id[5];
-			sprintf(nf_id, "%d", nf_group->umem[i]->nf[j]->id);
+static int check_config(const cJSON *root)
+{
+	static const struct cfg_field umem_field = { "umem", CFG_ARRAY, true, 1, INT_MAX };
+	const cJSON *umem_array = cJSON_GetObjectItemCaseSensitive(root, "umem");
+	const cJSON *route = cJSON_GetObjectItemCaseSensitive(root, "route");
+	const cJSON *umem_obj, *nf_obj, *thread_obj, *entry, *item;
+	const cJSON *resolved[FLASH_MAX_NF] = { NULL };
+	bool defined[FLASH_MAX_NF] = { false };
+	int errors, obj_errors, i, j, k, id;
+	char path[64];
+
+	if (!umem_array) {
+		log_error("config: missing 'umem'");
+		return 1;
+	}
+	errors = check_field(umem_array, &umem_field, "config");
+	/* optional when every UMEM has its own */
+	if (route && !cJSON_IsObject(route)) {
+		log_error("config: 'route' must be an object");
+		errors++;
+	}
+	if (errors)
+		return errors;
+
+	i = 0;
+	cJSON_ArrayForEach(umem_obj, umem_array)
+	{
+		bool seen[FLASH_MAX_NF] = { false };
+
+		snprintf(path, sizeof(path), "umem[%d]", i);
+		errors += check_umem(umem_obj, umem_array, path);
+		if (!cJSON_IsArray(cJSON_GetObjectItemCaseSensitive(umem_obj, "nf"))) {
+			i++;
+			continue;
+		}
 
-			cJSON *route_item = cJSON_GetObjectItem(route, nf_id);
+		j = 0;
+		cJSON_ArrayForEach(nf_obj, cJSON_GetObjectItemCaseSensitive(umem_obj, "nf"))
+		{
+			/* templates are expanded by now, so the NF ID finds it in the config */
+			item = cJSON_GetObjectItemCaseSensitive(nf_obj, "nf_id");
+			if (cJSON_IsNumber(item))
+				snprintf(path, sizeof(path), "umem[%d].nf[nf_id=%d]", i, item->valueint);
+			else
+				snprintf(path, sizeof(path), "umem[%d].nf[%d]", i, j);
+			j++;
+			obj_errors = check_object(nf_obj, nf_schema, path, true);
+			if (obj_errors) {
+				errors += obj_errors;
+				continue;
+			}
 
-			if (!cJSON_IsArray(route_item)) {
-				log_error("Invalid or missing 'route_item' array");
-				cJSON_Delete(root);
-				return NULL;
+			id = get_int(nf_obj, "nf_id");
+			if (seen[id]) {
+				log_error("%s: nf_id %d is used twice in this UMEM", path, id);
+				errors++;
 			}
+			seen[id] = true;
+			defined[id] = true;
 
-			int edges = cJSON_GetArraySize(route_item);
-			int *next = (int *)calloc(edges, sizeof(int) * edges);
+			k = 0;
+			cJSON_ArrayForEach(thread_obj, cJSON_GetObjectItemCaseSensitive(nf_obj, "thread"))
+			{
+				char thread_path[96];
 
-			for (int l = 0; l < edges; l++) {
-				cJSON *item = cJSON_GetArrayItem(route_item, l);
-				if (item == NULL || !cJSON_IsNumber(item)) {
-					log_error("Invalid array item at index %d", l);
-					free(next);
-					cJSON_Delete(root);
-					return NULL;
-				}
-				next[l] = cJSON_GetNumberValue(item);
-				log_info("%d -> %d", nf_group->umem[i]->nf[j]->id, next[l]);
-
-				int u = nf_group->umem[i]->nf[j]->id;
-				int v = next[l];
-				if (prev[v] == NULL) {
-					prev[v] = (int *)calloc(FLASH_MAX_XSK, sizeof(int));
-					prev_size[v] = 0;
-				}
-				prev[v][prev_size[v]++] = u;
+				snprintf(thread_path, sizeof(thread_path), "%s.thread[%d]", path, k++);
+				errors += check_object(thread_obj, thread_schema, thread_path, true);
 			}
 
-			cJSON *thread_array = cJSON_GetObjectItem(nf_obj, "thread");
-			if (!cJSON_IsArray(thread_array)) {
-				log_error("Invalid or missing 'thread' array");
-				cJSON_Delete(root);
-				return NULL;
+			item = cJSON_GetObjectItemCaseSensitive(nf_obj, "min_threads");
+			if (item && item->valueint > k) {
+				log_error("%s: 'min_threads' is more than its %d threads", path, k);
+				errors++;
 			}
-			nf_group->umem[i]->nf[j]->thread_count = cJSON_GetArraySize(thread_array);
-			nf_group->umem[i]->nf[j]->current_thread_count = 0;
-			nf_group->umem[i]->nf[j]->thread =
-				(struct thread **)calloc(nf_group->umem[i]->nf[j]->thread_count, sizeof(struct thread *));
-
-			// Iterate over each "thread" entry
-			for (int k = 0; k < nf_group->umem[i]->nf[j]->thread_count; k++) {
-				cJSON *thread_obj = cJSON_GetArrayItem(thread_array, k);
-				nf_group->umem[i]->nf[j]->thread[k] = (struct thread *)calloc(1, sizeof(struct thread));
-				nf_group->umem[i]->nf[j]->thread[k]->id = cJSON_GetObjectItem(thread_obj, "thread_id")->valueint;
-				cJSON *queue_obj = cJSON_GetObjectItem(thread_obj, "queue");
-				if (!cJSON_IsNumber(queue_obj)) {
-					log_error("Invalid or missing 'queue'");
-					cJSON_Delete(root);
-					return NULL;
+		}
+		i++;
+	}
+	if (errors)
+		return errors;
+
+	errors = check_route(route, NULL, defined, "route");
+	i = 0;
+	cJSON_ArrayForEach(umem_obj, umem_array)
+	{
+		snprintf(path, sizeof(path), "umem[%d].route", i++);
+		errors += check_route(cJSON_GetObjectItemCaseSensitive(umem_obj, "route"), umem_obj, defined, path);
+	}
+	if (errors)
+		return errors;
+
+	/*
+	 * The routes every NF ends up with. Frames stay in the UMEM they were
+	 * received in, and the kernel keeps one route per NF ID, so an NF in
+	 * several UMEMs has the same route in each.
+	 */
+	i = 0;
+	cJSON_ArrayForEach(umem_obj, umem_array)
+	{
+		int in_degree[FLASH_MAX_NF] = { 0 };
+
+		cJSON_ArrayForEach(nf_obj, cJSON_GetObjectItemCaseSensitive(umem_obj, "nf"))
+		{
+			id = get_int(nf_obj, "nf_id");
+			snprintf(path, sizeof(path), "umem[%d].nf[nf_id=%d]", i, id);
+			entry = route_entry(umem_obj, route, id);
+			if (!entry) {
+				log_error("%s: missing route entry, use [] for none", path);
+				errors++;
+				continue;
+			}
+			if (!resolved[id]) {
+				resolved[id] = entry;
+			} else if (!same_route(resolved[id], entry)) {
+				log_error("%s: route differs from NF %d in another UMEM", path, id);
+				errors++;
+			}
+
+			cJSON_ArrayForEach(item, entry)
+			{
+				if (defined[item->valueint] && !umem_has_nf(umem_obj, item->valueint)) {
+					log_error("%s: next NF %d is in another UMEM", path, item->valueint);
+					errors++;
+				}
+				if (++in_degree[item->valueint] == FLASH_MAX_NF + 1) {
+					log_error("umem[%d]: NF %d has more than %d previous NFs", i, item->valueint, FLASH_MAX_NF);
+					errors++;
 				}
-				nf_group->umem[i]->nf[j]->thread[k]->ifqueue = (uint8_t)cJSON_GetNumberValue(queue_obj);
-				log_info("thread_id: %d, queue: %d", nf_group->umem[i]->nf[j]->thread[k]->id,
-					 nf_group->umem[i]->nf[j]->thread[k]->ifqueue);
-				nf_group->umem[i]->nf[j]->thread[k]->socket = NULL;
-				nf_group->umem[i]->nf[j]->thread[k]->xsk = NULL;
-				nf_group->umem[i]->nf[j]->thread[k]->umem_offset = total_threads;
-				total_threads++;
 			}
-			nf_group->umem[i]->nf[j]->next = next;
-			nf_group->umem[i]->nf[j]->next_size = edges;
 		}
-		nf_group->umem[i]->cfg->total_sockets = total_threads;
+		i++;
+	}
+
+	return errors;
+}
+
+/* Build the NFGroup of a config that check_config() accepted. */
+static struct NFGroup *build_nf_group(const cJSON *root)
+{
+	const cJSON *umem_array = cJSON_GetObjectItemCaseSensitive(root, "umem");
+	const cJSON *route = cJSON_GetObjectItemCaseSensitive(root, "route");
+	struct NFGroup *nf_group;
 
-		if (i == nf_group->umem_count - 1) {
-			strncpy(ifname, _ifname, IF_NAMESIZE - 1);
-			mode = nf_group->umem[i]->cfg->xsk->mode;
+	nf_group = calloc(1, sizeof(struct NFGroup));
+	if (!nf_group)
+		return NULL;
+	nf_group->umem = calloc(cJSON_GetArraySize(umem_array), sizeof(struct umem *));
+	if (!nf_group->umem)
+		goto out_free;
+
+	for (int i = 0; i < cJSON_GetArraySize(umem_array); i++) {
+		const cJSON *umem_obj = cJSON_GetArrayItem(umem_array, i);
+		const cJSON *nf_array = cJSON_GetObjectItemCaseSensitive(umem_obj, "nf");
+		const cJSON *item;
+		struct umem *umem;
+		int total_threads = 0;
+
+		umem = calloc(1, sizeof(struct umem));
+		if (!umem)
+			goto out_free;
+		umem->cfg = calloc(1, sizeof(struct config));
+		if (!umem->cfg) {
+			free(umem);
+			goto out_free;
 		}
+		nf_group->umem[nf_group->umem_count++] = umem;
+		umem->cfg->umem = calloc(1, sizeof(struct umem_config));
+		umem->cfg->xsk = calloc(1, sizeof(struct xsk_config));
+		umem->nf = calloc(cJSON_GetArraySize(nf_array), sizeof(struct nf *));
+		if (!umem->cfg->umem || !umem->cfg->xsk || !umem->nf)
+			goto out_free;
+
+		umem->id = get_int(umem_obj, "umem_id");
+		strncpy(umem->cfg->ifname, cJSON_GetObjectItemCaseSensitive(umem_obj, "ifname")->valuestring,
+			IF_NAMESIZE - 1);
+		umem->cfg->umem_id = umem->id;
+		umem->cfg->nf_id = -1;
+
+		item = cJSON_GetObjectItemCaseSensitive(umem_obj, "umem_scale");
+		umem->cfg->umem_scale = item ? item->valueint : 1;
+
+		/* keep sockets bound across NF restarts unless told otherwise */
+		item = cJSON_GetObjectItemCaseSensitive(umem_obj, "warm_pool");
+		umem->warm_pool = !item || cJSON_IsTrue(item);
+
+		get_flags(cJSON_GetObjectItemCaseSensitive(umem_obj, "xdp_flags")->valuestring, &umem->cfg->xsk->xdp_flags);
+		get_flags(cJSON_GetObjectItemCaseSensitive(umem_obj, "bind_flags")->valuestring,
+			  &umem->cfg->xsk->bind_flags);
+		item = cJSON_GetObjectItemCaseSensitive(umem_obj, "mode");
+		if (item->valuestring[0] == '\0')
+			umem->cfg->xsk->bind_flags |= XDP_USE_NEED_WAKEUP;
+		else
+			get_flags(item->valuestring, &umem->cfg->xsk->mode);
+		if (umem->cfg->xsk->mode == FLASH__POLL)
+			umem->cfg->xsk->poll_timeout = get_int(umem_obj, "poll_timeout");
+
+		umem->cfg->custom_xsk = cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(umem_obj, "custom_xsk"));
+		if (umem->cfg->custom_xsk)
+			log_warn("PLEASE MAKE SURE YOU LOADED CUSTOM XDP PROGRAM!");
+		umem->cfg->frags_enabled = cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(umem_obj, "frags_enabled"));
+
+		log_debug("umem %d: ifname %s, xdp_flags 0x%x, bind_flags 0x%x, mode 0x%x", umem->id, umem->cfg->ifname,
+			  umem->cfg->xsk->xdp_flags, umem->cfg->xsk->bind_flags, umem->cfg->xsk->mode);
+
+		for (int j = 0; j < cJSON_GetArraySize(nf_array); j++) {
+			const cJSON *nf_obj = cJSON_GetArrayItem(nf_array, j);
+			const cJSON *thread_array = cJSON_GetObjectItemCaseSensitive(nf_obj, "thread");
+			const cJSON *route_item;
+			struct nf *nf;
+
+			nf = calloc(1, sizeof(struct nf));
+			if (!nf)
+				goto out_free;
+			umem->nf[umem->nf_count++] = nf;
+
+			nf->id = get_int(nf_obj, "nf_id");
+			nf->is_up = false;
+			strncpy(nf->ip, cJSON_GetObjectItemCaseSensitive(nf_obj, "nf_ip")->valuestring, INET_ADDRSTRLEN - 1);
+			nf->port = (uint16_t)get_int(nf_obj, "nf_port");
+
+			route_item = route_entry(umem_obj, route, nf->id);
+			nf->next = calloc(cJSON_GetArraySize(route_item) ?: 1, sizeof(int));
+			nf->thread = calloc(cJSON_GetArraySize(thread_array), sizeof(struct thread *));
+			if (!nf->next || !nf->thread)
+				goto out_free;
+			for (int l = 0; l < cJSON_GetArraySize(route_item); l++)
+				nf->next[nf->next_size++] = cJSON_GetArrayItem(route_item, l)->valueint;
+
+			for (int k = 0; k < cJSON_GetArraySize(thread_array); k++) {
+				const cJSON *thread_obj = cJSON_GetArrayItem(thread_array, k);
+				struct thread *thread = calloc(1, sizeof(struct thread));
+
+				if (!thread)
+					goto out_free;
+				nf->thread[nf->thread_count++] = thread;
+				thread->id = get_int(thread_obj, "thread_id");
+				thread->ifqueue = (uint8_t)get_int(thread_obj, "queue");
+				thread->umem_offset = total_threads++;
+			}
+
+			/* optional, the autoscaler runs the NF on min_threads up to all its threads */
+			item = cJSON_GetObjectItemCaseSensitive(nf_obj, "min_threads");
+			nf->min_threads = item ? item->valueint : nf->thread_count;
+			nf->active_threads = nf->thread_count;
 
-		num_queues += total_threads;
+			log_debug("umem %d: nf %d at %s:%d, %d threads, %d next", umem->id, nf->id, nf->ip, nf->port,
+				  nf->thread_count, nf->next_size);
+		}
+		umem->cfg->total_sockets = total_threads;
 	}
 
+	if (link_routes(nf_group))
+		goto out_free;
+
+	return nf_group;
+
+out_free:
+	free_nf_group(nf_group);
+	return NULL;
+}
+
+/**
+ * Fill the prev list of every NF from the next lists of the NFs in its UMEM,
+ * the only ones it can receive frames from. Each entry of an NF owns its
+ * list, which holds exactly its previous NFs.
+ *
+ * @param nf_group NF group with next lists set and no prev lists.
+ * @return 0 on success, -1 if out of memory.
+ */
+int link_routes(struct NFGroup *nf_group)
+{
 	for (int i = 0; i < nf_group->umem_count; i++) {
-		for (int j = 0; j < nf_group->umem[i]->nf_count; j++) {
-			nf_group->umem[i]->nf[j]->prev = prev[nf_group->umem[i]->nf[j]->id];
-			nf_group->umem[i]->nf[j]->prev_size = prev_size[nf_group->umem[i]->nf[j]->id];
+		struct umem *umem = nf_group->umem[i];
+		struct nf *by_id[FLASH_MAX_NF] = { NULL };
+		int prev_size[FLASH_MAX_NF] = { 0 };
+
+		/* count first, so every list is allocated once at its size */
+		for (int j = 0; j < umem->nf_count; j++) {
+			struct nf *nf = umem->nf[j];
+
+			by_id[nf->id] = nf;
+			for (int l = 0; l < nf->next_size; l++)
+				prev_size[nf->next[l]]++;
+		}
+
+		for (int j = 0; j < umem->nf_count; j++) {
+			struct nf *nf = umem->nf[j];
+
+			nf->prev = calloc(prev_size[nf->id] ?: 1, sizeof(int));
+			if (!nf->prev)
+				return -1;
+			nf->prev_size = 0;
+		}
+
+		for (int j = 0; j < umem->nf_count; j++) {
+			struct nf *nf = umem->nf[j];
+
+			for (int l = 0; l < nf->next_size; l++) {
+				struct nf *dst = by_id[nf->next[l]];
+
+				if (dst)
+					dst->prev[dst->prev_size++] = nf->id;
+			}
 		}
 	}
 
-	configure_nic(ifname, num_queues, mode);
+	return 0;
+}
+
+static char *read_file(const char *filename, size_t *len)
+{
+	FILE *file = fopen(filename, "r");
+	char *data = NULL;
+	long length;
+
+	if (file == NULL) {
+		log_error("Unable to open %s: %s", filename, strerror(errno));
+		return NULL;
+	}
+
+	if (fseek(file, 0, SEEK_END) || (length = ftell(file)) < 0 || fseek(file, 0, SEEK_SET)) {
+		log_error("Unable to size %s: %s", filename, strerror(errno));
+		goto out;
+	}
+
+	data = malloc(length + 1);
+	if (!data) {
+		log_error("Unable to read %s: out of memory", filename);
+		goto out;
+	}
+	if (fread(data, 1, length, file) != (size_t)length) {
+		log_error("Error in reading %s", filename);
+		free(data);
+		data = NULL;
+		goto out;
+	}
+	data[length] = '\0';
+	*len = length;
+
+out:
+	fclose(file);
+	return data;
+}
+
+/**
+ * Load a config, from its compiled topology when that was built from the
+ * same config, else by parsing, expanding and checking the JSON. A freshly
+ * parsed config is compiled for the next load.
+ *
+ * @param filename Path of the JSON config.
+ * @return the NF group, or NULL if the config is invalid.
+ */
+struct NFGroup *load_config(const char *filename)
+{
+	char cache[PATH_MAX], *json_data;
+	struct NFGroup *nf_group;
+	uint64_t hash;
+	size_t length;
+	cJSON *root;
+
+	json_data = read_file(filename, &length);
+	if (!json_data)
+		return NULL;
+
+	hash = topology_hash(json_data, length);
+	if (snprintf(cache, sizeof(cache), "%s.topo", filename) >= (int)sizeof(cache))
+		cache[0] = '\0';
+
+	nf_group = cache[0] ? topology_load(cache, hash) : NULL;
+	if (nf_group) {
+		log_debug("Loaded %s from %s", filename, cache);
+		free(json_data);
+		return nf_group;
+	}
+
+	root = cJSON_Parse(json_data);
+	if (!root) {
+		const char *err = cJSON_GetErrorPtr();
+		int line = 1;
+
+		for (const char *c = json_data; err && c < err && *c; c++)
+			line += *c == '\n';
+		log_error("%s: not valid JSON near line %d", filename, line);
+		free(json_data);
+		return NULL;
+	}
+	free(json_data);
+
+	/* a template that does not expand is left out, so check_config() reports the rest */
+	if (expand_templates(root) + check_config(root)) {
+		log_error("%s: invalid config", filename);
+		cJSON_Delete(root);
+		return NULL;
+	}
+
+	nf_group = build_nf_group(root);
 	cJSON_Delete(root);
+	if (!nf_group) {
+		log_error("%s: out of memory", filename);
+		return NULL;
+	}
+
+	if (cache[0] && topology_save(cache, hash, nf_group))
+		log_warn("Could not write compiled topology %s, the next load parses %s again", cache, filename);
+
+	return nf_group;
+}
+
+/**
+ * Load a config with load_config() and set up the queues of every interface
+ * its UMEMs are on.
+ *
+ * @param filename Path of the JSON config.
+ * @return the NF group, or NULL if the config is invalid.
+ */
+struct NFGroup *parse_json(const char *filename)
+{
+	struct NFGroup *nf_group = load_config(filename);
+	int num_queues = 0, nfs = 0;
+
+	if (!nf_group)
+		return NULL;
+
+	for (int i = 0; i < nf_group->umem_count; i++) {
+		num_queues += nf_group->umem[i]->cfg->total_sockets;
+		nfs += nf_group->umem[i]->nf_count;
+	}
+	log_info("%s: %d UMEMs, %d NFs, %d sockets", filename, nf_group->umem_count, nfs, num_queues);
+
+	/* one setup per interface, for the sockets of all the UMEMs on it */
+	for (int i = 0; i < nf_group->umem_count; i++) {
+		struct config *cfg = nf_group->umem[i]->cfg;
+		bool done = false;
+
+		num_queues = 0;
+		for (int j = 0; j < nf_group->umem_count; j++) {
+			if (strcmp(nf_group->umem[j]->cfg->ifname, cfg->ifname))
+				continue;
+			if (j < i)
+				done = true;
+			num_queues += nf_group->umem[j]->cfg->total_sockets;
+		}
+		if (!done)
+			configure_nic(cfg->ifname, num_queues, cfg->xsk->mode);
+	}
 
 	return nf_group;
 }
@@ -373,6 +991,12 @@ void free_nf_group(struct NFGroup *nf_group)
 					}
 					free(nf_group->umem[i]->nf[j]->thread);
 					free(nf_group->umem[i]->nf[j]->next);
+					free(nf_group->umem[i]->nf[j]->prev);
+					if (nf_group->umem[i]->nf[j]->autoscale) {
+						free(nf_group->umem[i]->nf[j]->autoscale->rx_prod);
+						free(nf_group->umem[i]->nf[j]->autoscale->stats);
+						free(nf_group->umem[i]->nf[j]->autoscale);
+					}
 					free(nf_group->umem[i]->nf[j]);
 				}
 			}
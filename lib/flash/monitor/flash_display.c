@@ -18,6 +18,12 @@
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
+#define TOP_REFRESH_MS 1000
+/* an NF that has not published for this long has no stats thread running */
+#define TOP_STALE_NS (5 * 1000000000UL)
+/* edges listed under an NF, the rest share one line */
+#define TOP_MAX_EDGES 16
+
 WINDOW *output_pad, *input_win;
 int rows, cols;
 int pad_top = 0;
@@ -31,7 +37,7 @@ static char input_history[HISTORY_SIZE][100];
 static int history_count = 0;
 static int history_index = -1;
 
-static const char *commands[] = { "logs", "clear", "load", "unload", "exit" };
+static const char *commands[] = { "logs", "clear", "load", "unload", "route", "telemetry", "top", "exit" };
 static const int num_commands = sizeof(commands) / sizeof(commands[0]);
 
 static const int ansi_to_ncurses[] = {
@@ -315,6 +321,273 @@ static void clear_screen(void)
 	prefresh(output_pad, pad_top, 0, 0, 0, visible_rows - 1, cols - 1);
 }
 
+/* A socket as the top view last saw it, with rates over the NF's last publish interval. */
+struct top_socket {
+	struct telemetry_snap snap;
+	double rx_pps;
+	double tx_pps;
+	double drop_pps;
+	double bp_ps;
+	double edge_pps[TOP_MAX_EDGES];
+	double other_pps; /* edges past TOP_MAX_EDGES and those added after the NF started */
+	uint64_t hist[FLASH_TELEMETRY_HIST_BUCKETS];
+};
+
+struct top_state {
+	struct telemetry_snap *snap;
+	uint64_t *edges; /* edge counters of the snaps in old */
+	struct top_socket *sock;
+	struct top_socket *old;
+	int n;
+	int old_n;
+	int cap;
+};
+
+static int top_cmp(const void *a, const void *b)
+{
+	const struct telemetry_snap *x = a, *y = b;
+
+	if (x->umem_id != y->umem_id)
+		return x->umem_id - y->umem_id;
+	if (x->nf_id != y->nf_id)
+		return x->nf_id - y->nf_id;
+	if (x->pid != y->pid)
+		return x->pid - y->pid;
+	return x->index - y->index;
+}
+
+static bool top_same_nf(const struct telemetry_snap *x, const struct telemetry_snap *y)
+{
+	return x->umem_id == y->umem_id && x->nf_id == y->nf_id && x->pid == y->pid;
+}
+
+static void top_rates(struct top_socket *t, const struct top_socket *old)
+{
+	const struct flash_telemetry_socket *a = &old->snap.socket, *b = &t->snap.socket;
+	double dt = (double)(t->snap.published_ns - old->snap.published_ns) / 1E9;
+	uint32_t nr_edges = MIN(t->snap.nr_edges, old->snap.nr_edges);
+	struct telemetry_snap snap;
+
+	/* not published again yet, keep showing the last interval */
+	if (t->snap.published_ns <= old->snap.published_ns) {
+		snap = t->snap;
+		*t = *old;
+		t->snap = snap;
+		return;
+	}
+
+	t->rx_pps = (b->rx_npkts - a->rx_npkts) / dt;
+	t->tx_pps = (b->tx_npkts - a->tx_npkts) / dt;
+	t->drop_pps = ((b->drop_npkts - a->drop_npkts) + (b->rx_dropped - a->rx_dropped) +
+		       (b->rx_ring_full - a->rx_ring_full) + (b->rx_fill_ring_empty_descs - a->rx_fill_ring_empty_descs)) /
+		      dt;
+	t->bp_ps = (b->backpressure - a->backpressure) / dt;
+	for (uint32_t e = 0; e < nr_edges; e++) {
+		double pps = (t->snap.edge_tx[e] - old->snap.edge_tx[e]) / dt;
+
+		if (e < TOP_MAX_EDGES)
+			t->edge_pps[e] = pps;
+		else
+			t->other_pps += pps;
+	}
+	t->other_pps += (b->edge_tx_other - a->edge_tx_other) / dt;
+	for (int i = 0; i < FLASH_TELEMETRY_HIST_BUCKETS; i++)
+		t->hist[i] = b->batch_cycles[i] - a->batch_cycles[i];
+}
+
+static int top_update(struct top_state *st)
+{
+	int max = telemetry_count();
+	struct top_socket *tmp;
+	uint64_t *edges;
+
+	if (max > st->cap) {
+		struct telemetry_snap *snap = realloc(st->snap, max * sizeof(*snap));
+		struct top_socket *sock = realloc(st->sock, max * sizeof(*sock));
+		struct top_socket *old = realloc(st->old, max * sizeof(*old));
+
+		if (snap)
+			st->snap = snap;
+		if (sock)
+			st->sock = sock;
+		if (old)
+			st->old = old;
+		if (!snap || !sock || !old)
+			return -1;
+		st->cap = max;
+	}
+
+	st->n = telemetry_snapshot(st->snap, st->cap, &edges);
+	if (st->n < 0) {
+		st->n = 0;
+		return -1;
+	}
+	qsort(st->snap, st->n, sizeof(struct telemetry_snap), top_cmp);
+
+	/* both sorted, so the previous sample of a socket is found in one pass */
+	for (int i = 0, j = 0; i < st->n; i++) {
+		struct top_socket *t = &st->sock[i];
+
+		memset(t, 0, sizeof(*t));
+		t->snap = st->snap[i];
+		while (j < st->old_n && top_cmp(&st->old[j].snap, &t->snap) < 0)
+			j++;
+		if (j < st->old_n && top_cmp(&st->old[j].snap, &t->snap) == 0)
+			top_rates(t, &st->old[j]);
+	}
+
+	tmp = st->old;
+	st->old = st->sock;
+	st->sock = tmp;
+	st->old_n = st->n;
+	free(st->edges);
+	st->edges = edges;
+	return 0;
+}
+
+static void top_fmt_rate(char *buf, size_t len, double v)
+{
+	if (v >= 1E9)
+		snprintf(buf, len, "%.2fG", v / 1E9);
+	else if (v >= 1E6)
+		snprintf(buf, len, "%.2fM", v / 1E6);
+	else if (v >= 1E3)
+		snprintf(buf, len, "%.1fK", v / 1E3);
+	else
+		snprintf(buf, len, "%.0f", v);
+}
+
+/* Upper bound of the histogram bucket holding the 99th percentile. */
+static void top_fmt_p99(char *buf, size_t len, const uint64_t *hist, uint64_t hz)
+{
+	uint64_t total = 0, seen = 0;
+
+	for (int i = 0; i < FLASH_TELEMETRY_HIST_BUCKETS; i++)
+		total += hist[i];
+	snprintf(buf, len, "-");
+	if (!total || !hz)
+		return;
+
+	for (int i = 0; i < FLASH_TELEMETRY_HIST_BUCKETS; i++) {
+		seen += hist[i];
+		if (seen * 100 >= total * 99) {
+			double us = (double)(2UL << i) * 1E6 / hz;
+			snprintf(buf, len, us >= 1000 ? "%.1fms" : "%.1fus", us >= 1000 ? us / 1000 : us);
+			return;
+		}
+	}
+}
+
+static unsigned int top_pct(uint32_t used, uint32_t size)
+{
+	return size ? (unsigned int)((uint64_t)MIN(used, size) * 100 / size) : 0;
+}
+
+/* Every NF on one line, its edges below it, in UMEM and NF ID order. */
+static void top_draw(const struct top_state *st)
+{
+	char rx[16], tx[16], drop[16], bp[16], p99[16], pps[16];
+	int row = 0, nfs = 0;
+
+	for (int i = 0; i < st->n; i++)
+		nfs += i == 0 || !top_same_nf(&st->old[i].snap, &st->old[i - 1].snap);
+
+	werase(output_pad);
+	mvwprintw(output_pad, row++, 0, "%d NFs, %d sockets, every %d ms. q to return", nfs, st->n, TOP_REFRESH_MS);
+	row++;
+	wattron(output_pad, A_BOLD);
+	mvwprintw(output_pad, row++, 0, "%-4s %-4s %-7s %5s %8s %8s %8s %8s %4s %4s %7s", "UMEM", "NF", "PID", "SOCKS",
+		  "RX/s", "TX/s", "DROP/s", "BP/s", "RXQ%", "TXQ%", "P99");
+	wattroff(output_pad, A_BOLD);
+
+	for (int i = 0, j; i < st->n; i = j) {
+		const struct telemetry_snap *s = &st->old[i].snap;
+		double rx_pps = 0, tx_pps = 0, drop_pps = 0, bp_ps = 0, other_pps = 0, edge_pps[TOP_MAX_EDGES] = { 0 };
+		uint64_t hist[FLASH_TELEMETRY_HIST_BUCKETS] = { 0 };
+		unsigned int rx_pct = 0, tx_pct = 0;
+
+		for (j = i; j < st->n && top_same_nf(&st->old[j].snap, s); j++) {
+			const struct top_socket *t = &st->old[j];
+
+			rx_pps += t->rx_pps;
+			tx_pps += t->tx_pps;
+			drop_pps += t->drop_pps;
+			bp_ps += t->bp_ps;
+			rx_pct = MAX(rx_pct, top_pct(t->snap.socket.rx_ring_used, t->snap.socket.rx_ring_size));
+			tx_pct = MAX(tx_pct, top_pct(t->snap.socket.tx_ring_used, t->snap.socket.tx_ring_size));
+			for (int e = 0; e < TOP_MAX_EDGES; e++)
+				edge_pps[e] += t->edge_pps[e];
+			other_pps += t->other_pps;
+			for (int b = 0; b < FLASH_TELEMETRY_HIST_BUCKETS; b++)
+				hist[b] += t->hist[b];
+		}
+
+		top_fmt_rate(rx, sizeof(rx), rx_pps);
+		top_fmt_rate(tx, sizeof(tx), tx_pps);
+		top_fmt_rate(drop, sizeof(drop), drop_pps);
+		top_fmt_rate(bp, sizeof(bp), bp_ps);
+		top_fmt_p99(p99, sizeof(p99), hist, s->timer_hz);
+
+		if (drop_pps > 0)
+			wattron(output_pad, COLOR_PAIR(2));
+		mvwprintw(output_pad, row++, 0, "%-4d %-4d %-7d %5d %8s %8s %8s %8s %4u %4u %7s%s", s->umem_id, s->nf_id,
+			  s->pid, j - i, rx, tx, drop, bp, rx_pct, tx_pct, p99, s->age_ns > TOP_STALE_NS ? " stale" : "");
+		if (drop_pps > 0)
+			wattroff(output_pad, COLOR_PAIR(2));
+
+		for (int e = 0; e < TOP_MAX_EDGES; e++) {
+			int to = nf_next_id(s->umem_id, s->nf_id, e);
+
+			if (to < 0 && edge_pps[e] == 0)
+				continue;
+			top_fmt_rate(pps, sizeof(pps), edge_pps[e]);
+			if (to < 0)
+				mvwprintw(output_pad, row++, 0, "     `-> edge %-8d %8s", e, pps);
+			else
+				mvwprintw(output_pad, row++, 0, "     `-> NF %-10d %8s", to, pps);
+		}
+		if (other_pps > 0 || nf_next_id(s->umem_id, s->nf_id, TOP_MAX_EDGES) >= 0) {
+			top_fmt_rate(pps, sizeof(pps), other_pps);
+			mvwprintw(output_pad, row++, 0, "     `-> %-13s %8s", "other edges", pps);
+		}
+	}
+
+	if (!st->n)
+		mvwprintw(output_pad, row++, 0, "No NF has published telemetry yet");
+
+	prefresh(output_pad, 0, 0, 0, 0, visible_rows - 1, cols - 1);
+}
+
+/* Live view of every NF's telemetry until q is pressed. */
+static void run_top(void)
+{
+	struct top_state st = { 0 };
+	int ch;
+
+	werase(input_win);
+	mvwprintw(input_win, 0, 0, "top: q to return");
+	wrefresh(input_win);
+	curs_set(0);
+	wtimeout(input_win, TOP_REFRESH_MS);
+
+	do {
+		if (top_update(&st) < 0) {
+			update_screen("top: out of memory");
+			break;
+		}
+		top_draw(&st);
+		ch = wgetch(input_win);
+	} while (ch != 'q' && ch != 'Q' && ch != 27);
+
+	wtimeout(input_win, -1);
+	curs_set(1);
+	free(st.snap);
+	free(st.sock);
+	free(st.old);
+	free(st.edges);
+	clear_screen();
+}
+
 static void add_to_history(const char *input)
 {
 	if (history_count < HISTORY_SIZE) {
@@ -395,6 +668,10 @@ static void run_prompt(void)
 				} else if (strcmp(input, "clear") == 0) {
 					clear_screen();
 					break;
+				} else if (strcmp(input, "top") == 0) {
+					add_to_history(input);
+					run_top();
+					break;
 				} else {
 					input[len] = '\0';
 					add_to_history(input);
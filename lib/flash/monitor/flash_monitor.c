@@ -3,7 +3,10 @@
  */
 
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <linux/memfd.h>
+#include <limits.h>
 #include <sys/resource.h>
 #include <sched.h>
 #include <stdlib.h>
@@ -15,37 +18,163 @@
 
 #include "flash_monitor.h"
 
+/* how long a parked socket may take to finish its pending transmits */
+#define DRAIN_TX_WAIT_MS 100
+
 static struct NFGroup *nfg;
 int unix_socket_server;
+/* wakes the control plane to push route changes to the NFs */
+int route_event_fd = -1;
+/* next/prev lists change on the prompt thread, the control plane reads them */
+pthread_mutex_t route_lock = PTHREAD_MUTEX_INITIALIZER;
 
-void close_nf(struct umem *umem, int umem_id, int nf_id)
+/**
+ * Look up a UMEM of the loaded config by its umem_id.
+ *
+ * @param umem_id UMEM ID from the config.
+ * @return the UMEM, or NULL if the loaded config has none with that ID.
+ */
+struct umem *find_umem(int umem_id)
 {
+	if (nfg == NULL)
+		return NULL;
+
+	for (int u = 0; u < nfg->umem_count; u++) {
+		if (nfg->umem[u]->id == umem_id)
+			return nfg->umem[u];
+	}
+	return NULL;
+}
+
+/**
+ * Look up an NF by its nf_id. NF IDs need not follow the order of the NFs in
+ * their UMEM, and an NF in several UMEMs has an entry in each.
+ *
+ * @param umem UMEM to look in, or NULL for the first entry in any UMEM.
+ * @param nf_id NF ID from the config.
+ * @return the NF, or NULL if there is none.
+ */
+struct nf *find_nf(struct umem *umem, int nf_id)
+{
+	if (umem == NULL) {
+		for (int u = 0; nfg && u < nfg->umem_count; u++) {
+			struct nf *nf = find_nf(nfg->umem[u], nf_id);
+
+			if (nf)
+				return nf;
+		}
+		return NULL;
+	}
+
+	for (int n = 0; n < umem->nf_count; n++) {
+		if (umem->nf[n]->id == nf_id)
+			return umem->nf[n];
+	}
+	return NULL;
+}
+
+/*
+ * Sockets of a warm pool UMEM outlive their NF: close_nf() hands them back
+ * drained, and the next instance of the same NF gets the same sockets,
+ * bound to the same queues, without a socket() or bind(). The ring indices
+ * carry over, so the NF picks up where its previous instance stopped.
+ */
+static void drain_tx(struct socket *socket)
+{
+	int waited = 0;
+
+	while (socket->tx.ring && __atomic_load_n(socket->tx.consumer, __ATOMIC_ACQUIRE) != *socket->tx.producer) {
+		if (waited++ == DRAIN_TX_WAIT_MS) {
+			log_warn("Socket %d still has %u frames to transmit", socket->fd,
+				 *socket->tx.producer - *socket->tx.consumer);
+			break;
+		}
+		sendto(socket->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+		usleep(1000);
+	}
+}
+
+static void drain_socket(struct umem *umem, struct socket *socket)
+{
+	struct xsk_ring_cons *comp = socket->comp.ring ? &socket->comp : &umem->umem_info->cq;
+
+	/* frames queued for transmit come back through the completion ring */
+	drain_tx(socket);
+
+	/* whatever sits in RX and completion belongs to the NF's frame range again */
+	if (socket->rx.ring)
+		__atomic_store_n(socket->rx.consumer, __atomic_load_n(socket->rx.producer, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+	if (comp->ring)
+		__atomic_store_n(comp->consumer, __atomic_load_n(comp->producer, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
+
+/*
+ * Hot upgrade: the old instance of an NF has stopped and its successor
+ * already has the sockets mapped. Nothing is drained from RX or completion,
+ * the successor reclaims those frames; only the transmits the old instance
+ * queued are flushed so they do not sit in the TX ring across the switch.
+ */
+void handover_nf(struct umem *umem, int nf_id)
+{
+	struct nf *nf = find_nf(umem, nf_id);
+
+	for (int i = 0; i < nf->thread_count; i++) {
+		if (nf->thread[i]->socket)
+			drain_tx(nf->thread[i]->socket);
+	}
+
+	/* the sockets and current_thread_count now belong to the successor */
+	if (umem->current_nf_count > 0)
+		umem->current_nf_count--;
+	log_info("NF %d of UMEM %d handed over", nf_id, umem->id);
+}
+
+static void delete_socket(struct umem *umem, struct thread *thread)
+{
+	struct socket *socket = thread->socket;
 	struct xdp_mmap_offsets off;
 	int err;
+
+	xsk_socket__delete(thread->xsk);
+	err = xsk_get_mmap_offsets(socket->fd, &off);
+	if (!err) {
+		munmap(socket->fill.ring - off.fr.desc, off.fr.desc + umem->cfg->umem_config->fill_size * sizeof(__u64));
+		munmap(socket->comp.ring - off.cr.desc, off.cr.desc + umem->cfg->umem_config->comp_size * sizeof(__u64));
+	}
+	free(socket);
+	thread->socket = NULL;
+	thread->xsk = NULL;
+	umem->cfg->current_socket_count--;
+}
+
+void close_nf(struct umem *umem, int umem_id, int nf_id)
+{
+	struct nf *nf = find_nf(umem, nf_id);
+
 	if (umem->current_nf_count == 0)
 		return;
-	for (int i = 0; i < umem->nf[nf_id]->thread_count; i++) {
-		if (umem->nf[nf_id]->current_thread_count == 0)
+	for (int i = 0; i < nf->thread_count; i++) {
+		if (nf->current_thread_count == 0)
 			continue;
-		struct socket *socket = umem->nf[nf_id]->thread[i]->socket;
-		if (socket == NULL)
+		struct thread *thread = nf->thread[i];
+		if (thread->socket == NULL)
 			continue;
-		xsk_socket__delete(umem->nf[nf_id]->thread[i]->xsk);
-		err = xsk_get_mmap_offsets(socket->fd, &off);
-		if (!err) {
-			munmap(socket->fill.ring - off.fr.desc, off.fr.desc + umem->cfg->umem_config->fill_size * sizeof(__u64));
-			munmap(socket->comp.ring - off.cr.desc, off.cr.desc + umem->cfg->umem_config->comp_size * sizeof(__u64));
-		}
-		free(socket);
+		if (umem->warm_pool)
+			drain_socket(umem, thread->socket);
+		else
+			delete_socket(umem, thread);
 	}
-	umem->cfg->current_socket_count -= umem->nf[nf_id]->thread_count;
 	if (umem->cfg->current_socket_count < 0)
 		umem->cfg->current_socket_count = 0;
-	umem->nf[nf_id]->current_thread_count = 0;
+	nf->current_thread_count = 0;
 	umem->current_nf_count--;
 	if (umem->current_nf_count < 0)
 		umem->current_nf_count = 0;
 
+	/* NFs still in bring-up may not have a socket pinning the UMEM yet */
+	if (umem->current_nf_count > 0)
+		return;
+
 	if (umem->umem_info && umem->umem_info->umem) {
 		if (xsk_umem__delete(umem->umem_info->umem) < 0) {
 			log_info("UMEM refcount is %d (> 0), not deleting UMEM", umem->umem_info->umem->refcount);
@@ -68,6 +197,7 @@ void close_nf(struct umem *umem, int umem_id, int nf_id)
 			free(umem->cfg->umem_config);
 			free(umem->cfg->xsk_config);
 			free(umem->umem_info);
+			umem->umem_info = NULL;
 		}
 	} else {
 		log_warn("UMEM for nf %d having umem_id %d does not exist", nf_id, umem_id);
@@ -103,35 +233,266 @@ static char *int_array_to_string(int *arr, int size)
 	return result;
 }
 
-static void write_to_kernel_flash(int *arr, int size, int num)
+/* The whole list goes out in one write, so the kernel swaps routes at once. */
+static int write_to_kernel_flash(int *arr, int size, int num)
 {
-	char *x = int_array_to_string(arr, size);
+	char *x = size ? int_array_to_string(arr, size) : strdup("-1");
 	char y_path[256];
+	int ret;
 	snprintf(y_path, sizeof(y_path), "/sys/kernel/flash/%d/next", num);
 
 	FILE *file = fopen(y_path, "w");
 	if (file == NULL) {
-		log_error("Error opening file");
+		log_error("Error opening file %s: %s", y_path, strerror(errno));
 		free(x);
-		exit(EXIT_FAILURE);
+		return -1;
 	}
 
 	fprintf(file, "%s\n", x);
-	log_info("Successfully wrote the %s to %s\n", x, y_path);
-	fclose(file);
+	ret = fclose(file);
+	if (ret)
+		log_error("Error writing %s to %s: %s", x, y_path, strerror(errno));
+	else
+		log_info("Successfully wrote the %s to %s\n", x, y_path);
 	free(x);
+	return ret ? -1 : 0;
 }
 
 static void load_route(int *next, int size, int nf_id)
 {
-	write_to_kernel_flash(next, size, nf_id);
+	if (write_to_kernel_flash(next, size, nf_id) < 0)
+		exit(EXIT_FAILURE);
+}
+
+static void load(struct umem *umem)
+{
+	for (int i = 0; i < umem->nf_count; i++)
+		load_route(umem->nf[i]->next, umem->nf[i]->next_size, umem->nf[i]->id);
 }
 
-static void load(int umem_id)
+/* "load route" loads the routes of every UMEM, "load route <umem_id>" of one. */
+static const char *load_command(char *args)
 {
-	for (int i = 0; i < nfg->umem[umem_id]->nf_count; i++) {
-		load_route(nfg->umem[umem_id]->nf[i]->next, nfg->umem[umem_id]->nf[i]->next_size, nfg->umem[umem_id]->nf[i]->id);
+	static char msg[64];
+	struct umem *umem;
+	int umem_id;
+
+	if (nfg == NULL)
+		return "First load config file";
+
+	if (*args == '\0') {
+		for (int u = 0; u < nfg->umem_count; u++)
+			load(nfg->umem[u]);
+		return "load route";
 	}
+
+	if (sscanf(args, "%d", &umem_id) != 1)
+		return "Usage: load route [umem_id]";
+	umem = find_umem(umem_id);
+	if (!umem) {
+		snprintf(msg, sizeof(msg), "No UMEM %d in the loaded config", umem_id);
+		return msg;
+	}
+	load(umem);
+	snprintf(msg, sizeof(msg), "load route %d", umem_id);
+	return msg;
+}
+
+static int find_edge(struct nf *nf, int to)
+{
+	for (int i = 0; i < nf->next_size; i++) {
+		if (nf->next[i] == to)
+			return i;
+	}
+	return -1;
+}
+
+/**
+ * The NF an edge of nf_id leads to; edges are indices into its next list.
+ *
+ * @return the NF ID, or -1 if there is no such edge in the loaded config.
+ */
+int nf_next_id(int umem_id, int nf_id, int edge)
+{
+	struct umem *umem = find_umem(umem_id);
+	struct nf *nf;
+
+	nf = umem ? find_nf(umem, nf_id) : NULL;
+	if (nf == NULL)
+		return -1;
+	return edge >= 0 && edge < nf->next_size ? nf->next[edge] : -1;
+}
+
+/*
+ * Add or remove the edge from -> to while NFs run. Like the routes of the
+ * config, routes are per NF ID, so every UMEM entry of from changes, and a
+ * new edge needs to in each UMEM of from as frames do not leave their UMEM.
+ * The prev lists of to are per UMEM and only change in the UMEMs of from.
+ * The kernel route is written first and the tables here only change once
+ * it took the new list; the control plane then tells the running instances
+ * of both NFs. The tables change under route_lock, which the control plane
+ * holds while it serves the NFs.
+ *
+ * Removing an edge shifts the index of the edges after it.
+ *
+ * @return 0 on success, or a negative errno.
+ */
+static int __update_route(int from, int to, bool add)
+{
+	struct nf *src, *dst;
+	int **nexts, *next, *prev, size, idx, ret = 0;
+
+	src = find_nf(NULL, from);
+	if (!src || !find_nf(NULL, to))
+		return -ENOENT;
+
+	idx = find_edge(src, to);
+	if (add && idx >= 0)
+		return -EEXIST;
+	if (!add && idx < 0)
+		return -ENOENT;
+	if (add && src->next_size >= FLASH_MAX_EDGES)
+		return -E2BIG;
+
+	/* everything that can fail is checked and allocated before the kernel route changes */
+	for (int u = 0; add && u < nfg->umem_count; u++) {
+		if (!find_nf(nfg->umem[u], from))
+			continue;
+		dst = find_nf(nfg->umem[u], to);
+		if (!dst)
+			return -EXDEV;
+		if (dst->prev_size >= FLASH_MAX_NF)
+			return -E2BIG;
+		prev = realloc(dst->prev, (dst->prev_size + 1) * sizeof(int));
+		if (!prev)
+			return -ENOMEM;
+		dst->prev = prev;
+	}
+
+	/* every UMEM entry of from gets its own copy of the same new list */
+	next = calloc(src->next_size + 1, sizeof(int));
+	nexts = calloc(nfg->umem_count, sizeof(int *));
+	if (!next || !nexts) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	size = 0;
+	for (int i = 0; i < src->next_size; i++) {
+		if (add || src->next[i] != to)
+			next[size++] = src->next[i];
+	}
+	if (add)
+		next[size++] = to;
+
+	for (int u = 0; u < nfg->umem_count; u++) {
+		if (!find_nf(nfg->umem[u], from))
+			continue;
+		nexts[u] = calloc(src->next_size + 1, sizeof(int));
+		if (!nexts[u]) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		memcpy(nexts[u], next, size * sizeof(int));
+	}
+
+	if (write_to_kernel_flash(next, size, from) < 0) {
+		ret = -EIO;
+		goto out;
+	}
+
+	for (int u = 0; u < nfg->umem_count; u++) {
+		struct nf *nf = find_nf(nfg->umem[u], from);
+
+		if (!nf)
+			continue;
+
+		free(nf->next);
+		nf->next = nexts[u];
+		nexts[u] = NULL;
+		nf->next_size = size;
+		__atomic_add_fetch(&nf->route_gen, 1, __ATOMIC_RELEASE);
+
+		dst = find_nf(nfg->umem[u], to);
+		if (!dst)
+			continue;
+		prev = dst->prev;
+		if (add) {
+			prev[dst->prev_size] = from;
+			dst->prev_size++;
+		} else {
+			for (int i = 0; i < dst->prev_size; i++) {
+				if (prev[i] == from) {
+					memmove(&prev[i], &prev[i + 1], (dst->prev_size - i - 1) * sizeof(int));
+					dst->prev_size--;
+					break;
+				}
+			}
+		}
+		__atomic_add_fetch(&dst->route_gen, 1, __ATOMIC_RELEASE);
+	}
+
+out:
+	for (int u = 0; nexts && u < nfg->umem_count; u++)
+		free(nexts[u]);
+	free(nexts);
+	free(next);
+	return ret;
+}
+
+int update_route(int from, int to, bool add)
+{
+	uint64_t one = 1;
+	int ret;
+
+	pthread_mutex_lock(&route_lock);
+	ret = __update_route(from, to, add);
+	pthread_mutex_unlock(&route_lock);
+	if (ret < 0)
+		return ret;
+
+	if (route_event_fd >= 0 && write(route_event_fd, &one, sizeof(one)) < 0)
+		log_warn("Could not wake the control plane: %s", strerror(errno));
+
+	log_info("Route %d -> %d %s", from, to, add ? "added" : "removed");
+	return 0;
+}
+
+static const char *route_command(char *args)
+{
+	static char msg[128];
+	int from, to, ret;
+	char op[8];
+
+	if (sscanf(args, "%7s %d %d", op, &from, &to) != 3 || (strcmp(op, "add") && strcmp(op, "del")))
+		return "Usage: route add|del <from_nf_id> <to_nf_id>";
+
+	ret = update_route(from, to, strcmp(op, "add") == 0);
+	if (ret < 0)
+		snprintf(msg, sizeof(msg), "route %s %d %d failed: %s", op, from, to, strerror(-ret));
+	else
+		snprintf(msg, sizeof(msg), "route %s %d %d", op, from, to);
+	return msg;
+}
+
+static const char *telemetry_command(char *args)
+{
+	static char msg[PATH_MAX + 64];
+	const char *path;
+
+	if (*args == '\0') {
+		path = telemetry_export_path();
+		snprintf(msg, sizeof(msg), "telemetry: %s", path ? path : "not exported");
+		return msg;
+	}
+	if (strcmp(args, "off") == 0) {
+		telemetry_set_export(NULL);
+		return "telemetry export stopped";
+	}
+
+	/* the control plane writes it, and logs if it cannot */
+	telemetry_set_export(args);
+	snprintf(msg, sizeof(msg), "telemetry written to %s every second", args);
+	return msg;
 }
 
 const char *process_input(char *input)
@@ -139,15 +500,34 @@ const char *process_input(char *input)
 	if (strncmp(input, "load config", 11) == 0) {
 		nfg = parse_json(input + 12);
 		return input;
-	} else if (strcmp(input, "load route") == 0) {
-		load(0);
-		return input;
+	} else if (strncmp(input, "load route", 10) == 0 && (input[10] == '\0' || input[10] == ' ')) {
+		return load_command(input + 10 + (input[10] == ' '));
+	} else if (strncmp(input, "route ", 6) == 0) {
+		return route_command(input + 6);
+	} else if (strncmp(input, "telemetry", 9) == 0 && (input[9] == '\0' || input[9] == ' ')) {
+		return telemetry_command(input + 9 + (input[9] == ' '));
 	} else {
 		return "Invalid command";
 	}
 	return NULL;
 }
 
+int autoscale(uint64_t now_ms)
+{
+	struct NFGroup *group = nfg;
+	int changed = 0;
+
+	if (group == NULL)
+		return 0;
+
+	for (int u = 0; u < group->umem_count; u++) {
+		for (int n = 0; n < group->umem[u]->nf_count; n++)
+			changed += autoscale_nf(group, group->umem[u], group->umem[u]->nf[n], now_ms);
+	}
+
+	return changed;
+}
+
 static int create_memfd(const char *name, size_t size)
 {
 	int fd, ret;
@@ -207,6 +587,7 @@ static void flash__setup_umem(struct umem *umem)
 	void *packet_buffer;
 	struct sched_param schparam;
 	int ret, fd, flags;
+	char name[32];
 	size_t size;
 
 	if (setrlimit(RLIMIT_MEMLOCK, &rlim)) {
@@ -228,7 +609,9 @@ static void flash__setup_umem(struct umem *umem)
 
 	log_info("UMEM size: %lu", size);
 
-	fd = create_memfd("UMEM0", size);
+	/* named after the UMEM, so the memfds of several UMEMs tell apart in /proc */
+	snprintf(name, sizeof(name), "UMEM%d", umem->id);
+	fd = create_memfd(name, size);
 	flags = MAP_SHARED;
 
 	/* Reserve memory for the umem. Use hugepages if unaligned chunk mode is enabled */
@@ -241,8 +624,9 @@ static void flash__setup_umem(struct umem *umem)
 	umem->cfg->umem->size = size;
 	umem->cfg->umem_fd = fd;
 
-	size = FLASH_MAX_XSK * sizeof(uint8_t);
-	fd = create_memfd("POLLOUT_STATUS_MEM0", size);
+	size = FLASH_MAX_NF * sizeof(uint8_t);
+	snprintf(name, sizeof(name), "POLLOUT_STATUS_MEM%d", umem->id);
+	fd = create_memfd(name, size);
 	flags = MAP_SHARED;
 
 	umem->cfg->nf_pollout_status = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0);
@@ -262,17 +646,18 @@ static void flash__setup_umem(struct umem *umem)
   * is created with the shared UMEM. The function also updates the xsk_map with the
   * socket fd.
   *
-  * @param cfg
   * @param umem
-  * @return struct xsk_socket_info*
+  * @param nf entry of the NF in umem
+  * @param slot thread of the NF the socket is for
+  * @return struct socket*, NULL on failure
   */
-static struct socket *flash__setup_xsk(struct umem *umem, int nf_id)
+static struct socket *flash__setup_xsk(struct umem *umem, struct nf *nf, int slot)
 {
 	int ret;
 	int sock_opt;
 	int umem_ref_count = umem->cfg->current_socket_count;
-	int nf_thread_count = umem->nf[nf_id]->current_thread_count;
-	int ifqueue = umem->nf[nf_id]->thread[nf_thread_count]->ifqueue;
+	struct thread *thread = nf->thread[slot];
+	int ifqueue = thread->ifqueue;
 	char *ifname = umem->cfg->ifname;
 
 	struct xsk_socket *xsk;
@@ -282,7 +667,7 @@ static struct socket *flash__setup_xsk(struct umem *umem, int nf_id)
 	struct socket *socket = calloc(1, sizeof(struct socket));
 	if (!socket) {
 		log_error("Memory allocation failed, errno: %d/\"%s\"\n", errno, strerror(errno));
-		exit(EXIT_FAILURE);
+		return NULL;
 	}
 
 	/**
@@ -304,15 +689,15 @@ static struct socket *flash__setup_xsk(struct umem *umem, int nf_id)
 	}
 	if (ret) {
 		log_error("xsk_socket__create failed(check available queues), errno: %d/\"%s\"\n", errno, strerror(errno));
-		exit(EXIT_FAILURE);
+		free(socket);
+		return NULL;
 	}
 
 	socket->fd = xsk_socket__fd(xsk);
 	log_info("SOCKET FD: %d", socket->fd);
-	umem->nf[nf_id]->thread[nf_thread_count]->xsk = xsk;
-	umem->nf[nf_id]->thread[nf_thread_count]->socket = socket;
-	umem->nf[nf_id]->thread[nf_thread_count]->socket->ifqueue = ifqueue;
-	umem->nf[nf_id]->current_thread_count++;
+	thread->xsk = xsk;
+	thread->socket = socket;
+	thread->socket->ifqueue = ifqueue;
 	umem->cfg->current_socket_count++;
 
 	/* Enable and configure busy poll */
@@ -320,19 +705,22 @@ static struct socket *flash__setup_xsk(struct umem *umem, int nf_id)
 		sock_opt = 1;
 		if (setsockopt(socket->fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, (void *)&sock_opt, sizeof(sock_opt)) < 0) {
 			log_error("setsockopt 1 failed, errno: %d/\"%s\"\n", errno, strerror(errno));
-			exit(EXIT_FAILURE);
+			delete_socket(umem, thread);
+			return NULL;
 		}
 
 		sock_opt = 20;
 		if (setsockopt(socket->fd, SOL_SOCKET, SO_BUSY_POLL, (void *)&sock_opt, sizeof(sock_opt)) < 0) {
 			log_error("setsockopt 2 failed, errno: %d/\"%s\"\n", errno, strerror(errno));
-			exit(EXIT_FAILURE);
+			delete_socket(umem, thread);
+			return NULL;
 		}
 
 		sock_opt = 64; // poll budget
 		if (setsockopt(socket->fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, (void *)&sock_opt, sizeof(sock_opt)) < 0) {
 			log_error("setsockopt 3 failed, errno: %d/\"%s\"\n", errno, strerror(errno));
-			exit(EXIT_FAILURE);
+			delete_socket(umem, thread);
+			return NULL;
 		}
 	}
 
@@ -347,6 +735,16 @@ static void init_config(struct config *cfg)
 	cfg->nf_pollout_status_fd = -1;
 }
 
+static void setup_umem(struct umem *umem)
+{
+	if (umem->cfg->umem_fd != 0 && umem->cfg->umem_fd != -1)
+		return;
+
+	init_config(umem->cfg);
+	setup_xsk_config(&umem->cfg->xsk_config, &umem->cfg->umem_config, umem->cfg);
+	flash__setup_umem(umem);
+}
+
 int configure_umem(struct nf_data *data, struct umem **_umem)
 {
 	if (nfg == NULL) {
@@ -354,16 +752,19 @@ int configure_umem(struct nf_data *data, struct umem **_umem)
 		return -1;
 	}
 
-	struct umem *umem = nfg->umem[data->umem_id];
-	umem->current_nf_count++;
-	if (umem->cfg->umem_fd != 0 && umem->cfg->umem_fd != -1) {
-		*_umem = umem;
-		return umem->cfg->umem_fd;
+	struct umem *umem = find_umem(data->umem_id);
+	if (!umem) {
+		log_error("No UMEM %d in the loaded config", data->umem_id);
+		return -1;
 	}
 
-	init_config(umem->cfg);
-	setup_xsk_config(&umem->cfg->xsk_config, &umem->cfg->umem_config, umem->cfg);
-	flash__setup_umem(umem);
+	if (!find_nf(umem, data->nf_id)) {
+		log_error("No NF %d in UMEM %d", data->nf_id, data->umem_id);
+		return -1;
+	}
+
+	umem->current_nf_count++;
+	setup_umem(umem);
 
 	*_umem = umem;
 	return umem->cfg->umem_fd;
@@ -371,5 +772,58 @@ int configure_umem(struct nf_data *data, struct umem **_umem)
 
 struct socket *create_new_socket(struct umem *umem, int nf_id)
 {
-	return flash__setup_xsk(umem, nf_id);
+	struct nf *nf = find_nf(umem, nf_id);
+	int slot = nf->current_thread_count;
+	struct socket *socket;
+
+	if (slot >= nf->thread_count) {
+		log_error("NF %d asked for more than its %d sockets", nf_id, nf->thread_count);
+		return NULL;
+	}
+
+	socket = nf->thread[slot]->socket;
+	if (socket)
+		log_debug("Reusing warm socket %d for NF %d thread %d", socket->fd, nf_id, slot);
+	else
+		socket = flash__setup_xsk(umem, nf, slot);
+	if (!socket)
+		return NULL;
+
+	nf->current_thread_count++;
+	return socket;
+}
+
+int prewarm_sockets(int budget)
+{
+	struct NFGroup *group = nfg;
+	int created = 0;
+
+	if (group == NULL)
+		return 0;
+
+	/* config order, so socket creation order does not depend on NF start order */
+	for (int u = 0; u < group->umem_count && created < budget; u++) {
+		struct umem *umem = group->umem[u];
+
+		if (!umem->warm_pool)
+			continue;
+
+		for (int n = 0; n < umem->nf_count && umem->warm_pool && created < budget; n++) {
+			struct nf *nf = umem->nf[n];
+
+			for (int t = 0; t < nf->thread_count && created < budget; t++) {
+				if (nf->thread[t]->socket)
+					continue;
+				setup_umem(umem);
+				if (!flash__setup_xsk(umem, nf, t)) {
+					log_warn("Disabling the warm socket pool of UMEM %d", umem->id);
+					umem->warm_pool = false;
+					break;
+				}
+				created++;
+			}
+		}
+	}
+
+	return created;
 }
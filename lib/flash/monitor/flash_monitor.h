@@ -5,18 +5,82 @@
 #ifndef __FLASH_MONITOR_H
 #define __FLASH_MONITOR_H
 
+#include <pthread.h>
+#include <stdio.h>
 #include <sys/mman.h>
 #include <flash_defines.h>
+#include <flash_telemetry.h>
+
+/* What the autoscaler sees of an NF in one sampling interval. */
+struct autoscale_sample {
+	unsigned int rx_pct; /* fullest RX ring among the active sockets */
+	uint64_t rx_pkts; /* packets received by all sockets */
+	uint64_t drops; /* RX ring full, fill ring empty and dropped */
+	uint64_t interval_ms;
+};
+
+struct autoscale_state {
+	int min;
+	int max;
+	int active;
+	int hot; /* consecutive saturated samples */
+	int cold; /* consecutive samples with room to spare */
+	uint64_t thread_pps; /* per-thread rate seen at saturation, 0 until then */
+	uint64_t last_change_ms;
+	/* monitor bookkeeping */
+	uint64_t last_sample_ms;
+	uint32_t *rx_prod;
+	struct xdp_statistics *stats;
+	bool disabled;
+};
+
+/* One socket of an NF instance, as read from its telemetry region. */
+struct telemetry_snap {
+	int umem_id;
+	int nf_id;
+	int pid;
+	int index; /* socket of the NF */
+	uint64_t timer_hz;
+	uint64_t published_ns;
+	uint64_t age_ns; /* since the NF last published */
+	struct flash_telemetry_socket socket;
+	uint32_t nr_edges;
+	const uint64_t *edge_tx; /* in the edges array of telemetry_snapshot() */
+};
 
 extern int unix_socket_server;
+extern int route_event_fd;
+extern pthread_mutex_t route_lock;
 
 void *init_prompt(void *arg);
 void cleanup_exit(void);
 struct NFGroup *parse_json(const char *filename);
+struct NFGroup *load_config(const char *filename);
+int link_routes(struct NFGroup *nf_group);
 void free_nf_group(struct NFGroup *nf_group);
+uint64_t topology_hash(const void *data, size_t len);
+int topology_save(const char *path, uint64_t src_hash, const struct NFGroup *nfg);
+struct NFGroup *topology_load(const char *path, uint64_t src_hash);
+struct umem *find_umem(int umem_id);
+struct nf *find_nf(struct umem *umem, int nf_id);
 int configure_umem(struct nf_data *data, struct umem **_umem);
 struct socket *create_new_socket(struct umem *umem, int nf_id);
+int prewarm_sockets(int budget);
 const char *process_input(char *input);
+int nf_next_id(int umem_id, int nf_id, int edge);
+int update_route(int from, int to, bool add);
+int autoscale(uint64_t now_ms);
+int autoscale_nf(struct NFGroup *nfg, struct umem *umem, struct nf *nf, uint64_t now_ms);
+int autoscale_decide(struct autoscale_state *st, const struct autoscale_sample *s, uint64_t now_ms);
+int telemetry_create(const void *owner, int umem_id, int nf_id, int nr_sockets, int nr_edges);
+void telemetry_destroy(const void *owner);
+int telemetry_count(void);
+int telemetry_snapshot(struct telemetry_snap *snap, int max, uint64_t **edges);
+int telemetry_write_prometheus(FILE *f);
+void telemetry_set_export(const char *path);
+const char *telemetry_export_path(void);
+int telemetry_export(uint64_t now_ms);
 void close_nf(struct umem *umem, int umem_id, int nf_id);
+void handover_nf(struct umem *umem, int nf_id);
 
 #endif /* __FLASH_MONITOR_H */
@@ -0,0 +1,430 @@
+/* SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) 2025 Debojeet Das
+ *
+ * Telemetry: the monitor creates a memfd for every NF instance it
+ * bootstraps and keeps it mapped. The NF's stats thread publishes its
+ * per-socket counters there, so reading every NF's counters takes no
+ * syscall and no lock on the NF side. The monitor writes them out in the
+ * Prometheus text format, on request or periodically to a file for the
+ * node_exporter textfile collector.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/memfd.h>
+#include <sys/mman.h>
+
+#include <flash_list.h>
+#include <flash_telemetry.h>
+#include <log.h>
+
+#include "flash_monitor.h"
+
+#define TELEMETRY_EXPORT_INTERVAL_MS 1000
+#define TELEMETRY_READ_TRIES 100
+
+struct telemetry_region {
+	struct list_head list;
+	const void *owner;
+	struct flash_telemetry *tm;
+	size_t size;
+};
+
+/* the control thread adds and removes regions, the prompt thread reads them */
+static pthread_mutex_t regions_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(regions);
+static char *export_path;
+static uint64_t last_export_ms;
+static bool export_failing;
+
+static const struct {
+	const char *name;
+	const char *help;
+	size_t off;
+} counters[] = {
+	{ "flash_rx_packets_total", "Packets received", offsetof(struct flash_telemetry_socket, rx_npkts) },
+	{ "flash_rx_frags_total", "Frames received", offsetof(struct flash_telemetry_socket, rx_frags) },
+	{ "flash_tx_packets_total", "Packets sent", offsetof(struct flash_telemetry_socket, tx_npkts) },
+	{ "flash_tx_frags_total", "Frames sent", offsetof(struct flash_telemetry_socket, tx_frags) },
+	{ "flash_drop_packets_total", "Packets dropped by the NF", offsetof(struct flash_telemetry_socket, drop_npkts) },
+	{ "flash_xdp_rx_dropped_total", "XDP_STATISTICS rx_dropped", offsetof(struct flash_telemetry_socket, rx_dropped) },
+	{ "flash_xdp_rx_invalid_descs_total", "XDP_STATISTICS rx_invalid_descs",
+	  offsetof(struct flash_telemetry_socket, rx_invalid_descs) },
+	{ "flash_xdp_tx_invalid_descs_total", "XDP_STATISTICS tx_invalid_descs",
+	  offsetof(struct flash_telemetry_socket, tx_invalid_descs) },
+	{ "flash_xdp_rx_ring_full_total", "XDP_STATISTICS rx_ring_full", offsetof(struct flash_telemetry_socket, rx_ring_full) },
+	{ "flash_xdp_rx_fill_ring_empty_descs_total", "XDP_STATISTICS rx_fill_ring_empty_descs",
+	  offsetof(struct flash_telemetry_socket, rx_fill_ring_empty_descs) },
+	{ "flash_xdp_tx_ring_empty_descs_total", "XDP_STATISTICS tx_ring_empty_descs",
+	  offsetof(struct flash_telemetry_socket, tx_ring_empty_descs) },
+	{ "flash_rx_empty_polls_total", "Polls of an empty RX ring", offsetof(struct flash_telemetry_socket, rx_empty_polls) },
+	{ "flash_fill_fail_polls_total", "Polls for room in the fill ring",
+	  offsetof(struct flash_telemetry_socket, fill_fail_polls) },
+	{ "flash_copy_tx_sendtos_total", "TX kicks in copy mode", offsetof(struct flash_telemetry_socket, copy_tx_sendtos) },
+	{ "flash_tx_wakeup_sendtos_total", "TX kicks for a wakeup", offsetof(struct flash_telemetry_socket, tx_wakeup_sendtos) },
+	{ "flash_backpressure_total", "Waits for the next NF to make room", offsetof(struct flash_telemetry_socket, backpressure) },
+	{ "flash_opt_polls_total", "poll() calls", offsetof(struct flash_telemetry_socket, opt_polls) },
+	{ "flash_edge_tx_other_packets_total", "Packets sent on edges added after the NF started",
+	  offsetof(struct flash_telemetry_socket, edge_tx_other) },
+};
+
+static const struct {
+	const char *name;
+	const char *help;
+	size_t off;
+} gauges[] = {
+	{ "flash_rx_ring_used", "RX ring entries waiting for the NF", offsetof(struct flash_telemetry_socket, rx_ring_used) },
+	{ "flash_rx_ring_size", "RX ring entries", offsetof(struct flash_telemetry_socket, rx_ring_size) },
+	{ "flash_tx_ring_used", "TX ring entries not yet consumed", offsetof(struct flash_telemetry_socket, tx_ring_used) },
+	{ "flash_tx_ring_size", "TX ring entries", offsetof(struct flash_telemetry_socket, tx_ring_size) },
+};
+
+/* A copy of the socket that the NF was not writing to halfway. */
+static bool read_socket(const struct flash_telemetry_socket *src, struct flash_telemetry_socket *dst)
+{
+	for (int i = 0; i < TELEMETRY_READ_TRIES; i++) {
+		uint32_t seq = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+
+		if (seq & 1)
+			continue;
+		memcpy(dst, src, sizeof(*dst));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&src->seq, __ATOMIC_RELAXED) == seq)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Create the telemetry region of an NF instance.
+ *
+ * @param owner Key for telemetry_destroy(), the instance's connection.
+ * @param nr_edges Edges counted per socket, the length of the NF's next list.
+ * @return the memfd to pass to the NF, which the caller closes, or -1.
+ */
+int telemetry_create(const void *owner, int umem_id, int nf_id, int nr_sockets, int nr_edges)
+{
+	struct telemetry_region *region;
+	size_t size = flash_telemetry_size(nr_sockets, nr_edges);
+	int fd;
+
+	region = calloc(1, sizeof(struct telemetry_region));
+	if (!region)
+		return -1;
+
+	fd = memfd_create("FLASH_TELEMETRY", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0 || ftruncate(fd, size) < 0 || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+		log_warn("NF %d: no telemetry region: %s", nf_id, strerror(errno));
+		goto out_free;
+	}
+
+	region->tm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (region->tm == MAP_FAILED) {
+		log_warn("NF %d: telemetry region mmap failed: %s", nf_id, strerror(errno));
+		goto out_free;
+	}
+
+	region->owner = owner;
+	region->size = size;
+	region->tm->version = FLASH_TELEMETRY_VERSION;
+	region->tm->umem_id = umem_id;
+	region->tm->nf_id = nf_id;
+	region->tm->nr_sockets = nr_sockets;
+	region->tm->nr_edges = nr_edges;
+	__atomic_store_n(&region->tm->magic, FLASH_TELEMETRY_MAGIC, __ATOMIC_RELEASE);
+
+	pthread_mutex_lock(&regions_lock);
+	list_add_tail(&region->list, &regions);
+	pthread_mutex_unlock(&regions_lock);
+	return fd;
+
+out_free:
+	if (fd >= 0)
+		close(fd);
+	free(region);
+	return -1;
+}
+
+void telemetry_destroy(const void *owner)
+{
+	struct telemetry_region *region, *tmp;
+
+	pthread_mutex_lock(&regions_lock);
+	list_for_each_entry_safe(region, tmp, &regions, list) {
+		if (region->owner != owner)
+			continue;
+		list_del(&region->list);
+		munmap(region->tm, region->size);
+		free(region);
+	}
+	pthread_mutex_unlock(&regions_lock);
+}
+
+/**
+ * Copy out the counters of every NF instance that has published them.
+ *
+ * @param snap Filled with up to max sockets, in NF then socket order.
+ * @param edges Set to one array holding the edge counters of every socket
+ *              copied, which the caller frees once done with snap.
+ * @return the number of sockets copied, or -1 if out of memory.
+ */
+int telemetry_snapshot(struct telemetry_snap *snap, int max, uint64_t **edges)
+{
+	struct telemetry_region *region;
+	uint64_t now_ns, *edge_tx;
+	size_t nr_edges = 0;
+	struct timespec ts;
+	int n = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now_ns = ts.tv_sec * 1000000000UL + ts.tv_nsec;
+
+	pthread_mutex_lock(&regions_lock);
+	list_for_each_entry(region, &regions, list)
+		nr_edges += (size_t)region->tm->nr_sockets * region->tm->nr_edges;
+	edge_tx = calloc(nr_edges ?: 1, sizeof(uint64_t));
+	*edges = edge_tx;
+	if (!edge_tx) {
+		pthread_mutex_unlock(&regions_lock);
+		return -1;
+	}
+
+	list_for_each_entry(region, &regions, list) {
+		struct flash_telemetry *tm = region->tm;
+		uint64_t published = __atomic_load_n(&tm->published_ns, __ATOMIC_ACQUIRE);
+
+		if (!published)
+			continue;
+		for (uint32_t i = 0; i < tm->nr_sockets && n < max; i++) {
+			const uint64_t *src = flash_telemetry_edge_tx(tm, i);
+
+			if (!read_socket(&tm->socket[i], &snap[n].socket))
+				continue;
+			/* only ever grow, so they need no seq */
+			for (uint32_t e = 0; e < tm->nr_edges; e++)
+				edge_tx[e] = __atomic_load_n(&src[e], __ATOMIC_RELAXED);
+			snap[n].nr_edges = tm->nr_edges;
+			snap[n].edge_tx = edge_tx;
+			edge_tx += tm->nr_edges;
+			snap[n].umem_id = tm->umem_id;
+			snap[n].nf_id = tm->nf_id;
+			snap[n].pid = tm->pid;
+			snap[n].index = i;
+			snap[n].timer_hz = tm->timer_hz;
+			snap[n].published_ns = published;
+			snap[n].age_ns = now_ns > published ? now_ns - published : 0;
+			n++;
+		}
+	}
+	pthread_mutex_unlock(&regions_lock);
+
+	return n;
+}
+
+/* Sockets of every NF instance with a region, an upper bound for telemetry_snapshot(). */
+int telemetry_count(void)
+{
+	struct telemetry_region *region;
+	int n = 0;
+
+	pthread_mutex_lock(&regions_lock);
+	list_for_each_entry(region, &regions, list)
+		n += region->tm->nr_sockets;
+	pthread_mutex_unlock(&regions_lock);
+
+	return n;
+}
+
+static void write_labels(FILE *f, const struct telemetry_snap *s)
+{
+	fprintf(f, "{umem=\"%d\",nf=\"%d\",socket=\"%d\",queue=\"%u\"", s->umem_id, s->nf_id, s->index, s->socket.ifqueue);
+}
+
+static void write_histogram(FILE *f, const struct telemetry_snap *snap, int n)
+{
+	const char *name = "flash_batch_latency_seconds";
+
+	fprintf(f, "# HELP %s Time from receiving a batch to sending or dropping it\n", name);
+	fprintf(f, "# TYPE %s histogram\n", name);
+
+	for (int i = 0; i < n; i++) {
+		const struct flash_telemetry_socket *t = &snap[i].socket;
+		double hz = snap[i].timer_hz;
+		uint64_t count = 0;
+
+		if (!snap[i].timer_hz)
+			continue;
+		for (int b = 0; b < FLASH_TELEMETRY_HIST_BUCKETS; b++) {
+			count += t->batch_cycles[b];
+			if (b == FLASH_TELEMETRY_HIST_BUCKETS - 1)
+				break;
+			fprintf(f, "%s_bucket", name);
+			write_labels(f, &snap[i]);
+			fprintf(f, ",le=\"%.9g\"} %lu\n", (double)(2UL << b) / hz, count);
+		}
+		fprintf(f, "%s_bucket", name);
+		write_labels(f, &snap[i]);
+		fprintf(f, ",le=\"+Inf\"} %lu\n", count);
+		fprintf(f, "%s_sum", name);
+		write_labels(f, &snap[i]);
+		fprintf(f, "} %.9g\n", t->batch_cycles_sum / hz);
+		fprintf(f, "%s_count", name);
+		write_labels(f, &snap[i]);
+		fprintf(f, "} %lu\n", count);
+	}
+}
+
+/**
+ * Write every NF's counters in the Prometheus text format.
+ *
+ * @return the number of sockets written, or -1 on error.
+ */
+int telemetry_write_prometheus(FILE *f)
+{
+	struct telemetry_snap *snap;
+	uint64_t *edges;
+	int max = telemetry_count(), n;
+
+	snap = calloc(max ? max : 1, sizeof(struct telemetry_snap));
+	if (!snap)
+		return -1;
+	/* instances that came up since counting are left for the next time */
+	n = telemetry_snapshot(snap, max, &edges);
+	if (n < 0) {
+		free(snap);
+		return -1;
+	}
+
+	fprintf(f, "# HELP flash_nf_info NF instances publishing telemetry\n# TYPE flash_nf_info gauge\n");
+	for (int i = 0; i < n; i++) {
+		if (snap[i].index == 0)
+			fprintf(f, "flash_nf_info{umem=\"%d\",nf=\"%d\",pid=\"%d\"} 1\n", snap[i].umem_id, snap[i].nf_id,
+				snap[i].pid);
+	}
+
+	fprintf(f, "# HELP flash_publish_age_seconds Time since the NF last published its counters\n"
+		   "# TYPE flash_publish_age_seconds gauge\n");
+	for (int i = 0; i < n; i++) {
+		if (snap[i].index == 0)
+			fprintf(f, "flash_publish_age_seconds{umem=\"%d\",nf=\"%d\"} %.3f\n", snap[i].umem_id, snap[i].nf_id,
+				snap[i].age_ns / 1E9);
+	}
+
+	for (size_t c = 0; c < sizeof(counters) / sizeof(counters[0]); c++) {
+		fprintf(f, "# HELP %s %s\n# TYPE %s counter\n", counters[c].name, counters[c].help, counters[c].name);
+		for (int i = 0; i < n; i++) {
+			uint64_t val;
+
+			memcpy(&val, (const uint8_t *)&snap[i].socket + counters[c].off, sizeof(val));
+			fprintf(f, "%s", counters[c].name);
+			write_labels(f, &snap[i]);
+			fprintf(f, "} %lu\n", val);
+		}
+	}
+
+	for (size_t g = 0; g < sizeof(gauges) / sizeof(gauges[0]); g++) {
+		fprintf(f, "# HELP %s %s\n# TYPE %s gauge\n", gauges[g].name, gauges[g].help, gauges[g].name);
+		for (int i = 0; i < n; i++) {
+			uint32_t val;
+
+			memcpy(&val, (const uint8_t *)&snap[i].socket + gauges[g].off, sizeof(val));
+			fprintf(f, "%s", gauges[g].name);
+			write_labels(f, &snap[i]);
+			fprintf(f, "} %u\n", val);
+		}
+	}
+
+	fprintf(f, "# HELP flash_edge_tx_packets_total Packets sent on an edge, by index into the NF's next list\n"
+		   "# TYPE flash_edge_tx_packets_total counter\n");
+	for (int i = 0; i < n; i++) {
+		for (uint32_t e = 0; e < snap[i].nr_edges; e++) {
+			if (!snap[i].edge_tx[e])
+				continue;
+			fprintf(f, "flash_edge_tx_packets_total");
+			write_labels(f, &snap[i]);
+			fprintf(f, ",edge=\"%u\"} %lu\n", e, snap[i].edge_tx[e]);
+		}
+	}
+
+	write_histogram(f, snap, n);
+
+	free(edges);
+	free(snap);
+	return ferror(f) ? -1 : n;
+}
+
+/**
+ * Start writing the counters to path every second, or stop with NULL.
+ */
+void telemetry_set_export(const char *path)
+{
+	char *dup = path && *path ? strdup(path) : NULL;
+
+	pthread_mutex_lock(&regions_lock);
+	free(export_path);
+	export_path = dup;
+	last_export_ms = 0;
+	export_failing = false;
+	pthread_mutex_unlock(&regions_lock);
+}
+
+const char *telemetry_export_path(void)
+{
+	return export_path;
+}
+
+/* Replace the file in one rename so the collector never reads half of it. */
+static int write_export(const char *path)
+{
+	char tmp[PATH_MAX];
+	FILE *f;
+	int ret;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+		return -1;
+
+	f = fopen(tmp, "w");
+	if (!f)
+		return -1;
+	ret = telemetry_write_prometheus(f);
+	if (fclose(f) != 0 || ret < 0 || rename(tmp, path) < 0) {
+		unlink(tmp);
+		return -1;
+	}
+	return ret;
+}
+
+/**
+ * Called from the control loop, writes the export file once a second.
+ *
+ * @return the number of sockets written, 0 if it was not time yet, -1 on error.
+ */
+int telemetry_export(uint64_t now_ms)
+{
+	char path[PATH_MAX];
+	int ret;
+
+	pthread_mutex_lock(&regions_lock);
+	if (!export_path || now_ms - last_export_ms < TELEMETRY_EXPORT_INTERVAL_MS) {
+		pthread_mutex_unlock(&regions_lock);
+		return 0;
+	}
+	snprintf(path, sizeof(path), "%s", export_path);
+	last_export_ms = now_ms;
+	pthread_mutex_unlock(&regions_lock);
+
+	ret = write_export(path);
+	/* once per failure, not once a second */
+	if (ret < 0 && !export_failing)
+		log_warn("Could not write telemetry to %s: %s", path, strerror(errno));
+	export_failing = ret < 0;
+	return ret;
+}
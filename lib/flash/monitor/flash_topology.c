@@ -0,0 +1,372 @@
+/* SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) 2025 Debojeet Das
+ *
+ * Compiled topology: the NF group load_config() built from a config, written
+ * next to the config as <config>.topo. Loading the same config again, as
+ * after a monitor restart, reads it back in one pass instead of parsing,
+ * expanding and checking the JSON. It carries the hash of the config it was
+ * built from and is ignored once the config changes.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <log.h>
+
+#include "flash_monitor.h"
+
+#define TOPOLOGY_MAGIC 0x464c5450 /* "FLTP" */
+/* bump when the layout below or the meaning of a config changes */
+#define TOPOLOGY_VERSION 3
+
+struct topo_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t src_hash;
+	uint64_t size; /* of the whole file */
+	int32_t umem_count;
+	int32_t max_nf; /* FLASH_MAX_NF it was checked against */
+};
+
+struct topo_umem {
+	int32_t id;
+	int32_t nf_count;
+	char ifname[IF_NAMESIZE];
+	uint32_t xdp_flags;
+	uint32_t bind_flags;
+	uint32_t mode;
+	int32_t poll_timeout;
+	int32_t umem_scale;
+	int32_t total_sockets;
+	uint8_t custom_xsk;
+	uint8_t frags_enabled;
+	uint8_t warm_pool;
+};
+
+/* followed by next_size int32_t and thread_count struct topo_thread */
+struct topo_nf {
+	int32_t id;
+	char ip[INET_ADDRSTRLEN];
+	uint16_t port;
+	int32_t thread_count;
+	int32_t min_threads;
+	int32_t next_size;
+};
+
+struct topo_thread {
+	int32_t id;
+	int32_t umem_offset;
+	uint8_t ifqueue;
+};
+
+/* A bounds checked reader over the file. */
+struct topo_cursor {
+	const char *pos;
+	const char *end;
+};
+
+static const void *take(struct topo_cursor *c, size_t len)
+{
+	const void *p = c->pos;
+
+	if ((size_t)(c->end - c->pos) < len)
+		return NULL;
+	c->pos += len;
+	return p;
+}
+
+/**
+ * FNV-1a hash of a config, which names the config a compiled topology was
+ * built from.
+ *
+ * @param data Config contents.
+ * @param len Length of data.
+ * @return the hash.
+ */
+uint64_t topology_hash(const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (size_t i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+static int write_topology(FILE *f, uint64_t src_hash, const struct NFGroup *nfg)
+{
+	struct topo_header hdr = { 0 };
+	int32_t next;
+
+	hdr.magic = TOPOLOGY_MAGIC;
+	hdr.version = TOPOLOGY_VERSION;
+	hdr.src_hash = src_hash;
+	hdr.umem_count = nfg->umem_count;
+	hdr.max_nf = FLASH_MAX_NF;
+	/* size is filled in once everything else is written */
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+		return -1;
+
+	for (int i = 0; i < nfg->umem_count; i++) {
+		const struct umem *umem = nfg->umem[i];
+		struct topo_umem tu;
+
+		memset(&tu, 0, sizeof(tu));
+		tu.id = umem->id;
+		tu.nf_count = umem->nf_count;
+		memcpy(tu.ifname, umem->cfg->ifname, IF_NAMESIZE);
+		tu.xdp_flags = umem->cfg->xsk->xdp_flags;
+		tu.bind_flags = umem->cfg->xsk->bind_flags;
+		tu.mode = umem->cfg->xsk->mode;
+		tu.poll_timeout = umem->cfg->xsk->poll_timeout;
+		tu.umem_scale = umem->cfg->umem_scale;
+		tu.total_sockets = umem->cfg->total_sockets;
+		tu.custom_xsk = umem->cfg->custom_xsk;
+		tu.frags_enabled = umem->cfg->frags_enabled;
+		tu.warm_pool = umem->warm_pool;
+		if (fwrite(&tu, sizeof(tu), 1, f) != 1)
+			return -1;
+
+		for (int j = 0; j < umem->nf_count; j++) {
+			const struct nf *nf = umem->nf[j];
+			struct topo_nf tn;
+
+			memset(&tn, 0, sizeof(tn));
+			tn.id = nf->id;
+			memcpy(tn.ip, nf->ip, INET_ADDRSTRLEN);
+			tn.port = nf->port;
+			tn.thread_count = nf->thread_count;
+			tn.min_threads = nf->min_threads;
+			tn.next_size = nf->next_size;
+			if (fwrite(&tn, sizeof(tn), 1, f) != 1)
+				return -1;
+
+			for (int l = 0; l < nf->next_size; l++) {
+				next = nf->next[l];
+				if (fwrite(&next, sizeof(next), 1, f) != 1)
+					return -1;
+			}
+
+			for (int k = 0; k < nf->thread_count; k++) {
+				struct topo_thread tt;
+
+				memset(&tt, 0, sizeof(tt));
+				tt.id = nf->thread[k]->id;
+				tt.umem_offset = nf->thread[k]->umem_offset;
+				tt.ifqueue = nf->thread[k]->ifqueue;
+				if (fwrite(&tt, sizeof(tt), 1, f) != 1)
+					return -1;
+			}
+		}
+	}
+
+	hdr.size = ftell(f);
+	if (fseek(f, 0, SEEK_SET) || fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+		return -1;
+
+	return 0;
+}
+
+/**
+ * Compile an NF group to path, replacing it atomically.
+ *
+ * @param path Where to write the compiled topology.
+ * @param src_hash topology_hash() of the config it was built from.
+ * @param nfg NF group as load_config() built it, before any NF connected.
+ * @return 0 on success, -1 on error.
+ */
+int topology_save(const char *path, uint64_t src_hash, const struct NFGroup *nfg)
+{
+	char tmp[PATH_MAX];
+	FILE *f;
+	int ret;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+		return -1;
+
+	f = fopen(tmp, "w");
+	if (!f) {
+		log_debug("Unable to open %s: %s", tmp, strerror(errno));
+		return -1;
+	}
+
+	ret = write_topology(f, src_hash, nfg);
+	if (fclose(f) || ret || rename(tmp, path)) {
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int read_umem(struct topo_cursor *c, struct umem *umem)
+{
+	const struct topo_umem *tu = take(c, sizeof(*tu));
+	int total_threads = 0;
+
+	if (!tu || tu->nf_count < 1 || tu->nf_count > FLASH_MAX_NF)
+		return -1;
+
+	umem->id = tu->id;
+	umem->warm_pool = tu->warm_pool;
+	memcpy(umem->cfg->ifname, tu->ifname, IF_NAMESIZE);
+	umem->cfg->ifname[IF_NAMESIZE - 1] = '\0';
+	umem->cfg->umem_id = tu->id;
+	umem->cfg->nf_id = -1;
+	umem->cfg->umem_scale = tu->umem_scale;
+	umem->cfg->total_sockets = tu->total_sockets;
+	umem->cfg->custom_xsk = tu->custom_xsk;
+	umem->cfg->frags_enabled = tu->frags_enabled;
+	umem->cfg->xsk->xdp_flags = tu->xdp_flags;
+	umem->cfg->xsk->bind_flags = tu->bind_flags;
+	umem->cfg->xsk->mode = tu->mode;
+	umem->cfg->xsk->poll_timeout = tu->poll_timeout;
+
+	umem->nf = calloc(tu->nf_count, sizeof(struct nf *));
+	if (!umem->nf)
+		return -1;
+
+	for (int j = 0; j < tu->nf_count; j++) {
+		const struct topo_nf *tn = take(c, sizeof(*tn));
+		const int32_t *next;
+		struct nf *nf;
+
+		if (!tn || tn->id < 0 || tn->id >= FLASH_MAX_NF || tn->thread_count < 1 || tn->thread_count > FLASH_MAX_SOCKETS ||
+		    tn->next_size < 0 || tn->next_size > FLASH_MAX_EDGES || tn->min_threads < 1 || tn->min_threads > tn->thread_count)
+			return -1;
+
+		nf = calloc(1, sizeof(struct nf));
+		if (!nf)
+			return -1;
+		umem->nf[umem->nf_count++] = nf;
+
+		nf->id = tn->id;
+		memcpy(nf->ip, tn->ip, INET_ADDRSTRLEN);
+		nf->ip[INET_ADDRSTRLEN - 1] = '\0';
+		nf->port = tn->port;
+		nf->min_threads = tn->min_threads;
+		nf->active_threads = tn->thread_count;
+
+		next = take(c, tn->next_size * sizeof(int32_t));
+		nf->next = calloc(tn->next_size ?: 1, sizeof(int));
+		nf->thread = calloc(tn->thread_count, sizeof(struct thread *));
+		if (!next || !nf->next || !nf->thread)
+			return -1;
+		for (int l = 0; l < tn->next_size; l++) {
+			if (next[l] < 0 || next[l] >= FLASH_MAX_NF)
+				return -1;
+			nf->next[nf->next_size++] = next[l];
+		}
+
+		for (int k = 0; k < tn->thread_count; k++) {
+			const struct topo_thread *tt = take(c, sizeof(*tt));
+			struct thread *thread;
+
+			if (!tt || tt->umem_offset != total_threads)
+				return -1;
+			thread = calloc(1, sizeof(struct thread));
+			if (!thread)
+				return -1;
+			nf->thread[nf->thread_count++] = thread;
+			thread->id = tt->id;
+			thread->umem_offset = tt->umem_offset;
+			thread->ifqueue = tt->ifqueue;
+			total_threads++;
+		}
+	}
+
+	return total_threads == tu->total_sockets ? 0 : -1;
+}
+
+/**
+ * Load the NF group compiled to path, if it was compiled from the config
+ * with hash src_hash by this version of the monitor.
+ *
+ * @param path Compiled topology.
+ * @param src_hash topology_hash() of the config being loaded.
+ * @return the NF group, or NULL if there is no usable compiled topology.
+ */
+struct NFGroup *topology_load(const char *path, uint64_t src_hash)
+{
+	const struct topo_header *hdr;
+	struct NFGroup *nfg = NULL;
+	struct topo_cursor c;
+	size_t len;
+	char *data;
+	FILE *f;
+	long size;
+
+	f = fopen(path, "r");
+	if (!f)
+		return NULL;
+
+	if (fseek(f, 0, SEEK_END) || (size = ftell(f)) < (long)sizeof(*hdr) || fseek(f, 0, SEEK_SET)) {
+		fclose(f);
+		return NULL;
+	}
+	len = size;
+	data = malloc(len);
+	if (!data || fread(data, 1, len, f) != len) {
+		free(data);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+
+	c.pos = data;
+	c.end = data + len;
+	hdr = take(&c, sizeof(*hdr));
+	if (hdr->magic != TOPOLOGY_MAGIC || hdr->version != TOPOLOGY_VERSION || hdr->max_nf != FLASH_MAX_NF ||
+	    hdr->size != len || hdr->umem_count < 1) {
+		log_debug("%s: not a compiled topology of this monitor", path);
+		goto out;
+	}
+	if (hdr->src_hash != src_hash) {
+		log_debug("%s: compiled from another version of the config", path);
+		goto out;
+	}
+
+	nfg = calloc(1, sizeof(struct NFGroup));
+	if (!nfg)
+		goto out;
+	nfg->umem = calloc(hdr->umem_count, sizeof(struct umem *));
+	if (!nfg->umem)
+		goto out_free;
+
+	for (int i = 0; i < hdr->umem_count; i++) {
+		struct umem *umem = calloc(1, sizeof(struct umem));
+
+		if (!umem)
+			goto out_free;
+		umem->cfg = calloc(1, sizeof(struct config));
+		if (!umem->cfg) {
+			free(umem);
+			goto out_free;
+		}
+		nfg->umem[nfg->umem_count++] = umem;
+		umem->cfg->umem = calloc(1, sizeof(struct umem_config));
+		umem->cfg->xsk = calloc(1, sizeof(struct xsk_config));
+		if (!umem->cfg->umem || !umem->cfg->xsk || read_umem(&c, umem))
+			goto out_free;
+	}
+
+	if (c.pos != c.end || link_routes(nfg))
+		goto out_free;
+
+	free(data);
+	return nfg;
+
+out_free:
+	log_warn("%s: corrupt compiled topology, ignoring it", path);
+	free_nf_group(nfg);
+	nfg = NULL;
+out:
+	free(data);
+	return nfg;
+}
@@ -40,6 +40,7 @@
 #include "tcp_in.h"
 #include "tcp_stream.h"
 #include "tcp_out.h"
+#include "tcp_cc.h"
 #include "ip_out.h"
 #include "eventpoll.h"
 #include "pipe.h"
@@ -52,6 +53,9 @@
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
+/* streams mtcp_accept_many() takes off the accept queue at a time */
+#define MTCP_ACCEPT_BATCH 64
+
 /*----------------------------------------------------------------------------*/
 static inline int mtcp_is_connected(mtcp_manager_t mtcp, tcp_stream *cur_stream)
 {
@@ -139,6 +143,138 @@ static inline int GetSocketError(socket_map_t socket, void *optval, socklen_t *o
 	return -1;
 }
 /*----------------------------------------------------------------------------*/
+/* hand a stream with pending socket options to the mTCP thread, which owns
+ * its congestion control and pacing state; called with optq_lock held */
+static inline int EnqueueSocketOptions(mtcp_manager_t mtcp, tcp_stream *cur_stream)
+{
+	if (cur_stream->sndvar->on_optq)
+		return 0;
+
+	if (StreamEnqueue(mtcp->optq, cur_stream) < 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+	cur_stream->sndvar->on_optq = TRUE;
+	mtcp->wakeup_flag = TRUE;
+
+	return 0;
+}
+/*----------------------------------------------------------------------------*/
+/* TCP_CONGESTION on a stream is switched by the mTCP thread; before the
+ * stream exists, and on listeners for the streams they accept, it is kept
+ * on the socket */
+static inline int SetSocketCongestion(mtcp_manager_t mtcp, socket_map_t socket, const void *optval, socklen_t optlen)
+{
+	char name[TCP_CC_NAME_MAX];
+	const struct tcp_cc_ops *ops;
+	int ret = 0;
+
+	if (optlen == 0 || optlen >= TCP_CC_NAME_MAX) {
+		errno = optlen ? ENOENT : EINVAL;
+		return -1;
+	}
+	memcpy(name, optval, optlen);
+	name[optlen] = '\0';
+
+	ops = TCPCCFind(name);
+	if (!ops) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	socket->cc_ops = ops;
+	if (socket->socktype == MTCP_SOCK_STREAM && socket->stream) {
+		SQ_LOCK(&mtcp->ctx->optq_lock);
+		socket->stream->sndvar->cc_pending = ops;
+		ret = EnqueueSocketOptions(mtcp, socket->stream);
+		SQ_UNLOCK(&mtcp->ctx->optq_lock);
+	}
+
+	return ret;
+}
+/*----------------------------------------------------------------------------*/
+static inline int GetSocketCongestion(socket_map_t socket, void *optval, socklen_t *optlen)
+{
+	const struct tcp_cc_ops *ops;
+	socklen_t len;
+
+	if (socket->socktype == MTCP_SOCK_STREAM && socket->stream)
+		ops = socket->stream->sndvar->cc_pending ? socket->stream->sndvar->cc_pending : socket->stream->sndvar->cc_ops;
+	else
+		ops = socket->cc_ops ? socket->cc_ops : TCPCCDefault();
+
+	len = MIN(*optlen, (socklen_t)TCP_CC_NAME_MAX);
+	strncpy(optval, ops->name, len);
+	*optlen = len;
+
+	return 0;
+}
+/*----------------------------------------------------------------------------*/
+#if PACING_ENABLED
+/* SO_MAX_PACING_RATE takes bytes per second as a 32 or 64 bit value, all
+ * ones meaning unlimited, as on Linux */
+static inline int SetSocketPacingRate(mtcp_manager_t mtcp, socket_map_t socket, const void *optval, socklen_t optlen)
+{
+	struct tcp_send_vars *sndvar;
+	uint64_t rate;
+	int ret;
+
+	if (socket->socktype != MTCP_SOCK_STREAM || !socket->stream) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	if (optlen == sizeof(uint64_t)) {
+		rate = *(const uint64_t *)optval;
+	} else if (optlen == sizeof(uint32_t)) {
+		rate = *(const uint32_t *)optval;
+		if (rate == UINT32_MAX)
+			rate = UINT64_MAX;
+	} else {
+		errno = EINVAL;
+		return -1;
+	}
+
+	sndvar = socket->stream->sndvar;
+	SQ_LOCK(&mtcp->ctx->optq_lock);
+	sndvar->pacing_rate_pending = rate == UINT64_MAX ? 0 : rate;
+	sndvar->pacing_pending = TRUE;
+	ret = EnqueueSocketOptions(mtcp, socket->stream);
+	SQ_UNLOCK(&mtcp->ctx->optq_lock);
+
+	return ret;
+}
+/*----------------------------------------------------------------------------*/
+static inline int GetSocketPacingRate(socket_map_t socket, void *optval, socklen_t *optlen)
+{
+	uint64_t rate;
+
+	if (!socket->stream) {
+		errno = EBADF;
+		return -1;
+	}
+
+	if (socket->stream->sndvar->pacing_pending)
+		rate = socket->stream->sndvar->pacing_rate_pending;
+	else
+		rate = socket->stream->pacer.rate;
+	if (!rate)
+		rate = UINT64_MAX;
+	if (*optlen >= sizeof(uint64_t)) {
+		*(uint64_t *)optval = rate;
+		*optlen = sizeof(uint64_t);
+	} else if (*optlen >= sizeof(uint32_t)) {
+		*(uint32_t *)optval = rate > UINT32_MAX ? UINT32_MAX : rate;
+		*optlen = sizeof(uint32_t);
+	} else {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+#endif
+/*----------------------------------------------------------------------------*/
 int mtcp_getsockname(mctx_t mctx, int sockid, struct sockaddr *addr, socklen_t *addrlen)
 {
 	mtcp_manager_t mtcp;
@@ -267,6 +403,15 @@ int mtcp_getsockopt(mctx_t mctx, int sockid, int level, int optname, void *optva
 				return GetSocketError(socket, optval, optlen);
 			}
 		}
+#if PACING_ENABLED
+		if (optname == SO_MAX_PACING_RATE) {
+			if (socket->socktype == MTCP_SOCK_STREAM) {
+				return GetSocketPacingRate(socket, optval, optlen);
+			}
+		}
+#endif
+	} else if (level == IPPROTO_TCP && optname == TCP_CONGESTION) {
+		return GetSocketCongestion(socket, optval, optlen);
 	}
 
 	errno = ENOSYS;
@@ -275,10 +420,6 @@ int mtcp_getsockopt(mctx_t mctx, int sockid, int level, int optname, void *optva
 /*----------------------------------------------------------------------------*/
 int mtcp_setsockopt(mctx_t mctx, int sockid, int level, int optname, const void *optval, socklen_t optlen)
 {
-	(void)level;
-	(void)optname;
-	(void)optval;
-	(void)optlen;
 	mtcp_manager_t mtcp;
 	socket_map_t socket;
 
@@ -306,6 +447,15 @@ int mtcp_setsockopt(mctx_t mctx, int sockid, int level, int optname, const void
 		return -1;
 	}
 
+	if (level == IPPROTO_TCP && optname == TCP_CONGESTION) {
+		return SetSocketCongestion(mtcp, socket, optval, optlen);
+	}
+#if PACING_ENABLED
+	if (level == SOL_SOCKET && optname == SO_MAX_PACING_RATE) {
+		return SetSocketPacingRate(mtcp, socket, optval, optlen);
+	}
+#endif
+
 	return 0;
 }
 /*----------------------------------------------------------------------------*/
@@ -559,80 +709,105 @@ int mtcp_listen(mctx_t mctx, int sockid, int backlog)
 	return 0;
 }
 /*----------------------------------------------------------------------------*/
-int mtcp_accept(mctx_t mctx, int sockid, struct sockaddr *addr, socklen_t *addrlen)
+/* the listener of sockid, NULL with errno set if it is not one */
+static inline struct tcp_listener *GetListener(mtcp_manager_t mtcp, int sockid)
 {
-	mtcp_manager_t mtcp;
-	struct tcp_listener *listener;
-	socket_map_t socket;
-	tcp_stream *accepted = NULL;
-
-	mtcp = GetMTCPManager(mctx);
-	if (!mtcp) {
-		return -1;
-	}
-
 	if (sockid < 0 || sockid >= CONFIG.max_concurrency) {
 		TRACE_API("Socket id %d out of range.\n", sockid);
 		errno = EBADF;
-		return -1;
+		return NULL;
 	}
 
 	/* requires listening socket */
 	if (mtcp->smap[sockid].socktype != MTCP_SOCK_LISTENER) {
 		errno = EINVAL;
-		return -1;
+		return NULL;
 	}
 
-	listener = mtcp->smap[sockid].listener;
+	return mtcp->smap[sockid].listener;
+}
+/*----------------------------------------------------------------------------*/
+/* waits until the acceptq of a blocking listener has something, FALSE if
+ * it is empty and either the listener does not block or mTCP is exiting */
+static int WaitForAccept(mtcp_manager_t mtcp, struct tcp_listener *listener)
+{
+	if (!StreamQueueIsEmpty(listener->acceptq))
+		return TRUE;
 
-	/* dequeue from the acceptq without lock first */
-	/* if nothing there, acquire lock and cond_wait */
-	accepted = StreamDequeue(listener->acceptq);
-	if (!accepted) {
-		if (listener->socket->opts & MTCP_NONBLOCK) {
-			errno = EAGAIN;
-			return -1;
+	if (listener->socket->opts & MTCP_NONBLOCK) {
+		errno = EAGAIN;
+		return FALSE;
+	}
 
-		} else {
-			pthread_mutex_lock(&listener->accept_lock);
-			while ((accepted = StreamDequeue(listener->acceptq)) == NULL) {
-				pthread_cond_wait(&listener->accept_cond, &listener->accept_lock);
-
-				if (mtcp->ctx->done || mtcp->ctx->exit) {
-					pthread_mutex_unlock(&listener->accept_lock);
-					errno = EINTR;
-					return -1;
-				}
-			}
+	pthread_mutex_lock(&listener->accept_lock);
+	while (StreamQueueIsEmpty(listener->acceptq)) {
+		pthread_cond_wait(&listener->accept_cond, &listener->accept_lock);
+
+		if (mtcp->ctx->done || mtcp->ctx->exit) {
 			pthread_mutex_unlock(&listener->accept_lock);
+			errno = EINTR;
+			return FALSE;
 		}
 	}
+	pthread_mutex_unlock(&listener->accept_lock);
+
+	return TRUE;
+}
+/*----------------------------------------------------------------------------*/
+static inline void AttachAcceptedSocket(tcp_stream *accepted, socket_map_t socket)
+{
+	socket->stream = accepted;
+	accepted->socket = socket;
+
+	/* set socket parameters */
+	socket->saddr.sin_family = AF_INET;
+	socket->saddr.sin_port = accepted->dport;
+	socket->saddr.sin_addr.s_addr = accepted->daddr;
 
-	if (!accepted) {
-		TRACE_ERROR("[NEVER HAPPEN] Empty accept queue!\n");
+	TRACE_API("Stream %d accepted.\n", accepted->id);
+}
+/*----------------------------------------------------------------------------*/
+static inline void RearmAcceptEvent(mtcp_manager_t mtcp, struct tcp_listener *listener)
+{
+	if (!(listener->socket->epoll & MTCP_EPOLLET) && !StreamQueueIsEmpty(listener->acceptq))
+		AddEpollEvent(mtcp->ep, USR_SHADOW_EVENT_QUEUE, listener->socket, MTCP_EPOLLIN);
+}
+/*----------------------------------------------------------------------------*/
+int mtcp_accept(mctx_t mctx, int sockid, struct sockaddr *addr, socklen_t *addrlen)
+{
+	mtcp_manager_t mtcp;
+	struct tcp_listener *listener;
+	socket_map_t socket;
+	tcp_stream *accepted = NULL;
+
+	mtcp = GetMTCPManager(mctx);
+	if (!mtcp) {
+		return -1;
 	}
 
-	if (!accepted->socket) {
-		socket = AllocateSocket(mctx, MTCP_SOCK_STREAM, FALSE);
-		if (!socket) {
-			TRACE_ERROR("Failed to create new socket!\n");
-			/* TODO: destroy the stream */
-			errno = ENFILE;
-			return -1;
-		}
-		socket->stream = accepted;
-		accepted->socket = socket;
+	listener = GetListener(mtcp, sockid);
+	if (!listener)
+		return -1;
 
-		/* set socket parameters */
-		socket->saddr.sin_family = AF_INET;
-		socket->saddr.sin_port = accepted->dport;
-		socket->saddr.sin_addr.s_addr = accepted->daddr;
+	if (!WaitForAccept(mtcp, listener))
+		return -1;
+
+	/* the stream stays queued if there is no socket for it */
+	socket = AllocateSocket(mctx, MTCP_SOCK_STREAM, FALSE);
+	if (!socket) {
+		TRACE_ERROR("Failed to create new socket!\n");
+		errno = ENFILE;
+		return -1;
 	}
 
-	if (!(listener->socket->epoll & MTCP_EPOLLET) && !StreamQueueIsEmpty(listener->acceptq))
-		AddEpollEvent(mtcp->ep, USR_SHADOW_EVENT_QUEUE, listener->socket, MTCP_EPOLLIN);
+	/* this thread is the only consumer, so the stream is still there */
+	accepted = StreamDequeue(listener->acceptq);
+	if (!accepted->socket)
+		AttachAcceptedSocket(accepted, socket);
+	else
+		FreeSocket(mctx, socket->id, FALSE);
 
-	TRACE_API("Stream %d accepted.\n", accepted->id);
+	RearmAcceptEvent(mtcp, listener);
 
 	if (addr && addrlen) {
 		struct sockaddr_in *addr_in = (struct sockaddr_in *)addr;
@@ -645,6 +820,77 @@ int mtcp_accept(mctx_t mctx, int sockid, struct sockaddr *addr, socklen_t *addrl
 	return accepted->socket->id;
 }
 /*----------------------------------------------------------------------------*/
+int mtcp_accept_many(mctx_t mctx, int sockid, int *sockids, struct sockaddr_in *addrs, int cnt)
+{
+	mtcp_manager_t mtcp;
+	struct tcp_listener *listener;
+	socket_map_t sockets[MTCP_ACCEPT_BATCH];
+	tcp_stream *accepted[MTCP_ACCEPT_BATCH];
+	int nsock, n, i;
+	int total = 0;
+
+	mtcp = GetMTCPManager(mctx);
+	if (!mtcp) {
+		return -1;
+	}
+
+	if (!sockids || cnt <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	listener = GetListener(mtcp, sockid);
+	if (!listener)
+		return -1;
+
+	if (!WaitForAccept(mtcp, listener))
+		return -1;
+
+	while (total < cnt) {
+		/* as many sockets as there are streams to take, and no more */
+		n = MIN(MIN(cnt - total, MTCP_ACCEPT_BATCH), StreamQueueCount(listener->acceptq));
+		for (nsock = 0; nsock < n; nsock++) {
+			sockets[nsock] = AllocateSocket(mctx, MTCP_SOCK_STREAM, FALSE);
+			if (!sockets[nsock])
+				break;
+		}
+		if (nsock == 0)
+			break;
+
+		/* this thread is the only consumer, so all nsock are there */
+		n = StreamDequeueBulk(listener->acceptq, accepted, nsock);
+		for (i = 0; i < n; i++) {
+			if (accepted[i]->socket)
+				FreeSocket(mctx, sockets[i]->id, FALSE);
+			else
+				AttachAcceptedSocket(accepted[i], sockets[i]);
+
+			sockids[total] = accepted[i]->socket->id;
+			if (addrs) {
+				addrs[total].sin_family = AF_INET;
+				addrs[total].sin_port = accepted[i]->dport;
+				addrs[total].sin_addr.s_addr = accepted[i]->daddr;
+			}
+			total++;
+		}
+		for (; i < nsock; i++)
+			FreeSocket(mctx, sockets[i]->id, FALSE);
+
+		if (n < MTCP_ACCEPT_BATCH)
+			break;
+	}
+
+	RearmAcceptEvent(mtcp, listener);
+
+	if (total == 0) {
+		TRACE_ERROR("Failed to create new socket!\n");
+		errno = ENFILE;
+		return -1;
+	}
+
+	return total;
+}
+/*----------------------------------------------------------------------------*/
 int mtcp_init_rss(mctx_t mctx, in_addr_t saddr_base, int num_addr, in_addr_t daddr, in_addr_t dport)
 {
 	mtcp_manager_t mtcp;
@@ -679,7 +925,7 @@ int mtcp_init_rss(mctx_t mctx, in_addr_t saddr_base, int num_addr, in_addr_t dad
 		saddr_base = CONFIG.eths[eidx].ip_addr;
 	}
 
-	ap = CreateAddressPoolPerCore(mctx->cpu, num_cpus, saddr_base, num_addr, daddr, dport);
+	ap = CreateAddressPoolPerCore(GetCoreRSSQueue(mctx->cpu), num_queues, saddr_base, num_addr, daddr, dport);
 	if (!ap) {
 		errno = ENOMEM;
 		return -1;
@@ -760,13 +1006,13 @@ int mtcp_connect(mctx_t mctx, int sockid, const struct sockaddr *addr, socklen_t
 
 		rss_core = GetRSSCPUCore(socket->saddr.sin_addr.s_addr, dip, socket->saddr.sin_port, dport, num_queues, endian_check);
 
-		if (rss_core != mctx->cpu) {
+		if (rss_core != GetCoreRSSQueue(mctx->cpu)) {
 			errno = EINVAL;
 			return -1;
 		}
 	} else {
 		if (mtcp->ap) {
-			ret = FetchAddressPerCore(mtcp->ap, mctx->cpu, num_queues, addr_in, &socket->saddr);
+			ret = FetchAddressPerCore(mtcp->ap, GetCoreRSSQueue(mctx->cpu), num_queues, addr_in, &socket->saddr);
 		} else {
 			uint8_t is_external;
 			nif = GetOutputInterface(dip, &is_external);
@@ -774,7 +1020,7 @@ int mtcp_connect(mctx_t mctx, int sockid, const struct sockaddr *addr, socklen_t
 				errno = EINVAL;
 				return -1;
 			}
-			ret = FetchAddress(ap[nif], mctx->cpu, num_queues, addr_in, &socket->saddr);
+			ret = FetchAddress(ap[nif], GetCoreRSSQueue(mctx->cpu), num_queues, addr_in, &socket->saddr);
 			UNUSED(is_external);
 		}
 		if (ret < 0) {
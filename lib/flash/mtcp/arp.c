@@ -29,7 +29,10 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <assert.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 /* for inet_ntoa() */
 #include <sys/socket.h>
@@ -80,7 +83,52 @@ struct arp_manager {
 	pthread_mutex_t lock;
 };
 /*----------------------------------------------------------------------------*/
+/*
+ * Neighbor table: exact /32 entries, static ones from arp.conf and learned
+ * ones, hashed by IP. Readers on any core walk the chains without a lock;
+ * writers serialize on the table lock, publish fully built entries with
+ * release stores and never modify an entry readers can reach, replacing it
+ * instead. Static entries with a shorter prefix stay in CONFIG.arp and are
+ * matched only when the hash misses.
+ */
+#define ARP_HASH_BITS 10
+#define ARP_HASH_SIZE (1 << ARP_HASH_BITS)
+#define ARP_REACHABLE_SEC 30 /* learned entries are probed after this */
+#define ARP_MAX_PROBES 3     /* unanswered probes before an entry goes */
+#define ARP_AGE_BUCKETS 8    /* buckets aged per ARPTimer() call */
+
+struct arp_neigh {
+	uint32_t ip;
+	unsigned char haddr[ETH_ALEN];
+	uint8_t is_static;
+
+	/* below only touched with the table lock held */
+	uint8_t probes;
+	int nif;
+	uint32_t ts_confirmed; /* last time the peer was heard from */
+	uint32_t ts_probe;
+
+	struct arp_neigh *next;
+	struct arp_neigh *retired_next;
+	uint64_t retire_epoch;
+};
+
+struct arp_neigh_table {
+	struct arp_neigh *bucket[ARP_HASH_SIZE];
+	uint32_t gen;
+	int entries; /* learned ones */
+	int age_cursor;
+
+	struct arp_entry *prefix[MAX_ARPENTRY];
+	int prefixes;
+
+	struct arp_neigh *retired; /* unlinked, waiting for readers */
+	pthread_mutex_t lock;
+};
+/*----------------------------------------------------------------------------*/
 struct arp_manager g_arpm;
+static struct arp_neigh_table g_neigh;
+uint64_t g_arp_epoch;
 /*----------------------------------------------------------------------------*/
 void DumpARPPacket(mtcp_manager_t mtcp, struct arphdr *arph);
 /*----------------------------------------------------------------------------*/
@@ -97,9 +145,150 @@ int InitARPTable(void)
 	TAILQ_INIT(&g_arpm.list);
 	pthread_mutex_init(&g_arpm.lock, NULL);
 
+	memset(&g_neigh, 0, sizeof(g_neigh));
+	/* per-core cache slots start out zeroed, i.e. at generation 0 */
+	g_neigh.gen = 1;
+	pthread_mutex_init(&g_neigh.lock, NULL);
+
 	return 0;
 }
 /*----------------------------------------------------------------------------*/
+static inline uint32_t NeighHash(uint32_t ip)
+{
+	return (ip * 2654435761u) >> (32 - ARP_HASH_BITS);
+}
+/*----------------------------------------------------------------------------*/
+static inline struct arp_neigh *NeighLookup(uint32_t ip)
+{
+	struct arp_neigh *n;
+
+	n = __atomic_load_n(&g_neigh.bucket[NeighHash(ip)], __ATOMIC_ACQUIRE);
+	while (n && n->ip != ip)
+		n = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE);
+
+	return n;
+}
+/*----------------------------------------------------------------------------*/
+/* the link pointing at the entry for ip, or at the end of its chain */
+static inline struct arp_neigh **NeighLink(uint32_t ip)
+{
+	struct arp_neigh **link = &g_neigh.bucket[NeighHash(ip)];
+
+	while (*link && (*link)->ip != ip)
+		link = &(*link)->next;
+
+	return link;
+}
+/*----------------------------------------------------------------------------*/
+/* an unlinked entry is freed once no core can still be reading it; its
+ * next pointer is left alone for readers standing on it */
+static void NeighRetire(struct arp_neigh *n)
+{
+	n->retire_epoch = __atomic_add_fetch(&g_arp_epoch, 1, __ATOMIC_SEQ_CST);
+	n->retired_next = g_neigh.retired;
+	g_neigh.retired = n;
+}
+/*----------------------------------------------------------------------------*/
+static void NeighReclaim(void)
+{
+	struct arp_neigh **link, *n;
+	uint64_t seen = UINT64_MAX;
+	uint64_t epoch;
+	int i;
+
+	for (i = 0; i < MAX_CPUS; i++) {
+		if (!g_mtcp[i])
+			continue;
+		epoch = __atomic_load_n(&g_mtcp[i]->arp_epoch, __ATOMIC_ACQUIRE);
+		if (epoch < seen)
+			seen = epoch;
+	}
+
+	link = &g_neigh.retired;
+	while ((n = *link)) {
+		if (n->retire_epoch <= seen) {
+			*link = n->retired_next;
+			free(n);
+		} else {
+			link = &n->retired_next;
+		}
+	}
+}
+/*----------------------------------------------------------------------------*/
+static inline void PrintNeighbor(const char *what, uint32_t ip, const unsigned char *haddr)
+{
+	uint8_t *da = (uint8_t *)&ip;
+
+	TRACE_CONFIG("%s IP addr: %u.%u.%u.%u, "
+		     "dst_hwaddr: %02X:%02X:%02X:%02X:%02X:%02X\n",
+		     what, da[0], da[1], da[2], da[3], haddr[0], haddr[1], haddr[2], haddr[3], haddr[4], haddr[5]);
+}
+/*----------------------------------------------------------------------------*/
+/* add or refresh a neighbor; a static entry is never overridden */
+static void NeighUpdate(uint32_t ip, const unsigned char *haddr, int is_static, int nif, uint32_t cur_ts)
+{
+	struct arp_neigh **link, *old, *n;
+
+	pthread_mutex_lock(&g_neigh.lock);
+	link = NeighLink(ip);
+	old = *link;
+	if (old && (old->is_static || memcmp(old->haddr, haddr, ETH_ALEN) == 0)) {
+		old->ts_confirmed = cur_ts;
+		old->probes = 0;
+		pthread_mutex_unlock(&g_neigh.lock);
+		return;
+	}
+
+	n = (struct arp_neigh *)calloc(1, sizeof(struct arp_neigh));
+	if (!n) {
+		pthread_mutex_unlock(&g_neigh.lock);
+		TRACE_ERROR("Failed to allocate a neighbor entry.\n");
+		return;
+	}
+	n->ip = ip;
+	memcpy(n->haddr, haddr, ETH_ALEN);
+	n->is_static = is_static;
+	n->nif = nif;
+	n->ts_confirmed = cur_ts;
+
+	if (old) {
+		/* the peer moved: the new entry takes the old one's place */
+		n->next = old->next;
+		__atomic_store_n(link, n, __ATOMIC_RELEASE);
+		NeighRetire(old);
+	} else {
+		n->next = g_neigh.bucket[NeighHash(ip)];
+		__atomic_store_n(&g_neigh.bucket[NeighHash(ip)], n, __ATOMIC_RELEASE);
+		if (!is_static)
+			g_neigh.entries++;
+	}
+	__atomic_add_fetch(&g_neigh.gen, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&g_neigh.lock);
+
+	if (!is_static)
+		PrintNeighbor(old ? "Updated arp entry." : "Learned new arp entry.", ip, haddr);
+}
+/*----------------------------------------------------------------------------*/
+void AddStaticARPEntry(struct arp_entry *ent)
+{
+	if (ent->prefix == 32) {
+		NeighUpdate(ent->ip, ent->haddr, TRUE, -1, 0);
+		return;
+	}
+
+	if (g_neigh.prefixes == MAX_ARPENTRY) {
+		TRACE_CONFIG("Too many prefix entries in the ARP table.\n");
+		return;
+	}
+	g_neigh.prefix[g_neigh.prefixes++] = ent;
+	__atomic_add_fetch(&g_neigh.gen, 1, __ATOMIC_RELEASE);
+}
+/*----------------------------------------------------------------------------*/
+uint32_t ARPGeneration(void)
+{
+	return __atomic_load_n(&g_neigh.gen, __ATOMIC_ACQUIRE);
+}
+/*----------------------------------------------------------------------------*/
 unsigned char *GetHWaddr(uint32_t ip)
 {
 	int i;
@@ -114,36 +303,92 @@ unsigned char *GetHWaddr(uint32_t ip)
 	return haddr;
 }
 /*----------------------------------------------------------------------------*/
-unsigned char *GetDestinationHWaddr(uint32_t dip, uint8_t is_gateway)
+static unsigned char *LookupNeighbor(uint32_t dip)
 {
+	struct arp_neigh *n;
 	unsigned char *d_haddr = NULL;
 	int prefix = 0;
 	int i;
 
-	if (is_gateway == 1 && CONFIG.arp.gateway)
-		d_haddr = (CONFIG.arp.gateway)->haddr;
-	else {
-		/* Longest prefix matching */
-		for (i = 0; i < CONFIG.arp.entries; i++) {
-			if (CONFIG.arp.entry[i].prefix == 1) {
-				if (CONFIG.arp.entry[i].ip == dip) {
-					d_haddr = CONFIG.arp.entry[i].haddr;
-					break;
-				}
-			} else {
-				if ((dip & CONFIG.arp.entry[i].ip_mask) == CONFIG.arp.entry[i].ip_masked) {
-					if (CONFIG.arp.entry[i].prefix > prefix) {
-						d_haddr = CONFIG.arp.entry[i].haddr;
-						prefix = CONFIG.arp.entry[i].prefix;
-					}
-				}
+	n = NeighLookup(dip);
+	if (n)
+		return n->haddr;
+
+	/* Longest prefix matching over the static prefix entries */
+	for (i = 0; i < g_neigh.prefixes; i++) {
+		struct arp_entry *ent = g_neigh.prefix[i];
+
+		if (ent->prefix == 1) {
+			if (ent->ip == dip) {
+				d_haddr = ent->haddr;
+				break;
 			}
+		} else if ((dip & ent->ip_mask) == ent->ip_masked && ent->prefix > prefix) {
+			d_haddr = ent->haddr;
+			prefix = ent->prefix;
 		}
 	}
 
 	return d_haddr;
 }
 /*----------------------------------------------------------------------------*/
+unsigned char *GetDestinationHWaddr(mtcp_manager_t mtcp, uint32_t dip, uint8_t is_gateway)
+{
+	struct arp_cache_slot *slot;
+	unsigned char *haddr;
+	uint32_t gen;
+
+	if (is_gateway == 1 && CONFIG.gateway)
+		dip = (CONFIG.gateway)->daddr;
+
+	if (!mtcp)
+		return LookupNeighbor(dip);
+
+	/* read the generation first: a change racing with the lookup below
+	 * leaves a slot that is already stale */
+	gen = ARPGeneration();
+	slot = &mtcp->arp_cache[NeighHash(dip) & (ARP_CACHE_SIZE - 1)];
+	if (slot->ip == dip && slot->gen == gen)
+		return slot->haddr;
+
+	haddr = LookupNeighbor(dip);
+	if (!haddr)
+		return NULL;
+
+	slot->ip = dip;
+	slot->gen = gen;
+	memcpy(slot->haddr, haddr, ETH_ALEN);
+
+	return slot->haddr;
+}
+/*----------------------------------------------------------------------------*/
+uint64_t GetDestinationHWaddrBulk(mtcp_manager_t mtcp, const uint32_t *dips, const uint8_t *is_gateway,
+				  unsigned char (*haddrs)[ETH_ALEN], int cnt)
+{
+	unsigned char *haddr;
+	uint64_t found = 0;
+	uint32_t dip;
+	int i;
+
+	assert(cnt <= ARP_RESOLVE_BATCH);
+
+	/* pull in the buckets of the whole batch before walking any */
+	for (i = 0; i < cnt; i++) {
+		dip = (is_gateway[i] == 1 && CONFIG.gateway) ? (CONFIG.gateway)->daddr : dips[i];
+		__builtin_prefetch(&g_neigh.bucket[NeighHash(dip)]);
+	}
+
+	for (i = 0; i < cnt; i++) {
+		haddr = GetDestinationHWaddr(mtcp, dips[i], is_gateway[i]);
+		if (haddr) {
+			memcpy(haddrs[i], haddr, ETH_ALEN);
+			found |= 1ULL << i;
+		}
+	}
+
+	return found;
+}
+/*----------------------------------------------------------------------------*/
 static int ARPOutput(struct mtcp_manager *mtcp, int nif, int opcode, uint32_t dst_ip, unsigned char *dst_haddr,
 		     unsigned char *target_haddr)
 {
@@ -182,29 +427,6 @@ static int ARPOutput(struct mtcp_manager *mtcp, int nif, int opcode, uint32_t ds
 	return 0;
 }
 /*----------------------------------------------------------------------------*/
-static int RegisterARPEntry(uint32_t ip, const unsigned char *haddr)
-{
-	int idx = CONFIG.arp.entries;
-
-	CONFIG.arp.entry[idx].prefix = 32;
-	CONFIG.arp.entry[idx].ip = ip;
-	memcpy(CONFIG.arp.entry[idx].haddr, haddr, ETH_ALEN);
-	CONFIG.arp.entry[idx].ip_mask = -1;
-	CONFIG.arp.entry[idx].ip_masked = ip;
-
-	if (CONFIG.gateway && ((CONFIG.gateway)->daddr & CONFIG.arp.entry[idx].ip_mask) == CONFIG.arp.entry[idx].ip_masked) {
-		CONFIG.arp.gateway = &CONFIG.arp.entry[idx];
-		TRACE_CONFIG("ARP Gateway SET!\n");
-	}
-
-	CONFIG.arp.entries = idx + 1;
-
-	TRACE_CONFIG("Learned new arp entry.\n");
-	PrintARPTable();
-
-	return 0;
-}
-/*----------------------------------------------------------------------------*/
 void RequestARP(mtcp_manager_t mtcp, uint32_t ip, int nif, uint32_t cur_ts)
 {
 	struct arp_queue_entry *ent;
@@ -236,14 +458,8 @@ void RequestARP(mtcp_manager_t mtcp, uint32_t ip, int nif, uint32_t cur_ts)
 /*----------------------------------------------------------------------------*/
 static int ProcessARPRequest(mtcp_manager_t mtcp, struct arphdr *arph, int nif, uint32_t cur_ts)
 {
-	(void)cur_ts;
-	unsigned char *temp;
-
-	/* register the arp entry if not exist */
-	temp = GetDestinationHWaddr(arph->ar_sip, 0);
-	if (!temp) {
-		RegisterARPEntry(arph->ar_sip, arph->ar_sha);
-	}
+	/* learn or refresh the sender */
+	NeighUpdate(arph->ar_sip, arph->ar_sha, FALSE, nif, cur_ts);
 
 	/* send arp reply */
 	ARPOutput(mtcp, nif, arp_op_reply, arph->ar_sip, arph->ar_sha, NULL);
@@ -251,18 +467,13 @@ static int ProcessARPRequest(mtcp_manager_t mtcp, struct arphdr *arph, int nif,
 	return 0;
 }
 /*----------------------------------------------------------------------------*/
-static int ProcessARPReply(mtcp_manager_t mtcp, struct arphdr *arph, uint32_t cur_ts)
+static int ProcessARPReply(mtcp_manager_t mtcp, struct arphdr *arph, int nif, uint32_t cur_ts)
 {
 	(void)mtcp;
-	(void)cur_ts;
-	unsigned char *temp;
 	struct arp_queue_entry *ent;
 
-	/* register the arp entry if not exist */
-	temp = GetDestinationHWaddr(arph->ar_sip, 0);
-	if (!temp) {
-		RegisterARPEntry(arph->ar_sip, arph->ar_sha);
-	}
+	/* learn or refresh the sender, this also answers our probes */
+	NeighUpdate(arph->ar_sip, arph->ar_sha, FALSE, nif, cur_ts);
 
 	/* remove from the arp request queue */
 	pthread_mutex_lock(&g_arpm.lock);
@@ -307,7 +518,8 @@ int ProcessARPPacket(mtcp_manager_t mtcp, uint32_t cur_ts, const int ifidx, unsi
 		break;
 
 	case arp_op_reply:
-		ProcessARPReply(mtcp, arph, cur_ts);
+		nif = CONFIG.eths[ifidx].ifindex;
+		ProcessARPReply(mtcp, arph, nif, cur_ts);
 		break;
 
 	default:
@@ -317,6 +529,50 @@ int ProcessARPPacket(mtcp_manager_t mtcp, uint32_t cur_ts, const int ifidx, unsi
 	return TRUE;
 }
 /*----------------------------------------------------------------------------*/
+/* age a few buckets of learned entries: a peer not heard from for
+ * ARP_REACHABLE_SEC gets unicast probes, one per ARP_TIMEOUT_SEC, and is
+ * dropped after ARP_MAX_PROBES of them go unanswered */
+static void AgeNeighbors(mtcp_manager_t mtcp, uint32_t cur_ts)
+{
+	struct arp_neigh **link, *n;
+	unsigned char taddr[ETH_ALEN];
+	int i;
+
+	memset(taddr, 0x00, ETH_ALEN);
+
+	pthread_mutex_lock(&g_neigh.lock);
+	for (i = 0; i < ARP_AGE_BUCKETS; i++) {
+		link = &g_neigh.bucket[g_neigh.age_cursor];
+		g_neigh.age_cursor = (g_neigh.age_cursor + 1) & (ARP_HASH_SIZE - 1);
+
+		while ((n = *link)) {
+			if (n->is_static || TCP_SEQ_LEQ(cur_ts, n->ts_confirmed + SEC_TO_TS(ARP_REACHABLE_SEC)) ||
+			    (n->probes && TCP_SEQ_LEQ(cur_ts, n->ts_probe + SEC_TO_TS(ARP_TIMEOUT_SEC)))) {
+				link = &n->next;
+				continue;
+			}
+
+			if (n->probes == ARP_MAX_PROBES) {
+				struct in_addr ina;
+				ina.s_addr = n->ip;
+				TRACE_INFO("[CPU%2d] ARP entry for %s expired.\n", mtcp->ctx->cpu, inet_ntoa(ina));
+				__atomic_store_n(link, n->next, __ATOMIC_RELEASE);
+				NeighRetire(n);
+				g_neigh.entries--;
+				__atomic_add_fetch(&g_neigh.gen, 1, __ATOMIC_RELEASE);
+				continue;
+			}
+
+			n->probes++;
+			n->ts_probe = cur_ts;
+			ARPOutput(mtcp, n->nif, arp_op_request, n->ip, n->haddr, taddr);
+			link = &n->next;
+		}
+	}
+	NeighReclaim();
+	pthread_mutex_unlock(&g_neigh.lock);
+}
+/*----------------------------------------------------------------------------*/
 /* ARPTimer: wakes up every milisecond and check the ARP timeout              */
 /*           timeout is set to 1 second                                       */
 /*----------------------------------------------------------------------------*/
@@ -324,6 +580,8 @@ void ARPTimer(mtcp_manager_t mtcp, uint32_t cur_ts)
 {
 	struct arp_queue_entry *ent, *ent_tmp;
 
+	AgeNeighbors(mtcp, cur_ts);
+
 	/* if the arp requet is timed out, retransmit */
 	pthread_mutex_lock(&g_arpm.lock);
 	TAILQ_FOREACH_SAFE(ent, &g_arpm.list, arp_link, ent_tmp)
@@ -356,6 +614,7 @@ void PrintARPTable(void)
 	}
 	if (CONFIG.arp.entries == 0)
 		TRACE_CONFIG("(blank)\n");
+	TRACE_CONFIG("Learned entries: %d\n", g_neigh.entries);
 
 	TRACE_CONFIG("----------------------------------------------------------"
 		     "-----------------------\n");
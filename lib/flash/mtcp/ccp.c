@@ -76,10 +76,10 @@ static void _dp_set_rate_abs(struct ccp_datapath *dp, struct ccp_connection *con
 	get_stream_from_ccp(&stream, conn);
 #if PACING_ENABLED || RATE_LIMIT_ENABLED
 #if RATE_LIMIT_ENABLED
-	stream->bucket->rate = rate;
+	SetTokenBucketRate(&stream->bucket, rate);
 #endif
 #if PACING_ENABLED
-	stream->pacer->rate_bps = rate;
+	SetPacingRate(&stream->pacer, rate);
 #endif
 #else
 	TRACE_ERROR("unable to set rate, both PACING and RATE_LIMIT are disabled."
@@ -93,10 +93,10 @@ static void _dp_set_rate_rel(struct ccp_datapath *dp, struct ccp_connection *con
 	get_stream_from_ccp(&stream, conn);
 #if PACING_ENABLED || RATE_LIMIT_ENABLED
 #if RATE_LIMIT_ENABLED
-	stream->bucket->rate *= (factor / 100);
+	SetTokenBucketRate(&stream->bucket, stream->bucket.rate * factor / 100);
 #endif
 #if PACING_ENABLED
-	stream->pacer->rate_bps *= (factor / 100);
+	SetPacingRate(&stream->pacer, stream->pacer.rate * factor / 100);
 #endif
 #else
 	TRACE_ERROR("unable to set rate, both PACING and RATE_LIMIT are disabled."
@@ -33,8 +33,39 @@
 /*----------------------------------------------------------------------------*/
 uint64_t init_time_ns = 0;
 uint32_t last_print = 0;
+static uint64_t tsc_hz = 0;
 /*----------------------------------------------------------------------------*/
-uint64_t now_usecs()
+uint64_t GetTSCHz(void)
+{
+#if defined(__ARM_ARCH_ISA_A64)
+	uint64_t freq;
+
+	if (tsc_hz == 0) {
+		asm volatile("mrs %0, cntfrq_el0; isb; " : "=r"(freq)::"memory");
+		tsc_hz = freq;
+	}
+#elif defined(__x86_64__)
+	struct timespec sleeptime = { .tv_nsec = 100000000L }; /* 1/10 second */
+	struct timespec t_start, t_end;
+	uint64_t start, end, ns;
+
+	if (tsc_hz == 0) {
+		clock_gettime(CLOCK_MONOTONIC, &t_start);
+		start = ReadTSC();
+		nanosleep(&sleeptime, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &t_end);
+		end = ReadTSC();
+
+		ns = (t_end.tv_sec - t_start.tv_sec) * 1000000000ULL + (t_end.tv_nsec - t_start.tv_nsec);
+		tsc_hz = (end - start) * 1000000000ULL / ns;
+	}
+#else
+	tsc_hz = 1000000000ULL;
+#endif
+	return tsc_hz;
+}
+/*----------------------------------------------------------------------------*/
+uint64_t now_usecs(void)
 {
 	struct timespec now;
 	uint64_t now_ns, now_us;
@@ -70,10 +101,10 @@ void log_cwnd_rtt(void *vs)
 		fprintf(stderr, "%lu %d %d/%d\n", now / 1000, stream->rcvvar->srtt * 125, stream->sndvar->cwnd / stream->sndvar->mss,
 			stream->sndvar->peer_wnd / stream->sndvar->mss);
 #if RATE_LIMIT_ENABLED
-		PrintBucket(stream->bucket);
+		PrintBucket(&stream->bucket);
 #endif
 #if PACING_ENABLED
-		PrintPacer(stream->pacer);
+		PrintPacer(&stream->pacer);
 #endif
 		last_print = now;
 	}
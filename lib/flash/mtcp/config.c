@@ -45,6 +45,8 @@
 #include "mtcp.h"
 #include "config.h"
 #include "tcp_in.h"
+#include "tcp_cc.h"
+#include "tcp_syncookie.h"
 #include "arp.h"
 #include "debug.h"
 /* for setting up io modules */
@@ -67,6 +69,9 @@ struct mtcp_config CONFIG = {
 	.sndbuf_size = -1,
 	.tcp_timeout = TCP_TIMEOUT,
 	.tcp_timewait = TCP_TIMEWAIT,
+	.tcp_gro = 1,
+	.tcp_gso = 1,
+	.tcp_syncookies = SYNCOOKIES_ON_OVERFLOW,
 	.num_mem_ch = 0,
 #if USE_CCP
 	.cc = "reno\n",
@@ -426,6 +431,10 @@ static void EnrollARPTableEntry(char *optstr)
 		return;
 	}
 
+	if (CONFIG.arp.entries == MAX_ARPENTRY) {
+		TRACE_CONFIG("Too many ARP entries, max %d.\n", MAX_ARPENTRY);
+		return;
+	}
 	idx = CONFIG.arp.entries++;
 
 	CONFIG.arp.entry[idx].prefix = prefix;
@@ -439,6 +448,7 @@ static void EnrollARPTableEntry(char *optstr)
 		CONFIG.arp.gateway = &CONFIG.arp.entry[idx];
 		TRACE_CONFIG("ARP Gateway SET!\n");
 	}
+	AddStaticARPEntry(&CONFIG.arp.entry[idx]);
 
 	/*
 	int i, cnt;
@@ -610,6 +620,8 @@ static int ParseConfiguration(char *line)
 			TRACE_CONFIG("Receive buffer size should be larger than 64.\n");
 			return -1;
 		}
+	} else if (strcmp(p, "rcvbuf_mirror") == 0) {
+		CONFIG.rcvbuf_mirror = mystrtol(q, 10) != 0;
 	} else if (strcmp(p, "sndbuf") == 0) {
 		CONFIG.sndbuf_size = mystrtol(q, 10);
 		if (CONFIG.sndbuf_size < 64) {
@@ -621,6 +633,22 @@ static int ParseConfiguration(char *line)
 		if (CONFIG.tcp_timeout > 0) {
 			CONFIG.tcp_timeout = SEC_TO_USEC(CONFIG.tcp_timeout) / TIME_TICK;
 		}
+	} else if (strcmp(p, "tcp_cc") == 0) {
+		CONFIG.tcp_cc = TCPCCFind(q);
+		if (!CONFIG.tcp_cc) {
+			TRACE_CONFIG("Unknown congestion control: %s\n", q);
+			return -1;
+		}
+	} else if (strcmp(p, "tcp_gro") == 0) {
+		CONFIG.tcp_gro = mystrtol(q, 10) != 0;
+	} else if (strcmp(p, "tcp_gso") == 0) {
+		CONFIG.tcp_gso = mystrtol(q, 10) != 0;
+	} else if (strcmp(p, "tcp_syncookies") == 0) {
+		CONFIG.tcp_syncookies = mystrtol(q, 10);
+		if (CONFIG.tcp_syncookies > SYNCOOKIES_ALWAYS) {
+			TRACE_CONFIG("Invalid tcp_syncookies: %s\n", q);
+			return -1;
+		}
 	} else if (strcmp(p, "tcp_timewait") == 0) {
 		CONFIG.tcp_timewait = mystrtol(q, 10);
 		if (CONFIG.tcp_timewait > 0) {
@@ -648,6 +676,22 @@ static int ParseConfiguration(char *line)
 		CONFIG.onvm_serv = mystrtol(q, 10);
 	} else if (strcmp(p, "onvm_dest") == 0) {
 		CONFIG.onvm_dest = mystrtol(q, 10);
+#endif
+#ifndef DISABLE_AFXDP
+	} else if (strcmp(p, "flash_umem") == 0) {
+		CONFIG.flash_umem_id = mystrtol(q, 10);
+		if (CONFIG.flash_umem_id < 0) {
+			TRACE_CONFIG("The flash umem id should not be negative.\n");
+			return -1;
+		}
+	} else if (strcmp(p, "flash_nf") == 0) {
+		CONFIG.flash_nf_id = mystrtol(q, 10);
+		if (CONFIG.flash_nf_id < 0) {
+			TRACE_CONFIG("The flash nf id should not be negative.\n");
+			return -1;
+		}
+	} else if (strcmp(p, "flash_rss_key") == 0) {
+		CONFIG.flash_rss_key = mystrtol(q, 10);
 #endif
 	} else if (strcmp(p, "multiprocess") == 0) {
 		SetMultiProcessSupport(line + strlen(p) + 1);
@@ -748,8 +792,13 @@ void PrintConfiguration(void)
 			TRACE_CONFIG("Current core is not master (for multi-process)\n");
 	}
 	TRACE_CONFIG("Maximum number of preallocated buffers per core: %d\n", CONFIG.max_num_buffers);
-	TRACE_CONFIG("Receive buffer size: %d\n", CONFIG.rcvbuf_size);
+	TRACE_CONFIG("Receive buffer size: %d, mirrored: %s\n", CONFIG.rcvbuf_size, CONFIG.rcvbuf_mirror ? "on" : "off");
 	TRACE_CONFIG("Send buffer size: %d\n", CONFIG.sndbuf_size);
+#ifndef DISABLE_AFXDP
+	if (current_iomodule_func == &afxdp_module_func)
+		TRACE_CONFIG("Flash umem id: %d, nf id: %d, rss key: %s\n", CONFIG.flash_umem_id, CONFIG.flash_nf_id,
+			     CONFIG.flash_rss_key ? "on" : "off");
+#endif
 
 	if (CONFIG.tcp_timeout > 0) {
 		TRACE_CONFIG("TCP timeout seconds: %d\n", USEC_TO_SEC(CONFIG.tcp_timeout * TIME_TICK));
@@ -757,6 +806,10 @@ void PrintConfiguration(void)
 		TRACE_CONFIG("TCP timeout check disabled.\n");
 	}
 	TRACE_CONFIG("TCP timewait seconds: %d\n", USEC_TO_SEC(CONFIG.tcp_timewait * TIME_TICK));
+	TRACE_CONFIG("TCP congestion control: %s\n", TCPCCDefault()->name);
+	TRACE_CONFIG("TCP GRO: %s, GSO: %s\n", CONFIG.tcp_gro ? "on" : "off", CONFIG.tcp_gso ? "on" : "off");
+	TRACE_CONFIG("TCP SYN cookies: %s\n",
+		     CONFIG.tcp_syncookies == SYNCOOKIES_ALWAYS ? "always" : CONFIG.tcp_syncookies ? "on overflow" : "off");
 	TRACE_CONFIG("NICs to print statistics:");
 	for (i = 0; i < CONFIG.eths_num; i++) {
 		if (CONFIG.eths[i].stat_print) {
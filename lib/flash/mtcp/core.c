@@ -53,11 +53,15 @@
 #include "tcp_out.h"
 #include "mtcp_api.h"
 #include "eventpoll.h"
-#include "logger.h"
+#include "log_ring.h"
 #include "config.h"
 #include "arp.h"
 #include "ip_out.h"
 #include "timer.h"
+#include "clock.h"
+#include "tcp_gro.h"
+#include "tcp_syncookie.h"
+#include "tcp_cc.h"
 #include "debug.h"
 #if USE_CCP
 #include "ccp.h"
@@ -96,13 +100,9 @@
 /*----------------------------------------------------------------------------*/
 /* handlers for threads */
 struct mtcp_thread_context *g_pctx[MAX_CPUS] = { 0 };
-struct log_thread_context *g_logctx[MAX_CPUS] = { 0 };
 /*----------------------------------------------------------------------------*/
 static pthread_t g_thread[MAX_CPUS] = { 0 };
-#if defined(PKTDUMP) || defined(DBGMSG) || defined(DBGFUNC) || defined(STREAM) || defined(STATE) || defined(STAT) || defined(APP) || \
-	defined(EPOLL) || defined(DUMP_STREAM)
-static pthread_t log_thread[MAX_CPUS] = { 0 };
-#endif
+static int g_created[MAX_CPUS] = { 0 };
 #if USE_CCP
 static pthread_t ccp_run_thread = 0;
 static pthread_t ccp_recv_thread[MAX_CPUS] = { 0 };
@@ -230,6 +230,10 @@ static inline void PrintThreadNetworkStats(mtcp_manager_t mtcp, struct net_stat
 		}
 #endif
 	}
+	ns->rx_gro_merged = mtcp->nstat.rx_gro_merged - mtcp->p_nstat.rx_gro_merged;
+	ns->tx_gso_segs = mtcp->nstat.tx_gso_segs - mtcp->p_nstat.tx_gso_segs;
+	ns->tx_syncookies = mtcp->nstat.tx_syncookies - mtcp->p_nstat.tx_syncookies;
+	ns->rx_syncookies = mtcp->nstat.rx_syncookies - mtcp->p_nstat.rx_syncookies;
 #ifdef ENABLELRO
 	ns->rx_gdptbytes = mtcp->nstat.rx_gdptbytes - mtcp->p_nstat.rx_gdptbytes;
 	ns->tx_gdptbytes = mtcp->nstat.tx_gdptbytes - mtcp->p_nstat.tx_gdptbytes;
@@ -315,6 +319,10 @@ static inline void PrintNetworkStats(mtcp_manager_t mtcp, uint32_t cur_ts)
 				g_nstat.tx_drops[j] += ns.tx_drops[j];
 				g_nstat.tx_bytes[j] += ns.tx_bytes[j];
 			}
+			g_nstat.rx_gro_merged += ns.rx_gro_merged;
+			g_nstat.tx_gso_segs += ns.tx_gso_segs;
+			g_nstat.tx_syncookies += ns.tx_syncookies;
+			g_nstat.rx_syncookies += ns.rx_syncookies;
 #ifdef ENABLELRO
 			g_nstat.rx_gdptbytes += ns.rx_gdptbytes;
 			g_nstat.tx_gdptbytes += ns.tx_gdptbytes;
@@ -333,6 +341,12 @@ static inline void PrintNetworkStats(mtcp_manager_t mtcp, uint32_t cur_ts)
 				GBPS(g_nstat.rx_bytes[i]), g_nstat.tx_packets[i], GBPS(g_nstat.tx_bytes[i]));
 		}
 	}
+	if (CONFIG.tcp_gro || CONFIG.tcp_gso)
+		fprintf(stderr, "[ ALL ] GRO merged: %7ld(pps), GSO segs: %7ld(pps)\n", g_nstat.rx_gro_merged,
+			g_nstat.tx_gso_segs);
+	if (CONFIG.tcp_syncookies)
+		fprintf(stderr, "[ ALL ] SYN cookies sent: %7ld(pps), accepted: %7ld(pps)\n", g_nstat.tx_syncookies,
+			g_nstat.rx_syncookies);
 #ifdef ENABLELRO
 	fprintf(stderr, "[ ALL ] Goodput RX: %5.2lf(Gbps), TX: %5.2lf(Gbps)\n", GBPS(g_nstat.rx_gdptbytes),
 		GBPS(g_nstat.tx_gdptbytes));
@@ -463,37 +477,54 @@ static inline void FlushReadEvents(mtcp_manager_t mtcp, int thresh)
 static inline void FlushEpollEvents(mtcp_manager_t mtcp, uint32_t cur_ts)
 {
 	struct mtcp_epoll *ep = mtcp->ep;
-	struct event_queue *usrq = ep->usr_queue;
-	struct event_queue *mtcpq = ep->mtcp_queue;
-
-	pthread_mutex_lock(&ep->epoll_lock);
-	if (ep->mtcp_queue->num_events > 0) {
-		/* while mtcp_queue have events */
-		/* and usr_queue is not full */
-		while (mtcpq->num_events > 0 && usrq->num_events < usrq->size) {
-			/* copy the event from mtcp_queue to usr_queue */
-			usrq->events[usrq->end++] = mtcpq->events[mtcpq->start++];
-
-			if (usrq->end >= usrq->size)
-				usrq->end = 0;
-			usrq->num_events++;
-
-			if (mtcpq->start >= mtcpq->size)
-				mtcpq->start = 0;
-			mtcpq->num_events--;
-		}
-	}
+	int published;
 
-	/* if there are pending events, wake up user */
-	if (ep->waiting && (ep->usr_queue->num_events > 0 || ep->usr_shadow_queue->num_events > 0)) {
+	/* move mtcp_queue to usr_queue without taking any lock */
+	published = PublishEpollEvents(ep);
+
+	/* if there are new events, wake up user (only if it sleeps) */
+	if (published > 0 && WakeupEpoll(ep)) {
 		STAT_COUNT(mtcp->runstat.rounds_epoll);
-		TRACE_EPOLL("Broadcasting events. num: %d, cur_ts: %u, prev_ts: %u\n", ep->usr_queue->num_events, cur_ts,
-			    mtcp->ts_last_event);
+		TRACE_EPOLL("Broadcasting events. num: %d, cur_ts: %u, prev_ts: %u\n", published, cur_ts, mtcp->ts_last_event);
 		mtcp->ts_last_event = cur_ts;
 		ep->stat.wakes++;
-		pthread_cond_signal(&ep->epoll_cond);
 	}
-	pthread_mutex_unlock(&ep->epoll_lock);
+}
+/*----------------------------------------------------------------------------*/
+/*
+ * Congestion control and pacing state is only touched by the mTCP thread,
+ * setsockopt() leaves the new values on the stream and queues it here.
+ */
+static inline void HandleSocketOptions(mtcp_manager_t mtcp, tcp_stream *stream)
+{
+	struct tcp_send_vars *sndvar = stream->sndvar;
+	const struct tcp_cc_ops *ops;
+#if PACING_ENABLED
+	uint64_t rate = 0;
+	uint8_t set_rate;
+#endif
+
+	SQ_LOCK(&mtcp->ctx->optq_lock);
+	sndvar->on_optq = FALSE;
+	ops = sndvar->cc_pending;
+	sndvar->cc_pending = NULL;
+#if PACING_ENABLED
+	set_rate = sndvar->pacing_pending;
+	if (set_rate)
+		rate = sndvar->pacing_rate_pending;
+	sndvar->pacing_pending = FALSE;
+#endif
+	SQ_UNLOCK(&mtcp->ctx->optq_lock);
+
+	if (stream->state == TCP_ST_CLOSED)
+		return;
+
+	if (ops && sndvar->cc_ops != ops)
+		TCPCCInit(stream, ops, mtcp->cur_tsc);
+#if PACING_ENABLED
+	if (set_rate)
+		SetPacingRate(&stream->pacer, rate);
+#endif
 }
 /*----------------------------------------------------------------------------*/
 static inline void HandleApplicationCalls(mtcp_manager_t mtcp, uint32_t cur_ts)
@@ -520,6 +551,11 @@ static inline void HandleApplicationCalls(mtcp_manager_t mtcp, uint32_t cur_ts)
 		EnqueueACK(mtcp, stream, cur_ts, ACK_OPT_AGGREGATE);
 	}
 
+	/* socket option handling */
+	while ((stream = StreamDequeue(mtcp->optq))) {
+		HandleSocketOptions(mtcp, stream);
+	}
+
 	/* close handling */
 	handled = delayed = 0;
 	control = send = ack = 0;
@@ -689,6 +725,10 @@ static inline void WritePacketsToChunks(mtcp_manager_t mtcp, uint32_t cur_ts)
 	/* Set the threshold to CONFIG.max_concurrency to send ACK immediately */
 	/* Otherwise, set to appropriate value (e.g. thresh) */
 	assert(mtcp->g_sender != NULL);
+
+	/* paced streams that are due go back on their send lists */
+	PacingWheelRun(mtcp);
+
 	if (mtcp->g_sender->control_list_cnt)
 		WriteTCPControlList(mtcp, mtcp->g_sender, cur_ts, thresh);
 	if (mtcp->g_sender->ack_list_cnt)
@@ -742,11 +782,7 @@ static void InterruptApplication(mtcp_manager_t mtcp)
 
 	/* interrupt if the mtcp_epoll_wait() is waiting */
 	if (mtcp->ep) {
-		pthread_mutex_lock(&mtcp->ep->epoll_lock);
-		if (mtcp->ep->waiting) {
-			pthread_cond_signal(&mtcp->ep->epoll_cond);
-		}
-		pthread_mutex_unlock(&mtcp->ep->epoll_lock);
+		WakeupEpoll(mtcp->ep);
 	}
 
 	/* interrupt if the accept() is waiting */
@@ -763,112 +799,119 @@ static void InterruptApplication(mtcp_manager_t mtcp)
 	}
 }
 /*----------------------------------------------------------------------------*/
-static void RunMainLoop(struct mtcp_thread_context *ctx)
+/* one pass of rx, tcp processing, timers, event flush and tx;
+ * returns the number of packets received */
+static int RunMainLoopOnce(struct mtcp_thread_context *ctx)
 {
 	mtcp_manager_t mtcp = ctx->mtcp_manager;
 	int i;
-	int recv_cnt;
+	int recv_cnt, recv_total;
 	int rx_inf, tx_inf;
 	struct timeval cur_ts = { 0 };
-	uint32_t ts, ts_prev;
+	uint32_t ts;
 	int thresh;
 
-	gettimeofday(&cur_ts, NULL);
-	TRACE_DBG("CPU %d: mtcp thread running.\n", ctx->cpu);
+	STAT_COUNT(mtcp->runstat.rounds);
+	recv_total = 0;
 
-	ts = ts_prev = 0;
-	while ((!ctx->done || mtcp->flow_cnt) && !ctx->exit) {
-		STAT_COUNT(mtcp->runstat.rounds);
-		recv_cnt = 0;
-
-		gettimeofday(&cur_ts, NULL);
-		ts = TIMEVAL_TO_TS(&cur_ts);
-		mtcp->cur_ts = ts;
-		for (rx_inf = 0; rx_inf < CONFIG.eths_num; rx_inf++) {
-			static uint16_t len;
-			static uint8_t *pktbuf;
-			recv_cnt = mtcp->iom->recv_pkts(ctx, rx_inf);
-			STAT_COUNT(mtcp->runstat.rounds_rx_try);
-
-			for (i = 0; i < recv_cnt; i++) {
-				pktbuf = mtcp->iom->get_rptr(mtcp->ctx, rx_inf, i, &len);
-				if (pktbuf != NULL) {
-					if (ProcessPacket(mtcp, rx_inf, ts, pktbuf, len) != TRUE)
-						mtcp->iom->release_pkt(mtcp->ctx, rx_inf, pktbuf, len);
-				}
+	gettimeofday(&cur_ts, NULL);
+	ts = TIMEVAL_TO_TS(&cur_ts);
+	mtcp->cur_ts = ts;
+	mtcp->cur_tsc = ReadTSC();
+	/* no neighbor entry is held across rounds */
+	ARPQuiescent(mtcp);
+	for (rx_inf = 0; rx_inf < CONFIG.eths_num; rx_inf++) {
+		static uint16_t len;
+		static uint8_t *pktbuf;
+		recv_cnt = mtcp->iom->recv_pkts(ctx, rx_inf);
+		STAT_COUNT(mtcp->runstat.rounds_rx_try);
+
+		for (i = 0; i < recv_cnt; i++) {
+			pktbuf = mtcp->iom->get_rptr(mtcp->ctx, rx_inf, i, &len);
+			if (pktbuf != NULL) {
+				if (mtcp->gro)
+					TCPGROReceive(mtcp, rx_inf, ts, pktbuf, len);
+				else if (ProcessPacket(mtcp, rx_inf, ts, pktbuf, len) != TRUE)
+					mtcp->iom->release_pkt(mtcp->ctx, rx_inf, pktbuf, len);
+			}
 #ifdef NETSTAT
-				else
-					mtcp->nstat.rx_errors[rx_inf]++;
+			else
+				mtcp->nstat.rx_errors[rx_inf]++;
 #endif
-			}
+		}
+		/* chained frames live in the rx ring until this burst is dropped */
+		if (mtcp->gro)
+			TCPGROFlush(mtcp, ts);
 #ifndef DISABLE_AFXDP
-			mtcp->iom->drop_pkts(mtcp->ctx);
+		mtcp->iom->drop_pkts(mtcp->ctx);
 #endif
-		}
-		STAT_COUNT(mtcp->runstat.rounds_rx);
+		if (recv_cnt > 0)
+			recv_total += recv_cnt;
+	}
+	STAT_COUNT(mtcp->runstat.rounds_rx);
 
-		/* interaction with application */
-		if (mtcp->flow_cnt > 0) {
-			/* check retransmission timeout and timewait expire */
+	/* interaction with application */
+	if (mtcp->flow_cnt > 0) {
+		/* check retransmission timeout and timewait expire */
 #if 0
-			thresh = (int)mtcp->flow_cnt / (TS_TO_USEC(PER_STREAM_TCHECK));
-			assert(thresh >= 0);
-			if (thresh == 0)
-				thresh = 1;
-			if (recv_cnt > 0 && thresh > recv_cnt)
-				thresh = recv_cnt;
+		thresh = (int)mtcp->flow_cnt / (TS_TO_USEC(PER_STREAM_TCHECK));
+		assert(thresh >= 0);
+		if (thresh == 0)
+			thresh = 1;
+		if (recv_cnt > 0 && thresh > recv_cnt)
+			thresh = recv_cnt;
 #endif
-			thresh = CONFIG.max_concurrency;
+		thresh = CONFIG.max_concurrency;
 
-			/* Eunyoung, you may fix this later 
-			 * if there is no rcv packet, we will send as much as possible
-			 */
-			if (thresh == -1)
-				thresh = CONFIG.max_concurrency;
+		/* Eunyoung, you may fix this later 
+		 * if there is no rcv packet, we will send as much as possible
+		 */
+		if (thresh == -1)
+			thresh = CONFIG.max_concurrency;
 
-			CheckRtmTimeout(mtcp, ts, thresh);
-			CheckTimewaitExpire(mtcp, ts, CONFIG.max_concurrency);
+		CheckRtmTimeout(mtcp, ts, thresh);
+		CheckTimewaitExpire(mtcp, ts, CONFIG.max_concurrency);
 
-			if (CONFIG.tcp_timeout > 0 && ts != ts_prev) {
-				CheckConnectionTimeout(mtcp, ts, thresh);
-			}
+		if (CONFIG.tcp_timeout > 0 && ts != mtcp->ts_prev) {
+			CheckConnectionTimeout(mtcp, ts, thresh);
 		}
+	}
 
-		/* if epoll is in use, flush all the queued events */
-		if (mtcp->ep) {
-			FlushEpollEvents(mtcp, ts);
-		}
+	/* if epoll is in use, flush all the queued events */
+	if (mtcp->ep) {
+		FlushEpollEvents(mtcp, ts);
+	}
 
-		if (mtcp->flow_cnt > 0) {
-			/* hadnle stream queues  */
-			HandleApplicationCalls(mtcp, ts);
-		}
+	if (mtcp->flow_cnt > 0) {
+		/* hadnle stream queues  */
+		HandleApplicationCalls(mtcp, ts);
+	}
 
-		WritePacketsToChunks(mtcp, ts);
+	WritePacketsToChunks(mtcp, ts);
 
-		/* send packets from write buffer */
-		/* send until tx is available */
-		for (tx_inf = 0; tx_inf < CONFIG.eths_num; tx_inf++) {
-			mtcp->iom->send_pkts(ctx, tx_inf);
-		}
+	/* send packets from write buffer */
+	/* send until tx is available */
+	for (tx_inf = 0; tx_inf < CONFIG.eths_num; tx_inf++) {
+		mtcp->iom->send_pkts(ctx, tx_inf);
+	}
 
-		if (ts != ts_prev) {
-			ts_prev = ts;
-			if (ctx->cpu == mtcp_master) {
-				ARPTimer(mtcp, ts);
+	if (ts != mtcp->ts_prev) {
+		mtcp->ts_prev = ts;
+		if (ctx->cpu == mtcp_master) {
+			ARPTimer(mtcp, ts);
 #ifdef NETSTAT
-				PrintNetworkStats(mtcp, ts);
+			PrintNetworkStats(mtcp, ts);
 #endif
-			}
-		}
-
-		mtcp->iom->select(ctx);
-
-		if (ctx->interrupt) {
-			InterruptApplication(mtcp);
 		}
 	}
 
+	return recv_total;
+}
+/*----------------------------------------------------------------------------*/
+static void FinishMainLoop(struct mtcp_thread_context *ctx)
+{
+	mtcp_manager_t mtcp = ctx->mtcp_manager;
+
 #if TESTING
 	DestroyRemainingFlows(mtcp);
 #endif
@@ -881,6 +924,26 @@ static void RunMainLoop(struct mtcp_thread_context *ctx)
 	TRACE_INFO("MTCP thread %d finished.\n", ctx->cpu);
 }
 /*----------------------------------------------------------------------------*/
+static void RunMainLoop(struct mtcp_thread_context *ctx)
+{
+	mtcp_manager_t mtcp = ctx->mtcp_manager;
+
+	TRACE_DBG("CPU %d: mtcp thread running.\n", ctx->cpu);
+
+	mtcp->ts_prev = 0;
+	while ((!ctx->done || mtcp->flow_cnt) && !ctx->exit) {
+		RunMainLoopOnce(ctx);
+
+		mtcp->iom->select(ctx);
+
+		if (ctx->interrupt) {
+			InterruptApplication(mtcp);
+		}
+	}
+
+	FinishMainLoop(ctx);
+}
+/*----------------------------------------------------------------------------*/
 static struct mtcp_sender *CreateMTCPSender(int ifidx)
 {
 	struct mtcp_sender *sender;
@@ -920,6 +983,7 @@ static mtcp_manager_t InitializeMTCPManager(struct mtcp_thread_context *ctx)
 		fprintf(stderr, "Failed to allocate mtcp_manager.\n");
 		return NULL;
 	}
+	ARPQuiescent(mtcp);
 	g_mtcp[ctx->cpu] = mtcp;
 
 	mtcp->tcp_flow_table = CreateHashtable(HashFlow, EqualFlow, NUM_BINS_FLOWS);
@@ -986,7 +1050,7 @@ static mtcp_manager_t InitializeMTCPManager(struct mtcp_thread_context *ctx)
 		return NULL;
 	}
 
-	mtcp->rbm_rcv = RBManagerCreate(mtcp, CONFIG.rcvbuf_size, CONFIG.max_num_buffers);
+	mtcp->rbm_rcv = RBManagerCreate(mtcp, CONFIG.rcvbuf_size, CONFIG.max_num_buffers, CONFIG.rcvbuf_mirror);
 	if (!mtcp->rbm_rcv) {
 		CTRACE_ERROR("Failed to create recv ring buffer.\n");
 		return NULL;
@@ -1018,8 +1082,6 @@ static mtcp_manager_t InitializeMTCPManager(struct mtcp_thread_context *ctx)
 		CTRACE_ERROR("Failed to create file for logging.\n");
 		return NULL;
 	}
-	mtcp->sp_fd = g_logctx[ctx->cpu]->pair_sp_fd;
-	mtcp->logger = g_logctx[ctx->cpu];
 
 	mtcp->connectq = CreateStreamQueue(BACKLOG_SIZE);
 	if (!mtcp->connectq) {
@@ -1036,6 +1098,11 @@ static mtcp_manager_t InitializeMTCPManager(struct mtcp_thread_context *ctx)
 		CTRACE_ERROR("Failed to create ack queue.\n");
 		return NULL;
 	}
+	mtcp->optq = CreateStreamQueue(CONFIG.max_concurrency);
+	if (!mtcp->optq) {
+		CTRACE_ERROR("Failed to create socket option queue.\n");
+		return NULL;
+	}
 	mtcp->closeq = CreateStreamQueue(CONFIG.max_concurrency);
 	if (!mtcp->closeq) {
 		CTRACE_ERROR("Failed to create close queue.\n");
@@ -1079,6 +1146,20 @@ static mtcp_manager_t InitializeMTCPManager(struct mtcp_thread_context *ctx)
 	TAILQ_INIT(&mtcp->timewait_list);
 	TAILQ_INIT(&mtcp->timeout_list);
 
+	mtcp->pacing_wheel = CreatePacingWheel();
+	if (!mtcp->pacing_wheel) {
+		CTRACE_ERROR("Failed to create pacing wheel.\n");
+		return NULL;
+	}
+
+	if (CONFIG.tcp_gro) {
+		mtcp->gro = CreateTCPGRO();
+		if (!mtcp->gro) {
+			CTRACE_ERROR("Failed to allocate GRO table.\n");
+			return NULL;
+		}
+	}
+
 #if BLOCKING_SUPPORT
 	TAILQ_INIT(&mtcp->rcv_br_list);
 	TAILQ_INIT(&mtcp->snd_br_list);
@@ -1146,10 +1227,9 @@ static void *CCPRecvLoopThread(void *arg)
 }
 #endif
 /*----------------------------------------------------------------------------*/
-static void *MTCPRunThread(void *arg)
+/* per-core stack setup, run on the thread that will drive the stack */
+static struct mtcp_thread_context *InitializeMTCPThread(int cpu)
 {
-	mctx_t mctx = (mctx_t)arg;
-	int cpu = mctx->cpu;
 	int working;
 	struct mtcp_manager *mtcp;
 	struct mtcp_thread_context *ctx;
@@ -1205,6 +1285,7 @@ static void *MTCPRunThread(void *arg)
 	SQ_LOCK_INIT(&ctx->sendq_lock, "ctx->sendq_lock", exit(-1));
 	SQ_LOCK_INIT(&ctx->ackq_lock, "ctx->ackq_lock", exit(-1));
 	SQ_LOCK_INIT(&ctx->destroyq_lock, "ctx->destroyq_lock", exit(-1));
+	SQ_LOCK_INIT(&ctx->optq_lock, "ctx->optq_lock", exit(-1));
 
 	/* remember this context pointer for signal processing */
 	g_pctx[cpu] = ctx;
@@ -1233,12 +1314,13 @@ static void *MTCPRunThread(void *arg)
 
 	fprintf(stderr, "CPU %d: initialization finished.\n", cpu);
 
-	sem_post(&g_init_sem[ctx->cpu]);
-
-	/* start the main loop */
-	RunMainLoop(ctx);
-
+	return ctx;
+}
+/*----------------------------------------------------------------------------*/
+static void DestroyMTCPThread(int cpu)
+{
 	struct mtcp_context m;
+
 	m.cpu = cpu;
 	mtcp_free_context(&m);
 	/* destroy hash tables */
@@ -1248,7 +1330,25 @@ static void *MTCPRunThread(void *arg)
 #endif
 	DestroyHashtable(g_mtcp[cpu]->listeners);
 
-	TRACE_DBG("MTCP thread %d finished.\n", ctx->cpu);
+	TRACE_DBG("MTCP thread %d finished.\n", cpu);
+}
+/*----------------------------------------------------------------------------*/
+static void *MTCPRunThread(void *arg)
+{
+	mctx_t mctx = (mctx_t)arg;
+	int cpu = mctx->cpu;
+	struct mtcp_thread_context *ctx;
+
+	ctx = InitializeMTCPThread(cpu);
+	if (!ctx)
+		return NULL;
+
+	sem_post(&g_init_sem[cpu]);
+
+	/* start the main loop */
+	RunMainLoop(ctx);
+
+	DestroyMTCPThread(cpu);
 
 	return 0;
 }
@@ -1261,10 +1361,9 @@ int MTCPDPDKRunThread(void *arg)
 }
 #endif
 /*----------------------------------------------------------------------------*/
-mctx_t mtcp_create_context(int cpu)
+static mctx_t AllocateContext(int cpu)
 {
 	mctx_t mctx;
-	int ret;
 
 	if (cpu >= CONFIG.num_cores) {
 		TRACE_ERROR("Failed initialize new mtcp context. "
@@ -1274,17 +1373,11 @@ mctx_t mtcp_create_context(int cpu)
 	}
 
 	/* check if mtcp_create_context() was already initialized */
-	if (g_logctx[cpu] != NULL) {
+	if (g_created[cpu]) {
 		TRACE_ERROR("%s was already initialized before!\n", __FUNCTION__);
 		return NULL;
 	}
 
-	ret = sem_init(&g_init_sem[cpu], 0, 0);
-	if (ret) {
-		TRACE_ERROR("Failed initialize init_sem.\n");
-		return NULL;
-	}
-
 	mctx = (mctx_t)calloc(1, sizeof(struct mtcp_context));
 	if (!mctx) {
 		TRACE_ERROR("Failed to allocate memory for mtcp_context.\n");
@@ -1292,25 +1385,38 @@ mctx_t mtcp_create_context(int cpu)
 	}
 	mctx->cpu = cpu;
 
-	/* initialize logger */
-	g_logctx[cpu] = (struct log_thread_context *)calloc(1, sizeof(struct log_thread_context));
-	if (!g_logctx[cpu]) {
-		perror("calloc");
-		TRACE_ERROR("Failed to allocate memory for log thread context.\n");
-		free(mctx);
-		return NULL;
+	/* thread_printf() needs no per-core logger: every thread logs
+	   into its own ring on first use */
+	g_created[cpu] = TRUE;
+
+	return mctx;
+}
+/*----------------------------------------------------------------------------*/
+static void MarkContextRunning(int cpu)
+{
+	running[cpu] = TRUE;
+
+	if (mtcp_master < 0) {
+		mtcp_master = cpu;
+		TRACE_INFO("CPU %d is now the master thread.\n", mtcp_master);
 	}
-	InitLogThreadContext(g_logctx[cpu], cpu);
-#if defined(PKTDUMP) || defined(DBGMSG) || defined(DBGFUNC) || defined(STREAM) || defined(STATE) || defined(STAT) || defined(APP) || \
-	defined(EPOLL) || defined(DUMP_STREAM)
-	if (pthread_create(&log_thread[cpu], NULL, ThreadLogMain, (void *)g_logctx[cpu])) {
-		perror("pthread_create");
-		TRACE_ERROR("Failed to create log thread\n");
-		free(g_logctx[cpu]);
-		free(mctx);
+}
+/*----------------------------------------------------------------------------*/
+mctx_t mtcp_create_context(int cpu)
+{
+	mctx_t mctx;
+	int ret;
+
+	mctx = AllocateContext(cpu);
+	if (!mctx)
+		return NULL;
+
+	ret = sem_init(&g_init_sem[cpu], 0, 0);
+	if (ret) {
+		TRACE_ERROR("Failed initialize init_sem.\n");
 		return NULL;
 	}
-#endif
+
 #ifndef DISABLE_DPDK
 	/* Wake up mTCP threads (wake up I/O threads) */
 	if (current_iomodule_func == &dpdk_module_func) {
@@ -1339,21 +1445,86 @@ mctx_t mtcp_create_context(int cpu)
 	sem_wait(&g_init_sem[cpu]);
 	sem_destroy(&g_init_sem[cpu]);
 
-	running[cpu] = TRUE;
+	MarkContextRunning(cpu);
 
-	if (mtcp_master < 0) {
-		mtcp_master = cpu;
-		TRACE_INFO("CPU %d is now the master thread.\n", mtcp_master);
+	return mctx;
+}
+/*----------------------------------------------------------------------------*/
+mctx_t mtcp_create_context_inline(int cpu)
+{
+	mctx_t mctx;
+	struct mtcp_thread_context *ctx;
+
+	mctx = AllocateContext(cpu);
+	if (!mctx)
+		return NULL;
+
+	/* the calling thread becomes the mtcp thread of this core */
+	ctx = InitializeMTCPThread(cpu);
+	if (!ctx) {
+		TRACE_ERROR("Failed to initialize inline mtcp context on cpu %d.\n", cpu);
+		free(mctx);
+		return NULL;
 	}
+	ctx->run_inline = TRUE;
+	ctx->mtcp_manager->ts_prev = 0;
+	g_thread[cpu] = ctx->thread;
+
+	TRACE_DBG("CPU %d: mtcp running inline in the application thread.\n", cpu);
+
+	MarkContextRunning(cpu);
 
 	return mctx;
 }
 /*----------------------------------------------------------------------------*/
+int mtcp_poll_once(mctx_t mctx)
+{
+	mtcp_manager_t mtcp;
+	struct mtcp_thread_context *ctx;
+	int ret;
+
+	mtcp = GetMTCPManager(mctx);
+	if (!mtcp) {
+		return -1;
+	}
+	ctx = mtcp->ctx;
+
+	if (!ctx->run_inline) {
+		TRACE_API("CPU %d: context is driven by its own mtcp thread.\n", mctx->cpu);
+		errno = EINVAL;
+		return -1;
+	}
+
+	ret = RunMainLoopOnce(ctx);
+
+	/* hand ready events straight to the application */
+	if (mtcp->ep && mtcp->event_cb) {
+		ret += DispatchEpollEvents(mctx, mtcp->ep, mtcp->event_cb, mtcp->event_arg);
+	}
+
+	if (ctx->interrupt) {
+		ctx->interrupt = FALSE;
+		errno = EINTR;
+		return -1;
+	}
+
+	return ret;
+}
+/*----------------------------------------------------------------------------*/
 void mtcp_destroy_context(mctx_t mctx)
 {
 	struct mtcp_thread_context *ctx = g_pctx[mctx->cpu];
-	if (ctx != NULL)
+	if (ctx != NULL) {
 		ctx->done = 1;
+		if (ctx->run_inline) {
+			/* no mtcp thread to finish the job, so drain the
+			   remaining flows and tear down right here */
+			while (ctx->mtcp_manager->flow_cnt && !ctx->exit)
+				RunMainLoopOnce(ctx);
+			FinishMainLoop(ctx);
+			DestroyMTCPThread(mctx->cpu);
+		}
+	}
 	free(mctx);
 }
 /*----------------------------------------------------------------------------*/
@@ -1361,8 +1532,7 @@ void mtcp_free_context(mctx_t mctx)
 {
 	struct mtcp_thread_context *ctx = g_pctx[mctx->cpu];
 	struct mtcp_manager *mtcp = ctx->mtcp_manager;
-	struct log_thread_context *log_ctx = mtcp->logger;
-	int ret, i;
+	int i;
 
 	if (g_pctx[mctx->cpu] == NULL)
 		return;
@@ -1399,16 +1569,10 @@ void mtcp_free_context(mctx_t mctx)
 		}
 	}
 
-	log_ctx->done = 1;
-	ret = write(log_ctx->pair_sp_fd, "F", 1);
-	assert(ret == 1);
-	UNUSED(ret);
-#if defined(PKTDUMP) || defined(DBGMSG) || defined(DBGFUNC) || defined(STREAM) || defined(STATE) || defined(STAT) || defined(APP) || \
-	defined(EPOLL) || defined(DUMP_STREAM)
-	pthread_join(log_thread[ctx->cpu], NULL);
-#endif
+	/* nothing of this core may be left in a ring once log_fp is gone */
+	flush_log_data(mtcp);
 	fclose(mtcp->log_fp);
-	TRACE_LOG("Log thread %d joined.\n", mctx->cpu);
+	TRACE_LOG("Logs of CPU %d flushed.\n", mctx->cpu);
 
 #if USE_CCP
 	destroy_ccp_connection(mtcp);
@@ -1429,6 +1593,10 @@ void mtcp_free_context(mctx_t mctx)
 		DestroyStreamQueue(mtcp->ackq);
 		mtcp->ackq = NULL;
 	}
+	if (mtcp->optq) {
+		DestroyStreamQueue(mtcp->optq);
+		mtcp->optq = NULL;
+	}
 	if (mtcp->closeq) {
 		DestroyStreamQueue(mtcp->closeq);
 		mtcp->closeq = NULL;
@@ -1455,6 +1623,12 @@ void mtcp_free_context(mctx_t mctx)
 		DestroyMTCPSender(mtcp->n_sender[i]);
 	}
 
+	DestroyPacingWheel(mtcp->pacing_wheel);
+	mtcp->pacing_wheel = NULL;
+	DestroyTCPGRO(mtcp->gro);
+	mtcp->gro = NULL;
+	ARPOffline(mtcp);
+
 	MPDestroy(mtcp->rv_pool);
 	MPDestroy(mtcp->sv_pool);
 	MPDestroy(mtcp->flow_pool);
@@ -1470,14 +1644,12 @@ void mtcp_free_context(mctx_t mctx)
 	SQ_LOCK_DESTROY(&ctx->sendq_lock);
 	SQ_LOCK_DESTROY(&ctx->ackq_lock);
 	SQ_LOCK_DESTROY(&ctx->destroyq_lock);
+	SQ_LOCK_DESTROY(&ctx->optq_lock);
 
 	//TRACE_INFO("MTCP thread %d destroyed.\n", mctx->cpu);
 	mtcp->iom->destroy_handle(ctx);
 	free(ctx);
-	if (g_logctx[mctx->cpu]) {
-		free(g_logctx[mctx->cpu]);
-		g_logctx[mctx->cpu] = NULL;
-	}
+	g_created[mctx->cpu] = FALSE;
 	g_pctx[mctx->cpu] = NULL;
 }
 /*----------------------------------------------------------------------------*/
@@ -1605,6 +1777,11 @@ int mtcp_init(const char *config_file)
 	LoadARPTable();
 	PrintARPTable();
 
+	InitSYNCookies();
+
+	/* calibrate the pacing clock once, before any thread needs it */
+	GetTSCHz();
+
 	if (signal(SIGUSR1, HandleSignal) == SIG_ERR) {
 		perror("signal, SIGUSR1");
 		return -1;
@@ -1623,6 +1800,7 @@ int mtcp_init(const char *config_file)
 /*----------------------------------------------------------------------------*/
 void mtcp_destroy(void)
 {
+	struct log_ring_stats lst;
 	int i;
 #ifndef DISABLE_DPDK
 	int master = rte_get_master_lcore();
@@ -1652,6 +1830,10 @@ void mtcp_destroy(void)
 	onvm_nflib_stop(CONFIG.nf_local_ctx);
 #endif
 
+	log_ring_get_stats(&lst);
+	if (lst.dropped)
+		TRACE_CONFIG("%lu log records dropped on full log rings.\n", lst.dropped);
+
 	TRACE_INFO("All MTCP threads are joined.\n");
 }
 /*----------------------------------------------------------------------------*/
@@ -36,55 +36,27 @@
 #include <stdarg.h>
 #include "debug.h"
 #include "tcp_in.h"
-#include "logger.h"
+#include "log_ring.h"
 
 /*----------------------------------------------------------------------------*/
+/* writes out what every thread has logged so far */
 void flush_log_data(mtcp_manager_t mtcp)
 {
-	int ret = 0;
-	if (mtcp->w_buffer) {
-		EnqueueJobBuffer(mtcp->logger, mtcp->w_buffer);
-		ret = write(mtcp->sp_fd, "A", 1);
-		if (ret != 1) {
-			TRACE_INFO("Failed to flush logs in the buffer.\n");
-			perror("write() for pipe");
-		}
-	}
+	UNUSED(mtcp);
+	log_ring_flush();
 }
 /*----------------------------------------------------------------------------*/
+/* records the arguments on this thread's log ring, the formatting happens
+ * on the ring's consumer */
 void thread_printf(mtcp_manager_t mtcp, FILE *f_idx, const char *_Format, ...)
 {
 	va_list argptr;
-	va_start(argptr, _Format);
-
-#define PRINT_LIMIT 4096
-	int len;
-	log_buff *wbuf;
 
 	assert(f_idx != NULL);
+	UNUSED(mtcp);
 
-	pthread_mutex_lock(&mtcp->logger->mutex);
-	wbuf = mtcp->w_buffer;
-	if (wbuf && (wbuf->buff_len + PRINT_LIMIT > LOG_BUFF_SIZE)) {
-		flush_log_data(mtcp);
-		wbuf = NULL;
-	}
-
-	if (!wbuf) {
-		do { // out of free buffers!!
-			wbuf = DequeueFreeBuffer(mtcp->logger);
-			assert(wbuf);
-		} while (!wbuf);
-		wbuf->buff_len = 0;
-		wbuf->tid = mtcp->ctx->cpu;
-		wbuf->fid = f_idx;
-		mtcp->w_buffer = wbuf;
-	}
-
-	len = vsnprintf(wbuf->buff + wbuf->buff_len, PRINT_LIMIT, _Format, argptr);
-	wbuf->buff_len += len;
-	pthread_mutex_unlock(&mtcp->logger->mutex);
-
+	va_start(argptr, _Format);
+	log_ring_vprintf(f_idx, 0, _Format, argptr);
 	va_end(argptr);
 }
 /*----------------------------------------------------------------------------*/
@@ -33,6 +33,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <assert.h>
 
@@ -108,3 +109,26 @@ uint8_t *EthernetOutput(struct mtcp_manager *mtcp, uint16_t h_proto, int nif, un
 	return (uint8_t *)(ethh + 1);
 }
 /*----------------------------------------------------------------------------*/
+/* same as EthernetOutput() but stamps a prebuilt header (Ethernet and
+ * whatever follows it) instead of building the Ethernet header */
+uint8_t *EthernetOutputPrebuilt(struct mtcp_manager *mtcp, int nif, const uint8_t *hdr, uint16_t hdrlen, uint16_t iplen)
+{
+	uint8_t *buf;
+	int eidx;
+
+	if (nif < 0)
+		return NULL;
+
+	eidx = CONFIG.nif_to_eidx[nif];
+	if (eidx < 0)
+		return NULL;
+
+	buf = mtcp->iom->get_wptr(mtcp->ctx, eidx, iplen + ETHERNET_HEADER_LEN);
+	if (!buf)
+		return NULL;
+
+	memcpy(buf, hdr, hdrlen);
+
+	return buf + ETHERNET_HEADER_LEN;
+}
+/*----------------------------------------------------------------------------*/
@@ -35,6 +35,9 @@
 #include <signal.h>
 #include <assert.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "mtcp.h"
 #include "tcp_stream.h"
@@ -49,6 +52,8 @@
 #define SPIN_BEFORE_SLEEP FALSE
 #define SPIN_THRESH 10000000
 
+#define DISPATCH_BATCH 64
+
 /*----------------------------------------------------------------------------*/
 const char *event_str[] = { "NONE", "IN", "PRI", "OUT", "ERR", "HUP", "RDHUP" };
 /*----------------------------------------------------------------------------*/
@@ -113,6 +118,89 @@ static void DestroyEventQueue(struct event_queue *eq)
 	free(eq);
 }
 /*----------------------------------------------------------------------------*/
+static struct event_ring *CreateEventRing(int size)
+{
+	struct event_ring *ring;
+	uint32_t rsize = 1;
+
+	while (rsize < (uint32_t)size)
+		rsize <<= 1;
+
+	ring = (struct event_ring *)aligned_alloc(64, sizeof(struct event_ring));
+	if (!ring)
+		return NULL;
+	memset(ring, 0, sizeof(struct event_ring));
+
+	ring->size = rsize;
+	ring->events = (struct mtcp_epoll_event_int *)calloc(rsize, sizeof(struct mtcp_epoll_event_int));
+	if (!ring->events) {
+		free(ring);
+		return NULL;
+	}
+
+	return ring;
+}
+/*----------------------------------------------------------------------------*/
+static void DestroyEventRing(struct event_ring *ring)
+{
+	if (ring->events)
+		free(ring->events);
+
+	free(ring);
+}
+/*----------------------------------------------------------------------------*/
+static inline int EventsPending(struct mtcp_epoll *ep)
+{
+	struct event_ring *ring = ep->usr_queue;
+
+	return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) != ring->head || ep->usr_shadow_queue->num_events > 0 ||
+	       __atomic_load_n(&ep->pipe_queue->num_events, __ATOMIC_RELAXED) > 0;
+}
+/*----------------------------------------------------------------------------*/
+int PublishEpollEvents(struct mtcp_epoll *ep)
+{
+	struct event_ring *ring = ep->usr_queue;
+	struct event_queue *mtcpq = ep->mtcp_queue;
+	uint32_t head, tail, mask = ring->size - 1;
+	int cnt = 0;
+
+	if (mtcpq->num_events == 0)
+		return 0;
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	tail = ring->tail;
+
+	/* while mtcp_queue have events */
+	/* and usr_queue is not full */
+	while (mtcpq->num_events > 0 && tail - head < ring->size) {
+		ring->events[tail++ & mask] = mtcpq->events[mtcpq->start++];
+
+		if (mtcpq->start >= mtcpq->size)
+			mtcpq->start = 0;
+		mtcpq->num_events--;
+		cnt++;
+	}
+
+	/* a single release store hands the whole batch to the application */
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+	return cnt;
+}
+/*----------------------------------------------------------------------------*/
+int WakeupEpoll(struct mtcp_epoll *ep)
+{
+	/* pairs with the fence in mtcp_epoll_wait(): either we see the waiter
+	 * or the waiter sees what was published before calling us */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!ep->waiting)
+		return FALSE;
+
+	__atomic_fetch_add(&ep->wake_seq, 1, __ATOMIC_RELEASE);
+	syscall(SYS_futex, &ep->wake_seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+
+	return TRUE;
+}
+/*----------------------------------------------------------------------------*/
 int mtcp_epoll_create1(mctx_t mctx, int flags)
 {
 	int rc;
@@ -165,7 +253,7 @@ int mtcp_epoll_create(mctx_t mctx, int size)
 	}
 
 	/* create event queues */
-	ep->usr_queue = CreateEventQueue(size);
+	ep->usr_queue = CreateEventRing(size);
 	if (!ep->usr_queue) {
 		FreeSocket(mctx, epsocket->id, FALSE);
 		free(ep);
@@ -174,7 +262,7 @@ int mtcp_epoll_create(mctx_t mctx, int size)
 
 	ep->usr_shadow_queue = CreateEventQueue(size);
 	if (!ep->usr_shadow_queue) {
-		DestroyEventQueue(ep->usr_queue);
+		DestroyEventRing(ep->usr_queue);
 		FreeSocket(mctx, epsocket->id, FALSE);
 		free(ep);
 		return -1;
@@ -183,29 +271,32 @@ int mtcp_epoll_create(mctx_t mctx, int size)
 	ep->mtcp_queue = CreateEventQueue(size);
 	if (!ep->mtcp_queue) {
 		DestroyEventQueue(ep->usr_shadow_queue);
-		DestroyEventQueue(ep->usr_queue);
+		DestroyEventRing(ep->usr_queue);
 		FreeSocket(mctx, epsocket->id, FALSE);
 		free(ep);
 		return -1;
 	}
 
-	TRACE_EPOLL("epoll structure of size %d created.\n", size);
-
-	mtcp->ep = ep;
-	epsocket->ep = ep;
-
-	if (pthread_mutex_init(&ep->epoll_lock, NULL)) {
+	ep->pipe_queue = CreateEventQueue(size);
+	if (!ep->pipe_queue) {
 		DestroyEventQueue(ep->mtcp_queue);
 		DestroyEventQueue(ep->usr_shadow_queue);
-		DestroyEventQueue(ep->usr_queue);
+		DestroyEventRing(ep->usr_queue);
 		FreeSocket(mctx, epsocket->id, FALSE);
 		free(ep);
 		return -1;
 	}
-	if (pthread_cond_init(&ep->epoll_cond, NULL)) {
+
+	TRACE_EPOLL("epoll structure of size %d created.\n", size);
+
+	mtcp->ep = ep;
+	epsocket->ep = ep;
+
+	if (pthread_mutex_init(&ep->epoll_lock, NULL)) {
+		DestroyEventQueue(ep->pipe_queue);
 		DestroyEventQueue(ep->mtcp_queue);
 		DestroyEventQueue(ep->usr_shadow_queue);
-		DestroyEventQueue(ep->usr_queue);
+		DestroyEventRing(ep->usr_queue);
 		FreeSocket(mctx, epsocket->id, FALSE);
 		free(ep);
 		return -1;
@@ -230,17 +321,15 @@ int CloseEpollSocket(mctx_t mctx, int epid)
 		return -1;
 	}
 
-	DestroyEventQueue(ep->usr_queue);
+	DestroyEventRing(ep->usr_queue);
 	DestroyEventQueue(ep->usr_shadow_queue);
 	DestroyEventQueue(ep->mtcp_queue);
+	DestroyEventQueue(ep->pipe_queue);
 
-	pthread_mutex_lock(&ep->epoll_lock);
 	mtcp->ep = NULL;
 	mtcp->smap[epid].ep = NULL;
-	pthread_cond_signal(&ep->epoll_cond);
-	pthread_mutex_unlock(&ep->epoll_lock);
+	WakeupEpoll(ep);
 
-	pthread_cond_destroy(&ep->epoll_cond);
 	pthread_mutex_destroy(&ep->epoll_lock);
 	free(ep);
 
@@ -349,7 +438,6 @@ int mtcp_epoll_ctl(mctx_t mctx, int epid, int op, int sockid, struct mtcp_epoll_
 
 	} else if (op == MTCP_EPOLL_CTL_MOD) {
 		if (!socket->epoll) {
-			pthread_mutex_unlock(&ep->epoll_lock);
 			errno = ENOENT;
 			return -1;
 		}
@@ -377,16 +465,78 @@ int mtcp_epoll_ctl(mctx_t mctx, int epid, int op, int sockid, struct mtcp_epoll_
 	return 0;
 }
 /*----------------------------------------------------------------------------*/
+static inline int HandleEpollEvent(mtcp_manager_t mtcp, struct mtcp_epoll *ep, struct mtcp_epoll_event_int *ev,
+				   struct mtcp_epoll_event *events, int cnt)
+{
+	socket_map_t event_socket;
+	int validity;
+
+	event_socket = &mtcp->smap[ev->sockid];
+	validity = TRUE;
+	if (event_socket->socktype == MTCP_SOCK_UNUSED)
+		validity = FALSE;
+	if (!(event_socket->epoll & ev->ev.events))
+		validity = FALSE;
+	if (!(event_socket->events & ev->ev.events))
+		validity = FALSE;
+
+	if (validity) {
+		events[cnt++] = ev->ev;
+		assert(ev->sockid >= 0);
+
+		TRACE_EPOLL("Socket %d: Handled event. event: %s\n", event_socket->id, EventToString(ev->ev.events));
+		ep->stat.handled++;
+	} else {
+		TRACE_EPOLL("Socket %d: event %s invalidated.\n", ev->sockid, EventToString(ev->ev.events));
+		ep->stat.invalidated++;
+	}
+	/* the mTCP thread sets these bits concurrently */
+	__atomic_fetch_and(&event_socket->events, ~ev->ev.events, __ATOMIC_RELAXED);
+
+	return cnt;
+}
+/*----------------------------------------------------------------------------*/
+static int FetchEventRing(mtcp_manager_t mtcp, struct mtcp_epoll *ep, struct mtcp_epoll_event *events, int cnt, int maxevents)
+{
+	struct event_ring *ring = ep->usr_queue;
+	uint32_t head, tail, mask = ring->size - 1;
+
+	head = ring->head;
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	while (head != tail && cnt < maxevents)
+		cnt = HandleEpollEvent(mtcp, ep, &ring->events[head++ & mask], events, cnt);
+
+	/* give the consumed slots back to the mTCP thread in one go */
+	__atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+
+	return cnt;
+}
+/*----------------------------------------------------------------------------*/
+static int FetchEventQueue(mtcp_manager_t mtcp, struct mtcp_epoll *ep, struct event_queue *eq, struct mtcp_epoll_event *events,
+			   int cnt, int maxevents)
+{
+	int i, num_events;
+
+	num_events = eq->num_events;
+	for (i = 0; i < num_events && cnt < maxevents; i++) {
+		cnt = HandleEpollEvent(mtcp, ep, &eq->events[eq->start], events, cnt);
+
+		eq->start++;
+		eq->num_events--;
+		if (eq->start >= eq->size) {
+			eq->start = 0;
+		}
+	}
+
+	return cnt;
+}
+/*----------------------------------------------------------------------------*/
 int mtcp_epoll_wait(mctx_t mctx, int epid, struct mtcp_epoll_event *events, int maxevents, int timeout)
 {
 	mtcp_manager_t mtcp;
 	struct mtcp_epoll *ep;
-	struct event_queue *eq;
-	struct event_queue *eq_shadow;
-	socket_map_t event_socket;
-	int validity;
-	int i, cnt, ret;
-	int num_events;
+	int cnt, ret;
 
 	mtcp = GetMTCPManager(mctx);
 	if (!mtcp) {
@@ -419,23 +569,16 @@ int mtcp_epoll_wait(mctx_t mctx, int epid, struct mtcp_epoll_event *events, int
 
 #if SPIN_BEFORE_SLEEP
 	int spin = 0;
-	while (ep->num_events == 0 && spin < SPIN_THRESH) {
+	while (!EventsPending(ep) && spin < SPIN_THRESH) {
 		spin++;
 	}
 #endif /* SPIN_BEFORE_SLEEP */
 
-	if (pthread_mutex_lock(&ep->epoll_lock)) {
-		if (errno == EDEADLK)
-			perror("mtcp_epoll_wait: epoll_lock blocked\n");
-		assert(0);
-	}
-
 wait:
-	eq = ep->usr_queue;
-	eq_shadow = ep->usr_shadow_queue;
-
 	/* wait until event occurs */
-	while (eq->num_events == 0 && eq_shadow->num_events == 0 && timeout != 0) {
+	while (!EventsPending(ep) && timeout != 0) {
+		uint32_t seq;
+
 #if INTR_SLEEPING_MTCP
 		/* signal to mtcp thread if it is sleeping */
 		if (mtcp->wakeup_flag && mtcp->is_sleeping) {
@@ -443,41 +586,25 @@ wait:
 		}
 #endif
 		ep->stat.waits++;
+		seq = __atomic_load_n(&ep->wake_seq, __ATOMIC_ACQUIRE);
 		ep->waiting = TRUE;
-		if (timeout > 0) {
-			struct timespec deadline;
-
-			clock_gettime(CLOCK_REALTIME, &deadline);
-			if (timeout >= 1000) {
-				int sec;
-				sec = timeout / 1000;
-				deadline.tv_sec += sec;
-				timeout -= sec * 1000;
+		/* pairs with the fence in WakeupEpoll() */
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		if (!EventsPending(ep) && !mtcp->ctx->done && !mtcp->ctx->exit && !mtcp->ctx->interrupt) {
+			if (timeout > 0) {
+				struct timespec rel;
+
+				rel.tv_sec = timeout / 1000;
+				rel.tv_nsec = (timeout % 1000) * 1000000;
+				ret = syscall(SYS_futex, &ep->wake_seq, FUTEX_WAIT_PRIVATE, seq, &rel, NULL, 0);
+				timeout = 0;
+			} else {
+				ret = syscall(SYS_futex, &ep->wake_seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
 			}
-
-			deadline.tv_nsec += timeout * 1000000;
-
-			if (deadline.tv_nsec >= 1000000000) {
-				deadline.tv_sec++;
-				deadline.tv_nsec -= 1000000000;
-			}
-
-			//deadline.tv_sec = mtcp->cur_tv.tv_sec;
-			//deadline.tv_nsec = (mtcp->cur_tv.tv_usec + timeout * 1000) * 1000;
-			ret = pthread_cond_timedwait(&ep->epoll_cond, &ep->epoll_lock, &deadline);
-			if (ret && ret != ETIMEDOUT) {
-				/* errno set by pthread_cond_timedwait() */
-				pthread_mutex_unlock(&ep->epoll_lock);
-				TRACE_ERROR("pthread_cond_timedwait failed. ret: %d, error: %s\n", ret, strerror(errno));
-				return -1;
-			}
-			timeout = 0;
-		} else if (timeout < 0) {
-			ret = pthread_cond_wait(&ep->epoll_cond, &ep->epoll_lock);
-			if (ret) {
-				/* errno set by pthread_cond_wait() */
-				pthread_mutex_unlock(&ep->epoll_lock);
-				TRACE_ERROR("pthread_cond_wait failed. ret: %d, error: %s\n", ret, strerror(errno));
+			if (ret && errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT) {
+				ep->waiting = FALSE;
+				TRACE_ERROR("futex wait failed. error: %s\n", strerror(errno));
 				return -1;
 			}
 		}
@@ -485,93 +612,74 @@ wait:
 
 		if (mtcp->ctx->done || mtcp->ctx->exit || mtcp->ctx->interrupt) {
 			mtcp->ctx->interrupt = FALSE;
-			//ret = pthread_cond_signal(&ep->epoll_cond);
-			pthread_mutex_unlock(&ep->epoll_lock);
 			errno = EINTR;
 			return -1;
 		}
 	}
 
 	/* fetch events from the user event queue */
-	cnt = 0;
-	num_events = eq->num_events;
-	for (i = 0; i < num_events && cnt < maxevents; i++) {
-		event_socket = &mtcp->smap[eq->events[eq->start].sockid];
-		validity = TRUE;
-		if (event_socket->socktype == MTCP_SOCK_UNUSED)
-			validity = FALSE;
-		if (!(event_socket->epoll & eq->events[eq->start].ev.events))
-			validity = FALSE;
-		if (!(event_socket->events & eq->events[eq->start].ev.events))
-			validity = FALSE;
-
-		if (validity) {
-			events[cnt++] = eq->events[eq->start].ev;
-			assert(eq->events[eq->start].sockid >= 0);
-
-			TRACE_EPOLL("Socket %d: Handled event. event: %s, "
-				    "start: %u, end: %u, num: %u\n",
-				    event_socket->id, EventToString(eq->events[eq->start].ev.events), eq->start, eq->end,
-				    eq->num_events);
-			ep->stat.handled++;
-		} else {
-			TRACE_EPOLL("Socket %d: event %s invalidated.\n", eq->events[eq->start].sockid,
-				    EventToString(eq->events[eq->start].ev.events));
-			ep->stat.invalidated++;
-		}
-		event_socket->events &= (~eq->events[eq->start].ev.events);
-
-		eq->start++;
-		eq->num_events--;
-		if (eq->start >= eq->size) {
-			eq->start = 0;
-		}
-	}
+	cnt = FetchEventRing(mtcp, ep, events, 0, maxevents);
 
 	/* fetch eventes from user shadow event queue */
-	eq = ep->usr_shadow_queue;
-	num_events = eq->num_events;
-	for (i = 0; i < num_events && cnt < maxevents; i++) {
-		event_socket = &mtcp->smap[eq->events[eq->start].sockid];
-		validity = TRUE;
-		if (event_socket->socktype == MTCP_SOCK_UNUSED)
-			validity = FALSE;
-		if (!(event_socket->epoll & eq->events[eq->start].ev.events))
-			validity = FALSE;
-		if (!(event_socket->events & eq->events[eq->start].ev.events))
-			validity = FALSE;
-
-		if (validity) {
-			events[cnt++] = eq->events[eq->start].ev;
-			assert(eq->events[eq->start].sockid >= 0);
-
-			TRACE_EPOLL("Socket %d: Handled event. event: %s, "
-				    "start: %u, end: %u, num: %u\n",
-				    event_socket->id, EventToString(eq->events[eq->start].ev.events), eq->start, eq->end,
-				    eq->num_events);
-			ep->stat.handled++;
-		} else {
-			TRACE_EPOLL("Socket %d: event %s invalidated.\n", eq->events[eq->start].sockid,
-				    EventToString(eq->events[eq->start].ev.events));
-			ep->stat.invalidated++;
-		}
-		event_socket->events &= (~eq->events[eq->start].ev.events);
+	cnt = FetchEventQueue(mtcp, ep, ep->usr_shadow_queue, events, cnt, maxevents);
 
-		eq->start++;
-		eq->num_events--;
-		if (eq->start >= eq->size) {
-			eq->start = 0;
-		}
+	/* fetch events raised by other application threads */
+	if (__atomic_load_n(&ep->pipe_queue->num_events, __ATOMIC_RELAXED) > 0 && cnt < maxevents) {
+		pthread_mutex_lock(&ep->epoll_lock);
+		cnt = FetchEventQueue(mtcp, ep, ep->pipe_queue, events, cnt, maxevents);
+		pthread_mutex_unlock(&ep->epoll_lock);
 	}
 
 	if (cnt == 0 && timeout != 0)
 		goto wait;
 
-	pthread_mutex_unlock(&ep->epoll_lock);
-
 	return cnt;
 }
 /*----------------------------------------------------------------------------*/
+int DispatchEpollEvents(mctx_t mctx, struct mtcp_epoll *ep, mtcp_event_cb_t cb, void *arg)
+{
+	mtcp_manager_t mtcp = g_mtcp[mctx->cpu];
+	struct mtcp_epoll_event events[DISPATCH_BATCH];
+	int i, cnt, total = 0;
+
+	do {
+		cnt = FetchEventRing(mtcp, ep, events, 0, DISPATCH_BATCH);
+		cnt = FetchEventQueue(mtcp, ep, ep->usr_shadow_queue, events, cnt, DISPATCH_BATCH);
+		if (__atomic_load_n(&ep->pipe_queue->num_events, __ATOMIC_RELAXED) > 0 && cnt < DISPATCH_BATCH) {
+			pthread_mutex_lock(&ep->epoll_lock);
+			cnt = FetchEventQueue(mtcp, ep, ep->pipe_queue, events, cnt, DISPATCH_BATCH);
+			pthread_mutex_unlock(&ep->epoll_lock);
+		}
+
+		for (i = 0; i < cnt; i++)
+			cb(mctx, &events[i], arg);
+		total += cnt;
+	} while (cnt == DISPATCH_BATCH);
+
+	return total;
+}
+/*----------------------------------------------------------------------------*/
+int mtcp_set_event_callback(mctx_t mctx, mtcp_event_cb_t cb, void *arg)
+{
+	mtcp_manager_t mtcp;
+
+	mtcp = GetMTCPManager(mctx);
+	if (!mtcp) {
+		return -1;
+	}
+
+	if (!mtcp->ctx->run_inline) {
+		TRACE_API("CPU %d: event callbacks need an inline context.\n", mctx->cpu);
+		errno = EINVAL;
+		return -1;
+	}
+
+	mtcp->event_arg = arg;
+	mtcp->event_cb = cb;
+
+	return 0;
+}
+/*----------------------------------------------------------------------------*/
 inline int AddEpollEvent(struct mtcp_epoll *ep, int queue_type, socket_map_t socket, uint32_t event)
 {
 	struct event_queue *eq;
@@ -589,7 +697,8 @@ inline int AddEpollEvent(struct mtcp_epoll *ep, int queue_type, socket_map_t soc
 	if (queue_type == MTCP_EVENT_QUEUE) {
 		eq = ep->mtcp_queue;
 	} else if (queue_type == USR_EVENT_QUEUE) {
-		eq = ep->usr_queue;
+		/* raised from an application thread, possibly not the waiter */
+		eq = ep->pipe_queue;
 		pthread_mutex_lock(&ep->epoll_lock);
 	} else if (queue_type == USR_SHADOW_EVENT_QUEUE) {
 		eq = ep->usr_shadow_queue;
@@ -607,7 +716,7 @@ inline int AddEpollEvent(struct mtcp_epoll *ep, int queue_type, socket_map_t soc
 
 	index = eq->end++;
 
-	socket->events |= event;
+	__atomic_fetch_or(&socket->events, event, __ATOMIC_RELAXED);
 	eq->events[index].sockid = socket->id;
 	eq->events[index].ev.events = event;
 	eq->events[index].ev.data = socket->ep_data;
@@ -615,7 +724,7 @@ inline int AddEpollEvent(struct mtcp_epoll *ep, int queue_type, socket_map_t soc
 	if (eq->end >= eq->size) {
 		eq->end = 0;
 	}
-	eq->num_events++;
+	__atomic_store_n(&eq->num_events, eq->num_events + 1, __ATOMIC_RELEASE);
 
 #if 0
 	TRACE_EPOLL("Socket %d New event: %s, start: %u, end: %u, num: %u\n",
@@ -624,8 +733,10 @@ inline int AddEpollEvent(struct mtcp_epoll *ep, int queue_type, socket_map_t soc
 			ep->start, ep->end, ep->num_events);
 #endif
 
-	if (queue_type == USR_EVENT_QUEUE)
+	if (queue_type == USR_EVENT_QUEUE) {
 		pthread_mutex_unlock(&ep->epoll_lock);
+		WakeupEpoll(ep);
+	}
 
 	ep->stat.registered++;
 
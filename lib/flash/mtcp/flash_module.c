@@ -21,6 +21,14 @@
 #include "config.h"
 /* for ETHER_CRC_LEN */
 #include <net/ethernet.h>
+/* for GetRSSKey() */
+#include "rss.h"
+/* for ethtool queries */
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
 
 /*----------------------------------------------------------------------------*/
 #define MAX_IFNAMELEN (IF_NAMESIZE + 10)
@@ -35,16 +43,28 @@
 /*----------------------------------------------------------------------------*/
 
 struct afxdp_private_context { // private context on mTCP
-	struct config cfg;
-	struct nf *nf;
+	struct config *cfg;
+	struct socket *xsk;
 	struct xskvec *recvvecs;
 	struct xskvec *sendvecs;
 	struct xskvec *dropvecs;
+	struct xskvec *freevecs; /* tx frames reserved ahead of get_wptr */
 	uint32_t recv_index;
 	uint32_t send_index;
+	uint32_t free_index;
+	uint32_t free_count;
+	uint32_t batch_size;
 	struct pollfd fds[1];
 } __attribute__((aligned(__WORDSIZE)));
 
+/*
+ * d-> The NF is configured once per process; the monitor hands out one
+ * socket per thread of the NF and mTCP core i drives nf->thread[i].
+ */
+static struct config afxdp_cfg;
+static struct nf *afxdp_nf;
+static int afxdp_users;
+
 /*----------------------------------------------------------------------------*/
 void afxdp_load_module(void);
 void afxdp_init_handle(struct mtcp_thread_context *ctxt);
@@ -59,17 +79,160 @@ int afxdp_select(struct mtcp_thread_context *ctxt);
 void afxdp_destroy_handle(struct mtcp_thread_context *ctxt);
 int afxdp_dev_ioctl(struct mtcp_thread_context *ctxt, int nif, int cmd, void *argp);
 
+/*----------------------------------------------------------------------------*/
+static int afxdp_ethtool(const char *ifname, void *data)
+{
+	struct ifreq ifr;
+	int fd, ret;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return -1;
+
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, IFNAMSIZ, "%s", ifname);
+	ifr.ifr_data = data;
+	ret = ioctl(fd, SIOCETHTOOL, &ifr);
+	close(fd);
+
+	return ret;
+}
+
+/*----------------------------------------------------------------------------*/
+/* number of rx queues the NIC spreads RSS traffic over */
+static int afxdp_get_num_rx_queues(const char *ifname)
+{
+	struct ethtool_channels ch = { .cmd = ETHTOOL_GCHANNELS };
+
+	if (afxdp_ethtool(ifname, &ch) < 0)
+		return -1;
+
+	return ch.combined_count + ch.rx_count;
+}
+
+/*----------------------------------------------------------------------------*/
+/*
+ * d-> GetRSSCPUCore() predicts the rx queue of a flow from mTCP's own hash
+ * key and the default (round-robin) indirection table. Make the NIC agree,
+ * otherwise replies to active connects land on another core's socket.
+ * The key is NIC-wide, so this is opt-in (flash_rss_key = 1) and skipped
+ * when other NFs may own queues of the same interface. The indirection
+ * table is left alone, the monitor may have steered it.
+ */
+static void afxdp_setup_rss(const char *ifname, int nqueues)
+{
+	struct ethtool_rxfh hdr = { .cmd = ETHTOOL_GRSSH };
+	struct ethtool_rxfh *rxfh;
+	uint8_t *key;
+
+	if (!CONFIG.flash_rss_key)
+		return;
+
+	if (nqueues > afxdp_cfg.total_sockets) {
+		TRACE_ERROR("%s has %d queues but this NF owns %d, not touching the "
+			    "shared RSS hash key; active connects may not map back to "
+			    "the issuing core\n",
+			    ifname, nqueues, afxdp_cfg.total_sockets);
+		return;
+	}
+
+	if (afxdp_ethtool(ifname, &hdr) < 0 || hdr.key_size == 0) {
+		TRACE_ERROR("Can't read RSS hash key of %s, active connects may "
+			    "not map back to the issuing core\n",
+			    ifname);
+		return;
+	}
+
+	rxfh = calloc(1, sizeof(*rxfh) + hdr.key_size);
+	if (!rxfh) {
+		TRACE_ERROR("Can't allocate RSS hash key buffer\n");
+		return;
+	}
+
+	rxfh->cmd = ETHTOOL_SRSSH;
+	rxfh->rss_context = 0;
+	rxfh->hfunc = 0; /* keep toeplitz, the NIC default */
+	rxfh->indir_size = ETH_RXFH_INDIR_NO_CHANGE;
+	rxfh->key_size = hdr.key_size;
+	key = (uint8_t *)rxfh->rss_config;
+	GetRSSKey(key, hdr.key_size);
+
+	if (afxdp_ethtool(ifname, rxfh) < 0) {
+		TRACE_ERROR("Can't program RSS hash key of %s (%s), active connects "
+			    "may not map back to the issuing core\n",
+			    ifname, strerror(errno));
+	} else {
+		TRACE_INFO("Programmed mTCP RSS hash key on %s\n", ifname);
+	}
+
+	free(rxfh);
+}
+
 /*----------------------------------------------------------------------------*/
 void afxdp_load_module(void)
 {
-	/* not needed - all initializations done in afxdp_init_handle() */
+	char prog[] = "mtcp", uopt[] = "-u", fopt[] = "-f", topt[] = "-t";
+	char umem_id[12], nf_id[12];
+	char *argv[6];
+	int i, nqueues;
+
+	afxdp_cfg.app_name = "MTCP";
+	afxdp_cfg.app_options = NULL;
+
+	// custom argv for the afxdp module
+	argv[0] = prog;
+	argv[1] = uopt;
+	argv[2] = umem_id;
+	argv[3] = fopt;
+	argv[4] = nf_id;
+	argv[5] = topt;
+	snprintf(umem_id, sizeof(umem_id), "%d", CONFIG.flash_umem_id);
+	snprintf(nf_id, sizeof(nf_id), "%d", CONFIG.flash_nf_id);
+
+	if (flash__parse_cmdline_args(6, argv, &afxdp_cfg) < 0)
+		exit(EXIT_FAILURE);
+
+	if (flash__configure_nf(&afxdp_nf, &afxdp_cfg) < 0)
+		exit(EXIT_FAILURE);
+
+	log_info("Control Plane setup done...");
+
+	if (afxdp_cfg.total_sockets < num_cpus) {
+		TRACE_ERROR("NF %d of umem %d has %d socket(s) but mTCP runs %d core(s), "
+			    "add threads to the NF in the monitor config\n",
+			    CONFIG.flash_nf_id, CONFIG.flash_umem_id, afxdp_cfg.total_sockets, num_cpus);
+		flash__xsk_close(&afxdp_cfg, afxdp_nf);
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < num_cpus; i++)
+		TRACE_INFO("mTCP core %d bound to %s queue %d\n", i, afxdp_cfg.ifname, afxdp_nf->thread[i]->socket->ifqueue);
+
+	/* RSS spreads over every queue of the NIC, not only the ones we own */
+	nqueues = afxdp_get_num_rx_queues(afxdp_cfg.ifname);
+	if (nqueues <= 0) {
+		TRACE_ERROR("Can't read channel count of %s, assuming %d queue(s)\n", afxdp_cfg.ifname,
+			    afxdp_cfg.total_sockets);
+		nqueues = afxdp_cfg.total_sockets;
+	}
+	num_queues = nqueues;
+
+	afxdp_setup_rss(afxdp_cfg.ifname, nqueues);
+}
+
+/*----------------------------------------------------------------------------*/
+int afxdp_get_core_queue(int cpu)
+{
+	if (!afxdp_nf || cpu >= afxdp_cfg.total_sockets)
+		return cpu;
+
+	return afxdp_nf->thread[cpu]->socket->ifqueue;
 }
 
 /*----------------------------------------------------------------------------*/
 void afxdp_init_handle(struct mtcp_thread_context *ctxt)
 {
 	struct afxdp_private_context *axpc;
-	int j;
 
 	/* create and initialize private I/O module context */
 	ctxt->io_private_context = calloc(1, sizeof(struct afxdp_private_context));
@@ -81,69 +244,24 @@ void afxdp_init_handle(struct mtcp_thread_context *ctxt)
 
 	axpc = (struct afxdp_private_context *)ctxt->io_private_context;
 
-	// m-> come back here to evaluate the multiple interface scenario
-	// d-> I am also assuming that there is only one interface
-	for (j = 0; j < num_devices_attached; j++) {
-		axpc->cfg.app_name = "MTCP";
-		axpc->cfg.app_options = NULL;
-
-		// custom argv for the afxdp module
-		char *argv[6];
-		argv[0] = strdup("mtcp");
-		argv[1] = strdup("-u");
-		argv[2] = strdup("0");
-		argv[3] = strdup("-f");
-		argv[4] = strdup("0");
-		argv[5] = strdup("-t");
-
-		if (flash__parse_cmdline_args(6, argv, &axpc->cfg) < 0)
-			goto out_cfg;
-
-		if (flash__configure_nf(&axpc->nf, &axpc->cfg) < 0)
-			goto out_cfg;
-
-		log_info("Control Plane setup done...");
-
-		// m-> set the receiving queue to the processing core number
-		// d-> i am consdering this info is setup from the config file
-		// axpc->cfg.ifname = ifname;
-		// axpc->cfg.xsk_if_queue = ctxt->cpu;
-
-		// axpc->packet_buffer_size = NUM_FRAMES * FRAME_SIZE;
-		// if (posix_memalign(&axpc->packet_buffer, getpagesize(), /* PAGE_SIZE aligned */
-		// 		   axpc->packet_buffer_size)) {
-		// 	fprintf(stderr, "ERROR: Can't allocate buffer memory \"%s\"\n", strerror(errno));
-		// 	exit(EXIT_FAILURE);
-		// }
-
-		// /* Initialize shared packet_buffer for umem usage */
-		// axpc->umem = configure_xsk_umem(axpc->packet_buffer, axpc->packet_buffer_size);
-		// if (axpc->umem == NULL) {
-		// 	fprintf(stderr, "ERROR: Can't create umem \"%s\"\n", strerror(errno));
-		// 	exit(EXIT_FAILURE);
-		// }
-
-		/* Open and configure the AF_XDP (xsk) socket */
-		// axpc->xsk_socket = xsk_configure_socket(&axpc->cfg, axpc->umem);
-		// if (axpc->xsk_socket == NULL) {
-		// 	fprintf(stderr, "ERROR: Can't setup AF_XDP socket \"%s\"\n", strerror(errno));
-		// 	exit(EXIT_FAILURE);
-		// }
-	}
+	// d-> I am assuming that there is only one interface per NF
+	axpc->cfg = &afxdp_cfg;
+	axpc->xsk = afxdp_nf->thread[ctxt->cpu]->socket;
+	__sync_fetch_and_add(&afxdp_users, 1);
 
 	memset(axpc->fds, 0, sizeof(axpc->fds));
-	axpc->fds[0].fd = axpc->nf->thread[0]->socket->fd; // d-> Assuming single thread for now
+	axpc->fds[0].fd = axpc->xsk->fd;
 	axpc->fds[0].events = POLLIN;
 
 	// d-> initialize send vectors
-	axpc->sendvecs = calloc(axpc->cfg.xsk->batch_size, sizeof(struct xskvec));
+	axpc->sendvecs = calloc(axpc->cfg->xsk->batch_size, sizeof(struct xskvec));
 	if (!axpc->sendvecs) {
 		log_error("Failed to allocate xskvecs array");
 		goto out_cfg_close;
 	}
 	axpc->send_index = 0;
 
-	axpc->recvvecs = calloc(axpc->cfg.xsk->batch_size, sizeof(struct xskvec));
+	axpc->recvvecs = calloc(axpc->cfg->xsk->batch_size, sizeof(struct xskvec));
 	if (!axpc->recvvecs) {
 		log_error("Failed to allocate recv xskvecs array");
 		free(axpc->sendvecs);
@@ -151,7 +269,7 @@ void afxdp_init_handle(struct mtcp_thread_context *ctxt)
 	}
 	axpc->recv_index = 0;
 
-	axpc->dropvecs = calloc(axpc->cfg.xsk->batch_size, sizeof(struct xskvec));
+	axpc->dropvecs = calloc(axpc->cfg->xsk->batch_size, sizeof(struct xskvec));
 	if (!axpc->dropvecs) {
 		log_error("Failed to allocate drop xskvecs array");
 		free(axpc->sendvecs);
@@ -159,12 +277,22 @@ void afxdp_init_handle(struct mtcp_thread_context *ctxt)
 		goto out_cfg_close;
 	}
 
+	axpc->freevecs = calloc(axpc->cfg->xsk->batch_size, sizeof(struct xskvec));
+	if (!axpc->freevecs) {
+		log_error("Failed to allocate free xskvecs array");
+		free(axpc->sendvecs);
+		free(axpc->recvvecs);
+		free(axpc->dropvecs);
+		goto out_cfg_close;
+	}
+	axpc->free_index = 0;
+	axpc->free_count = 0;
+	axpc->batch_size = axpc->cfg->xsk->batch_size;
+
 	return;
 
 out_cfg_close:
-	flash__xsk_close(&axpc->cfg, axpc->nf);
-out_cfg:
-	free(&axpc->cfg);
+	flash__xsk_close(&afxdp_cfg, afxdp_nf);
 	exit(EXIT_FAILURE);
 }
 
@@ -184,13 +312,12 @@ int32_t afxdp_recv_pkts(struct mtcp_thread_context *ctxt, int ifidx)
 	uint32_t nrecv = 0;
 	struct afxdp_private_context *axpc;
 	axpc = (struct afxdp_private_context *)ctxt->io_private_context;
-	struct socket *xsk = axpc->nf->thread[0]->socket; // d-> Assuming single thread for now
 
-	ret = flash__poll(&axpc->cfg, xsk, axpc->fds, nfds);
+	ret = flash__poll(axpc->cfg, axpc->xsk, axpc->fds, nfds);
 	if (!(ret == 1 || ret == -2))
 		return 0;
 
-	nrecv = flash__recvmsg(&axpc->cfg, xsk, axpc->recvvecs, axpc->cfg.xsk->batch_size);
+	nrecv = flash__recvmsg(axpc->cfg, axpc->xsk, axpc->recvvecs, axpc->cfg->xsk->batch_size);
 	return nrecv;
 }
 
@@ -204,8 +331,6 @@ uint8_t *afxdp_get_rptr(struct mtcp_thread_context *ctxt, int ifidx, int index,
 	struct afxdp_private_context *axpc;
 	axpc = (struct afxdp_private_context *)ctxt->io_private_context;
 
-	printf("get_rptr: recv_index=%u\n", axpc->recv_index);
-
 	uint8_t *pktbuf = axpc->recvvecs[axpc->recv_index].data;
 	*len = axpc->recvvecs[axpc->recv_index].len;
 
@@ -221,7 +346,7 @@ void afxdp_drop_pkts(struct mtcp_thread_context *ctxt)
 	struct afxdp_private_context *axpc;
 	axpc = (struct afxdp_private_context *)ctxt->io_private_context;
 
-	if (flash__dropmsg(&axpc->cfg, axpc->nf->thread[0]->socket, axpc->dropvecs, axpc->recv_index) != axpc->recv_index) {
+	if (flash__dropmsg(axpc->cfg, axpc->xsk, axpc->dropvecs, axpc->recv_index) != axpc->recv_index) {
 		log_error("Failed to drop messages");
 		axpc->recv_index = 0;
 		return;
@@ -240,27 +365,50 @@ void afxdp_release_pkt(struct mtcp_thread_context *ctxt, int ifidx, unsigned cha
 }
 
 /*----------------------------------------------------------------------------*/
-//m-> for more details of what needs to be done see my notebook (mtcp pktio), pages 44 and 54
-//also see the get_wptr dpdk function to see more details
+/*
+ * d-> The tx side works a batch at a time: frames are pulled from the pool
+ * batch_size at a time, get_wptr only hands out the next reserved frame and
+ * the tx ring is reserved/submitted once per send_pkts() call, i.e. once
+ * per main-loop iteration unless a single iteration fills a whole batch.
+ */
+static inline void afxdp_flush_tx(struct afxdp_private_context *axpc)
+{
+	if (!axpc->send_index)
+		return;
+
+	flash__sendmsg(axpc->cfg, axpc->xsk, axpc->sendvecs, axpc->send_index);
+	axpc->send_index = 0;
+}
+
+/*----------------------------------------------------------------------------*/
 uint8_t *afxdp_get_wptr(struct mtcp_thread_context *ctxt, int nif, uint16_t pktsize)
 {
 	(void)nif; // d-> unused parameter
 	struct afxdp_private_context *axpc;
-	axpc = (struct afxdp_private_context *)ctxt->io_private_context;
-
-	printf("get_wptr: send_index=%u\n", axpc->send_index);
+	struct xskvec *vec;
 
-	struct xskvec tmpvec;
-	flash__allocmsg(&axpc->cfg, axpc->nf->thread[0]->socket, &tmpvec, 1);
+	axpc = (struct afxdp_private_context *)ctxt->io_private_context;
 
-	uint8_t *pktbuf = tmpvec.data;
+	if (axpc->send_index == axpc->batch_size)
+		afxdp_flush_tx(axpc);
+
+	if (axpc->free_index == axpc->free_count) {
+		/*
+		 * Submit what is pending first so its frames can come back, then
+		 * take only what the pool has now; NULL lets mTCP back off.
+		 */
+		afxdp_flush_tx(axpc);
+		axpc->free_count = flash__tryallocmsg(axpc->cfg, axpc->xsk, axpc->freevecs, axpc->batch_size);
+		axpc->free_index = 0;
+		if (!axpc->free_count)
+			return NULL;
+	}
 
-	axpc->sendvecs[axpc->send_index].data = pktbuf;
-	axpc->sendvecs[axpc->send_index].len = pktsize;
-	axpc->sendvecs[axpc->send_index].addr = tmpvec.addr;
-	axpc->sendvecs[axpc->send_index++].options = 0;
+	vec = &axpc->sendvecs[axpc->send_index++];
+	*vec = axpc->freevecs[axpc->free_index++];
+	vec->len = pktsize;
 
-	return pktbuf;
+	return vec->data;
 }
 
 /*----------------------------------------------------------------------------*/
@@ -270,8 +418,7 @@ int afxdp_send_pkts(struct mtcp_thread_context *ctxt, int nif)
 	struct afxdp_private_context *axpc;
 	axpc = (struct afxdp_private_context *)ctxt->io_private_context;
 
-	flash__sendmsg(&axpc->cfg, axpc->nf->thread[0]->socket, axpc->sendvecs, axpc->send_index);
-	axpc->send_index = 0;
+	afxdp_flush_tx(axpc);
 
 	return 1;
 }
@@ -291,12 +438,21 @@ void afxdp_destroy_handle(struct mtcp_thread_context *ctxt)
 	struct afxdp_private_context *axpc;
 	axpc = (struct afxdp_private_context *)ctxt->io_private_context;
 
+	/* give back the frames reserved but never written */
+	afxdp_flush_tx(axpc);
+	flash__dropmsg(axpc->cfg, axpc->xsk, axpc->freevecs + axpc->free_index, axpc->free_count - axpc->free_index);
+
 	free(axpc->recvvecs);
 	free(axpc->sendvecs);
 	free(axpc->dropvecs);
-	flash__xsk_close(&axpc->cfg, axpc->nf);
-	free(&axpc->cfg);
+	free(axpc->freevecs);
 	free(axpc);
+
+	/* last core out tears down the shared NF */
+	if (__sync_sub_and_fetch(&afxdp_users, 1) == 0) {
+		flash__xsk_close(&afxdp_cfg, afxdp_nf);
+		afxdp_nf = NULL;
+	}
 }
 
 /*----------------------------------------------------------------------------*/
@@ -34,11 +34,24 @@
 
 #define MAX_ARPENTRY 1024
 
+/* lookups per GetDestinationHWaddrBulk() call */
+#define ARP_RESOLVE_BATCH 64
+
 int InitARPTable(void);
 
+void AddStaticARPEntry(struct arp_entry *ent);
+
 unsigned char *GetHWaddr(uint32_t ip);
 
-unsigned char *GetDestinationHWaddr(uint32_t dip, uint8_t is_gateway);
+/* the returned address stays valid until the next lookup on this core */
+unsigned char *GetDestinationHWaddr(mtcp_manager_t mtcp, uint32_t dip, uint8_t is_gateway);
+
+/* resolves cnt addresses into haddrs, returns the mask of those found */
+uint64_t GetDestinationHWaddrBulk(mtcp_manager_t mtcp, const uint32_t *dips, const uint8_t *is_gateway,
+				  unsigned char (*haddrs)[ETH_ALEN], int cnt);
+
+/* bumped whenever a neighbor is added, changes its address or goes away */
+uint32_t ARPGeneration(void);
 
 void RequestARP(mtcp_manager_t mtcp, uint32_t ip, int nif, uint32_t cur_ts);
 
@@ -46,6 +59,28 @@ int ProcessARPPacket(mtcp_manager_t mtcp, uint32_t cur_ts, const int ifidx, unsi
 
 void ARPTimer(mtcp_manager_t mtcp, uint32_t cur_ts);
 
+/*----------------------------------------------------------------------------*/
+/*
+ * Neighbor entries are unlinked without waiting for readers and freed once
+ * every core has passed a quiescent point, i.e. started a new main loop
+ * round, after the unlink. A core holds no neighbor pointer across rounds.
+ */
+extern uint64_t g_arp_epoch;
+
+static inline void ARPQuiescent(mtcp_manager_t mtcp)
+{
+	uint64_t epoch = __atomic_load_n(&g_arp_epoch, __ATOMIC_ACQUIRE);
+
+	if (mtcp->arp_epoch != epoch)
+		__atomic_store_n(&mtcp->arp_epoch, epoch, __ATOMIC_RELEASE);
+}
+
+/* a core that stopped running never holds back reclamation */
+static inline void ARPOffline(mtcp_manager_t mtcp)
+{
+	__atomic_store_n(&mtcp->arp_epoch, UINT64_MAX, __ATOMIC_RELEASE);
+}
+
 void PrintARPTable(void);
 
 #endif /* ARP_H */
@@ -36,9 +36,38 @@
 #include <stdint.h>
 #include "tcp_stream.h"
 
+/*----------------------------------------------------------------------------*/
+/* cycle counter used by the pacing engine, read once per main loop round */
+#if defined(__ARM_ARCH_ISA_A64)
+static inline uint64_t ReadTSC(void)
+{
+	uint64_t cntvct;
+	asm volatile("mrs %0, cntvct_el0; " : "=r"(cntvct)::"memory");
+	return cntvct;
+}
+#elif defined(__x86_64__)
+static inline uint64_t ReadTSC(void)
+{
+	uint32_t lo, hi;
+	asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+#else
+static inline uint64_t ReadTSC(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+#endif
+/*----------------------------------------------------------------------------*/
+/* ticks per second of ReadTSC(), calibrated on the first call */
+uint64_t GetTSCHz(void);
+
 uint64_t now_usecs(void);
-uint64_t time_since_usecs(void);
-uint64_t time_after_usecs(void);
+uint64_t time_since_usecs(uint64_t then);
+uint64_t time_after_usecs(uint64_t usecs);
 void log_cwnd_rtt(void *stream);
 
 #endif
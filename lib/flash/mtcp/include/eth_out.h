@@ -42,4 +42,6 @@
 
 uint8_t *EthernetOutput(struct mtcp_manager *mtcp, uint16_t h_proto, int nif, unsigned char *dst_haddr, uint16_t iplen);
 
+uint8_t *EthernetOutputPrebuilt(struct mtcp_manager *mtcp, int nif, const uint8_t *hdr, uint16_t hdrlen, uint16_t iplen);
+
 #endif /* ETH_OUT_H */
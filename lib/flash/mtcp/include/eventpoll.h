@@ -63,19 +63,46 @@ struct event_queue {
 	int num_events; // number of events
 };
 /*----------------------------------------------------------------------------*/
+/*
+ * Lock-free single-producer (mTCP thread) / single-consumer (application
+ * thread) ring carrying events from FlushEpollEvents() to mtcp_epoll_wait().
+ * head and tail run freely and are masked with size - 1 (a power of 2).
+ */
+struct event_ring {
+	struct mtcp_epoll_event_int *events;
+	uint32_t size;
+
+	volatile uint32_t head __attribute__((aligned(64))); // consumer index
+	volatile uint32_t tail __attribute__((aligned(64))); // producer index
+};
+/*----------------------------------------------------------------------------*/
 struct mtcp_epoll {
-	struct event_queue *usr_queue;
+	struct event_ring *usr_queue;
 	struct event_queue *usr_shadow_queue;
 	struct event_queue *mtcp_queue;
+	struct event_queue *pipe_queue; // events raised by other app threads
 
-	uint8_t waiting;
+	/* futex word bumped on every wakeup of a sleeping mtcp_epoll_wait() */
+	volatile uint32_t wake_seq __attribute__((aligned(64)));
+	volatile uint8_t waiting;
 	struct mtcp_epoll_stat stat;
 
-	pthread_cond_t epoll_cond;
+	/* only guards pipe_queue, which may have several producers */
 	pthread_mutex_t epoll_lock;
 };
 /*----------------------------------------------------------------------------*/
 
 int CloseEpollSocket(mctx_t mctx, int epid);
 
+/* publish mtcp_queue to the application in one batch (mTCP thread only),
+ * returns the number of events published */
+int PublishEpollEvents(struct mtcp_epoll *ep);
+
+/* wake up a sleeping mtcp_epoll_wait(); cheap when nobody sleeps */
+int WakeupEpoll(struct mtcp_epoll *ep);
+
+/* run-to-completion mode: drain pending events into cb on the calling
+ * thread, returns the number of events delivered */
+int DispatchEpollEvents(mctx_t mctx, struct mtcp_epoll *ep, mtcp_event_cb_t cb, void *arg);
+
 #endif /* EVENTPOLL_H */
@@ -106,6 +106,9 @@ int SetNetEnv(char *port_list, char *port_stat_list);
 
 /* retrive device-specific endian type */
 int FetchEndianType(void);
+
+/* retrieve the NIC rx queue that feeds the given mTCP core */
+int GetCoreRSSQueue(int cpu);
 /*----------------------------------------------------------------------------*/
 /* ptr to the `running' I/O module context */
 extern io_module_func *current_iomodule_func;
@@ -138,6 +141,10 @@ extern io_module_func onvm_module_func;
 
 /* registered afxdp context */
 extern io_module_func afxdp_module_func;
+#ifndef DISABLE_AFXDP
+/* NIC rx queue of the AF_XDP socket owned by the given core */
+int afxdp_get_core_queue(int cpu);
+#endif
 
 /* check I/O module access permissions */
 int CheckIOModuleAccessPermissions(void);
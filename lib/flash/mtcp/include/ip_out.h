@@ -44,4 +44,9 @@ uint8_t *IPOutputStandalone(struct mtcp_manager *mtcp, uint8_t protocol, uint16_
 
 uint8_t *IPOutput(struct mtcp_manager *mtcp, tcp_stream *stream, uint16_t tcplen);
 
+/* (re)builds the header templates of up to ARP_RESOLVE_BATCH streams with
+ * one batched neighbor lookup; streams left unresolved get an ARP request
+ * and an invalid template. Returns the number of streams ready to send. */
+int PrepareHeaderTemplates(struct mtcp_manager *mtcp, tcp_stream **streams, int cnt);
+
 #endif /* IP_OUT_H */
@@ -50,7 +50,6 @@
 #include "eventpoll.h"
 #include "addr_pool.h"
 #include "ps.h"
-#include "logger.h"
 #include "stat.h"
 #include "io_module.h"
 
@@ -181,6 +180,15 @@ struct arp_table {
 	int entries;
 };
 /*----------------------------------------------------------------------------*/
+/* per-core copy of recently resolved neighbors, see arp.c */
+#define ARP_CACHE_SIZE 64 /* must be a power of 2 */
+
+struct arp_cache_slot {
+	uint32_t ip;
+	uint32_t gen; /* neighbor table generation it was filled at */
+	unsigned char haddr[ETH_ALEN];
+};
+/*----------------------------------------------------------------------------*/
 struct mtcp_config {
 	/* network interface config */
 	struct eth_table *eths;
@@ -205,10 +213,17 @@ struct mtcp_config {
 	int max_num_buffers;
 	int rcvbuf_size;
 	int sndbuf_size;
+	uint8_t rcvbuf_mirror; /* double-map receive buffers, off by default */
 
 	int tcp_timewait;
 	int tcp_timeout;
 
+	/* software segmentation offloads */
+	uint8_t tcp_gro;
+	uint8_t tcp_gso;
+
+	uint8_t tcp_syncookies; /* SYNCOOKIES_*, see tcp_syncookie.h */
+
 	/* adding multi-process support */
 	uint8_t multi_process;
 	uint8_t multi_process_is_master;
@@ -222,6 +237,14 @@ struct mtcp_config {
 #endif
 #if USE_CCP
 	char cc[CC_NAME];
+#endif
+	/* congestion control for new streams, NULL for the built-in default */
+	const struct tcp_cc_ops *tcp_cc;
+#ifndef DISABLE_AFXDP
+	/* flash specific args: umem/nf ids as laid out in the monitor config */
+	int flash_umem_id;
+	int flash_nf_id;
+	int flash_rss_key; /* program mTCP's RSS key on the NIC, off by default */
 #endif
 };
 /*----------------------------------------------------------------------------*/
@@ -242,11 +265,23 @@ struct mtcp_sender {
 	int ack_list_cnt;
 };
 /*----------------------------------------------------------------------------*/
+/* streams kept allocated, with their rcvvar/sndvar, between a close and the
+ * next open; see CreateTCPStream() */
+#define STREAM_STASH_SIZE 64
+
+struct stream_stash {
+	int cnt;
+	struct tcp_stream *stream[STREAM_STASH_SIZE];
+	struct tcp_recv_vars *rcvvar[STREAM_STASH_SIZE];
+	struct tcp_send_vars *sndvar[STREAM_STASH_SIZE];
+};
+/*----------------------------------------------------------------------------*/
 struct mtcp_manager {
 	mem_pool_t flow_pool; /* memory pool for tcp_stream */
 	mem_pool_t rv_pool;   /* memory pool for recv variables */
 	mem_pool_t sv_pool;   /* memory pool for send variables */
 	mem_pool_t mv_pool;   /* memory pool for monitor variables */
+	struct stream_stash stash; /* guarded by flow_pool_lock */
 
 	//mem_pool_t socket_pool;
 	sb_manager_t rbm_snd;
@@ -268,9 +303,6 @@ struct mtcp_manager {
 	struct mtcp_thread_context *ctx;
 
 	/* variables related to logger */
-	int sp_fd;
-	log_thread_context *logger;
-	log_buff *w_buffer;
 	FILE *log_fp;
 
 	/* variables related to event */
@@ -289,6 +321,7 @@ struct mtcp_manager {
 	stream_queue_int *resetq_int; /* internally maintained resetq */
 
 	stream_queue_t destroyq; /* streams need to be destroyed */
+	stream_queue_t optq;	 /* streams with socket options to apply */
 
 	struct mtcp_sender *g_sender;
 	struct mtcp_sender *n_sender[ETH_NUM];
@@ -302,6 +335,17 @@ struct mtcp_manager {
 	int timewait_list_cnt;
 	int timeout_list_cnt;
 
+	/* streams held back by their pacer */
+	struct pacing_wheel *pacing_wheel;
+
+	/* neighbor lookups: private cache and the last table epoch seen */
+	struct arp_cache_slot arp_cache[ARP_CACHE_SIZE];
+	uint64_t arp_epoch;
+
+	/* rx segment coalescing, NULL when disabled */
+	struct tcp_gro *gro;
+	struct tcp_gro_seg *gro_seg; /* chain ProcessPacket() is working on */
+
 #if BLOCKING_SUPPORT
 	TAILQ_HEAD(rcv_br_head, tcp_stream) rcv_br_list;
 	TAILQ_HEAD(snd_br_head, tcp_stream) snd_br_list;
@@ -310,6 +354,12 @@ struct mtcp_manager {
 #endif
 
 	uint32_t cur_ts;
+	uint32_t ts_prev; /* ts of the previous main loop round */
+	uint64_t cur_tsc; /* tsc sampled at the start of the round */
+
+	/* run-to-completion mode: events go to this callback */
+	mtcp_event_cb_t event_cb;
+	void *event_arg;
 
 	int wakeup_flag;
 	int is_sleeping;
@@ -343,6 +393,7 @@ struct mtcp_thread_context {
 	int cpu;
 	pthread_t thread;
 	uint8_t done : 1, exit : 1, interrupt : 1;
+	uint8_t run_inline : 1; /* driven by mtcp_poll_once() from the app thread */
 
 	struct mtcp_manager *mtcp_manager;
 
@@ -359,6 +410,7 @@ struct mtcp_thread_context {
 	pthread_spinlock_t sendq_lock;
 	pthread_spinlock_t ackq_lock;
 	pthread_spinlock_t destroyq_lock;
+	pthread_spinlock_t optq_lock;
 #else
 	pthread_mutex_t connect_lock;
 	pthread_mutex_t close_lock;
@@ -366,6 +418,7 @@ struct mtcp_thread_context {
 	pthread_mutex_t sendq_lock;
 	pthread_mutex_t ackq_lock;
 	pthread_mutex_t destroyq_lock;
+	pthread_mutex_t optq_lock;
 #endif /* USE_SPIN_LOCK */
 #endif /* LOCK_STREAM_QUEUE */
 };
@@ -83,6 +83,19 @@ int mtcp_core_affinitize(int cpu);
 
 mctx_t mtcp_create_context(int cpu);
 
+/* run-to-completion mode: set up the stack of this core on the calling
+   thread instead of spawning an mtcp thread. The application then drives
+   rx, tcp processing, timers and tx itself by calling mtcp_poll_once()
+   from its own loop. Sockets must be non-blocking in this mode. */
+mctx_t mtcp_create_context_inline(int cpu);
+
+/** Runs one round of the mtcp main loop on an inline context
+ * @param [in] mctx: mtcp context created with mtcp_create_context_inline()
+ * @return number of packets received plus events delivered to the event
+ *         callback, -1 on error (errno EINTR when interrupted by a signal)
+ */
+int mtcp_poll_once(mctx_t mctx);
+
 void mtcp_destroy_context(mctx_t mctx);
 
 typedef void (*mtcp_sighandler_t)(int);
@@ -109,6 +122,12 @@ int mtcp_listen(mctx_t mctx, int sockid, int backlog);
 
 int mtcp_accept(mctx_t mctx, int sockid, struct sockaddr *addr, socklen_t *addrlen);
 
+/* accepts up to cnt pending connections in one call: their socket ids go
+ * to sockids and, if addrs is not NULL, the peer addresses to addrs.
+ * Returns how many were accepted; blocks like mtcp_accept() until there is
+ * at least one, or fails with EAGAIN on a non-blocking listener. */
+int mtcp_accept_many(mctx_t mctx, int sockid, int *sockids, struct sockaddr_in *addrs, int cnt);
+
 int mtcp_init_rss(mctx_t mctx, in_addr_t saddr_base, int num_addr, in_addr_t daddr, in_addr_t dport);
 
 int mtcp_connect(mctx_t mctx, int sockid, const struct sockaddr *addr, socklen_t addrlen);
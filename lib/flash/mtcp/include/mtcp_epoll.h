@@ -74,6 +74,8 @@ struct mtcp_epoll_event {
 	mtcp_epoll_data_t data;
 };
 /*----------------------------------------------------------------------------*/
+typedef void (*mtcp_event_cb_t)(mctx_t mctx, struct mtcp_epoll_event *event, void *arg);
+/*----------------------------------------------------------------------------*/
 int mtcp_epoll_create(mctx_t mctx, int size);
 /*----------------------------------------------------------------------------*/
 int mtcp_epoll_create1(mctx_t mctx, int flags);
@@ -82,6 +84,11 @@ int mtcp_epoll_ctl(mctx_t mctx, int epid, int op, int sockid, struct mtcp_epoll_
 /*----------------------------------------------------------------------------*/
 int mtcp_epoll_wait(mctx_t mctx, int epid, struct mtcp_epoll_event *events, int maxevents, int timeout);
 /*----------------------------------------------------------------------------*/
+/* run-to-completion mode: have mtcp_poll_once() deliver the events of the
+ * sockets registered with mtcp_epoll_ctl() to cb instead of queueing them
+ * for mtcp_epoll_wait(); a NULL cb restores the queueing behaviour */
+int mtcp_set_event_callback(mctx_t mctx, mtcp_event_cb_t cb, void *arg);
+/*----------------------------------------------------------------------------*/
 const char *EventToString(uint32_t event);
 /*----------------------------------------------------------------------------*/
 
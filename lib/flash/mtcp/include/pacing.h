@@ -32,32 +32,70 @@
 #ifndef __PACING_H_
 #define __PACING_H_
 
-#include "tcp_stream.h"
-#include "clock.h"
+#include <stdint.h>
+#include <sys/queue.h>
+
+struct tcp_stream;
+struct mtcp_manager;
+
+/*
+ * Rates are in bytes per second, 0 leaves the stream unpaced. Time is kept
+ * in TSC cycles and the cost of a byte in 16.16 fixed point cycles, so the
+ * send path never divides or reads the clock per packet.
+ */
+#define PACING_CPB_SHIFT 16
 
 #if RATE_LIMIT_ENABLED
 typedef struct token_bucket {
-	double tokens;
-	uint32_t rate;
-	uint32_t burst;
-	uint32_t last_fill_t;
+	uint64_t rate;	    /* bytes per second */
+	uint64_t cpb;	    /* cycles per byte << PACING_CPB_SHIFT */
+	uint64_t tokens;    /* credit, in cycles */
+	uint64_t burst;	    /* maximum credit, in cycles */
+	uint64_t last_fill; /* tsc of the last refill */
 } token_bucket;
 
-token_bucket *NewTokenBucket();
-int SufficientTokens(token_bucket *bucket, uint64_t new_bits);
+void SetTokenBucketRate(token_bucket *bucket, uint64_t rate);
+int SufficientTokens(token_bucket *bucket, uint64_t now, uint32_t bytes, uint64_t *due);
 void PrintBucket(token_bucket *bucket);
 #endif
 
 #if PACING_ENABLED
 typedef struct packet_pacer {
-	uint32_t rate_bps;
-	uint32_t extra_packets;
-	uint32_t next_send_time;
+	uint64_t rate;		/* bytes per second */
+	uint64_t cpb;		/* cycles per byte << PACING_CPB_SHIFT */
+	uint64_t next_send_tsc; /* earliest departure time of the next segment */
 } packet_pacer;
 
-packet_pacer *NewPacketPacer();
-int CanSendNow(packet_pacer *pacer);
+void SetPacingRate(packet_pacer *pacer, uint64_t rate);
+int CanSendNow(packet_pacer *pacer, uint64_t now, uint64_t slack, uint32_t bytes, uint64_t *due);
 void PrintPacer(packet_pacer *pacer);
 #endif
 
+/*----------------------------------------------------------------------------*/
+/*
+ * Timing wheel of streams held back by their pacer. Each slot covers one
+ * tick and every stream due in a tick is handed back to its sender in one
+ * batch, so a core can pace a large number of flows with a single clock
+ * read per main loop round.
+ */
+#define PACING_WHEEL_SLOTS 1024 /* must be a power of 2 */
+#define PACING_TICK_US 10
+
+TAILQ_HEAD(pacing_slot, tcp_stream);
+
+struct pacing_wheel {
+	uint64_t tick_cycles;
+	uint64_t now;	   /* tsc of the round being released */
+	uint64_t cur_tick; /* last tick released */
+	uint32_t cnt;	   /* streams on the wheel */
+
+	struct pacing_slot slot[PACING_WHEEL_SLOTS];
+};
+
+struct pacing_wheel *CreatePacingWheel(void);
+void DestroyPacingWheel(struct pacing_wheel *pw);
+void PacingWheelAdd(struct mtcp_manager *mtcp, struct tcp_stream *cur_stream, uint64_t due);
+void PacingWheelRemove(struct mtcp_manager *mtcp, struct tcp_stream *cur_stream);
+int PacingWheelRun(struct mtcp_manager *mtcp);
+
 #endif
@@ -37,4 +37,7 @@
 /* sip, dip, sp, dp: in network byte order */
 int GetRSSCPUCore(in_addr_t sip, in_addr_t dip, in_port_t sp, in_port_t dp, int num_queues, uint8_t endian_check);
 
+/* copy the RSS hash key used by GetRSSCPUCore() into buf */
+void GetRSSKey(uint8_t *buf, int len);
+
 #endif /* RSS_H */
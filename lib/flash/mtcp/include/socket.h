@@ -55,6 +55,9 @@ struct socket_map {
 		struct pipe *pp;
 	};
 
+	/* congestion control chosen before the stream exists, NULL if none */
+	const struct tcp_cc_ops *cc_ops;
+
 	uint32_t epoll;	 /* registered events */
 	uint32_t events; /* available events */
 	mtcp_epoll_data_t ep_data;
@@ -75,6 +78,7 @@ struct tcp_listener {
 	socket_map_t socket;
 
 	int backlog;
+	int syn_backlog; /* streams in SYN_RCVD, see SYNCookieWanted() */
 	stream_queue_t acceptq;
 
 	pthread_mutex_t accept_lock;
@@ -78,6 +78,10 @@ struct net_stat {
 	uint64_t rx_packets[MAX_DEVICES];
 	uint64_t rx_bytes[MAX_DEVICES];
 	uint64_t rx_errors[MAX_DEVICES];
+	uint64_t rx_gro_merged; /* frames chained behind another one */
+	uint64_t tx_gso_segs;	/* frames sent with a header built for a previous one */
+	uint64_t tx_syncookies; /* SYN/ACKs sent without creating a stream */
+	uint64_t rx_syncookies; /* streams created from a cookie ACK */
 #ifdef ENABLELRO
 	uint64_t tx_gdptbytes;
 	uint64_t rx_gdptbytes;
@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ *
+ * In-process congestion control modules. A module owns cwnd, ssthresh and,
+ * if it paces, the pacer rate of the streams attached to it. The stack calls
+ * it inline from ProcessACK and the retransmission timer; now is the TSC
+ * sampled at the start of the current main loop round.
+ */
+
+#ifndef TCP_CC_H
+#define TCP_CC_H
+
+#include "tcp_stream.h"
+
+/* module picked when neither the config nor the socket names one */
+#ifndef TCP_CC_DEFAULT
+#define TCP_CC_DEFAULT "reno"
+#endif
+
+#define TCP_CC_NAME_MAX 16
+
+/*----------------------------------------------------------------------------*/
+struct tcp_cc_ops {
+	char name[TCP_CC_NAME_MAX];
+
+	/* reset the private state; cwnd is left to the handshake */
+	void (*init)(tcp_stream *cur_stream, uint64_t now);
+	/* acked bytes of new data were cumulatively acknowledged */
+	void (*on_ack)(tcp_stream *cur_stream, uint32_t acked, uint64_t now);
+	/* triple duplicate ACK; called before the stack rewinds snd_nxt to
+	 * fast retransmit */
+	void (*on_loss)(tcp_stream *cur_stream, uint64_t now);
+	/* retransmission timeout, also before snd_nxt is rewound */
+	void (*on_timer)(tcp_stream *cur_stream, uint64_t now);
+};
+/*----------------------------------------------------------------------------*/
+extern const struct tcp_cc_ops tcp_cc_reno;
+extern const struct tcp_cc_ops tcp_cc_cubic;
+extern const struct tcp_cc_ops tcp_cc_bbr;
+/*----------------------------------------------------------------------------*/
+/* NULL if no module goes by that name */
+const struct tcp_cc_ops *TCPCCFind(const char *name);
+
+/* the module from the configuration, TCP_CC_DEFAULT otherwise */
+const struct tcp_cc_ops *TCPCCDefault(void);
+
+/* attach a stream to ops, NULL meaning the default */
+void TCPCCInit(tcp_stream *cur_stream, const struct tcp_cc_ops *ops, uint64_t now);
+/*----------------------------------------------------------------------------*/
+static inline void *TCPCCPriv(tcp_stream *cur_stream)
+{
+	return cur_stream->sndvar->cc_priv;
+}
+/*----------------------------------------------------------------------------*/
+/* segments covered by acked bytes, as counted by the ACK path */
+static inline uint32_t TCPCCAckedSegments(tcp_stream *cur_stream, uint32_t acked)
+{
+	uint32_t eff_mss = cur_stream->sndvar->eff_mss;
+
+	return (acked + eff_mss - 1) / eff_mss;
+}
+/*----------------------------------------------------------------------------*/
+/* Reno slow start and congestion avoidance, shared by the loss based modules */
+void TCPCCRenoGrow(tcp_stream *cur_stream, uint32_t acked);
+/*----------------------------------------------------------------------------*/
+
+#endif /* TCP_CC_H */
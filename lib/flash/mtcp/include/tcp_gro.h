@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Receive side coalescing of in-order TCP segments. Consecutive data
+ * segments of a flow found in one rx burst are chained behind the first
+ * one and go through ProcessTCPPacket() as a single segment, so the flow
+ * lookup, ACK processing and event raising run once per chain instead of
+ * once per frame. The payloads stay in their rx frames and are copied into
+ * the receive buffer one by one; nothing is ever linearized.
+ */
+
+#ifndef TCP_GRO_H
+#define TCP_GRO_H
+
+#include <stdint.h>
+
+struct mtcp_manager;
+struct tcp_ring_buffer;
+
+#define TCP_GRO_MAX_SEGS 16 /* frames per chain, head included */
+#define TCP_GRO_MAX_FLOWS 8 /* chains held at once per core */
+
+/*----------------------------------------------------------------------------*/
+struct tcp_gro_frag {
+	uint8_t *pkt; /* rx frame, released with the head */
+	uint8_t *payload;
+	uint16_t pkt_len;
+	uint16_t len; /* payload bytes */
+};
+
+struct tcp_gro_seg {
+	uint8_t *pkt; /* head frame, NULL when the slot is free */
+	uint16_t pkt_len;
+
+	/* flow and the header fields every chained segment must match */
+	uint32_t saddr;
+	uint32_t daddr;
+	uint16_t sport;
+	uint16_t dport;
+	uint32_t ack_seq;
+	uint16_t window;
+	uint8_t optlen;
+	uint8_t *opts;
+
+	uint16_t mss;	   /* payload bytes of the head */
+	uint32_t next_seq; /* seq the next frame must carry */
+	uint32_t len;	   /* payload bytes in frag[] */
+	int nfrags;
+	struct tcp_gro_frag frag[TCP_GRO_MAX_SEGS - 1];
+};
+
+struct tcp_gro {
+	int ifidx;
+	int victim; /* next slot given up when all are taken */
+	struct tcp_gro_seg seg[TCP_GRO_MAX_FLOWS];
+};
+/*----------------------------------------------------------------------------*/
+struct tcp_gro *CreateTCPGRO(void);
+void DestroyTCPGRO(struct tcp_gro *gro);
+
+/* takes one rx frame; it is either chained or handed to ProcessPacket() */
+void TCPGROReceive(struct mtcp_manager *mtcp, int ifidx, uint32_t cur_ts, uint8_t *pkt_data, int len);
+/* processes every held chain; must run before the rx frames are recycled */
+void TCPGROFlush(struct mtcp_manager *mtcp, uint32_t cur_ts);
+
+/* RBPut() of the chain being processed, payload/len covering the head's
+ * payload plus every chained one */
+int TCPGROPut(struct mtcp_manager *mtcp, struct tcp_ring_buffer *buff, uint8_t *payload, uint32_t len, uint32_t seq);
+
+#endif
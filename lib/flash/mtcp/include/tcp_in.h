@@ -40,6 +40,8 @@
 #include "mtcp.h"
 #include "fhash.h"
 
+#define VERIFY_RX_CHECKSUM TRUE
+
 #ifndef TCP_FLAGS
 #define TCP_FLAGS
 #define TCP_FLAG_FIN 0x01 // 0000 0001
@@ -62,6 +64,7 @@
 #define TCP_OPT_WSCALE_LEN 3
 #define TCP_OPT_SACK_PERMIT_LEN 2
 #define TCP_OPT_SACK_LEN 10
+#define TCP_OPT_SACK_BLOCK_LEN 8
 #define TCP_OPT_TIMESTAMP_LEN 10
 
 #define TCP_DEFAULT_MSS 1460
@@ -0,0 +1,124 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Bounded sets of sequence number ranges, kept sorted and disjoint in a
+ * flat array. Used for out-of-order reassembly in the receive buffer and
+ * for the peer's SACK blocks on the send side.
+ */
+
+#ifndef TCP_INTERVAL_H
+#define TCP_INTERVAL_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*----------------------------------------------------------------------------*/
+/* [left_edge, right_edge) in sequence space */
+struct seq_interval {
+	uint32_t left_edge;
+	uint32_t right_edge;
+};
+/*----------------------------------------------------------------------------*/
+/* ranges are ordered by their distance from base, so the set stays valid
+ * across sequence number wrap as long as it spans less than 2^31 */
+#define SEQ_OFF(seq, base) ((uint32_t)((seq) - (base)))
+/*----------------------------------------------------------------------------*/
+/* index of the first range whose right edge is not before seq - base */
+static inline int SeqIntervalLowerBound(const struct seq_interval *ivs, int cnt, uint32_t base, uint32_t seq)
+{
+	int lo = 0, hi = cnt, mid;
+	uint32_t off = SEQ_OFF(seq, base);
+
+	while (lo < hi) {
+		mid = (lo + hi) >> 1;
+		if (SEQ_OFF(ivs[mid].right_edge, base) < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+/*----------------------------------------------------------------------------*/
+/* index of the range holding seq, -1 if none */
+static inline int SeqIntervalFind(const struct seq_interval *ivs, int cnt, uint32_t base, uint32_t seq)
+{
+	int i = SeqIntervalLowerBound(ivs, cnt, base, seq + 1);
+
+	if (i < cnt && SEQ_OFF(ivs[i].left_edge, base) <= SEQ_OFF(seq, base))
+		return i;
+
+	return -1;
+}
+/*----------------------------------------------------------------------------*/
+/*
+ * Add [left, right) to the set, merging it with every range it overlaps or
+ * touches. When the set is full and nothing merges, the range furthest from
+ * base is dropped to make room, or the new one is refused if it would be
+ * that range. *added is set to the number of newly covered bytes.
+ * Returns the index of the range now holding [left, right), -1 if refused.
+ */
+static inline int SeqIntervalInsert(struct seq_interval *ivs, int *cnt, int max, uint32_t base, uint32_t left, uint32_t right,
+				    uint32_t *added)
+{
+	uint32_t l = SEQ_OFF(left, base), r = SEQ_OFF(right, base);
+	uint32_t covered = 0;
+	int i, j;
+
+	*added = 0;
+	if (l >= r)
+		return -1;
+
+	/* [i, j) are the ranges that overlap or touch the new one */
+	i = SeqIntervalLowerBound(ivs, *cnt, base, left);
+	for (j = i; j < *cnt && SEQ_OFF(ivs[j].left_edge, base) <= r; j++)
+		covered += ivs[j].right_edge - ivs[j].left_edge;
+
+	if (i == j) {
+		if (*cnt == max) {
+			if (i == max)
+				return -1;
+			(*cnt)--;
+		}
+		memmove(&ivs[i + 1], &ivs[i], (*cnt - i) * sizeof(*ivs));
+		ivs[i].left_edge = left;
+		ivs[i].right_edge = right;
+		(*cnt)++;
+		*added = r - l;
+		return i;
+	}
+
+	if (SEQ_OFF(ivs[i].left_edge, base) < l)
+		l = SEQ_OFF(ivs[i].left_edge, base);
+	if (SEQ_OFF(ivs[j - 1].right_edge, base) > r)
+		r = SEQ_OFF(ivs[j - 1].right_edge, base);
+
+	ivs[i].left_edge = base + l;
+	ivs[i].right_edge = base + r;
+	if (j - i > 1) {
+		memmove(&ivs[i + 1], &ivs[j], (*cnt - j) * sizeof(*ivs));
+		*cnt -= j - i - 1;
+	}
+	*added = (r - l) - covered;
+
+	return i;
+}
+/*----------------------------------------------------------------------------*/
+/* forget everything before base, returns the number of ranges left */
+static inline int SeqIntervalTrim(struct seq_interval *ivs, int *cnt, uint32_t base, uint32_t old_base)
+{
+	int i;
+
+	/* ranges are still ordered from the old base */
+	i = SeqIntervalLowerBound(ivs, *cnt, old_base, base + 1);
+	if (i > 0) {
+		memmove(&ivs[0], &ivs[i], (*cnt - i) * sizeof(*ivs));
+		*cnt -= i;
+	}
+	if (*cnt > 0 && SEQ_OFF(ivs[0].left_edge, old_base) < SEQ_OFF(base, old_base))
+		ivs[0].left_edge = base;
+
+	return *cnt;
+}
+/*----------------------------------------------------------------------------*/
+
+#endif /* TCP_INTERVAL_H */
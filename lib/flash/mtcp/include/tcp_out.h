@@ -41,9 +41,16 @@ int SendTCPPacketStandalone(struct mtcp_manager *mtcp, uint32_t saddr, uint16_t
 			    uint32_t ack_seq, uint16_t window, uint8_t flags, uint8_t *payload, uint16_t payloadlen, uint32_t cur_ts,
 			    uint32_t echo_ts);
 
+/* SYN/ACK for a connection that has no stream yet, i.e. a SYN cookie;
+   without ext_opts it only carries the MSS, no timestamps, SACK or wscale */
+int SendTCPSynAckStandalone(struct mtcp_manager *mtcp, uint32_t saddr, uint16_t sport, uint32_t daddr, uint16_t dport, uint32_t seq,
+			    uint32_t ack_seq, uint16_t mss, int ext_opts, uint32_t ts_val, uint32_t ts_ecr);
+
 int SendTCPPacket(struct mtcp_manager *mtcp, tcp_stream *cur_stream, uint32_t cur_ts, uint8_t flags, uint8_t *payload,
 		  uint16_t payloadlen);
 
+extern inline struct mtcp_sender *GetSender(mtcp_manager_t mtcp, tcp_stream *cur_stream);
+
 extern inline int WriteTCPControlList(mtcp_manager_t mtcp, struct mtcp_sender *sender, uint32_t cur_ts, int thresh);
 
 extern inline int WriteTCPDataList(mtcp_manager_t mtcp, struct mtcp_sender *sender, uint32_t cur_ts, int thresh);
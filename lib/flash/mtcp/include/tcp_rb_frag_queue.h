@@ -1,49 +0,0 @@
-/*
- * mTCP source code is distributed under the Modified BSD Licence.
- *
- * Copyright (C) 2015 EunYoung Jeong, Shinae Woo, Muhammad Jamshed, Haewon Jeong, 
- *                    Sunghwan Ihm, Dongsu Han, KyoungSoo Park
- *
- * All rights reserved.
- *
- * Redistribution and use in source and binary forms, with or without
- * modification, are permitted provided that the following conditions are met:
- *     * Redistributions of source code must retain the above copyright
- *       notice, this list of conditions and the following disclaimer.
- *     * Redistributions in binary form must reproduce the above copyright
- *       notice, this list of conditions and the following disclaimer in the
- *       documentation and/or other materials provided with the distribution.
- *     * Neither the name of the <organization> nor the
- *       names of its contributors may be used to endorse or promote products
- *       derived from this software without specific prior written permission.
- *
- * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
- * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
- * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
- * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
- * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
- * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
- * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
- * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
- * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
- * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
- */
-
-#ifndef TCP_RB_FRAG_QUEUE
-#define TCP_RB_FRAG_QUEUE
-
-#include "tcp_ring_buffer.h"
-
-/*---------------------------------------------------------------------------*/
-typedef struct rb_frag_queue *rb_frag_queue_t;
-/*---------------------------------------------------------------------------*/
-rb_frag_queue_t CreateRBFragQueue(int capacity);
-/*---------------------------------------------------------------------------*/
-void DestroyRBFragQueue(rb_frag_queue_t rb_fragq);
-/*---------------------------------------------------------------------------*/
-int RBFragEnqueue(rb_frag_queue_t rb_fragq, struct fragment_ctx *frag);
-/*---------------------------------------------------------------------------*/
-struct fragment_ctx *RBFragDequeue(rb_frag_queue_t rb_fragq);
-/*---------------------------------------------------------------------------*/
-
-#endif /* TCP_RB_FRAG_QUEUE */
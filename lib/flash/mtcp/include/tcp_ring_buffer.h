@@ -40,6 +40,9 @@
  * automatically increase total buffer size when buffer is full
  * for efficiently managing packet payload and chunking
  *
+ * mirrored buffers map the same pages twice back-to-back, so the data
+ * stays virtually contiguous across the wrap point without compaction
+ *
  */
 
 #ifndef NRE_RING_BUFFER
@@ -48,19 +51,14 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include "tcp_interval.h"
+
 /*----------------------------------------------------------------------------*/
 enum rb_caller { AT_APP, AT_MTCP };
 /*----------------------------------------------------------------------------*/
 typedef struct mtcp_manager *mtcp_manager_t;
 typedef struct rb_manager *rb_manager_t;
 /*----------------------------------------------------------------------------*/
-struct fragment_ctx {
-	uint32_t seq;
-	uint32_t len : 31;
-	uint32_t is_calloc : 1;
-	struct fragment_ctx *next;
-};
-/*----------------------------------------------------------------------------*/
 struct tcp_ring_buffer {
 	u_char *data; /* buffered data */
 	u_char *head; /* pointer to the head */
@@ -77,7 +75,15 @@ struct tcp_ring_buffer {
 	uint32_t head_seq;
 	uint32_t init_seq;
 
-	struct fragment_ctx *fctx;
+	/* received ranges from head_seq on, sorted; ooo[0] starts at head_seq
+	   once the head is in (merged_len bytes), the rest are holes away */
+#define RB_MAX_OOO 32
+	struct seq_interval ooo[RB_MAX_OOO];
+	int ooo_cnt;
+	uint32_t last_seq; /* start of the most recently received segment */
+
+	uint32_t mirror_size; /* wrap period of a mirrored buffer, 0 if not mirrored */
+	uint32_t slot;	      /* mirrored slot backing this buffer */
 };
 /*----------------------------------------------------------------------------*/
 uint32_t RBGetCurnum(rb_manager_t rbm);
@@ -85,7 +91,10 @@ void RBPrintInfo(struct tcp_ring_buffer *buff);
 void RBPrintStr(struct tcp_ring_buffer *buff);
 void RBPrintHex(struct tcp_ring_buffer *buff);
 /*----------------------------------------------------------------------------*/
-rb_manager_t RBManagerCreate(mtcp_manager_t mtcp, size_t chunk_size, uint32_t cnum);
+/* mirror: back buffers with double-mapped memfd pages instead of the
+   memory pool, falls back to the pool if the memfd can't be set up and
+   to a plain buffer per connection once the mappings run out */
+rb_manager_t RBManagerCreate(mtcp_manager_t mtcp, size_t chunk_size, uint32_t cnum, int mirror);
 /*----------------------------------------------------------------------------*/
 struct tcp_ring_buffer *RBInit(rb_manager_t rbm, uint32_t init_seq);
 void RBFree(rb_manager_t rbm, struct tcp_ring_buffer *buff);
@@ -95,6 +104,9 @@ uint32_t RBIsDanger(rb_manager_t rbm);
 int RBPut(rb_manager_t rbm, struct tcp_ring_buffer *buff, void *data, uint32_t len, uint32_t seq);
 size_t RBGet(rb_manager_t rbm, struct tcp_ring_buffer *buff, size_t len);
 size_t RBRemove(rb_manager_t rbm, struct tcp_ring_buffer *buff, size_t len, int option);
+/* ranges received beyond the first hole, the one holding the most recently
+   received segment first as SACK wants; returns the number filled in */
+int RBGetOOORanges(struct tcp_ring_buffer *buff, struct seq_interval *ranges, int max);
 /*----------------------------------------------------------------------------*/
 
 #endif
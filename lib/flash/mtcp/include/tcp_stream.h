@@ -43,12 +43,15 @@
 #endif
 
 #ifndef PACING_ENABLED
-#define PACING_ENABLED FALSE
+#define PACING_ENABLED TRUE
 #endif
 
-#if RATE_LIMIT_ENABLED || PACING_ENABLED
 #include "pacing.h"
-#endif
+
+/* room for the private state of a congestion control module */
+#define TCP_CC_PRIV_SIZE 96
+
+struct tcp_cc_ops;
 
 struct rtm_stat {
 	uint32_t tdp_ack_cnt;
@@ -65,14 +68,6 @@ struct rtm_stat {
 	uint32_t rto_bytes;
 };
 
-#if TCP_OPT_SACK_ENABLED
-struct sack_entry {
-	uint32_t left_edge;
-	uint32_t right_edge;
-	uint32_t expire;
-};
-#endif /* TCP_OPT_SACK_ENABLED */
-
 struct tcp_recv_vars {
 	/* receiver variables */
 	uint32_t rcv_wnd; /* receive window (unscaled) */
@@ -98,11 +93,13 @@ struct tcp_recv_vars {
 	uint32_t rttvar;   /* smoothed mdev_max */
 	uint32_t rtt_seq;  /* sequence number to update rttvar */
 
-#if TCP_OPT_SACK_ENABLED /* currently not used */
+#if TCP_OPT_SACK_ENABLED
 #define MAX_SACK_ENTRY 8
 	uint32_t sacked_pkts;
-	struct sack_entry sack_table[MAX_SACK_ENTRY];
-	uint8_t sacks : 3;
+	/* blocks sacked by the peer, sorted from sack_base (a past snd_una) */
+	struct seq_interval sack_table[MAX_SACK_ENTRY];
+	uint32_t sack_base;
+	int sacks;
 #endif /* TCP_OPT_SACK_ENABLED */
 
 	struct tcp_ring_buffer *rcvbuf;
@@ -120,9 +117,19 @@ struct tcp_recv_vars {
 #endif
 };
 
+/* Ethernet + IP prefix shared by every segment of a stream */
+struct tcp_hdr_template {
+	uint8_t valid;
+	uint32_t arp_gen; /* neighbor table generation the MAC was taken at */
+	uint8_t hdr[ETHERNET_HEADER_LEN + IP_HEADER_LEN];
+	uint32_t ip_sum;     /* IP header sum with tot_len, id and check zeroed */
+	uint32_t pseudo_sum; /* TCP pseudo header sum without the length */
+};
+
 struct tcp_send_vars {
 	/* IP-level information */
 	uint16_t ip_id;
+	struct tcp_hdr_template hdr_tmpl; /* built on the first IPOutput() */
 
 	uint16_t mss;	  /* maximum segment size */
 	uint16_t eff_mss; /* effective segment size (excluding tcp option) */
@@ -149,6 +156,17 @@ struct tcp_send_vars {
 	/* congestion control variables */
 	uint32_t cwnd;	   /* congestion window */
 	uint32_t ssthresh; /* slow start threshold */
+
+	/* congestion control module and its per-stream state */
+	const struct tcp_cc_ops *cc_ops;
+	uint64_t cc_priv[TCP_CC_PRIV_SIZE / sizeof(uint64_t)];
+
+	/* socket options set by the application, applied from the optq */
+	const struct tcp_cc_ops *cc_pending;
+#if PACING_ENABLED
+	uint64_t pacing_rate_pending;
+	uint8_t pacing_pending;
+#endif
 #if USE_CCP
 	uint32_t missing_seq;
 #endif
@@ -166,6 +184,7 @@ struct tcp_send_vars {
 	uint8_t on_ackq;
 	uint8_t on_closeq;
 	uint8_t on_resetq;
+	uint8_t on_optq;
 
 	uint8_t on_closeq_int : 1, on_resetq_int : 1, is_fin_sent : 1, is_fin_ackd : 1;
 
@@ -173,6 +192,11 @@ struct tcp_send_vars {
 	TAILQ_ENTRY(tcp_stream) send_link;
 	TAILQ_ENTRY(tcp_stream) ack_link;
 
+	TAILQ_ENTRY(tcp_stream) pacing_link; /* waiting on the pacing wheel */
+	uint64_t paced_until;		     /* tsc the pacer will let it send */
+	uint16_t pacing_slot;
+	uint8_t on_pacing_wheel;
+
 	TAILQ_ENTRY(tcp_stream) timer_link;   /* timer link (rto list, tw list) */
 	TAILQ_ENTRY(tcp_stream) timeout_link; /* connection timeout link */
 
@@ -216,7 +240,8 @@ typedef struct tcp_stream {
 	uint16_t on_timeout_list : 1, on_rcv_br_list : 1, on_snd_br_list : 1, saw_timestamp : 1, /* whether peer sends timestamp */
 		sack_permit : 1,								 /* whether peer permits SACK */
 		control_list_waiting : 1, have_reset : 1, is_external : 1, /* the peer node is locate outside of lan */
-		wait_for_acks : 1; /* if true, the sender should wait for acks to catch up before sending again */
+		wait_for_acks : 1, /* if true, the sender should wait for acks to catch up before sending again */
+		syn_queued : 1;	   /* counted in its listener's syn_backlog */
 
 	uint32_t snd_nxt; /* send next */
 	uint32_t rcv_nxt; /* receive next */
@@ -227,10 +252,10 @@ typedef struct tcp_stream {
 	struct tcp_recv_vars *rcvvar;
 	struct tcp_send_vars *sndvar;
 #if RATE_LIMIT_ENABLED
-	struct token_bucket *bucket;
+	struct token_bucket bucket;
 #endif
 #if PACING_ENABLED
-	struct packet_pacer *pacer;
+	struct packet_pacer pacer;
 #endif
 #if USE_CCP
 	struct ccp_connection *ccp_conn;
@@ -99,6 +99,12 @@ int StreamEnqueue(stream_queue_t sq, struct tcp_stream *stream);
 /*---------------------------------------------------------------------------*/
 struct tcp_stream *StreamDequeue(stream_queue_t sq);
 /*---------------------------------------------------------------------------*/
+/* consumer side: dequeues up to cnt streams, returns how many */
+int StreamDequeueBulk(stream_queue_t sq, struct tcp_stream **streams, int cnt);
+/*---------------------------------------------------------------------------*/
+/* consumer side: streams that can be dequeued right now, at least */
+int StreamQueueCount(stream_queue_t sq);
+/*---------------------------------------------------------------------------*/
 int StreamQueueIsEmpty(stream_queue_t sq);
 /*---------------------------------------------------------------------------*/
 
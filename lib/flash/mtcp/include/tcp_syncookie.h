@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Stateless passive open. A SYN is answered with a SYN/ACK whose sequence
+ * number encodes the connection (a keyed hash of the 4-tuple and the peer's
+ * ISN, a coarse time counter and the MSS); no tcp_stream exists until the
+ * peer's ACK echoes a valid cookie back. Window scale and SACK, which do
+ * not fit in the sequence number, ride in the low bits of our timestamp.
+ */
+
+#ifndef TCP_SYNCOOKIE_H
+#define TCP_SYNCOOKIE_H
+
+#include <stdint.h>
+#include <netinet/ip.h>
+#include <linux/tcp.h>
+
+struct mtcp_manager;
+struct tcp_listener;
+struct tcp_stream;
+
+/* values of CONFIG.tcp_syncookies, as in Linux */
+#define SYNCOOKIES_OFF 0
+#define SYNCOOKIES_ON_OVERFLOW 1 /* once a listener has backlog half-open streams */
+#define SYNCOOKIES_ALWAYS 2
+
+/* draws the cookie key, once per process */
+int InitSYNCookies(void);
+
+/* TRUE if a SYN to listener is to be answered with a cookie */
+int SYNCookieWanted(struct tcp_listener *listener);
+
+/* answers the SYN without creating a stream */
+int SendSYNCookie(struct mtcp_manager *mtcp, uint32_t cur_ts, const struct iphdr *iph, const struct tcphdr *tcph);
+
+/* the SYN_RCVD stream of a connection whose ACK carries a valid cookie,
+ * NULL if the cookie does not check out */
+struct tcp_stream *CheckSYNCookie(struct mtcp_manager *mtcp, uint32_t cur_ts, const struct iphdr *iph, const struct tcphdr *tcph);
+
+#endif /* TCP_SYNCOOKIE_H */
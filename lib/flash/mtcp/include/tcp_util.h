@@ -58,12 +58,19 @@ extern inline int ParseTCPTimestamp(tcp_stream *cur_stream, struct tcp_timestamp
 
 #if TCP_OPT_SACK_ENABLED
 int SeqIsSacked(tcp_stream *cur_stream, uint32_t seq);
+int NextSACKedRange(tcp_stream *cur_stream, uint32_t seq, struct seq_interval *range);
 
 void ParseSACKOption(tcp_stream *cur_stream, uint32_t ack_seq, uint8_t *tcpopt, int len);
+
+int GenerateSACKOption(const struct seq_interval *blocks, int nblocks, uint8_t *tcpopt);
 #endif
 
 uint16_t TCPCalcChecksum(uint16_t *buf, uint16_t len, uint32_t saddr, uint32_t daddr);
 
+uint32_t TCPCopyAndSum(uint8_t *dst, const uint8_t *src, uint16_t len);
+
+uint16_t TCPCalcChecksumPartial(uint16_t *hdr, uint16_t hdrlen, uint16_t seglen, uint32_t pseudo_sum, uint32_t payload_sum);
+
 void PrintTCPOptions(uint8_t *tcpopt, int len);
 
 #endif /* TCP_UTIL_H */
@@ -319,7 +319,7 @@ int SetNetEnv(char *dev_name_list, char *port_stat_list)
 		socket_mem = RTE_ALIGN_CEIL((unsigned long)ceil((CONFIG.num_cores *
 								 (CONFIG.rcvbuf_size + CONFIG.sndbuf_size + sizeof(struct tcp_stream) +
 								  sizeof(struct tcp_recv_vars) + sizeof(struct tcp_send_vars) +
-								  sizeof(struct fragment_ctx)) *
+								  sizeof(struct tcp_ring_buffer)) *
 								 CONFIG.max_concurrency) /
 								RTE_SOCKET_MEM_SHIFT),
 					    RTE_CACHE_LINE_SIZE);
@@ -727,6 +727,17 @@ int FetchEndianType(void)
 	return 0;
 }
 /*----------------------------------------------------------------------------*/
+int GetCoreRSSQueue(int cpu)
+{
+#ifndef DISABLE_AFXDP
+	/* flash hands out sockets bound to arbitrary queues of the NIC */
+	if (current_iomodule_func == &afxdp_module_func)
+		return afxdp_get_core_queue(cpu);
+#endif
+	/* other modules pin rx queue i to core i */
+	return cpu;
+}
+/*----------------------------------------------------------------------------*/
 int CheckIOModuleAccessPermissions(void)
 {
 #ifndef DISABLE_NETMAP
@@ -55,16 +55,19 @@ inline int ProcessIPv4Packet(mtcp_manager_t mtcp, uint32_t cur_ts, const int ifi
 	if (ip_len < (int)sizeof(struct iphdr))
 		return ERROR;
 
+	/* the head of a GRO chain was checked when it was chained */
+	if (!mtcp->gro_seg) {
 #ifndef DISABLE_HWCSUM
-	if (mtcp->iom->dev_ioctl != NULL)
-		rc = mtcp->iom->dev_ioctl(mtcp->ctx, ifidx, PKT_RX_IP_CSUM, iph);
-	if (rc == -1 && ip_fast_csum(iph, iph->ihl))
-		return ERROR;
+		if (mtcp->iom->dev_ioctl != NULL)
+			rc = mtcp->iom->dev_ioctl(mtcp->ctx, ifidx, PKT_RX_IP_CSUM, iph);
+		if (rc == -1 && ip_fast_csum(iph, iph->ihl))
+			return ERROR;
 #else
-	UNUSED(rc);
-	if (ip_fast_csum(iph, iph->ihl))
-		return ERROR;
+		UNUSED(rc);
+		if (ip_fast_csum(iph, iph->ihl))
+			return ERROR;
 #endif
+	}
 
 #if !PROMISCUOUS_MODE
 	/* if not promiscuous mode, drop if the destination is not myself */
@@ -78,7 +78,7 @@ uint8_t *IPOutputStandalone(struct mtcp_manager *mtcp, uint8_t protocol, uint16_
 	if (nif < 0)
 		return NULL;
 
-	haddr = GetDestinationHWaddr(daddr, is_external);
+	haddr = GetDestinationHWaddr(mtcp, daddr, is_external);
 	if (!haddr) {
 #if 0
 		uint8_t *da = (uint8_t *)&daddr;
@@ -129,71 +129,162 @@ uint8_t *IPOutputStandalone(struct mtcp_manager *mtcp, uint8_t protocol, uint16_
 	return (uint8_t *)(iph + 1);
 }
 /*----------------------------------------------------------------------------*/
+static inline uint16_t FoldChecksum(uint32_t sum)
+{
+	sum = (sum >> 16) + (sum & 0xFFFF);
+	sum += (sum >> 16);
+	return (uint16_t)~sum;
+}
+/*----------------------------------------------------------------------------*/
+/* build the per-stream Ethernet/IP prefix once the next hop is resolved;
+ * gen is the neighbor table generation haddr was looked up at */
+static int BuildHeaderTemplate(tcp_stream *stream, const unsigned char *haddr, uint32_t gen)
+{
+	struct tcp_hdr_template *tmpl = &stream->sndvar->hdr_tmpl;
+	struct ethhdr *ethh = (struct ethhdr *)tmpl->hdr;
+	struct iphdr *iph = (struct iphdr *)(ethh + 1);
+	uint16_t *w;
+	uint32_t sum;
+	int eidx, i;
+
+	eidx = CONFIG.nif_to_eidx[stream->sndvar->nif_out];
+	if (eidx < 0)
+		return -1;
+
+	memcpy(ethh->h_source, CONFIG.eths[eidx].haddr, ETH_ALEN);
+	memcpy(ethh->h_dest, haddr, ETH_ALEN);
+	ethh->h_proto = htons(ETH_P_IP);
+
+	iph->ihl = IP_HEADER_LEN >> 2;
+	iph->version = 4;
+	iph->tos = 0;
+	iph->tot_len = 0;
+	iph->id = 0;
+	iph->frag_off = htons(IP_DF); // no fragmentation
+	iph->ttl = 64;
+	iph->protocol = IPPROTO_TCP;
+	iph->saddr = stream->saddr;
+	iph->daddr = stream->daddr;
+	iph->check = 0;
+
+	sum = 0;
+	w = (uint16_t *)iph;
+	for (i = 0; i < IP_HEADER_LEN / 2; i++)
+		sum += w[i];
+	tmpl->ip_sum = sum;
+
+	tmpl->pseudo_sum = (stream->saddr & 0xFFFF) + (stream->saddr >> 16) + (stream->daddr & 0xFFFF) + (stream->daddr >> 16) +
+			   htons(IPPROTO_TCP);
+	tmpl->arp_gen = gen;
+	tmpl->valid = TRUE;
+
+	return 0;
+}
+/*----------------------------------------------------------------------------*/
+static inline int StreamOutputInterface(tcp_stream *stream)
+{
+	unsigned char is_external = 0;
+
+	if (stream->sndvar->nif_out < 0) {
+		stream->sndvar->nif_out = GetOutputInterface(stream->daddr, &is_external);
+		stream->is_external = is_external;
+	}
+
+	return stream->sndvar->nif_out;
+}
+/*----------------------------------------------------------------------------*/
+/* the header template is rebuilt whenever the neighbor table changed */
+static inline int HeaderTemplateStale(tcp_stream *stream, uint32_t gen)
+{
+	return !stream->sndvar->hdr_tmpl.valid || stream->sndvar->hdr_tmpl.arp_gen != gen;
+}
+/*----------------------------------------------------------------------------*/
+static inline void RequestStreamARP(struct mtcp_manager *mtcp, tcp_stream *stream)
+{
+	stream->sndvar->hdr_tmpl.valid = FALSE;
+	RequestARP(mtcp, (stream->is_external) ? (CONFIG.gateway)->daddr : stream->daddr, stream->sndvar->nif_out,
+		   mtcp->cur_ts);
+}
+/*----------------------------------------------------------------------------*/
+int PrepareHeaderTemplates(struct mtcp_manager *mtcp, tcp_stream **streams, int cnt)
+{
+	uint32_t dips[ARP_RESOLVE_BATCH];
+	uint8_t is_gateway[ARP_RESOLVE_BATCH];
+	unsigned char haddrs[ARP_RESOLVE_BATCH][ETH_ALEN];
+	tcp_stream *stale[ARP_RESOLVE_BATCH];
+	uint64_t found;
+	uint32_t gen;
+	int nstale = 0;
+	int ready = cnt;
+	int i;
+
+	assert(cnt <= ARP_RESOLVE_BATCH);
+
+	gen = ARPGeneration();
+	for (i = 0; i < cnt; i++) {
+		if (!HeaderTemplateStale(streams[i], gen))
+			continue;
+		StreamOutputInterface(streams[i]);
+		stale[nstale] = streams[i];
+		dips[nstale] = streams[i]->daddr;
+		is_gateway[nstale] = streams[i]->is_external;
+		nstale++;
+	}
+	if (!nstale)
+		return ready;
+
+	found = GetDestinationHWaddrBulk(mtcp, dips, is_gateway, haddrs, nstale);
+	for (i = 0; i < nstale; i++) {
+		if (!(found & (1ULL << i)) || BuildHeaderTemplate(stale[i], haddrs[i], gen) < 0) {
+			RequestStreamARP(mtcp, stale[i]);
+			ready--;
+		}
+	}
+
+	return ready;
+}
+/*----------------------------------------------------------------------------*/
 uint8_t *IPOutput(struct mtcp_manager *mtcp, tcp_stream *stream, uint16_t tcplen)
 {
+	struct tcp_hdr_template *tmpl = &stream->sndvar->hdr_tmpl;
 	struct iphdr *iph;
+	unsigned char *haddr;
+	uint32_t gen;
 	int nif;
-	unsigned char *haddr, is_external = 0;
 	int rc = -1;
 
-	if (stream->sndvar->nif_out >= 0) {
-		nif = stream->sndvar->nif_out;
-	} else {
-		nif = GetOutputInterface(stream->daddr, &is_external);
-		stream->sndvar->nif_out = nif;
-		stream->is_external = is_external;
-	}
+	nif = StreamOutputInterface(stream);
 
-	haddr = GetDestinationHWaddr(stream->daddr, stream->is_external);
-	if (!haddr) {
-#if 0
-		uint8_t *da = (uint8_t *)&stream->daddr;
-		TRACE_INFO("[WARNING] The destination IP %u.%u.%u.%u "
-				"is not in ARP table!\n",
-				da[0], da[1], da[2], da[3]);
-#endif
-		/* if not found in the arp table, send arp request and return NULL */
-		/* tcp will retry sending the packet later */
-		RequestARP(mtcp, (stream->is_external) ? (CONFIG.gateway)->daddr : stream->daddr, stream->sndvar->nif_out,
-			   mtcp->cur_ts);
-		return NULL;
+	gen = ARPGeneration();
+	if (HeaderTemplateStale(stream, gen)) {
+		haddr = GetDestinationHWaddr(mtcp, stream->daddr, stream->is_external);
+		if (!haddr || BuildHeaderTemplate(stream, haddr, gen) < 0) {
+			/* if not found in the arp table, send arp request and return NULL */
+			/* tcp will retry sending the packet later */
+			RequestStreamARP(mtcp, stream);
+			return NULL;
+		}
 	}
 
-	iph = (struct iphdr *)EthernetOutput(mtcp, ETH_P_IP, stream->sndvar->nif_out, haddr, tcplen + IP_HEADER_LEN);
+	/* only the length, id and checksum change from segment to segment */
+	iph = (struct iphdr *)EthernetOutputPrebuilt(mtcp, nif, tmpl->hdr, sizeof(tmpl->hdr), tcplen + IP_HEADER_LEN);
 	if (!iph) {
 		return NULL;
 	}
 
-	iph->ihl = IP_HEADER_LEN >> 2;
-	iph->version = 4;
-	iph->tos = 0;
 	iph->tot_len = htons(IP_HEADER_LEN + tcplen);
 	iph->id = htons(stream->sndvar->ip_id++);
-	iph->frag_off = htons(0x4000); // no fragmentation
-	iph->ttl = 64;
-	iph->protocol = IPPROTO_TCP;
-	iph->saddr = stream->saddr;
-	iph->daddr = stream->daddr;
-	iph->check = 0;
 
 #ifndef DISABLE_HWCSUM
 	/* offload IP checkum if possible */
-	if (mtcp->iom->dev_ioctl != NULL) {
-		switch (iph->protocol) {
-		case IPPROTO_TCP:
-			rc = mtcp->iom->dev_ioctl(mtcp->ctx, nif, PKT_TX_TCPIP_CSUM_PEEK, iph);
-			break;
-		case IPPROTO_ICMP:
-			rc = mtcp->iom->dev_ioctl(mtcp->ctx, nif, PKT_TX_IP_CSUM, iph);
-			break;
-		}
-	}
-	/* otherwise calculate IP checksum in S/W */
+	if (mtcp->iom->dev_ioctl != NULL)
+		rc = mtcp->iom->dev_ioctl(mtcp->ctx, nif, PKT_TX_TCPIP_CSUM_PEEK, iph);
+	/* otherwise patch the template checksum in S/W */
 	if (rc == -1)
-		iph->check = ip_fast_csum(iph, iph->ihl);
+		iph->check = FoldChecksum(tmpl->ip_sum + iph->tot_len + iph->id);
 #else
 	UNUSED(rc);
-	iph->check = ip_fast_csum(iph, iph->ihl);
+	iph->check = FoldChecksum(tmpl->ip_sum + iph->tot_len + iph->id);
 #endif
 	return (uint8_t *)(iph + 1);
 }
@@ -29,99 +29,197 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "tcp_stream.h"
 #include "pacing.h"
 #include "clock.h"
 #include "tcp_util.h"
+#include "tcp_out.h"
+#include "debug.h"
+
+#define PACING_WHEEL_MASK (PACING_WHEEL_SLOTS - 1)
 /*----------------------------------------------------------------------------*/
-#if RATE_LIMIT_ENABLED
-token_bucket *NewTokenBucket()
+static inline uint64_t CyclesPerByte(uint64_t rate)
 {
-	token_bucket *bucket;
-	bucket = malloc(sizeof(token_bucket));
-	if (bucket == NULL)
-		return NULL;
-
-	bucket->rate = 0;
-	bucket->burst = (MSS * INIT_CWND_PKTS);
-	bucket->tokens = bucket->burst;
-	bucket->last_fill_t = now_usecs();
-	return bucket;
+	return rate ? (GetTSCHz() << PACING_CPB_SHIFT) / rate : 0;
 }
 /*----------------------------------------------------------------------------*/
-void _refill_bucket(token_bucket *bucket)
+static inline uint64_t CyclesFor(uint64_t cpb, uint32_t bytes)
 {
-	uint32_t elapsed = time_since_usecs(bucket->last_fill_t);
-	double new_tokens = SECONDS_TO_USECS(bucket->rate * elapsed);
-	double prev_tokens = bucket->tokens;
-	bucket->tokens = MIN(bucket->burst, bucket->tokens + new_tokens);
-	if (bucket->tokens > prev_tokens) {
-		bucket->last_fill_t = now_usecs();
-	} else {
-		//fprintf(stderr, "elapsed=%lu new=%f\n", time_since_usecs(bucket->last_fill_t), new_tokens);
-	}
+	return ((uint64_t)bytes * cpb) >> PACING_CPB_SHIFT;
 }
 /*----------------------------------------------------------------------------*/
-int SufficientTokens(token_bucket *bucket, uint64_t new_bits)
+#if RATE_LIMIT_ENABLED
+void SetTokenBucketRate(token_bucket *bucket, uint64_t rate)
 {
-	double new_bytes = BITS_TO_BYTES(new_bits);
+	if (bucket->rate == rate)
+		return;
 
-	//fprintf(stderr, "checking for %ld tokens\n", new_bits);
+	bucket->cpb = CyclesPerByte(rate);
+	bucket->burst = CyclesFor(bucket->cpb, MSS * INIT_CWND_PKTS);
+	/* a bucket that was idle starts full */
+	if (bucket->rate == 0 || bucket->tokens > bucket->burst)
+		bucket->tokens = bucket->burst;
+	bucket->rate = rate;
+}
+/*----------------------------------------------------------------------------*/
+int SufficientTokens(token_bucket *bucket, uint64_t now, uint32_t bytes, uint64_t *due)
+{
+	uint64_t cost = CyclesFor(bucket->cpb, bytes);
 
-	_refill_bucket(bucket);
+	if (now > bucket->last_fill) {
+		bucket->tokens = MIN(bucket->burst, bucket->tokens + (now - bucket->last_fill));
+		bucket->last_fill = now;
+	}
 
-	if (bucket->tokens >= new_bytes) {
-		bucket->tokens -= new_bytes;
+	if (bucket->tokens >= cost) {
+		bucket->tokens -= cost;
 		return 0;
 	}
 
+	*due = now + (cost - bucket->tokens);
 	return -1;
 }
 /*----------------------------------------------------------------------------*/
 void PrintBucket(token_bucket *bucket)
 {
-	fprintf(stderr, "[rate=%.3f tokens=%f last=%u]\n", BPS_TO_MBPS(bucket->rate), bucket->tokens, bucket->last_fill_t);
+	fprintf(stderr, "[rate=%lu tokens=%lu last=%lu]\n", bucket->rate, bucket->tokens, bucket->last_fill);
 }
 /*----------------------------------------------------------------------------*/
 #endif /* !RATE_LIMIT_ENABLED */
 
 #if PACING_ENABLED
 /*----------------------------------------------------------------------------*/
-packet_pacer *NewPacketPacer()
+void SetPacingRate(packet_pacer *pacer, uint64_t rate)
 {
-	packet_pacer *pacer;
-	pacer = malloc(sizeof(packet_pacer));
-	if (pacer == NULL)
-		return NULL;
-	pacer->rate_bps = 0;
-	pacer->extra_packets = 1;
-	pacer->next_send_time = 0;
-	return pacer;
+	if (pacer->rate == rate)
+		return;
+
+	pacer->cpb = CyclesPerByte(rate);
+	pacer->rate = rate;
 }
 /*----------------------------------------------------------------------------*/
-int CanSendNow(packet_pacer *pacer)
+/*
+ * Earliest departure time: a segment may leave once its departure time is
+ * within slack cycles of now, and pushes the next one out by its own
+ * length at the paced rate. Time the stream spent idle is not banked.
+ */
+int CanSendNow(packet_pacer *pacer, uint64_t now, uint64_t slack, uint32_t bytes, uint64_t *due)
 {
-	if (pacer->rate_bps == 0) {
+	if (pacer->rate == 0) {
 		return TRUE;
 	}
 
-	uint32_t now = now_usecs();
-	if (now >= pacer->next_send_time) {
-		pacer->next_send_time = now + (int)(MSS / BPS_TO_MBPS(pacer->rate_bps));
-		pacer->extra_packets = 1;
-		//fprintf(stderr, "now=%u, next=%u\n", now, pacer->next_send_time);
+	if (pacer->next_send_tsc < now)
+		pacer->next_send_tsc = now;
 
-		return TRUE;
-	} else if (pacer->extra_packets) {
-		pacer->extra_packets--;
-		return TRUE;
-	} else {
+	if (pacer->next_send_tsc >= now + slack) {
+		*due = pacer->next_send_tsc;
 		return FALSE;
 	}
+
+	pacer->next_send_tsc += CyclesFor(pacer->cpb, bytes);
+	return TRUE;
 }
 /*----------------------------------------------------------------------------*/
 void PrintPacer(packet_pacer *pacer)
 {
-	//fprintf(stderr, "[rate=%u next_time=%u]\n", pacer->rate_bps, pacer->next_send_time);
+	fprintf(stderr, "[rate=%lu next_tsc=%lu]\n", pacer->rate, pacer->next_send_tsc);
 }
 /*----------------------------------------------------------------------------*/
 #endif /* !PACING_ENABLED */
+
+/*----------------------------------------------------------------------------*/
+struct pacing_wheel *CreatePacingWheel(void)
+{
+	struct pacing_wheel *pw;
+	int i;
+
+	pw = (struct pacing_wheel *)calloc(1, sizeof(struct pacing_wheel));
+	if (!pw)
+		return NULL;
+
+	pw->tick_cycles = GetTSCHz() * PACING_TICK_US / 1000000;
+	if (pw->tick_cycles == 0)
+		pw->tick_cycles = 1;
+	pw->now = ReadTSC();
+	pw->cur_tick = pw->now / pw->tick_cycles;
+
+	for (i = 0; i < PACING_WHEEL_SLOTS; i++)
+		TAILQ_INIT(&pw->slot[i]);
+
+	return pw;
+}
+/*----------------------------------------------------------------------------*/
+void DestroyPacingWheel(struct pacing_wheel *pw)
+{
+	free(pw);
+}
+/*----------------------------------------------------------------------------*/
+/* park a stream taken off its send list until due; it stays on_send_list */
+void PacingWheelAdd(mtcp_manager_t mtcp, tcp_stream *cur_stream, uint64_t due)
+{
+	struct pacing_wheel *pw = mtcp->pacing_wheel;
+	uint64_t tick = due / pw->tick_cycles;
+	int idx;
+
+	if (tick <= pw->cur_tick)
+		tick = pw->cur_tick + 1;
+	else if (tick - pw->cur_tick >= PACING_WHEEL_SLOTS)
+		tick = pw->cur_tick + PACING_WHEEL_SLOTS - 1;
+
+	idx = tick & PACING_WHEEL_MASK;
+	TAILQ_INSERT_TAIL(&pw->slot[idx], cur_stream, sndvar->pacing_link);
+	cur_stream->sndvar->pacing_slot = idx;
+	cur_stream->sndvar->on_pacing_wheel = TRUE;
+	pw->cnt++;
+}
+/*----------------------------------------------------------------------------*/
+void PacingWheelRemove(mtcp_manager_t mtcp, tcp_stream *cur_stream)
+{
+	struct pacing_wheel *pw = mtcp->pacing_wheel;
+
+	if (cur_stream->sndvar->on_pacing_wheel) {
+		TAILQ_REMOVE(&pw->slot[cur_stream->sndvar->pacing_slot], cur_stream, sndvar->pacing_link);
+		cur_stream->sndvar->on_pacing_wheel = FALSE;
+		pw->cnt--;
+	}
+}
+/*----------------------------------------------------------------------------*/
+/*
+ * Move every stream whose tick has passed by this round's clock sample
+ * back to the tail of its sender's send list. Returns the number of
+ * streams released.
+ */
+int PacingWheelRun(mtcp_manager_t mtcp)
+{
+	struct pacing_wheel *pw = mtcp->pacing_wheel;
+	struct mtcp_sender *sender;
+	struct pacing_slot *slot;
+	tcp_stream *cur_stream;
+	uint64_t tick, ticks;
+	int cnt = 0;
+
+	pw->now = mtcp->cur_tsc;
+	tick = pw->now / pw->tick_cycles;
+	if (tick <= pw->cur_tick)
+		return 0;
+
+	ticks = MIN(tick - pw->cur_tick, PACING_WHEEL_SLOTS);
+	while (pw->cnt > 0 && ticks-- > 0) {
+		slot = &pw->slot[(tick - ticks) & PACING_WHEEL_MASK];
+		while ((cur_stream = TAILQ_FIRST(slot))) {
+			TAILQ_REMOVE(slot, cur_stream, sndvar->pacing_link);
+			cur_stream->sndvar->on_pacing_wheel = FALSE;
+			pw->cnt--;
+
+			sender = GetSender(mtcp, cur_stream);
+			TAILQ_INSERT_TAIL(&sender->send_list, cur_stream, sndvar->send_link);
+			sender->send_list_cnt++;
+			cnt++;
+		}
+	}
+	pw->cur_tick = tick;
+
+	return cnt;
+}
+/*----------------------------------------------------------------------------*/
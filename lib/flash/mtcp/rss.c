@@ -39,16 +39,16 @@
 
 #include "rss.h"
 
+/*-------------------------------------------------------------*/
+/* Keys for system testing */
+static const uint8_t key[] = { 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05,
+			       0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05,
+			       0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05 };
 /*-------------------------------------------------------------*/
 static void BuildKeyCache(uint32_t *cache, int cache_len)
 {
 #define NBBY 8 /* number of bits per byte */
 
-	/* Keys for system testing */
-	static const uint8_t key[] = { 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05,
-				       0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05,
-				       0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05 };
-
 	uint32_t result = (((uint32_t)key[0]) << 24) | (((uint32_t)key[1]) << 16) | (((uint32_t)key[2]) << 8) | ((uint32_t)key[3]);
 
 	uint32_t idx = 32;
@@ -133,3 +133,14 @@ int GetRSSCPUCore(in_addr_t sip, in_addr_t dip, in_port_t sp, in_port_t dp, int
 	return (masked % num_queues);
 }
 /*-------------------------------------------------------------------*/
+/* fill buf with the hash key GetRSSCPUCore() assumes the NIC uses;  */
+/* the key is repeated if the NIC wants a longer one                 */
+/*-------------------------------------------------------------------*/
+void GetRSSKey(uint8_t *buf, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = key[i % sizeof(key)];
+}
+/*-------------------------------------------------------------------*/
@@ -70,6 +70,7 @@ socket_map_t AllocateSocket(mctx_t mctx, int socktype, int need_lock)
 	socket->socktype = socktype;
 	socket->opts = 0;
 	socket->stream = NULL;
+	socket->cc_ops = NULL;
 	socket->epoll = 0;
 	socket->events = 0;
 
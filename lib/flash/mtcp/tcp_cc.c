@@ -0,0 +1,117 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Congestion control module registry and the Reno module.
+ */
+
+#include <string.h>
+
+#include "tcp_cc.h"
+#include "tcp_util.h"
+#include "debug.h"
+
+/*----------------------------------------------------------------------------*/
+static const struct tcp_cc_ops *tcp_cc_modules[] = {
+	&tcp_cc_reno,
+	&tcp_cc_cubic,
+	&tcp_cc_bbr,
+};
+#define NUM_TCP_CC_MODULES (sizeof(tcp_cc_modules) / sizeof(tcp_cc_modules[0]))
+/*----------------------------------------------------------------------------*/
+const struct tcp_cc_ops *TCPCCFind(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < NUM_TCP_CC_MODULES; i++) {
+		if (strncmp(tcp_cc_modules[i]->name, name, TCP_CC_NAME_MAX) == 0)
+			return tcp_cc_modules[i];
+	}
+
+	return NULL;
+}
+/*----------------------------------------------------------------------------*/
+const struct tcp_cc_ops *TCPCCDefault(void)
+{
+	static const struct tcp_cc_ops *builtin = NULL;
+
+	if (CONFIG.tcp_cc)
+		return CONFIG.tcp_cc;
+
+	if (!builtin) {
+		builtin = TCPCCFind(TCP_CC_DEFAULT);
+		if (!builtin) {
+			TRACE_ERROR("Unknown default congestion control %s, using reno.\n", TCP_CC_DEFAULT);
+			builtin = &tcp_cc_reno;
+		}
+	}
+
+	return builtin;
+}
+/*----------------------------------------------------------------------------*/
+void TCPCCInit(tcp_stream *cur_stream, const struct tcp_cc_ops *ops, uint64_t now)
+{
+	struct tcp_send_vars *sndvar = cur_stream->sndvar;
+
+	sndvar->cc_ops = ops ? ops : TCPCCDefault();
+	memset(sndvar->cc_priv, 0, sizeof(sndvar->cc_priv));
+	if (sndvar->cc_ops->init)
+		sndvar->cc_ops->init(cur_stream, now);
+}
+/*----------------------------------------------------------------------------*/
+void TCPCCRenoGrow(tcp_stream *cur_stream, uint32_t acked)
+{
+	struct tcp_send_vars *sndvar = cur_stream->sndvar;
+	uint32_t packets = TCPCCAckedSegments(cur_stream, acked);
+	uint32_t new_cwnd;
+
+	if (sndvar->cwnd < sndvar->ssthresh) {
+		if ((sndvar->cwnd + sndvar->mss) > sndvar->cwnd) {
+			sndvar->cwnd += (sndvar->mss * packets);
+		}
+		TRACE_CONG("slow start cwnd: %u, ssthresh: %u\n", sndvar->cwnd, sndvar->ssthresh);
+	} else {
+		new_cwnd = sndvar->cwnd + packets * sndvar->mss * sndvar->mss / sndvar->cwnd;
+		if (new_cwnd > sndvar->cwnd) {
+			sndvar->cwnd = new_cwnd;
+		}
+	}
+}
+/*----------------------------------------------------------------------------*/
+static void RenoOnAck(tcp_stream *cur_stream, uint32_t acked, uint64_t now)
+{
+	UNUSED(now);
+	TCPCCRenoGrow(cur_stream, acked);
+}
+/*----------------------------------------------------------------------------*/
+static void RenoOnLoss(tcp_stream *cur_stream, uint64_t now)
+{
+	struct tcp_send_vars *sndvar = cur_stream->sndvar;
+
+	UNUSED(now);
+	/* ssthresh to half of min of cwnd and peer wnd */
+	sndvar->ssthresh = MIN(sndvar->cwnd, sndvar->peer_wnd) / 2;
+	if (sndvar->ssthresh < 2 * sndvar->mss) {
+		sndvar->ssthresh = 2 * sndvar->mss;
+	}
+	sndvar->cwnd = sndvar->ssthresh + 3 * sndvar->mss;
+}
+/*----------------------------------------------------------------------------*/
+static void RenoOnTimer(tcp_stream *cur_stream, uint64_t now)
+{
+	struct tcp_send_vars *sndvar = cur_stream->sndvar;
+
+	UNUSED(now);
+	sndvar->ssthresh = MIN(sndvar->cwnd, sndvar->peer_wnd) / 2;
+	if (sndvar->ssthresh < 2 * sndvar->mss) {
+		sndvar->ssthresh = 2 * sndvar->mss;
+	}
+	sndvar->cwnd = sndvar->mss;
+}
+/*----------------------------------------------------------------------------*/
+const struct tcp_cc_ops tcp_cc_reno = {
+	.name = "reno",
+	.init = NULL,
+	.on_ack = RenoOnAck,
+	.on_loss = RenoOnLoss,
+	.on_timer = RenoOnTimer,
+};
+/*----------------------------------------------------------------------------*/
@@ -0,0 +1,239 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ *
+ * BBR-like model based congestion control. Bottleneck bandwidth and round
+ * trip time are sampled once per round trip against the main loop TSC and
+ * drive both the pacer rate and cwnd; loss alone does not shrink the
+ * model. Gains are in units of 1/256.
+ */
+
+#include "tcp_cc.h"
+#include "tcp_in.h"
+#include "tcp_util.h"
+#include "clock.h"
+#include "debug.h"
+
+#define BBR_UNIT 256
+#define BBR_HIGH_GAIN 739  /* 2 / ln(2), startup */
+#define BBR_DRAIN_GAIN 88  /* 1 / BBR_HIGH_GAIN */
+#define BBR_CWND_GAIN 512  /* steady state cwnd is twice the BDP */
+#define BBR_FULL_BW_GAIN 320 /* startup ends once bw stops growing by 25% */
+#define BBR_FULL_BW_ROUNDS 3
+#define BBR_BW_ROUNDS 10   /* window of the max bandwidth filter */
+#define BBR_MIN_RTT_SEC 10 /* window of the min rtt filter */
+#define BBR_PROBE_RTT_MS 200
+#define BBR_MIN_CWND_SEGS 4
+#define BBR_CYCLE_LEN 8
+
+static const uint16_t bbr_pacing_gain[BBR_CYCLE_LEN] = { 320, 192, 256, 256, 256, 256, 256, 256 };
+
+enum bbr_mode {
+	BBR_STARTUP,
+	BBR_DRAIN,
+	BBR_PROBE_BW,
+	BBR_PROBE_RTT,
+};
+
+struct bbr {
+	uint64_t delivered;	  /* bytes acked over the connection */
+	uint64_t round_delivered; /* delivered when the round began */
+	uint64_t round_start;	  /* tsc the round began */
+	uint64_t btl_bw;	  /* windowed max delivery rate, bytes per second */
+	uint64_t full_bw;	  /* btl_bw when startup last saw it grow */
+	uint64_t min_rtt;	  /* windowed min round trip, in cycles */
+	uint64_t min_rtt_stamp;	  /* tsc min_rtt was taken */
+	uint64_t probe_rtt_done;  /* tsc probe rtt may end */
+	uint32_t high_seq;	  /* highest snd_nxt seen, it rewinds on loss */
+	uint32_t round_end_seq;	  /* high_seq when the round began */
+	uint32_t round_cnt;
+	uint32_t btl_bw_round; /* round btl_bw was taken in */
+	uint32_t prior_cwnd;   /* cwnd to restore after probe rtt */
+	uint8_t mode;
+	uint8_t cycle_idx;
+	uint8_t full_bw_cnt;
+	uint8_t full_bw_reached;
+	uint8_t lossy_rounds; /* rounds left to skip sampling after a loss */
+};
+_Static_assert(sizeof(struct bbr) <= TCP_CC_PRIV_SIZE, "bbr state too large");
+/*----------------------------------------------------------------------------*/
+static inline uint64_t BBRTarget(struct bbr *bbr, uint32_t gain)
+{
+	if (bbr->btl_bw == 0 || bbr->min_rtt == UINT64_MAX)
+		return 0;
+
+	return bbr->btl_bw * bbr->min_rtt / GetTSCHz() * gain / BBR_UNIT;
+}
+/*----------------------------------------------------------------------------*/
+/* snd_nxt only rewinds on loss, and the stack calls in before it does */
+static inline void BBRTrackHighSeq(tcp_stream *cur_stream, struct bbr *bbr)
+{
+	if (TCP_SEQ_GT(cur_stream->snd_nxt, bbr->high_seq))
+		bbr->high_seq = cur_stream->snd_nxt;
+}
+/*----------------------------------------------------------------------------*/
+static void BBRInit(tcp_stream *cur_stream, uint64_t now)
+{
+	struct bbr *bbr = TCPCCPriv(cur_stream);
+
+	bbr->mode = BBR_STARTUP;
+	bbr->round_start = now;
+	bbr->high_seq = bbr->round_end_seq = cur_stream->snd_nxt;
+	bbr->min_rtt = UINT64_MAX;
+	bbr->min_rtt_stamp = now;
+}
+/*----------------------------------------------------------------------------*/
+/* a round trip has completed: take its bandwidth and rtt samples */
+static void BBRNewRound(tcp_stream *cur_stream, struct bbr *bbr, uint64_t now)
+{
+	uint64_t interval = now - bbr->round_start;
+	uint64_t rate;
+	int expired = now - bbr->min_rtt_stamp > BBR_MIN_RTT_SEC * GetTSCHz();
+
+	/*
+	 * A loss rewinds snd_nxt and the cumulative ack that ends recovery jumps
+	 * over sacked data, so neither the round that saw it nor the next one
+	 * gives a usable sample.
+	 */
+	if (bbr->lossy_rounds) {
+		bbr->lossy_rounds--;
+	} else if (interval > 0 && bbr->delivered > bbr->round_delivered) {
+		rate = (bbr->delivered - bbr->round_delivered) * GetTSCHz() / interval;
+		if (rate >= bbr->btl_bw || bbr->round_cnt - bbr->btl_bw_round >= BBR_BW_ROUNDS) {
+			bbr->btl_bw = rate;
+			bbr->btl_bw_round = bbr->round_cnt;
+		}
+		/* the round is never shorter than the round trip of its last byte */
+		if (interval <= bbr->min_rtt || expired) {
+			bbr->min_rtt = interval;
+			bbr->min_rtt_stamp = now;
+		}
+	}
+
+	bbr->round_cnt++;
+	bbr->round_start = now;
+	bbr->round_delivered = bbr->delivered;
+	bbr->round_end_seq = bbr->high_seq;
+
+	if (!bbr->full_bw_reached) {
+		if (bbr->btl_bw >= bbr->full_bw * BBR_FULL_BW_GAIN / BBR_UNIT) {
+			bbr->full_bw = bbr->btl_bw;
+			bbr->full_bw_cnt = 0;
+		} else if (++bbr->full_bw_cnt >= BBR_FULL_BW_ROUNDS) {
+			bbr->full_bw_reached = TRUE;
+		}
+	}
+
+	if (bbr->mode == BBR_PROBE_BW)
+		bbr->cycle_idx = (bbr->cycle_idx + 1) % BBR_CYCLE_LEN;
+
+	if (expired && bbr->mode != BBR_PROBE_RTT) {
+		bbr->mode = BBR_PROBE_RTT;
+		bbr->prior_cwnd = cur_stream->sndvar->cwnd;
+		bbr->probe_rtt_done = now + MAX(BBR_PROBE_RTT_MS * GetTSCHz() / 1000, bbr->min_rtt);
+	}
+}
+/*----------------------------------------------------------------------------*/
+static void BBRUpdateMode(tcp_stream *cur_stream, struct bbr *bbr, uint64_t now)
+{
+	struct tcp_send_vars *sndvar = cur_stream->sndvar;
+
+	switch (bbr->mode) {
+	case BBR_STARTUP:
+		if (bbr->full_bw_reached) {
+			bbr->mode = BBR_DRAIN;
+			TRACE_CONG("Stream %d: bbr drain, btl_bw: %lu\n", cur_stream->id, bbr->btl_bw);
+		}
+		break;
+	case BBR_DRAIN:
+		if (cur_stream->snd_nxt - sndvar->snd_una <= BBRTarget(bbr, BBR_UNIT)) {
+			bbr->mode = BBR_PROBE_BW;
+			bbr->cycle_idx = bbr->round_cnt % BBR_CYCLE_LEN;
+		}
+		break;
+	case BBR_PROBE_RTT:
+		if (now >= bbr->probe_rtt_done) {
+			bbr->mode = bbr->full_bw_reached ? BBR_PROBE_BW : BBR_STARTUP;
+			sndvar->cwnd = MAX(sndvar->cwnd, bbr->prior_cwnd);
+		}
+		break;
+	}
+}
+/*----------------------------------------------------------------------------*/
+static void BBROnAck(tcp_stream *cur_stream, uint32_t acked, uint64_t now)
+{
+	struct tcp_send_vars *sndvar = cur_stream->sndvar;
+	struct bbr *bbr = TCPCCPriv(cur_stream);
+	uint32_t pacing_gain, cwnd_gain;
+	uint64_t target;
+
+	bbr->delivered += acked;
+	BBRTrackHighSeq(cur_stream, bbr);
+	/* the round ends once data sent after it began is acked */
+	if (TCP_SEQ_GT(sndvar->snd_una, bbr->round_end_seq))
+		BBRNewRound(cur_stream, bbr, now);
+	BBRUpdateMode(cur_stream, bbr, now);
+
+	switch (bbr->mode) {
+	case BBR_STARTUP:
+		pacing_gain = cwnd_gain = BBR_HIGH_GAIN;
+		break;
+	case BBR_DRAIN:
+		pacing_gain = BBR_DRAIN_GAIN;
+		cwnd_gain = BBR_HIGH_GAIN;
+		break;
+	case BBR_PROBE_BW:
+		pacing_gain = bbr_pacing_gain[bbr->cycle_idx];
+		cwnd_gain = BBR_CWND_GAIN;
+		break;
+	default:
+		pacing_gain = cwnd_gain = BBR_UNIT;
+		break;
+	}
+
+#if PACING_ENABLED
+	if (bbr->btl_bw)
+		SetPacingRate(&cur_stream->pacer, bbr->btl_bw * pacing_gain / BBR_UNIT);
+#else
+	UNUSED(pacing_gain);
+#endif
+
+	/* the clamp also takes back the stack's dupack inflation */
+	target = BBRTarget(bbr, cwnd_gain);
+	if (bbr->mode == BBR_PROBE_RTT)
+		sndvar->cwnd = MIN(sndvar->cwnd, BBR_MIN_CWND_SEGS * sndvar->mss);
+	else if (target == 0)
+		sndvar->cwnd += acked;
+	else
+		sndvar->cwnd = MIN(sndvar->cwnd + acked, target);
+	sndvar->cwnd = MAX(sndvar->cwnd, BBR_MIN_CWND_SEGS * sndvar->mss);
+}
+/*----------------------------------------------------------------------------*/
+static void BBROnLoss(tcp_stream *cur_stream, uint64_t now)
+{
+	struct bbr *bbr = TCPCCPriv(cur_stream);
+
+	UNUSED(now);
+	BBRTrackHighSeq(cur_stream, bbr);
+	bbr->lossy_rounds = 2;
+	/* keep cwnd across fast recovery, the stack restores ssthresh on exit */
+	cur_stream->sndvar->ssthresh = cur_stream->sndvar->cwnd;
+}
+/*----------------------------------------------------------------------------*/
+static void BBROnTimer(tcp_stream *cur_stream, uint64_t now)
+{
+	struct bbr *bbr = TCPCCPriv(cur_stream);
+
+	UNUSED(now);
+	BBRTrackHighSeq(cur_stream, bbr);
+	bbr->lossy_rounds = 2;
+	cur_stream->sndvar->ssthresh = cur_stream->sndvar->cwnd;
+	cur_stream->sndvar->cwnd = cur_stream->sndvar->mss;
+}
+/*----------------------------------------------------------------------------*/
+const struct tcp_cc_ops tcp_cc_bbr = {
+	.name = "bbr",
+	.init = BBRInit,
+	.on_ack = BBROnAck,
+	.on_loss = BBROnLoss,
+	.on_timer = BBROnTimer,
+};
+/*----------------------------------------------------------------------------*/
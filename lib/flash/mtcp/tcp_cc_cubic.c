@@ -0,0 +1,143 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ *
+ * CUBIC congestion control (RFC 8312) in integer arithmetic. Time is in
+ * milliseconds, windows in bytes.
+ */
+
+#include "tcp_cc.h"
+#include "tcp_util.h"
+#include "clock.h"
+#include "debug.h"
+
+/* beta = 0.7, C = 0.4 */
+#define CUBIC_BETA_NUM 7
+#define CUBIC_BETA_DEN 10
+/* 1 / C in ms^3 per segment */
+#define CUBIC_C_INV_MS3 2500000000ULL
+/* keep (t - K)^3 inside 64 bits */
+#define CUBIC_MAX_T_MS 1000000
+
+struct cubic {
+	uint64_t epoch_start; /* tsc the current growth epoch began, 0 if none */
+	uint32_t w_max;	      /* cwnd right before the last reduction */
+	uint32_t w_last_max;  /* w_max of the reduction before, for fast convergence */
+	uint32_t origin;      /* plateau of the cubic function */
+	uint32_t k;	      /* ms from epoch start to the plateau */
+	uint32_t w_est;	      /* Reno-friendly window estimate */
+	uint32_t ack_cnt;     /* bytes acked since cwnd last grew */
+};
+_Static_assert(sizeof(struct cubic) <= TCP_CC_PRIV_SIZE, "cubic state too large");
+/*----------------------------------------------------------------------------*/
+static uint32_t CubeRoot(uint64_t a)
+{
+	uint64_t r = 0, b;
+	int s;
+
+	for (s = 63; s >= 0; s -= 3) {
+		r <<= 1;
+		b = 3 * r * (r + 1) + 1;
+		if ((a >> s) >= b) {
+			a -= b << s;
+			r++;
+		}
+	}
+
+	return r;
+}
+/*----------------------------------------------------------------------------*/
+static void CubicOnAck(tcp_stream *cur_stream, uint32_t acked, uint64_t now)
+{
+	struct tcp_send_vars *sndvar = cur_stream->sndvar;
+	struct cubic *ca = TCPCCPriv(cur_stream);
+	uint64_t tsc_per_ms = GetTSCHz() / 1000;
+	uint32_t cwnd = sndvar->cwnd, mss = sndvar->mss;
+	int64_t t, d, target;
+
+	if (cwnd < sndvar->ssthresh) {
+		TCPCCRenoGrow(cur_stream, acked);
+		return;
+	}
+
+	if (ca->epoch_start == 0) {
+		ca->epoch_start = now;
+		ca->ack_cnt = 0;
+		ca->w_est = cwnd;
+		if (ca->w_max > cwnd) {
+			ca->k = CubeRoot((uint64_t)((ca->w_max - cwnd) / mss) * CUBIC_C_INV_MS3);
+			ca->origin = ca->w_max;
+		} else {
+			ca->k = 0;
+			ca->origin = cwnd;
+		}
+	}
+
+	/* W_cubic(t + RTT) = C * (t + RTT - K)^3 + W_max */
+	t = (now - ca->epoch_start) / tsc_per_ms + (cur_stream->rcvvar->srtt >> 3);
+	d = MIN(t - (int64_t)ca->k, CUBIC_MAX_T_MS);
+	if (d < -CUBIC_MAX_T_MS)
+		d = -CUBIC_MAX_T_MS;
+	target = (int64_t)ca->origin + d * d * d / (int64_t)(CUBIC_C_INV_MS3 / mss);
+
+	/* at most 1.5x per round trip, and never slower than Reno would */
+	if (target > (int64_t)cwnd + cwnd / 2)
+		target = cwnd + cwnd / 2;
+	ca->w_est += (uint64_t)acked * mss * 3 * (CUBIC_BETA_DEN - CUBIC_BETA_NUM) / ((CUBIC_BETA_DEN + CUBIC_BETA_NUM) * cwnd);
+	if (ca->w_est > target)
+		target = ca->w_est;
+
+	if (target > (int64_t)cwnd) {
+		ca->ack_cnt += acked;
+		/* cwnd grows by (target - cwnd) over one cwnd worth of acks */
+		if ((uint64_t)(target - cwnd) * ca->ack_cnt >= (uint64_t)cwnd * mss) {
+			sndvar->cwnd += (uint64_t)(target - cwnd) * ca->ack_cnt / cwnd;
+			ca->ack_cnt = 0;
+		}
+	}
+
+	TRACE_CONG("cubic cwnd: %u, target: %ld, k: %u, w_max: %u\n", sndvar->cwnd, (long)target, ca->k, ca->w_max);
+}
+/*----------------------------------------------------------------------------*/
+static void CubicReduce(tcp_stream *cur_stream)
+{
+	struct tcp_send_vars *sndvar = cur_stream->sndvar;
+	struct cubic *ca = TCPCCPriv(cur_stream);
+	uint32_t cwnd = MIN(sndvar->cwnd, sndvar->peer_wnd);
+
+	ca->epoch_start = 0;
+	/* fast convergence: release bandwidth to newer flows */
+	if (cwnd < ca->w_last_max) {
+		ca->w_last_max = cwnd;
+		ca->w_max = (uint64_t)cwnd * (CUBIC_BETA_DEN + CUBIC_BETA_NUM) / (2 * CUBIC_BETA_DEN);
+	} else {
+		ca->w_last_max = cwnd;
+		ca->w_max = cwnd;
+	}
+
+	sndvar->ssthresh = (uint64_t)cwnd * CUBIC_BETA_NUM / CUBIC_BETA_DEN;
+	if (sndvar->ssthresh < 2 * sndvar->mss) {
+		sndvar->ssthresh = 2 * sndvar->mss;
+	}
+}
+/*----------------------------------------------------------------------------*/
+static void CubicOnLoss(tcp_stream *cur_stream, uint64_t now)
+{
+	UNUSED(now);
+	CubicReduce(cur_stream);
+	cur_stream->sndvar->cwnd = cur_stream->sndvar->ssthresh + 3 * cur_stream->sndvar->mss;
+}
+/*----------------------------------------------------------------------------*/
+static void CubicOnTimer(tcp_stream *cur_stream, uint64_t now)
+{
+	UNUSED(now);
+	CubicReduce(cur_stream);
+	cur_stream->sndvar->cwnd = cur_stream->sndvar->mss;
+}
+/*----------------------------------------------------------------------------*/
+const struct tcp_cc_ops tcp_cc_cubic = {
+	.name = "cubic",
+	.init = NULL,
+	.on_ack = CubicOnAck,
+	.on_loss = CubicOnLoss,
+	.on_timer = CubicOnTimer,
+};
+/*----------------------------------------------------------------------------*/
@@ -0,0 +1,276 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Receive side coalescing of in-order TCP segments, see tcp_gro.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tcp_gro.h"
+#include "tcp_in.h"
+#include "tcp_util.h"
+#include "tcp_ring_buffer.h"
+#include "eth_in.h"
+#include "ps.h"
+#include "debug.h"
+
+/*----------------------------------------------------------------------------*/
+struct tcp_gro *CreateTCPGRO(void)
+{
+	return calloc(1, sizeof(struct tcp_gro));
+}
+/*----------------------------------------------------------------------------*/
+void DestroyTCPGRO(struct tcp_gro *gro)
+{
+	free(gro);
+}
+/*----------------------------------------------------------------------------*/
+static inline void DeliverPacket(mtcp_manager_t mtcp, int ifidx, uint32_t cur_ts, uint8_t *pkt_data, int len)
+{
+	if (ProcessPacket(mtcp, ifidx, cur_ts, pkt_data, len) != TRUE)
+		mtcp->iom->release_pkt(mtcp->ctx, ifidx, pkt_data, len);
+}
+/*----------------------------------------------------------------------------*/
+/* the IPv4/TCP headers of a frame, FALSE if it is anything else */
+static inline int ParseTCPFrame(uint8_t *pkt_data, int len, struct iphdr **iph, struct tcphdr **tcph)
+{
+	struct ethhdr *ethh = (struct ethhdr *)pkt_data;
+
+	if (len < (int)(sizeof(struct ethhdr) + sizeof(struct iphdr) + sizeof(struct tcphdr)))
+		return FALSE;
+	if (ethh->h_proto != htons(ETH_P_IP))
+		return FALSE;
+
+	*iph = (struct iphdr *)(ethh + 1);
+	if ((*iph)->version != 0x4 || (*iph)->protocol != IPPROTO_TCP)
+		return FALSE;
+	if ((int)sizeof(struct ethhdr) + ((*iph)->ihl << 2) + (int)sizeof(struct tcphdr) > len)
+		return FALSE;
+
+	*tcph = (struct tcphdr *)((uint8_t *)*iph + ((*iph)->ihl << 2));
+	return TRUE;
+}
+/*----------------------------------------------------------------------------*/
+/* payload length of a frame that may be chained, 0 if it has to go alone */
+static inline int MergeablePayload(mtcp_manager_t mtcp, int ifidx, int len, struct iphdr *iph, struct tcphdr *tcph)
+{
+	int ip_len = ntohs(iph->tot_len);
+	int payloadlen;
+	int rc = -1;
+
+	/* plain ACK or ACK|PSH data segment, no IP options or fragments */
+	if (iph->ihl != 5 || (iph->frag_off & htons(IP_MF | IP_OFFMASK)))
+		return 0;
+	if (!tcph->ack || tcph->syn || tcph->fin || tcph->rst || tcph->urg || tcph->ece || tcph->cwr)
+		return 0;
+	if (tcph->doff < 5 || ip_len > len - (int)sizeof(struct ethhdr))
+		return 0;
+
+	payloadlen = ip_len - ((iph->ihl + tcph->doff) << 2);
+	if (payloadlen <= 0)
+		return 0;
+
+#if !PROMISCUOUS_MODE
+	if (iph->daddr != CONFIG.eths[ifidx].ip_addr)
+		return 0;
+#endif
+
+	/* a chain skips the checks in ProcessIPv4Packet/ProcessTCPPacket,
+	 * so every frame is checked here; bad ones are left to those */
+#ifndef DISABLE_HWCSUM
+	if (mtcp->iom->dev_ioctl != NULL)
+		rc = mtcp->iom->dev_ioctl(mtcp->ctx, ifidx, PKT_RX_IP_CSUM, iph);
+#endif
+	if (rc == -1 && ip_fast_csum(iph, iph->ihl))
+		return 0;
+#if VERIFY_RX_CHECKSUM
+	rc = -1;
+#ifndef DISABLE_HWCSUM
+	if (mtcp->iom->dev_ioctl != NULL)
+		rc = mtcp->iom->dev_ioctl(mtcp->ctx, ifidx, PKT_RX_TCP_CSUM, NULL);
+#endif
+	if (rc == -1 && TCPCalcChecksum((uint16_t *)tcph, ip_len - (iph->ihl << 2), iph->saddr, iph->daddr))
+		return 0;
+#endif
+
+	return payloadlen;
+}
+/*----------------------------------------------------------------------------*/
+static inline struct tcp_gro_seg *FindChain(struct tcp_gro *gro, struct iphdr *iph, struct tcphdr *tcph)
+{
+	struct tcp_gro_seg *seg;
+	int i;
+
+	for (i = 0; i < TCP_GRO_MAX_FLOWS; i++) {
+		seg = &gro->seg[i];
+		if (seg->pkt && seg->saddr == iph->saddr && seg->daddr == iph->daddr && seg->sport == tcph->source &&
+		    seg->dport == tcph->dest)
+			return seg;
+	}
+
+	return NULL;
+}
+/*----------------------------------------------------------------------------*/
+static void FlushChain(mtcp_manager_t mtcp, struct tcp_gro_seg *seg, uint32_t cur_ts)
+{
+	struct tcp_gro *gro = mtcp->gro;
+	int ret;
+	int i;
+
+	mtcp->gro_seg = seg;
+	ret = ProcessPacket(mtcp, gro->ifidx, cur_ts, seg->pkt, seg->pkt_len);
+	mtcp->gro_seg = NULL;
+
+	/* the chained frames share the fate of the head */
+	if (ret != TRUE) {
+		mtcp->iom->release_pkt(mtcp->ctx, gro->ifidx, seg->pkt, seg->pkt_len);
+		for (i = 0; i < seg->nfrags; i++)
+			mtcp->iom->release_pkt(mtcp->ctx, gro->ifidx, seg->frag[i].pkt, seg->frag[i].pkt_len);
+	}
+
+#ifdef NETSTAT
+	mtcp->nstat.rx_packets[gro->ifidx] += seg->nfrags;
+	mtcp->nstat.rx_gro_merged += seg->nfrags;
+	for (i = 0; i < seg->nfrags; i++)
+		mtcp->nstat.rx_bytes[gro->ifidx] += seg->frag[i].pkt_len + 24;
+#endif
+
+	seg->pkt = NULL;
+}
+/*----------------------------------------------------------------------------*/
+static inline struct tcp_gro_seg *StartChain(mtcp_manager_t mtcp, uint32_t cur_ts, uint8_t *pkt_data, int len,
+					     struct iphdr *iph, struct tcphdr *tcph, int payloadlen)
+{
+	struct tcp_gro *gro = mtcp->gro;
+	struct tcp_gro_seg *seg = NULL;
+	int i;
+
+	for (i = 0; i < TCP_GRO_MAX_FLOWS; i++) {
+		if (!gro->seg[i].pkt) {
+			seg = &gro->seg[i];
+			break;
+		}
+	}
+	/* all taken: give one up, ordering only matters within a flow */
+	if (!seg) {
+		seg = &gro->seg[gro->victim];
+		gro->victim = (gro->victim + 1) % TCP_GRO_MAX_FLOWS;
+		FlushChain(mtcp, seg, cur_ts);
+	}
+
+	seg->pkt = pkt_data;
+	seg->pkt_len = len;
+	seg->saddr = iph->saddr;
+	seg->daddr = iph->daddr;
+	seg->sport = tcph->source;
+	seg->dport = tcph->dest;
+	seg->ack_seq = tcph->ack_seq;
+	seg->window = tcph->window;
+	seg->optlen = (tcph->doff << 2) - sizeof(struct tcphdr);
+	seg->opts = (uint8_t *)(tcph + 1);
+	seg->mss = payloadlen;
+	seg->next_seq = ntohl(tcph->seq) + payloadlen;
+	seg->len = 0;
+	seg->nfrags = 0;
+
+	return seg;
+}
+/*----------------------------------------------------------------------------*/
+/* chain the frame behind seg, FALSE if it does not continue it */
+static inline int AppendToChain(struct tcp_gro_seg *seg, uint8_t *pkt_data, int len, struct tcphdr *tcph, int payloadlen)
+{
+	struct tcp_gro_frag *frag;
+
+	if (seg->nfrags == TCP_GRO_MAX_SEGS - 1 || ntohl(tcph->seq) != seg->next_seq)
+		return FALSE;
+	if (tcph->ack_seq != seg->ack_seq || tcph->window != seg->window)
+		return FALSE;
+	/* options, timestamps included, must be byte for byte the same */
+	if ((tcph->doff << 2) - sizeof(struct tcphdr) != seg->optlen || memcmp(tcph + 1, seg->opts, seg->optlen))
+		return FALSE;
+	if (payloadlen > seg->mss)
+		return FALSE;
+
+	frag = &seg->frag[seg->nfrags++];
+	frag->pkt = pkt_data;
+	frag->pkt_len = len;
+	frag->payload = (uint8_t *)tcph + (tcph->doff << 2);
+	frag->len = payloadlen;
+
+	seg->len += payloadlen;
+	seg->next_seq += payloadlen;
+
+	return TRUE;
+}
+/*----------------------------------------------------------------------------*/
+void TCPGROReceive(mtcp_manager_t mtcp, int ifidx, uint32_t cur_ts, uint8_t *pkt_data, int len)
+{
+	struct tcp_gro *gro = mtcp->gro;
+	struct tcp_gro_seg *seg;
+	struct iphdr *iph;
+	struct tcphdr *tcph;
+	int payloadlen;
+
+	gro->ifidx = ifidx;
+
+	if (!ParseTCPFrame(pkt_data, len, &iph, &tcph)) {
+		DeliverPacket(mtcp, ifidx, cur_ts, pkt_data, len);
+		return;
+	}
+
+	seg = FindChain(gro, iph, tcph);
+	payloadlen = MergeablePayload(mtcp, ifidx, len, iph, tcph);
+	if (!payloadlen) {
+		/* keep the flow in order: whatever is held goes first */
+		if (seg)
+			FlushChain(mtcp, seg, cur_ts);
+		DeliverPacket(mtcp, ifidx, cur_ts, pkt_data, len);
+		return;
+	}
+
+	if (seg && !AppendToChain(seg, pkt_data, len, tcph, payloadlen)) {
+		FlushChain(mtcp, seg, cur_ts);
+		seg = NULL;
+	}
+	if (!seg)
+		seg = StartChain(mtcp, cur_ts, pkt_data, len, iph, tcph, payloadlen);
+
+	/* PSH or a short segment ends the chain, as does a full one */
+	if (tcph->psh || payloadlen < seg->mss || seg->nfrags == TCP_GRO_MAX_SEGS - 1)
+		FlushChain(mtcp, seg, cur_ts);
+}
+/*----------------------------------------------------------------------------*/
+void TCPGROFlush(mtcp_manager_t mtcp, uint32_t cur_ts)
+{
+	struct tcp_gro *gro = mtcp->gro;
+	int i;
+
+	for (i = 0; i < TCP_GRO_MAX_FLOWS; i++) {
+		if (gro->seg[i].pkt)
+			FlushChain(mtcp, &gro->seg[i], cur_ts);
+	}
+}
+/*----------------------------------------------------------------------------*/
+int TCPGROPut(mtcp_manager_t mtcp, struct tcp_ring_buffer *buff, uint8_t *payload, uint32_t len, uint32_t seq)
+{
+	struct tcp_gro_seg *seg = mtcp->gro_seg;
+	uint32_t head_len = len - seg->len;
+	int ret, rc;
+	int i;
+
+	ret = RBPut(mtcp->rbm_rcv, buff, payload, head_len, seq);
+	seq += head_len;
+	for (i = 0; i < seg->nfrags; i++) {
+		rc = RBPut(mtcp->rbm_rcv, buff, seg->frag[i].payload, seg->frag[i].len, seq);
+		if (rc < 0) {
+			if (ret >= 0)
+				ret = rc;
+		} else if (ret >= 0) {
+			ret += rc;
+		}
+		seq += seg->frag[i].len;
+	}
+
+	return ret;
+}
+/*----------------------------------------------------------------------------*/
@@ -42,6 +42,9 @@
 #include "timer.h"
 #include "ip_in.h"
 #include "clock.h"
+#include "tcp_cc.h"
+#include "tcp_gro.h"
+#include "tcp_syncookie.h"
 #if USE_CCP
 #include "ccp.h"
 #endif
@@ -49,12 +52,12 @@
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
-#define VERIFY_RX_CHECKSUM TRUE
 #define RECOVERY_AFTER_LOSS TRUE
 #define SELECTIVE_WRITE_EVENT_NOTIFY TRUE
 
 /*----------------------------------------------------------------------------*/
-static inline int FilterSYNPacket(mtcp_manager_t mtcp, uint32_t ip, uint16_t port)
+/* the listener a SYN to ip:port is for, NULL if there is none */
+static inline struct tcp_listener *FilterSYNPacket(mtcp_manager_t mtcp, uint32_t ip, uint16_t port)
 {
 	struct sockaddr_in *addr;
 	struct tcp_listener *listener;
@@ -64,33 +67,33 @@ static inline int FilterSYNPacket(mtcp_manager_t mtcp, uint32_t ip, uint16_t por
 	/* if not the address we want, drop */
 	listener = (struct tcp_listener *)ListenerHTSearch(mtcp->listeners, &port);
 	if (listener == NULL)
-		return FALSE;
+		return NULL;
 
 	addr = &listener->socket->saddr;
 
 	if (addr->sin_port == port) {
 		if (addr->sin_addr.s_addr != INADDR_ANY) {
 			if (ip == addr->sin_addr.s_addr) {
-				return TRUE;
+				return listener;
 			}
-			return FALSE;
+			return NULL;
 		} else {
 			int i;
 
 			for (i = 0; i < CONFIG.eths_num; i++) {
 				if (ip == CONFIG.eths[i].ip_addr) {
-					return TRUE;
+					return listener;
 				}
 			}
-			return FALSE;
+			return NULL;
 		}
 	}
 
-	return FALSE;
+	return NULL;
 }
 /*----------------------------------------------------------------------------*/
-static inline tcp_stream *HandlePassiveOpen(mtcp_manager_t mtcp, uint32_t cur_ts, const struct iphdr *iph, const struct tcphdr *tcph,
-					    uint32_t seq, uint16_t window)
+static inline tcp_stream *HandlePassiveOpen(mtcp_manager_t mtcp, uint32_t cur_ts, struct tcp_listener *listener,
+					    const struct iphdr *iph, const struct tcphdr *tcph, uint32_t seq, uint16_t window)
 {
 	tcp_stream *cur_stream = NULL;
 
@@ -100,6 +103,8 @@ static inline tcp_stream *HandlePassiveOpen(mtcp_manager_t mtcp, uint32_t cur_ts
 		TRACE_ERROR("INFO: Could not allocate tcp_stream!\n");
 		return FALSE;
 	}
+	cur_stream->syn_queued = TRUE;
+	listener->syn_backlog++;
 	cur_stream->rcvvar->irs = seq;
 	cur_stream->sndvar->peer_wnd = window;
 	cur_stream->rcv_nxt = cur_stream->rcvvar->irs;
@@ -122,6 +127,7 @@ static inline int HandleActiveOpen(mtcp_manager_t mtcp, tcp_stream *cur_stream,
 	cur_stream->sndvar->cwnd =
 		((cur_stream->sndvar->cwnd == 1) ? (cur_stream->sndvar->mss * TCP_INIT_CWND) : cur_stream->sndvar->mss);
 	cur_stream->sndvar->ssthresh = cur_stream->sndvar->mss * 10;
+	TCPCCInit(cur_stream, cur_stream->sndvar->cc_ops, mtcp->cur_tsc);
 	UpdateRetransmissionTimer(mtcp, cur_stream, cur_ts);
 
 	return TRUE;
@@ -422,6 +428,14 @@ static inline void ProcessACK(mtcp_manager_t mtcp, tcp_stream *cur_stream, uint3
 	if (dup && cur_stream->rcvvar->dup_acks == 3) {
 		TRACE_LOSS("Triple duplicated ACKs!! ack_seq: %u\n", ack_seq);
 		TRACE_CCP("tridup ack %u (%u)!\n", ack_seq - cur_stream->sndvar->iss, ack_seq);
+
+		/* update congestion control variables, while snd_nxt still marks
+		 * the highest sequence sent */
+		sndvar->cc_ops->on_loss(cur_stream, mtcp->cur_tsc);
+
+		TRACE_CONG("fast retrans (%s): ssthresh = %u, cwnd = %u\n", sndvar->cc_ops->name, sndvar->ssthresh / sndvar->mss,
+			   sndvar->cwnd / sndvar->mss);
+
 		if (TCP_SEQ_LT(ack_seq, cur_stream->snd_nxt)) {
 			TRACE_LOSS("Reducing snd_nxt from %u to %u\n", cur_stream->snd_nxt - sndvar->iss,
 				   ack_seq - cur_stream->sndvar->iss);
@@ -446,17 +460,6 @@ static inline void ProcessACK(mtcp_manager_t mtcp, tcp_stream *cur_stream, uint3
 #endif
 		}
 
-		/* update congestion control variables */
-		/* ssthresh to half of min of cwnd and peer wnd */
-		sndvar->ssthresh = MIN(sndvar->cwnd, sndvar->peer_wnd) / 2;
-		if (sndvar->ssthresh < 2 * sndvar->mss) {
-			sndvar->ssthresh = 2 * sndvar->mss;
-		}
-		sndvar->cwnd = sndvar->ssthresh + 3 * sndvar->mss;
-
-		TRACE_CONG("fast retrans: cwnd = ssthresh(%u)+3*mss = %u\n", sndvar->ssthresh / sndvar->mss,
-			   sndvar->cwnd / sndvar->mss);
-
 		/* count number of retransmissions */
 		if (sndvar->nrtx < TCP_MAX_RTX) {
 			sndvar->nrtx++;
@@ -513,13 +516,9 @@ static inline void ProcessACK(mtcp_manager_t mtcp, tcp_stream *cur_stream, uint3
 #endif /* RECOVERY_AFTER_LOSS */
 
 	rmlen = ack_seq - sndvar->sndbuf->head_seq;
-	uint16_t packets = rmlen / sndvar->eff_mss;
-	if (packets * sndvar->eff_mss > rmlen) {
-		packets++;
-	}
 
 #if USE_CCP
-	ccp_cong_control(mtcp, cur_stream, ack_seq, rmlen, packets);
+	ccp_cong_control(mtcp, cur_stream, ack_seq, rmlen, TCPCCAckedSegments(cur_stream, rmlen));
 #else
 	// log_cwnd_rtt(cur_stream);
 #endif
@@ -543,24 +542,6 @@ static inline void ProcessACK(mtcp_manager_t mtcp, tcp_stream *cur_stream, uint3
 			TRACE_RTT("NOT IMPLEMENTED.\n");
 		}
 
-		// TODO CCP should comment this out?
-		/* Update congestion control variables */
-		if (cur_stream->state >= TCP_ST_ESTABLISHED) {
-			if (sndvar->cwnd < sndvar->ssthresh) {
-				if ((sndvar->cwnd + sndvar->mss) > sndvar->cwnd) {
-					sndvar->cwnd += (sndvar->mss * packets);
-				}
-				TRACE_CONG("slow start cwnd: %u, ssthresh: %u\n", sndvar->cwnd, sndvar->ssthresh);
-			} else {
-				uint32_t new_cwnd = sndvar->cwnd + packets * sndvar->mss * sndvar->mss / sndvar->cwnd;
-				if (new_cwnd > sndvar->cwnd) {
-					sndvar->cwnd = new_cwnd;
-				}
-				//TRACE_CONG("congestion avoidance cwnd: %u, ssthresh: %u\n",
-				//		sndvar->cwnd, sndvar->ssthresh);
-			}
-		}
-
 		if (SBUF_LOCK(&sndvar->write_lock)) {
 			if (errno == EDEADLK)
 				perror("ProcessACK: write_lock blocked\n");
@@ -582,6 +563,13 @@ static inline void ProcessACK(mtcp_manager_t mtcp, tcp_stream *cur_stream, uint3
 #endif /* SELECTIVE_WRITE_EVENT_NOTIFY */
 
 		SBUF_UNLOCK(&sndvar->write_lock);
+
+		// TODO CCP should comment this out?
+		/* Update congestion control variables */
+		if (cur_stream->state >= TCP_ST_ESTABLISHED) {
+			sndvar->cc_ops->on_ack(cur_stream, rmlen, mtcp->cur_tsc);
+		}
+
 		UpdateRetransmissionTimer(mtcp, cur_stream, cur_ts);
 	}
 
@@ -629,7 +617,10 @@ static inline int ProcessTCPPayload(mtcp_manager_t mtcp, tcp_stream *cur_stream,
 	}
 
 	prev_rcv_nxt = cur_stream->rcv_nxt;
-	ret = RBPut(mtcp->rbm_rcv, rcvvar->rcvbuf, payload, (uint32_t)payloadlen, seq);
+	if (mtcp->gro_seg)
+		ret = TCPGROPut(mtcp, rcvvar->rcvbuf, payload, (uint32_t)payloadlen, seq);
+	else
+		ret = RBPut(mtcp->rbm_rcv, rcvvar->rcvbuf, payload, (uint32_t)payloadlen, seq);
 	if (ret < 0) {
 		TRACE_ERROR("Cannot merge payload. reason: %d\n", ret);
 	}
@@ -667,13 +658,13 @@ static inline tcp_stream *CreateNewFlowHTEntry(mtcp_manager_t mtcp, uint32_t cur
 					       uint16_t window)
 {
 	(void)ip_len;
+	struct tcp_listener *listener;
 	tcp_stream *cur_stream;
-	int ret;
 
 	if (tcph->syn && !tcph->ack) {
 		/* handle the SYN */
-		ret = FilterSYNPacket(mtcp, iph->daddr, tcph->dest);
-		if (!ret) {
+		listener = FilterSYNPacket(mtcp, iph->daddr, tcph->dest);
+		if (!listener) {
 			TRACE_DBG("Refusing SYN packet.\n");
 #ifdef DBGMSG
 			DumpIPPacket(mtcp, iph, ip_len);
@@ -684,8 +675,14 @@ static inline tcp_stream *CreateNewFlowHTEntry(mtcp_manager_t mtcp, uint32_t cur
 			return NULL;
 		}
 
+		/* past the SYN backlog, the stream waits for the handshake */
+		if (SYNCookieWanted(listener)) {
+			SendSYNCookie(mtcp, cur_ts, iph, tcph);
+			return NULL;
+		}
+
 		/* now accept the connection */
-		cur_stream = HandlePassiveOpen(mtcp, cur_ts, iph, tcph, seq, window);
+		cur_stream = HandlePassiveOpen(mtcp, cur_ts, listener, iph, tcph, seq, window);
 		if (!cur_stream) {
 			TRACE_DBG("Not available space in flow pool.\n");
 #ifdef DBGMSG
@@ -706,6 +703,14 @@ static inline tcp_stream *CreateNewFlowHTEntry(mtcp_manager_t mtcp, uint32_t cur
 		/* for the reset packet, just discard */
 		return NULL;
 	} else {
+		/* the handshake ACK of a connection answered with a cookie */
+		if (tcph->ack && !tcph->syn && CONFIG.tcp_syncookies != SYNCOOKIES_OFF &&
+		    FilterSYNPacket(mtcp, iph->daddr, tcph->dest)) {
+			cur_stream = CheckSYNCookie(mtcp, cur_ts, iph, tcph);
+			if (cur_stream)
+				return cur_stream;
+		}
+
 		TRACE_DBG("Weird packet comes.\n");
 #ifdef DBGMSG
 		DumpIPPacket(mtcp, iph, ip_len);
@@ -843,6 +848,14 @@ static inline void Handle_TCP_ST_SYN_RCVD(mtcp_manager_t mtcp, uint32_t cur_ts,
 
 		/* update listening socket */
 		listener = (struct tcp_listener *)ListenerHTSearch(mtcp->listeners, &tcph->dest);
+		if (cur_stream->syn_queued) {
+			cur_stream->syn_queued = FALSE;
+			listener->syn_backlog--;
+		}
+
+		/* streams inherit the congestion control set on the listener */
+		TCPCCInit(cur_stream, (listener->socket && listener->socket->cc_ops) ? listener->socket->cc_ops : sndvar->cc_ops,
+			  mtcp->cur_tsc);
 
 		ret = StreamEnqueue(listener->acceptq, cur_stream);
 		if (ret < 0) {
@@ -1162,10 +1175,10 @@ int ProcessTCPPacket(mtcp_manager_t mtcp, uint32_t cur_ts, const int ifidx, cons
 
 #if VERIFY_RX_CHECKSUM
 #ifndef DISABLE_HWCSUM
-	if (mtcp->iom->dev_ioctl != NULL)
+	if (mtcp->iom->dev_ioctl != NULL && !mtcp->gro_seg)
 		rc = mtcp->iom->dev_ioctl(mtcp->ctx, ifidx, PKT_RX_TCP_CSUM, NULL);
 #endif
-	if (rc == -1) {
+	if (rc == -1 && !mtcp->gro_seg) {
 		check = TCPCalcChecksum((uint16_t *)tcph, (tcph->doff << 2) + payloadlen, iph->saddr, iph->daddr);
 		if (check) {
 			TRACE_DBG("Checksum Error: Original: 0x%04x, calculated: 0x%04x\n", tcph->check,
@@ -1176,6 +1189,10 @@ int ProcessTCPPacket(mtcp_manager_t mtcp, uint32_t cur_ts, const int ifidx, cons
 	}
 #endif
 
+	/* a GRO chain carries the payload of every frame chained to its head */
+	if (mtcp->gro_seg)
+		payloadlen += mtcp->gro_seg->len;
+
 #if defined(NETSTAT) && defined(ENABLELRO)
 	mtcp->nstat.rx_gdptbytes += payloadlen;
 #endif /* NETSTAT */
@@ -34,14 +34,13 @@
 #include "tcp_util.h"
 #include "mtcp.h"
 #include "ip_out.h"
+#include "arp.h"
 #include "tcp_in.h"
 #include "tcp_stream.h"
 #include "eventpoll.h"
 #include "timer.h"
 #include "debug.h"
-#if RATE_LIMIT_ENABLED || PACING_ENABLED
 #include "pacing.h"
-#endif
 
 #define TCP_CALCULATE_CHECKSUM TRUE
 #define ACK_PIGGYBACK TRUE
@@ -49,6 +48,16 @@
 
 #define TCP_MAX_WINDOW 65535
 
+/* SACK blocks that fit into the option space next to the timestamp */
+#if TCP_OPT_TIMESTAMP_ENABLED
+#define TCP_MAX_SACK_BLOCKS 3
+#else
+#define TCP_MAX_SACK_BLOCKS 4
+#endif
+
+/* full size segments built from one header by SendTCPSegments() */
+#define TCP_GSO_MAX_SEGS 16
+
 /*----------------------------------------------------------------------------*/
 static inline uint16_t CalculateOptionLength(uint8_t flags)
 {
@@ -76,12 +85,6 @@ static inline uint16_t CalculateOptionLength(uint8_t flags)
 #if TCP_OPT_TIMESTAMP_ENABLED
 		optlen += TCP_OPT_TIMESTAMP_LEN + 2;
 #endif
-
-#if TCP_OPT_SACK_ENABLED
-		if (flags & TCP_FLAG_SACK) {
-			optlen += TCP_OPT_SACK_LEN + 2;
-		}
-#endif
 	}
 
 	assert(optlen % 4 == 0);
@@ -89,71 +92,101 @@ static inline uint16_t CalculateOptionLength(uint8_t flags)
 	return optlen;
 }
 /*----------------------------------------------------------------------------*/
-static inline void GenerateTCPTimestamp(tcp_stream *cur_stream, uint8_t *tcpopt, uint32_t cur_ts)
+#if TCP_OPT_SACK_ENABLED
+/* pick the out-of-order ranges to sack on a pure ack, returns how many */
+static inline int GetSACKBlocks(tcp_stream *cur_stream, uint8_t flags, uint16_t payloadlen, struct seq_interval *blocks)
+{
+	struct tcp_recv_vars *rcvvar = cur_stream->rcvvar;
+	int nblocks;
+
+	/* data segments are sized without room for SACK */
+	if (payloadlen > 0 || !(flags & TCP_FLAG_ACK) || (flags & (TCP_FLAG_SYN | TCP_FLAG_RST | TCP_FLAG_WACK)))
+		return 0;
+	if (!cur_stream->sack_permit || !rcvvar->rcvbuf)
+		return 0;
+
+	/* the application shifts the ooo list in RBRemove() under read_lock */
+	if (SBUF_LOCK(&rcvvar->read_lock)) {
+		if (errno == EDEADLK)
+			perror("GetSACKBlocks: read_lock blocked\n");
+		assert(0);
+	}
+	nblocks = RBGetOOORanges(rcvvar->rcvbuf, blocks, TCP_MAX_SACK_BLOCKS);
+	SBUF_UNLOCK(&rcvvar->read_lock);
+
+	return nblocks;
+}
+#endif /* TCP_OPT_SACK_ENABLED */
+/*----------------------------------------------------------------------------*/
+static inline void GenerateTCPTimestamp(uint8_t *tcpopt, uint32_t ts_val, uint32_t ts_ecr)
 {
 	uint32_t *ts = (uint32_t *)(tcpopt + 2);
 
 	tcpopt[0] = TCP_OPT_TIMESTAMP;
 	tcpopt[1] = TCP_OPT_TIMESTAMP_LEN;
-	ts[0] = htonl(cur_ts);
-	ts[1] = htonl(cur_stream->rcvvar->ts_recent);
+	ts[0] = htonl(ts_val);
+	ts[1] = htonl(ts_ecr);
 }
 /*----------------------------------------------------------------------------*/
-static inline void GenerateTCPOptions(tcp_stream *cur_stream, uint32_t cur_ts, uint8_t flags, uint8_t *tcpopt, uint16_t optlen)
+/* options of a SYN or SYN/ACK, returns their length */
+static inline int GenerateSYNOptions(uint8_t *tcpopt, uint16_t mss, uint8_t wscale, uint32_t ts_val, uint32_t ts_ecr)
 {
-	(void)optlen;
 	int i = 0;
 
-	if (flags & TCP_FLAG_SYN) {
-		uint16_t mss;
-
-		/* MSS option */
-		mss = cur_stream->sndvar->mss;
-		tcpopt[i++] = TCP_OPT_MSS;
-		tcpopt[i++] = TCP_OPT_MSS_LEN;
-		tcpopt[i++] = mss >> 8;
-		tcpopt[i++] = mss % 256;
+	/* MSS option */
+	tcpopt[i++] = TCP_OPT_MSS;
+	tcpopt[i++] = TCP_OPT_MSS_LEN;
+	tcpopt[i++] = mss >> 8;
+	tcpopt[i++] = mss % 256;
 
-		/* SACK permit */
+	/* SACK permit */
 #if TCP_OPT_SACK_ENABLED
 #if !TCP_OPT_TIMESTAMP_ENABLED
-		tcpopt[i++] = TCP_OPT_NOP;
-		tcpopt[i++] = TCP_OPT_NOP;
+	tcpopt[i++] = TCP_OPT_NOP;
+	tcpopt[i++] = TCP_OPT_NOP;
 #endif /* TCP_OPT_TIMESTAMP_ENABLED */
-		tcpopt[i++] = TCP_OPT_SACK_PERMIT;
-		tcpopt[i++] = TCP_OPT_SACK_PERMIT_LEN;
-		TRACE_SACK("Local SACK permited.\n");
+	tcpopt[i++] = TCP_OPT_SACK_PERMIT;
+	tcpopt[i++] = TCP_OPT_SACK_PERMIT_LEN;
+	TRACE_SACK("Local SACK permited.\n");
 #endif /* TCP_OPT_SACK_ENABLED */
 
-		/* Timestamp */
+	/* Timestamp */
 #if TCP_OPT_TIMESTAMP_ENABLED
 #if !TCP_OPT_SACK_ENABLED
-		tcpopt[i++] = TCP_OPT_NOP;
-		tcpopt[i++] = TCP_OPT_NOP;
+	tcpopt[i++] = TCP_OPT_NOP;
+	tcpopt[i++] = TCP_OPT_NOP;
 #endif /* TCP_OPT_SACK_ENABLED */
-		GenerateTCPTimestamp(cur_stream, tcpopt + i, cur_ts);
-		i += TCP_OPT_TIMESTAMP_LEN;
+	GenerateTCPTimestamp(tcpopt + i, ts_val, ts_ecr);
+	i += TCP_OPT_TIMESTAMP_LEN;
+#else
+	UNUSED(ts_val);
+	UNUSED(ts_ecr);
 #endif /* TCP_OPT_TIMESTAMP_ENABLED */
 
-		/* Window scale */
-		tcpopt[i++] = TCP_OPT_NOP;
-		tcpopt[i++] = TCP_OPT_WSCALE;
-		tcpopt[i++] = TCP_OPT_WSCALE_LEN;
-		tcpopt[i++] = cur_stream->sndvar->wscale_mine;
+	/* Window scale */
+	tcpopt[i++] = TCP_OPT_NOP;
+	tcpopt[i++] = TCP_OPT_WSCALE;
+	tcpopt[i++] = TCP_OPT_WSCALE_LEN;
+	tcpopt[i++] = wscale;
 
+	return i;
+}
+/*----------------------------------------------------------------------------*/
+static inline void GenerateTCPOptions(tcp_stream *cur_stream, uint32_t cur_ts, uint8_t flags, uint8_t *tcpopt, uint16_t optlen)
+{
+	(void)optlen;
+	int i = 0;
+
+	if (flags & TCP_FLAG_SYN) {
+		i = GenerateSYNOptions(tcpopt, cur_stream->sndvar->mss, cur_stream->sndvar->wscale_mine, cur_ts,
+				       cur_stream->rcvvar->ts_recent);
 	} else {
 #if TCP_OPT_TIMESTAMP_ENABLED
 		tcpopt[i++] = TCP_OPT_NOP;
 		tcpopt[i++] = TCP_OPT_NOP;
-		GenerateTCPTimestamp(cur_stream, tcpopt + i, cur_ts);
+		GenerateTCPTimestamp(tcpopt + i, cur_ts, cur_stream->rcvvar->ts_recent);
 		i += TCP_OPT_TIMESTAMP_LEN;
 #endif
-
-#if TCP_OPT_SACK_ENABLED
-		if (flags & TCP_OPT_SACK) {
-			// i += GenerateSACKOption(cur_stream, tcpopt + i);
-		}
-#endif
 	}
 
 	assert(i == optlen);
@@ -239,6 +272,55 @@ int SendTCPPacketStandalone(struct mtcp_manager *mtcp, uint32_t saddr, uint16_t
 	return payloadlen;
 }
 /*----------------------------------------------------------------------------*/
+int SendTCPSynAckStandalone(struct mtcp_manager *mtcp, uint32_t saddr, uint16_t sport, uint32_t daddr, uint16_t dport, uint32_t seq,
+			    uint32_t ack_seq, uint16_t mss, int ext_opts, uint32_t ts_val, uint32_t ts_ecr)
+{
+	struct tcphdr *tcph;
+	uint8_t *tcpopt;
+	uint16_t optlen;
+	int rc = -1;
+
+	optlen = ext_opts ? CalculateOptionLength(TCP_FLAG_SYN) : TCP_OPT_MSS_LEN;
+	tcph = (struct tcphdr *)IPOutputStandalone(mtcp, IPPROTO_TCP, 0, saddr, daddr, TCP_HEADER_LEN + optlen);
+	if (tcph == NULL) {
+		return ERROR;
+	}
+	memset(tcph, 0, TCP_HEADER_LEN + optlen);
+
+	tcph->source = sport;
+	tcph->dest = dport;
+	tcph->syn = TRUE;
+	tcph->ack = TRUE;
+	tcph->seq = htonl(seq);
+	tcph->ack_seq = htonl(ack_seq);
+	/* the window of a SYN is never scaled */
+	tcph->window = htons(MIN(TCP_INITIAL_WINDOW, TCP_MAX_WINDOW));
+	tcph->doff = (TCP_HEADER_LEN + optlen) >> 2;
+
+	tcpopt = (uint8_t *)tcph + TCP_HEADER_LEN;
+	if (ext_opts) {
+		GenerateSYNOptions(tcpopt, mss, TCP_DEFAULT_WSCALE, ts_val, ts_ecr);
+	} else {
+		tcpopt[0] = TCP_OPT_MSS;
+		tcpopt[1] = TCP_OPT_MSS_LEN;
+		tcpopt[2] = mss >> 8;
+		tcpopt[3] = mss % 256;
+	}
+
+#if TCP_CALCULATE_CHECKSUM
+#ifndef DISABLE_HWCSUM
+	uint8_t is_external;
+	if (mtcp->iom->dev_ioctl != NULL)
+		rc = mtcp->iom->dev_ioctl(mtcp->ctx, GetOutputInterface(daddr, &is_external), PKT_TX_TCPIP_CSUM, NULL);
+	UNUSED(is_external);
+#endif
+	if (rc == -1)
+		tcph->check = TCPCalcChecksum((uint16_t *)tcph, TCP_HEADER_LEN + optlen, saddr, daddr);
+#endif
+
+	return 1;
+}
+/*----------------------------------------------------------------------------*/
 int SendTCPPacket(struct mtcp_manager *mtcp, tcp_stream *cur_stream, uint32_t cur_ts, uint8_t flags, uint8_t *payload,
 		  uint16_t payloadlen)
 {
@@ -246,9 +328,19 @@ int SendTCPPacket(struct mtcp_manager *mtcp, tcp_stream *cur_stream, uint32_t cu
 	uint16_t optlen;
 	uint8_t wscale = 0;
 	uint32_t window32 = 0;
+	uint32_t payload_sum = 0;
+	uint16_t sacklen = 0;
 	int rc = -1;
+#if TCP_OPT_SACK_ENABLED
+	struct seq_interval sack_blocks[TCP_MAX_SACK_BLOCKS];
+	int nsack;
 
-	optlen = CalculateOptionLength(flags);
+	nsack = GetSACKBlocks(cur_stream, flags, payloadlen, sack_blocks);
+	if (nsack > 0)
+		sacklen = 4 + nsack * TCP_OPT_SACK_BLOCK_LEN;
+#endif
+
+	optlen = CalculateOptionLength(flags) + sacklen;
 	if (payloadlen + optlen > cur_stream->sndvar->mss) {
 		TRACE_ERROR("Payload size exceeds MSS\n");
 		return ERROR;
@@ -322,25 +414,35 @@ int SendTCPPacket(struct mtcp_manager *mtcp, tcp_stream *cur_stream, uint32_t cu
 		cur_stream->need_wnd_adv = TRUE;
 	}
 
-	GenerateTCPOptions(cur_stream, cur_ts, flags, (uint8_t *)tcph + TCP_HEADER_LEN, optlen);
+	GenerateTCPOptions(cur_stream, cur_ts, flags, (uint8_t *)tcph + TCP_HEADER_LEN, optlen - sacklen);
+#if TCP_OPT_SACK_ENABLED
+	if (sacklen)
+		GenerateSACKOption(sack_blocks, nsack, (uint8_t *)tcph + TCP_HEADER_LEN + optlen - sacklen);
+#endif
 
 	tcph->doff = (TCP_HEADER_LEN + optlen) >> 2;
-	// copy payload if exist
+
+#if TCP_CALCULATE_CHECKSUM
+#ifndef DISABLE_HWCSUM
+	if (mtcp->iom->dev_ioctl != NULL)
+		rc = mtcp->iom->dev_ioctl(mtcp->ctx, cur_stream->sndvar->nif_out, PKT_TX_TCPIP_CSUM, NULL);
+#endif
+#endif
+	// copy payload if exist, summing it on the way when csum is done in S/W
 	if (payloadlen > 0) {
-		memcpy((uint8_t *)tcph + TCP_HEADER_LEN + optlen, payload, payloadlen);
+		if (rc == -1)
+			payload_sum = TCPCopyAndSum((uint8_t *)tcph + TCP_HEADER_LEN + optlen, payload, payloadlen);
+		else
+			memcpy((uint8_t *)tcph + TCP_HEADER_LEN + optlen, payload, payloadlen);
 #if defined(NETSTAT) && defined(ENABLELRO)
 		mtcp->nstat.tx_gdptbytes += payloadlen;
 #endif /* NETSTAT */
 	}
 
 #if TCP_CALCULATE_CHECKSUM
-#ifndef DISABLE_HWCSUM
-	if (mtcp->iom->dev_ioctl != NULL)
-		rc = mtcp->iom->dev_ioctl(mtcp->ctx, cur_stream->sndvar->nif_out, PKT_TX_TCPIP_CSUM, NULL);
-#endif
 	if (rc == -1)
-		tcph->check =
-			TCPCalcChecksum((uint16_t *)tcph, TCP_HEADER_LEN + optlen + payloadlen, cur_stream->saddr, cur_stream->daddr);
+		tcph->check = TCPCalcChecksumPartial((uint16_t *)tcph, TCP_HEADER_LEN + optlen, TCP_HEADER_LEN + optlen + payloadlen,
+						     cur_stream->sndvar->hdr_tmpl.pseudo_sum, payload_sum);
 #endif
 
 	cur_stream->snd_nxt += payloadlen;
@@ -366,6 +468,108 @@ int SendTCPPacket(struct mtcp_manager *mtcp, tcp_stream *cur_stream, uint32_t cu
 	return payloadlen;
 }
 /*----------------------------------------------------------------------------*/
+/*
+ * Software GSO: sends len bytes of data as a run of seg_len sized segments,
+ * the last one possibly shorter. The TCP header and options are built and
+ * summed once, each segment then only gets its own seq and checksum, and
+ * the per stream bookkeeping SendTCPPacket() does for every segment is done
+ * once for the whole run. Returns the payload bytes sent, which is less
+ * than len when the tx ring fills up, or -2 if nothing could be sent.
+ */
+static int SendTCPSegments(struct mtcp_manager *mtcp, tcp_stream *cur_stream, uint32_t cur_ts, uint8_t *data, uint32_t len,
+			   uint16_t seg_len)
+{
+	struct tcp_send_vars *sndvar = cur_stream->sndvar;
+	uint32_t hdr[15]; /* 60 bytes, the largest TCP header */
+	struct tcphdr *th = (struct tcphdr *)hdr;
+	struct tcphdr *tcph;
+	uint16_t optlen = CalculateOptionLength(TCP_FLAG_ACK);
+	uint16_t hdrlen = TCP_HEADER_LEN + optlen;
+	uint32_t window32;
+	uint32_t hdr_sum = 0;
+	uint32_t sum, seq_n;
+	uint32_t off;
+	uint16_t plen = 0;
+	int nsegs = 0;
+	int rc;
+	int i;
+
+	memset(hdr, 0, hdrlen);
+	th->source = cur_stream->sport;
+	th->dest = cur_stream->dport;
+	th->ack = TRUE;
+	th->ack_seq = htonl(cur_stream->rcv_nxt);
+	sndvar->ts_lastack_sent = cur_ts;
+	cur_stream->last_active_ts = cur_ts;
+	UpdateTimeoutList(mtcp, cur_stream);
+
+	window32 = cur_stream->rcvvar->rcv_wnd >> sndvar->wscale_mine;
+	th->window = htons((uint16_t)MIN(window32, TCP_MAX_WINDOW));
+	if (window32 == 0) {
+		cur_stream->need_wnd_adv = TRUE;
+	}
+
+	GenerateTCPOptions(cur_stream, cur_ts, TCP_FLAG_ACK, (uint8_t *)hdr + TCP_HEADER_LEN, optlen);
+	th->doff = hdrlen >> 2;
+
+	/* everything but seq, the length and the payload, folded to 16 bits */
+	sum = sndvar->hdr_tmpl.pseudo_sum;
+	for (i = 0; i < hdrlen / 2; i++)
+		sum += ((uint16_t *)hdr)[i];
+	sum = (sum >> 16) + (sum & 0xFFFF);
+	hdr_sum = (sum >> 16) + (sum & 0xFFFF);
+
+	for (off = 0; off < len; off += plen) {
+		plen = MIN(seg_len, len - off);
+
+		tcph = (struct tcphdr *)IPOutput(mtcp, cur_stream, hdrlen + plen);
+		if (tcph == NULL)
+			break;
+		memcpy(tcph, hdr, hdrlen);
+		seq_n = htonl(cur_stream->snd_nxt + off);
+		tcph->seq = seq_n;
+
+		rc = -1;
+#if TCP_CALCULATE_CHECKSUM
+#ifndef DISABLE_HWCSUM
+		if (mtcp->iom->dev_ioctl != NULL)
+			rc = mtcp->iom->dev_ioctl(mtcp->ctx, sndvar->nif_out, PKT_TX_TCPIP_CSUM, NULL);
+#endif
+		if (rc == -1) {
+			sum = hdr_sum + TCPCopyAndSum((uint8_t *)tcph + hdrlen, data + off, plen) + htons(hdrlen + plen) +
+			      (seq_n >> 16) + (seq_n & 0xFFFF);
+			sum = (sum >> 16) + (sum & 0xFFFF);
+			sum += (sum >> 16);
+			tcph->check = (uint16_t)~sum;
+		} else
+#endif
+		{
+			memcpy((uint8_t *)tcph + hdrlen, data + off, plen);
+		}
+#if defined(NETSTAT) && defined(ENABLELRO)
+		mtcp->nstat.tx_gdptbytes += plen;
+#endif /* NETSTAT */
+		nsegs++;
+	}
+
+	if (off == 0)
+		return -2;
+
+#ifdef NETSTAT
+	mtcp->nstat.tx_gso_segs += nsegs - 1;
+#endif
+	cur_stream->snd_nxt += off;
+
+	/* update retransmission timer once for the run */
+	sndvar->ts_rto = cur_ts + sndvar->rto;
+	TRACE_RTO("Updating retransmission timer. "
+		  "cur_ts: %u, rto: %u, ts_rto: %u\n",
+		  cur_ts, sndvar->rto, sndvar->ts_rto);
+	AddtoRTOList(mtcp, cur_stream);
+
+	return off;
+}
+/*----------------------------------------------------------------------------*/
 static int FlushTCPSendingBuffer(mtcp_manager_t mtcp, tcp_stream *cur_stream, uint32_t cur_ts)
 {
 #if 0
@@ -473,10 +677,14 @@ static int FlushTCPSendingBuffer(mtcp_manager_t mtcp, tcp_stream *cur_stream, ui
 	uint32_t pkt_len;
 	uint32_t len;
 	uint32_t seq = 0;
+	uint32_t seg_len;
 	int remaining_window;
 	int sndlen;
 	int packets = 0;
 	uint8_t wack_sent = 0;
+#if TCP_OPT_SACK_ENABLED
+	struct seq_interval sacked;
+#endif
 
 	if (!sndvar->sndbuf) {
 		TRACE_ERROR("Stream %d: No send buffer available.\n", cur_stream->id);
@@ -491,6 +699,12 @@ static int FlushTCPSendingBuffer(mtcp_manager_t mtcp, tcp_stream *cur_stream, ui
 		goto out;
 	}
 
+#if RATE_LIMIT_ENABLED
+	/* cwnd per srtt, srtt being in ms << 3 */
+	if (cur_stream->rcvvar->srtt)
+		SetTokenBucketRate(&cur_stream->bucket, (uint64_t)sndvar->cwnd * 8000 / cur_stream->rcvvar->srtt);
+#endif
+
 	while (1) {
 #if USE_CCP
 		if (sndvar->missing_seq) {
@@ -536,10 +750,15 @@ static int FlushTCPSendingBuffer(mtcp_manager_t mtcp, tcp_stream *cur_stream, ui
 			break;
 
 #if TCP_OPT_SACK_ENABLED
-		if (SeqIsSacked(cur_stream, seq)) {
-			TRACE_DBG("!! SKIPPING %u\n", seq - sndvar->iss);
-			cur_stream->snd_nxt += len;
-			continue;
+		/* the peer already has the SACKed ranges: jump over the one seq
+		 * is in and stop short of the next */
+		if (NextSACKedRange(cur_stream, seq, &sacked)) {
+			if (TCP_SEQ_LEQ(sacked.left_edge, seq)) {
+				TRACE_DBG("!! SKIPPING %u-%u\n", seq - sndvar->iss, sacked.right_edge - sndvar->iss);
+				cur_stream->snd_nxt = sacked.right_edge;
+				continue;
+			}
+			len = MIN(len, sacked.left_edge - seq);
 		}
 #endif
 
@@ -564,30 +783,40 @@ static int FlushTCPSendingBuffer(mtcp_manager_t mtcp, tcp_stream *cur_stream, ui
 
 		/* payload size limited by remaining window space */
 		len = MIN((int)len, remaining_window);
-		/* payload size limited by TCP MSS */
-		pkt_len = MIN((int)len, (int)sndvar->mss - (int)CalculateOptionLength(TCP_FLAG_ACK));
+		/* payload size limited by TCP MSS, or by GSO to a run of full
+		 * segments plus a tail */
+		seg_len = sndvar->mss - CalculateOptionLength(TCP_FLAG_ACK);
+		pkt_len = MIN(len, seg_len);
+		if (CONFIG.tcp_gso && len > seg_len) {
+			pkt_len = MIN(len, seg_len * TCP_GSO_MAX_SEGS);
+#if PACING_ENABLED
+			/* a paced stream bursts at most ~1ms worth of its rate */
+			if (cur_stream->pacer.rate)
+				pkt_len = MIN(pkt_len, MAX(cur_stream->pacer.rate / 1000, 2 * seg_len));
+#endif
+		}
 
+		/* held back by the pacer: park on the wheel until paced_until */
 #if RATE_LIMIT_ENABLED
-		// update rate
-		if (cur_stream->rcvvar->srtt) {
-			cur_stream->bucket->rate = (uint32_t)(SECONDS_TO_USECS(			      // bits / s = mbps
-				BYTES_TO_BITS(							      // bits / us
-					(double)sndvar->cwnd / UNSHIFT_SRTT(cur_stream->rcvvar->srtt) // bytes / us
-					)));
-		}
-		if (cur_stream->bucket->rate != 0 && (SufficientTokens(cur_stream->bucket, pkt_len * 8) < 0)) {
-			packets = -3;
+		if (cur_stream->bucket.rate != 0 &&
+		    SufficientTokens(&cur_stream->bucket, mtcp->pacing_wheel->now, pkt_len, &sndvar->paced_until) < 0) {
+			packets = -4;
 			goto out;
 		}
 #endif
 
 #if PACING_ENABLED
-		if (!CanSendNow(cur_stream->pacer)) {
-			packets = -3;
+		if (!CanSendNow(&cur_stream->pacer, mtcp->pacing_wheel->now, mtcp->pacing_wheel->tick_cycles, pkt_len,
+				&sndvar->paced_until)) {
+			packets = -4;
 			goto out;
 		}
 #endif
-		if ((sndlen = SendTCPPacket(mtcp, cur_stream, cur_ts, TCP_FLAG_ACK, data, pkt_len)) < 0) {
+		if (pkt_len > seg_len)
+			sndlen = SendTCPSegments(mtcp, cur_stream, cur_ts, data, pkt_len, seg_len);
+		else
+			sndlen = SendTCPPacket(mtcp, cur_stream, cur_ts, TCP_FLAG_ACK, data, pkt_len);
+		if (sndlen < 0) {
 			/* there is no available tx buf */
 			packets = -3;
 			goto out;
@@ -597,7 +826,7 @@ static int FlushTCPSendingBuffer(mtcp_manager_t mtcp, tcp_stream *cur_stream, ui
 			sndvar->missing_seq = 0;
 		}
 #endif
-		packets++;
+		packets += (sndlen + seg_len - 1) / seg_len;
 	}
 
 out:
@@ -687,11 +916,25 @@ inline int WriteTCPControlList(mtcp_manager_t mtcp, struct mtcp_sender *sender,
 {
 	tcp_stream *cur_stream;
 	tcp_stream *next, *last;
+	tcp_stream *batch[ARP_RESOLVE_BATCH];
+	int nbatch = 0;
 	int cnt = 0;
 	int ret;
 
 	thresh = MIN(thresh, sender->control_list_cnt);
 
+	/* new connections show up here first: resolve the next hops of the
+	 * head of the list in one go, so that a peer still waiting for ARP is
+	 * skipped below instead of stalling everything behind it */
+	TAILQ_FOREACH(cur_stream, &sender->control_list, sndvar->control_link)
+	{
+		if (nbatch == MIN(thresh, ARP_RESOLVE_BATCH))
+			break;
+		batch[nbatch++] = cur_stream;
+	}
+	if (nbatch > 0)
+		PrepareHeaderTemplates(mtcp, batch, nbatch);
+
 	/* Send TCP control messages */
 	cnt = 0;
 	cur_stream = TAILQ_FIRST(&sender->control_list);
@@ -706,7 +949,11 @@ inline int WriteTCPControlList(mtcp_manager_t mtcp, struct mtcp_sender *sender,
 		TAILQ_REMOVE(&sender->control_list, cur_stream, sndvar->control_link);
 		sender->control_list_cnt--;
 
-		if (cur_stream->sndvar->on_control_list) {
+		if (cnt <= nbatch && !cur_stream->sndvar->hdr_tmpl.valid) {
+			/* waiting for ARP, try again after handling other streams */
+			TAILQ_INSERT_TAIL(&sender->control_list, cur_stream, sndvar->control_link);
+			sender->control_list_cnt++;
+		} else if (cur_stream->sndvar->on_control_list) {
 			cur_stream->sndvar->on_control_list = FALSE;
 			//TRACE_DBG("Stream %u: Sending control packet\n", cur_stream->id);
 			ret = SendControlPacket(mtcp, cur_stream, cur_ts);
@@ -776,7 +1023,12 @@ inline int WriteTCPDataList(mtcp_manager_t mtcp, struct mtcp_sender *sender, uin
 #endif
 			}
 
-			if (ret < 0) {
+			if (ret == -4) {
+				/* stays on_send_list while it waits on the wheel */
+				PacingWheelAdd(mtcp, cur_stream, cur_stream->sndvar->paced_until);
+				sender->send_list_cnt--;
+
+			} else if (ret < 0) {
 				TAILQ_INSERT_TAIL(&sender->send_list, cur_stream, sndvar->send_link);
 				/* since there is no available write buffer, break */
 				break;
@@ -1020,8 +1272,12 @@ inline void RemoveFromSendList(mtcp_manager_t mtcp, tcp_stream *cur_stream)
 
 	if (cur_stream->sndvar->on_send_list) {
 		cur_stream->sndvar->on_send_list = FALSE;
-		TAILQ_REMOVE(&sender->send_list, cur_stream, sndvar->send_link);
-		sender->send_list_cnt--;
+		if (cur_stream->sndvar->on_pacing_wheel) {
+			PacingWheelRemove(mtcp, cur_stream);
+		} else {
+			TAILQ_REMOVE(&sender->send_list, cur_stream, sndvar->send_link);
+			sender->send_list_cnt--;
+		}
 	}
 }
 /*----------------------------------------------------------------------------*/
@@ -33,10 +33,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 
 #include "tcp_ring_buffer.h"
-#include "tcp_rb_frag_queue.h"
 #include "memory_mgt.h"
 #include "debug.h"
 
@@ -58,10 +59,14 @@ struct rb_manager {
 	uint32_t cnum;
 
 	mem_pool_t mp;
-	mem_pool_t frag_mp;
 
-	rb_frag_queue_t free_fragq;	/* free fragment queue (for app thread) */
-	rb_frag_queue_t free_fragq_int; /* free fragment quuee (only for mtcp) */
+	/* mirrored buffers, only used when mp is NULL */
+	int memfd;	     /* backing pages of all slots */
+	size_t slot_size;    /* chunk_size rounded up to a page */
+	u_char **slot_base;  /* 2 * slot_size mapping per slot, lazily set up */
+	uint32_t *free_slot; /* stack of unused slots */
+	uint32_t free_cnt;
+	int map_failed;	     /* out of mappings, new buffers are plain */
 #ifdef ENABLELRO
 	mtcp_manager_t mtcp;
 #endif
@@ -99,7 +104,73 @@ void RBPrintHex(struct tcp_ring_buffer *buff)
 	printf("\n");
 }
 /*----------------------------------------------------------------------------*/
-rb_manager_t RBManagerCreate(mtcp_manager_t mtcp, size_t chunk_size, uint32_t cnum)
+static int CreateMirrorSlots(rb_manager_t rbm)
+{
+	size_t page = (size_t)getpagesize();
+	uint32_t i;
+
+	rbm->slot_size = (rbm->chunk_size + page - 1) & ~(page - 1);
+
+	rbm->memfd = memfd_create("mtcp_rcvbuf", MFD_CLOEXEC);
+	if (rbm->memfd < 0) {
+		perror("memfd_create");
+		return -1;
+	}
+
+	/* pages are only allocated once a slot is written to */
+	if (ftruncate(rbm->memfd, (off_t)rbm->slot_size * rbm->cnum) < 0) {
+		perror("ftruncate");
+		goto err;
+	}
+
+	rbm->slot_base = calloc(rbm->cnum, sizeof(u_char *));
+	rbm->free_slot = calloc(rbm->cnum, sizeof(uint32_t));
+	if (!rbm->slot_base || !rbm->free_slot) {
+		perror("calloc");
+		goto err;
+	}
+
+	/* hand out low slots first */
+	for (i = 0; i < rbm->cnum; i++)
+		rbm->free_slot[i] = rbm->cnum - i - 1;
+	rbm->free_cnt = rbm->cnum;
+
+	return 0;
+
+err:
+	free(rbm->slot_base);
+	free(rbm->free_slot);
+	rbm->slot_base = NULL;
+	rbm->free_slot = NULL;
+	close(rbm->memfd);
+	rbm->memfd = -1;
+	return -1;
+}
+/*----------------------------------------------------------------------------*/
+static u_char *MapMirrorSlot(rb_manager_t rbm, uint32_t slot)
+{
+	size_t sz = rbm->slot_size;
+	off_t off = (off_t)slot * sz;
+	u_char *base;
+
+	/* reserve both halves first so the two views end up adjacent */
+	base = mmap(NULL, 2 * sz, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		perror("mmap reserve");
+		return NULL;
+	}
+
+	if (mmap(base, sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, rbm->memfd, off) == MAP_FAILED ||
+	    mmap(base + sz, sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, rbm->memfd, off) == MAP_FAILED) {
+		perror("mmap mirror");
+		munmap(base, 2 * sz);
+		return NULL;
+	}
+
+	return base;
+}
+/*----------------------------------------------------------------------------*/
+rb_manager_t RBManagerCreate(mtcp_manager_t mtcp, size_t chunk_size, uint32_t cnum, int mirror)
 {
 	(void)mtcp;
 	rb_manager_t rbm = (rb_manager_t)calloc(1, sizeof(rb_manager));
@@ -111,47 +182,26 @@ rb_manager_t RBManagerCreate(mtcp_manager_t mtcp, size_t chunk_size, uint32_t cn
 
 	rbm->chunk_size = chunk_size;
 	rbm->cnum = cnum;
+	rbm->memfd = -1;
 #if !defined(DISABLE_DPDK) && !defined(ENABLE_ONVM)
 	char pool_name[RTE_MEMPOOL_NAMESIZE];
-	sprintf(pool_name, "rbm_pool_%u", mtcp->ctx->cpu);
-	rbm->mp = (mem_pool_t)MPCreate(pool_name, chunk_size, (uint64_t)chunk_size * cnum);
-#else
-	rbm->mp = (mem_pool_t)MPCreate(chunk_size, (uint64_t)chunk_size * cnum);
 #endif
-	if (!rbm->mp) {
-		TRACE_ERROR("Failed to allocate mp pool.\n");
-		free(rbm);
-		return NULL;
-	}
+
+	if (mirror && CreateMirrorSlots(rbm) < 0)
+		TRACE_ERROR("Failed to set up mirrored recv buffers, falling back to compaction.\n");
+
+	if (rbm->memfd < 0) {
 #if !defined(DISABLE_DPDK) && !defined(ENABLE_ONVM)
-	sprintf(pool_name, "frag_mp_%u", mtcp->ctx->cpu);
-	rbm->frag_mp = (mem_pool_t)MPCreate(pool_name, sizeof(struct fragment_ctx), sizeof(struct fragment_ctx) * cnum);
+		sprintf(pool_name, "rbm_pool_%u", mtcp->ctx->cpu);
+		rbm->mp = (mem_pool_t)MPCreate(pool_name, chunk_size, (uint64_t)chunk_size * cnum);
 #else
-	rbm->frag_mp = (mem_pool_t)MPCreate(sizeof(struct fragment_ctx), sizeof(struct fragment_ctx) * cnum);
+		rbm->mp = (mem_pool_t)MPCreate(chunk_size, (uint64_t)chunk_size * cnum);
 #endif
-	if (!rbm->frag_mp) {
-		TRACE_ERROR("Failed to allocate frag_mp pool.\n");
-		MPDestroy(rbm->mp);
-		free(rbm);
-		return NULL;
-	}
-
-	rbm->free_fragq = CreateRBFragQueue(cnum);
-	if (!rbm->free_fragq) {
-		TRACE_ERROR("Failed to create free fragment queue.\n");
-		MPDestroy(rbm->mp);
-		MPDestroy(rbm->frag_mp);
-		free(rbm);
-		return NULL;
-	}
-	rbm->free_fragq_int = CreateRBFragQueue(cnum);
-	if (!rbm->free_fragq_int) {
-		TRACE_ERROR("Failed to create internal free fragment queue.\n");
-		MPDestroy(rbm->mp);
-		MPDestroy(rbm->frag_mp);
-		DestroyRBFragQueue(rbm->free_fragq);
-		free(rbm);
-		return NULL;
+		if (!rbm->mp) {
+			TRACE_ERROR("Failed to allocate mp pool.\n");
+			free(rbm);
+			return NULL;
+		}
 	}
 
 #ifdef ENABLELRO
@@ -160,56 +210,6 @@ rb_manager_t RBManagerCreate(mtcp_manager_t mtcp, size_t chunk_size, uint32_t cn
 	return rbm;
 }
 /*----------------------------------------------------------------------------*/
-static inline void FreeFragmentContextSingle(rb_manager_t rbm, struct fragment_ctx *frag)
-{
-	if (frag->is_calloc)
-		free(frag);
-	else
-		MPFreeChunk(rbm->frag_mp, frag);
-}
-/*----------------------------------------------------------------------------*/
-static void FreeFragmentContext(rb_manager_t rbm, struct fragment_ctx *fctx)
-{
-	struct fragment_ctx *remove;
-
-	assert(fctx);
-	if (fctx == NULL)
-		return;
-
-	while (fctx) {
-		remove = fctx;
-		fctx = fctx->next;
-		FreeFragmentContextSingle(rbm, remove);
-	}
-}
-/*----------------------------------------------------------------------------*/
-static struct fragment_ctx *AllocateFragmentContext(rb_manager_t rbm)
-{
-	/* this function should be called only in mtcp thread */
-	struct fragment_ctx *frag;
-
-	/* first try deqeue the fragment in free fragment queue */
-	frag = RBFragDequeue(rbm->free_fragq);
-	if (!frag) {
-		frag = RBFragDequeue(rbm->free_fragq_int);
-		if (!frag) {
-			/* next fall back to fetching from mempool */
-			frag = MPAllocateChunk(rbm->frag_mp);
-			if (!frag) {
-				TRACE_ERROR("fragments depleted, fall back to calloc\n");
-				frag = calloc(1, sizeof(struct fragment_ctx));
-				if (frag == NULL) {
-					TRACE_ERROR("calloc failed\n");
-					exit(-1);
-				}
-				frag->is_calloc = 1; /* mark it as allocated by calloc */
-			}
-		}
-	}
-	memset(frag, 0, sizeof(*frag));
-	return frag;
-}
-/*----------------------------------------------------------------------------*/
 struct tcp_ring_buffer *RBInit(rb_manager_t rbm, uint32_t init_seq)
 {
 	struct tcp_ring_buffer *buff = (struct tcp_ring_buffer *)calloc(1, sizeof(struct tcp_ring_buffer));
@@ -219,11 +219,39 @@ struct tcp_ring_buffer *RBInit(rb_manager_t rbm, uint32_t init_seq)
 		return NULL;
 	}
 
-	buff->data = MPAllocateChunk(rbm->mp);
+	if (rbm->mp) {
+		buff->data = MPAllocateChunk(rbm->mp);
+		if (!buff->data) {
+			perror("rb_init MPAllocateChunk");
+			free(buff);
+			return NULL;
+		}
+	} else if (rbm->free_cnt > 0 && (rbm->slot_base[rbm->free_slot[rbm->free_cnt - 1]] || !rbm->map_failed)) {
+		buff->slot = rbm->free_slot[rbm->free_cnt - 1];
+		/* mappings are kept across reuse, only set them up once */
+		if (!rbm->slot_base[buff->slot]) {
+			rbm->slot_base[buff->slot] = MapMirrorSlot(rbm, buff->slot);
+			if (!rbm->slot_base[buff->slot]) {
+				/* likely vm.max_map_count, don't retry for every connection */
+				TRACE_ERROR("Out of mirrored recv buffer mappings, using plain buffers.\n");
+				rbm->map_failed = TRUE;
+			}
+		}
+		if (rbm->slot_base[buff->slot]) {
+			rbm->free_cnt--;
+			buff->data = rbm->slot_base[buff->slot];
+			buff->mirror_size = rbm->slot_size;
+		}
+	}
+
+	/* a plain buffer is compacted in RBPut() instead */
 	if (!buff->data) {
-		perror("rb_init MPAllocateChunk");
-		free(buff);
-		return NULL;
+		buff->data = malloc(rbm->chunk_size);
+		if (!buff->data) {
+			perror("rb_init malloc");
+			free(buff);
+			return NULL;
+		}
 	}
 
 	//memset(buff->data, 0, rbm->chunk_size);
@@ -241,13 +269,17 @@ struct tcp_ring_buffer *RBInit(rb_manager_t rbm, uint32_t init_seq)
 void RBFree(rb_manager_t rbm, struct tcp_ring_buffer *buff)
 {
 	assert(buff);
-	if (buff->fctx) {
-		FreeFragmentContext(rbm, buff->fctx);
-		buff->fctx = NULL;
-	}
 
 	if (buff->data) {
-		MPFreeChunk(rbm->mp, buff->data);
+		if (buff->mirror_size) {
+			/* drop the pages but keep the mapping for the next buffer */
+			madvise(buff->data, buff->mirror_size, MADV_REMOVE);
+			rbm->free_slot[rbm->free_cnt++] = buff->slot;
+		} else if (rbm->mp) {
+			MPFreeChunk(rbm->mp, buff->data);
+		} else {
+			free(buff->data);
+		}
 	}
 
 	rbm->cur_num--;
@@ -267,45 +299,13 @@ static inline uint32_t GetMinSeq(uint32_t a, uint32_t b)
 	return ((a - b) <= MAXSEQ / 2) ? b : a;
 }
 /*----------------------------------------------------------------------------*/
-static inline uint32_t GetMaxSeq(uint32_t a, uint32_t b)
-{
-	if (a == b)
-		return a;
-	if (a < b)
-		return ((b - a) <= MAXSEQ / 2) ? b : a;
-	/* b < a */
-	return ((a - b) <= MAXSEQ / 2) ? a : b;
-}
-/*----------------------------------------------------------------------------*/
-static inline int CanMerge(const struct fragment_ctx *a, const struct fragment_ctx *b)
-{
-	uint32_t a_end = a->seq + a->len + 1;
-	uint32_t b_end = b->seq + b->len + 1;
-
-	if (GetMinSeq(a_end, b->seq) == a_end || GetMinSeq(b_end, a->seq) == b_end)
-		return 0;
-	return (1);
-}
-/*----------------------------------------------------------------------------*/
-static inline void MergeFragments(struct fragment_ctx *a, struct fragment_ctx *b)
-{
-	/* merge a into b */
-	uint32_t min_seq, max_seq;
-
-	min_seq = GetMinSeq(a->seq, b->seq);
-	max_seq = GetMaxSeq(a->seq + a->len, b->seq + b->len);
-	b->seq = min_seq;
-	b->len = max_seq - min_seq;
-}
-/*----------------------------------------------------------------------------*/
 int RBPut(rb_manager_t rbm, struct tcp_ring_buffer *buff, void *data, uint32_t len, uint32_t cur_seq)
 {
 	int putx, end_off;
-	struct fragment_ctx *new_ctx;
-	struct fragment_ctx *iter;
-	struct fragment_ctx *prev, *pprev;
-	int merged = 0;
+	uint32_t added;
+	int idx;
 
+	(void)rbm;
 	if (len <= 0)
 		return 0;
 
@@ -319,8 +319,17 @@ int RBPut(rb_manager_t rbm, struct tcp_ring_buffer *buff, void *data, uint32_t l
 		return -2;
 	}
 
+	// record the range first, a full set may refuse it
+	idx = SeqIntervalInsert(buff->ooo, &buff->ooo_cnt, RB_MAX_OOO, buff->head_seq, cur_seq, cur_seq + len, &added);
+	if (idx < 0) {
+		TRACE_DBG("out-of-order ranges full, dropping seq %u\n", cur_seq);
+		return 0;
+	}
+	buff->last_seq = cur_seq;
+
 	// if buffer is at tail, move the data to the first of head
-	if (buff->size <= ((int)buff->head_offset + end_off)) {
+	// (a mirrored buffer always has size bytes mapped past the head)
+	if (!buff->mirror_size && buff->size <= ((int)buff->head_offset + end_off)) {
 		memmove(buff->data, buff->head, buff->last_len);
 		buff->tail_offset -= buff->head_offset;
 		buff->head_offset = 0;
@@ -337,58 +346,11 @@ int RBPut(rb_manager_t rbm, struct tcp_ring_buffer *buff, void *data, uint32_t l
 		buff->tail_offset = buff->head_offset + end_off;
 	buff->last_len = buff->tail_offset - buff->head_offset;
 
-	// create fragmentation context blocks
-	new_ctx = AllocateFragmentContext(rbm);
-	if (!new_ctx) {
-		perror("allocating new_ctx failed");
-		return 0;
-	}
-	new_ctx->seq = cur_seq;
-	new_ctx->len = len;
-	new_ctx->next = NULL;
-
-	// traverse the fragment list, and merge the new fragment if possible
-	for (iter = buff->fctx, prev = NULL, pprev = NULL; iter != NULL; pprev = prev, prev = iter, iter = iter->next) {
-		if (CanMerge(new_ctx, iter)) {
-			/* merge the first fragment into the second fragment */
-			MergeFragments(new_ctx, iter);
-
-			/* remove the first fragment */
-			if (prev == new_ctx) {
-				if (pprev)
-					pprev->next = iter;
-				else
-					buff->fctx = iter;
-				prev = pprev;
-			}
-			FreeFragmentContextSingle(rbm, new_ctx);
-			new_ctx = iter;
-			merged = 1;
-		} else if (merged || GetMaxSeq(cur_seq + len, iter->seq) == iter->seq) {
-			/* merged at some point, but no more mergeable
-			   then stop it now */
-			break;
-		}
-	}
+	if (idx == 0 && buff->ooo[0].left_edge == buff->head_seq) {
+		int first_len = buff->ooo[0].right_edge - buff->ooo[0].left_edge;
 
-	if (!merged) {
-		if (buff->fctx == NULL) {
-			buff->fctx = new_ctx;
-		} else if (GetMinSeq(cur_seq, buff->fctx->seq) == cur_seq) {
-			/* if the new packet's seqnum is before the existing fragments */
-			new_ctx->next = buff->fctx;
-			buff->fctx = new_ctx;
-		} else {
-			/* if the seqnum is in-between the fragments or
-			   at the last */
-			assert(GetMinSeq(cur_seq, prev->seq + prev->len) == prev->seq + prev->len);
-			prev->next = new_ctx;
-			new_ctx->next = iter;
-		}
-	}
-	if (buff->head_seq == buff->fctx->seq) {
-		buff->cum_len += buff->fctx->len - buff->merged_len;
-		buff->merged_len = buff->fctx->len;
+		buff->cum_len += first_len - buff->merged_len;
+		buff->merged_len = first_len;
 	}
 
 	return len;
@@ -397,6 +359,8 @@ int RBPut(rb_manager_t rbm, struct tcp_ring_buffer *buff, void *data, uint32_t l
 size_t RBRemove(rb_manager_t rbm, struct tcp_ring_buffer *buff, size_t len, int option)
 {
 	/* this function should be called only in application thread */
+	(void)rbm;
+	(void)option;
 
 	if (buff->merged_len < (int)len)
 		len = buff->merged_len;
@@ -405,28 +369,47 @@ size_t RBRemove(rb_manager_t rbm, struct tcp_ring_buffer *buff, size_t len, int
 		return 0;
 
 	buff->head_offset += len;
+	if (buff->mirror_size && buff->head_offset >= buff->mirror_size) {
+		/* the head crossed into the second view, step back to the first */
+		buff->head_offset -= buff->mirror_size;
+		buff->tail_offset -= buff->mirror_size;
+	}
 	buff->head = buff->data + buff->head_offset;
 	buff->head_seq += len;
 
 	buff->merged_len -= len;
 	buff->last_len -= len;
 
-	// modify fragementation chunks
-	if (len == buff->fctx->len) {
-		struct fragment_ctx *remove = buff->fctx;
-		buff->fctx = buff->fctx->next;
-		if (option == AT_APP) {
-			RBFragEnqueue(rbm->free_fragq, remove);
-		} else if (option == AT_MTCP) {
-			RBFragEnqueue(rbm->free_fragq_int, remove);
-		}
-	} else if (len < buff->fctx->len) {
-		buff->fctx->seq += len;
-		buff->fctx->len -= len;
+	// trim the in-order range, drop it once fully consumed
+	assert(buff->ooo_cnt > 0);
+	if (buff->merged_len == 0) {
+		buff->ooo_cnt--;
+		memmove(&buff->ooo[0], &buff->ooo[1], buff->ooo_cnt * sizeof(buff->ooo[0]));
 	} else {
-		assert(0);
+		buff->ooo[0].left_edge = buff->head_seq;
 	}
 
 	return len;
 }
 /*----------------------------------------------------------------------------*/
+int RBGetOOORanges(struct tcp_ring_buffer *buff, struct seq_interval *ranges, int max)
+{
+	int first, recent, i, n = 0;
+
+	/* the in-order range is acked cumulatively, not sacked */
+	first = (buff->merged_len > 0) ? 1 : 0;
+	if (first >= buff->ooo_cnt || max <= 0)
+		return 0;
+
+	recent = SeqIntervalFind(buff->ooo, buff->ooo_cnt, buff->head_seq, buff->last_seq);
+	if (recent >= first)
+		ranges[n++] = buff->ooo[recent];
+
+	for (i = first; i < buff->ooo_cnt && n < max; i++) {
+		if (i != recent)
+			ranges[n++] = buff->ooo[i];
+	}
+
+	return n;
+}
+/*----------------------------------------------------------------------------*/
@@ -39,9 +39,8 @@
 #include "ip_out.h"
 #include "timer.h"
 #include "debug.h"
-#if RATE_LIMIT_ENABLED || PACING_ENABLED
 #include "pacing.h"
-#endif
+#include "tcp_cc.h"
 #if USE_CCP
 #include "ccp.h"
 #endif
@@ -218,6 +217,97 @@ inline void RaiseErrorEvent(mtcp_manager_t mtcp, tcp_stream *stream)
 	}
 }
 /*---------------------------------------------------------------------------*/
+/*
+ * A stream is three pool chunks. Rather than going to the three pools on
+ * every open and close, streams are taken from and given back to a per-core
+ * stash that moves them to and from the pools in batches, so that at high
+ * connection rates most opens reuse a stream closed moments ago, still warm
+ * in cache. All of it runs with flow_pool_lock held.
+ */
+static void RefillStreamStash(mtcp_manager_t mtcp)
+{
+	struct stream_stash *ss = &mtcp->stash;
+	tcp_stream *stream;
+	struct tcp_recv_vars *rcvvar;
+	struct tcp_send_vars *sndvar;
+
+	while (ss->cnt < STREAM_STASH_SIZE / 2) {
+		stream = (tcp_stream *)MPAllocateChunk(mtcp->flow_pool);
+		if (!stream)
+			break;
+		rcvvar = (struct tcp_recv_vars *)MPAllocateChunk(mtcp->rv_pool);
+		if (!rcvvar) {
+			MPFreeChunk(mtcp->flow_pool, stream);
+			break;
+		}
+		sndvar = (struct tcp_send_vars *)MPAllocateChunk(mtcp->sv_pool);
+		if (!sndvar) {
+			MPFreeChunk(mtcp->rv_pool, rcvvar);
+			MPFreeChunk(mtcp->flow_pool, stream);
+			break;
+		}
+
+		ss->stream[ss->cnt] = stream;
+		ss->rcvvar[ss->cnt] = rcvvar;
+		ss->sndvar[ss->cnt] = sndvar;
+		ss->cnt++;
+	}
+}
+/*---------------------------------------------------------------------------*/
+static tcp_stream *TakeStreamFromStash(mtcp_manager_t mtcp)
+{
+	struct stream_stash *ss = &mtcp->stash;
+	tcp_stream *stream;
+	int i;
+
+	if (ss->cnt == 0)
+		RefillStreamStash(mtcp);
+	if (ss->cnt == 0)
+		return NULL;
+
+	i = --ss->cnt;
+	stream = ss->stream[i];
+	memset(stream, 0, sizeof(tcp_stream));
+	stream->rcvvar = ss->rcvvar[i];
+	stream->sndvar = ss->sndvar[i];
+	memset(stream->rcvvar, 0, sizeof(struct tcp_recv_vars));
+	memset(stream->sndvar, 0, sizeof(struct tcp_send_vars));
+
+	/* the next open is likely to come right after this one */
+	if (i > 0) {
+		__builtin_prefetch(ss->stream[i - 1], 1);
+		__builtin_prefetch(ss->rcvvar[i - 1], 1);
+		__builtin_prefetch(ss->sndvar[i - 1], 1);
+	}
+
+	return stream;
+}
+/*---------------------------------------------------------------------------*/
+static void ReturnStreamToStash(mtcp_manager_t mtcp, tcp_stream *stream)
+{
+	struct stream_stash *ss = &mtcp->stash;
+
+	/* full: hand the older half back */
+	if (ss->cnt == STREAM_STASH_SIZE) {
+		int i;
+
+		for (i = 0; i < STREAM_STASH_SIZE / 2; i++) {
+			MPFreeChunk(mtcp->rv_pool, ss->rcvvar[i]);
+			MPFreeChunk(mtcp->sv_pool, ss->sndvar[i]);
+			MPFreeChunk(mtcp->flow_pool, ss->stream[i]);
+		}
+		ss->cnt -= STREAM_STASH_SIZE / 2;
+		memmove(ss->stream, ss->stream + STREAM_STASH_SIZE / 2, ss->cnt * sizeof(ss->stream[0]));
+		memmove(ss->rcvvar, ss->rcvvar + STREAM_STASH_SIZE / 2, ss->cnt * sizeof(ss->rcvvar[0]));
+		memmove(ss->sndvar, ss->sndvar + STREAM_STASH_SIZE / 2, ss->cnt * sizeof(ss->sndvar[0]));
+	}
+
+	ss->stream[ss->cnt] = stream;
+	ss->rcvvar[ss->cnt] = stream->rcvvar;
+	ss->sndvar[ss->cnt] = stream->sndvar;
+	ss->cnt++;
+}
+/*---------------------------------------------------------------------------*/
 tcp_stream *CreateTCPStream(mtcp_manager_t mtcp, socket_map_t socket, int type, uint32_t saddr, uint16_t sport, uint32_t daddr,
 			    uint16_t dport)
 {
@@ -230,7 +320,7 @@ tcp_stream *CreateTCPStream(mtcp_manager_t mtcp, socket_map_t socket, int type,
 
 	pthread_mutex_lock(&mtcp->ctx->flow_pool_lock);
 
-	stream = (tcp_stream *)MPAllocateChunk(mtcp->flow_pool);
+	stream = TakeStreamFromStash(mtcp);
 	if (!stream) {
 		TRACE_ERROR("Cannot allocate memory for the stream. "
 			    "CONFIG.max_concurrency: %d, concurrent: %u\n",
@@ -238,23 +328,6 @@ tcp_stream *CreateTCPStream(mtcp_manager_t mtcp, socket_map_t socket, int type,
 		pthread_mutex_unlock(&mtcp->ctx->flow_pool_lock);
 		return NULL;
 	}
-	memset(stream, 0, sizeof(tcp_stream));
-
-	stream->rcvvar = (struct tcp_recv_vars *)MPAllocateChunk(mtcp->rv_pool);
-	if (!stream->rcvvar) {
-		MPFreeChunk(mtcp->flow_pool, stream);
-		pthread_mutex_unlock(&mtcp->ctx->flow_pool_lock);
-		return NULL;
-	}
-	stream->sndvar = (struct tcp_send_vars *)MPAllocateChunk(mtcp->sv_pool);
-	if (!stream->sndvar) {
-		MPFreeChunk(mtcp->rv_pool, stream->rcvvar);
-		MPFreeChunk(mtcp->flow_pool, stream);
-		pthread_mutex_unlock(&mtcp->ctx->flow_pool_lock);
-		return NULL;
-	}
-	memset(stream->rcvvar, 0, sizeof(struct tcp_recv_vars));
-	memset(stream->sndvar, 0, sizeof(struct tcp_send_vars));
 
 	stream->id = mtcp->g_id++;
 	stream->saddr = saddr;
@@ -267,7 +340,7 @@ tcp_stream *CreateTCPStream(mtcp_manager_t mtcp, socket_map_t socket, int type,
 		TRACE_ERROR("Stream %d: "
 			    "Failed to insert the stream into hash table.\n",
 			    stream->id);
-		MPFreeChunk(mtcp->flow_pool, stream);
+		ReturnStreamToStash(mtcp, stream);
 		pthread_mutex_unlock(&mtcp->ctx->flow_pool_lock);
 		return NULL;
 	}
@@ -278,7 +351,7 @@ tcp_stream *CreateTCPStream(mtcp_manager_t mtcp, socket_map_t socket, int type,
 		TRACE_ERROR("Stream %d: "
 			    "Failed to insert the stream into SID lookup table.\n",
 			    stream->id);
-		MPFreeChunk(mtcp->flow_pool, stream);
+		ReturnStreamToStash(mtcp, stream);
 		pthread_mutex_unlock(&mtcp->ctx->flow_pool_lock);
 		return NULL;
 	}
@@ -369,12 +442,7 @@ tcp_stream *CreateTCPStream(mtcp_manager_t mtcp, socket_map_t socket, int type,
 		     stream->id, sa[0], sa[1], sa[2], sa[3], ntohs(stream->sport), da[0], da[1], da[2], da[3], ntohs(stream->dport),
 		     stream->sndvar->iss);
 
-#if RATE_LIMIT_ENABLED
-	stream->bucket = NewTokenBucket();
-#endif
-#if PACING_ENABLED
-	stream->pacer = NewPacketPacer();
-#endif
+	TCPCCInit(stream, socket ? socket->cc_ops : NULL, mtcp->cur_tsc);
 #if USE_CCP
 	ccp_create(mtcp, stream);
 #endif
@@ -480,6 +548,15 @@ void DestroyTCPStream(mtcp_manager_t mtcp, tcp_stream *stream)
 	if (CONFIG.tcp_timeout > 0)
 		RemoveFromTimeoutList(mtcp, stream);
 
+	if (stream->syn_queued) {
+		struct tcp_listener *listener = (struct tcp_listener *)ListenerHTSearch(mtcp->listeners, &stream->sport);
+
+		/* the listener may have gone, or been replaced, meanwhile */
+		if (listener && listener->syn_backlog > 0)
+			listener->syn_backlog--;
+		stream->syn_queued = FALSE;
+	}
+
 #if BLOCKING_SUPPORT
 	if (stream->on_snd_br_list) {
 		stream->on_snd_br_list = FALSE;
@@ -527,9 +604,7 @@ void DestroyTCPStream(mtcp_manager_t mtcp, tcp_stream *stream)
 
 	mtcp->flow_cnt--;
 
-	MPFreeChunk(mtcp->rv_pool, stream->rcvvar);
-	MPFreeChunk(mtcp->sv_pool, stream->sndvar);
-	MPFreeChunk(mtcp->flow_pool, stream);
+	ReturnStreamToStash(mtcp, stream);
 	pthread_mutex_unlock(&mtcp->ctx->flow_pool_lock);
 
 	if (bound_addr) {
@@ -126,12 +126,7 @@ static inline index_type PrevIndex(stream_queue_t sq, index_type i)
 /*---------------------------------------------------------------------------*/
 int StreamQueueIsEmpty(stream_queue_t sq)
 {
-	return (sq->_head == sq->_tail);
-}
-/*---------------------------------------------------------------------------*/
-static inline void StreamMemoryBarrier(tcp_stream *volatile stream, volatile index_type index)
-{
-	__asm__ volatile("" : : "m"(stream), "m"(index));
+	return (__atomic_load_n(&sq->_head, __ATOMIC_RELAXED) == __atomic_load_n(&sq->_tail, __ATOMIC_RELAXED));
 }
 /*---------------------------------------------------------------------------*/
 stream_queue_t CreateStreamQueue(int capacity)
@@ -168,16 +163,21 @@ void DestroyStreamQueue(stream_queue_t sq)
 	free(sq);
 }
 /*---------------------------------------------------------------------------*/
+/*
+ * The stream queues are single-producer (application) / single-consumer
+ * (mTCP thread). The slot is published with a release store of the index
+ * and read after an acquire load of it, so no lock is needed even on
+ * weakly ordered CPUs.
+ */
 int StreamEnqueue(stream_queue_t sq, tcp_stream *stream)
 {
-	index_type h = sq->_head;
+	index_type h = __atomic_load_n(&sq->_head, __ATOMIC_ACQUIRE);
 	index_type t = sq->_tail;
 	index_type nt = NextIndex(sq, t);
 
 	if (nt != h) {
 		sq->_q[t] = stream;
-		StreamMemoryBarrier(sq->_q[t], sq->_tail);
-		sq->_tail = nt;
+		__atomic_store_n(&sq->_tail, nt, __ATOMIC_RELEASE);
 		return 0;
 	}
 
@@ -188,12 +188,11 @@ int StreamEnqueue(stream_queue_t sq, tcp_stream *stream)
 tcp_stream *StreamDequeue(stream_queue_t sq)
 {
 	index_type h = sq->_head;
-	index_type t = sq->_tail;
+	index_type t = __atomic_load_n(&sq->_tail, __ATOMIC_ACQUIRE);
 
 	if (h != t) {
 		tcp_stream *stream = sq->_q[h];
-		StreamMemoryBarrier(sq->_q[h], sq->_head);
-		sq->_head = NextIndex(sq, h);
+		__atomic_store_n(&sq->_head, NextIndex(sq, h), __ATOMIC_RELEASE);
 		assert(stream);
 		return stream;
 	}
@@ -201,3 +200,27 @@ tcp_stream *StreamDequeue(stream_queue_t sq)
 	return NULL;
 }
 /*---------------------------------------------------------------------------*/
+int StreamDequeueBulk(stream_queue_t sq, tcp_stream **streams, int cnt)
+{
+	index_type h = sq->_head;
+	index_type t = __atomic_load_n(&sq->_tail, __ATOMIC_ACQUIRE);
+	int n = 0;
+
+	while (h != t && n < cnt) {
+		streams[n++] = sq->_q[h];
+		h = NextIndex(sq, h);
+	}
+	if (n > 0)
+		__atomic_store_n(&sq->_head, h, __ATOMIC_RELEASE);
+
+	return n;
+}
+/*---------------------------------------------------------------------------*/
+int StreamQueueCount(stream_queue_t sq)
+{
+	index_type h = sq->_head;
+	index_type t = __atomic_load_n(&sq->_tail, __ATOMIC_ACQUIRE);
+
+	return (t >= h) ? t - h : t + sq->_capacity + 1 - h;
+}
+/*---------------------------------------------------------------------------*/
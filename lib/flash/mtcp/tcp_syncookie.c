@@ -0,0 +1,310 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ *
+ * SYN cookies, see tcp_syncookie.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+
+#include "tcp_syncookie.h"
+#include "mtcp.h"
+#include "socket.h"
+#include "tcp_in.h"
+#include "tcp_out.h"
+#include "tcp_stream.h"
+#include "tcp_util.h"
+#include "debug.h"
+
+/*
+ * Cookie layout, i.e. our ISN:
+ *
+ *   31      27 26  24 23                                     0
+ *  +----------+------+----------------------------------------+
+ *  |  count   | mss  |   MAC(4-tuple, peer ISN, count, mss)   |
+ *  +----------+------+----------------------------------------+
+ *
+ * count ticks every COOKIE_PERIOD_SEC; a cookie is accepted for the
+ * period it was issued in and the next one.
+ *
+ * Low bits of our SYN/ACK timestamp, when the peer uses timestamps:
+ *
+ *    5     4     3    0
+ *  +-----+-----+-------+
+ *  |  1  | sack| wscale|     wscale 0xf: the peer sent none
+ *  +-----+-----+-------+
+ */
+#define COOKIE_PERIOD_SEC 64
+#define COOKIE_COUNT_BITS 5
+#define COOKIE_MAX_AGE 1
+#define COOKIE_MAC_MASK 0x00FFFFFF
+
+#define COOKIE_TS_BITS 6
+#define COOKIE_TS_MASK ((1 << COOKIE_TS_BITS) - 1)
+#define COOKIE_TS_VALID 0x20
+#define COOKIE_TS_SACK 0x10
+#define COOKIE_TS_NO_WSCALE 0x0F
+
+#define TCP_MAX_WSCALE 14
+
+/* MSS values a cookie can carry, the peer gets the largest not above its own */
+static const uint16_t cookie_mss[] = { 216, 536, 1200, 1360, 1400, 1440, 1452, 1460 };
+
+static uint64_t g_cookie_key[2];
+/*----------------------------------------------------------------------------*/
+int InitSYNCookies(void)
+{
+	unsigned int seed;
+
+	if (getrandom(g_cookie_key, sizeof(g_cookie_key), 0) == sizeof(g_cookie_key))
+		return 0;
+
+	/* no entropy source: still unique per process, but guessable */
+	TRACE_ERROR("getrandom() failed, SYN cookies use a weak key.\n");
+	seed = (unsigned int)time(NULL) ^ (unsigned int)getpid();
+	g_cookie_key[0] = ((uint64_t)rand_r(&seed) << 32) | (uint32_t)rand_r(&seed);
+	g_cookie_key[1] = ((uint64_t)rand_r(&seed) << 32) | (uint32_t)rand_r(&seed);
+
+	return -1;
+}
+/*----------------------------------------------------------------------------*/
+#define ROTL64(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND                        \
+	do {                            \
+		v0 += v1;               \
+		v1 = ROTL64(v1, 13);    \
+		v1 ^= v0;               \
+		v0 = ROTL64(v0, 32);    \
+		v2 += v3;               \
+		v3 = ROTL64(v3, 16);    \
+		v3 ^= v2;               \
+		v0 += v3;               \
+		v3 = ROTL64(v3, 21);    \
+		v3 ^= v0;               \
+		v2 += v1;               \
+		v1 = ROTL64(v1, 17);    \
+		v1 ^= v2;               \
+		v2 = ROTL64(v2, 32);    \
+	} while (0)
+
+/* SipHash-2-4 of three words */
+static uint64_t CookieHash(uint64_t m0, uint64_t m1, uint64_t m2)
+{
+	uint64_t v0 = g_cookie_key[0] ^ 0x736f6d6570736575ULL;
+	uint64_t v1 = g_cookie_key[1] ^ 0x646f72616e646f6dULL;
+	uint64_t v2 = g_cookie_key[0] ^ 0x6c7967656e657261ULL;
+	uint64_t v3 = g_cookie_key[1] ^ 0x7465646279746573ULL;
+	uint64_t m[4] = { m0, m1, m2, 24ULL << 56 };
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		v3 ^= m[i];
+		SIPROUND;
+		SIPROUND;
+		v0 ^= m[i];
+	}
+
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+/*----------------------------------------------------------------------------*/
+/* saddr/sport are the peer's, daddr/dport ours */
+static inline uint32_t CookieMAC(uint32_t saddr, uint32_t daddr, uint16_t sport, uint16_t dport, uint32_t irs, uint32_t count,
+				 int mss_idx)
+{
+	return (uint32_t)CookieHash(((uint64_t)saddr << 32) | daddr, ((uint64_t)sport << 48) | ((uint64_t)dport << 32) | irs,
+				    ((uint64_t)mss_idx << 32) | count) &
+	       COOKIE_MAC_MASK;
+}
+/*----------------------------------------------------------------------------*/
+static inline uint32_t CookieCount(uint32_t cur_ts)
+{
+	return cur_ts / SEC_TO_TS(COOKIE_PERIOD_SEC);
+}
+/*----------------------------------------------------------------------------*/
+int SYNCookieWanted(struct tcp_listener *listener)
+{
+	switch (CONFIG.tcp_syncookies) {
+	case SYNCOOKIES_ALWAYS:
+		return TRUE;
+	case SYNCOOKIES_ON_OVERFLOW:
+		return listener->syn_backlog >= listener->backlog;
+	default:
+		return FALSE;
+	}
+}
+/*----------------------------------------------------------------------------*/
+/* the options of the peer's SYN a cookie keeps */
+struct syn_opts {
+	uint16_t mss;
+	uint8_t wscale;
+	uint8_t sack;
+	uint8_t has_ts;
+	uint32_t ts_val;
+};
+
+static void ParseSYNOptions(const struct tcphdr *tcph, struct syn_opts *so)
+{
+	const uint8_t *tcpopt = (const uint8_t *)tcph + TCP_HEADER_LEN;
+	int len = (tcph->doff << 2) - TCP_HEADER_LEN;
+	int i, opt, optlen;
+
+	memset(so, 0, sizeof(*so));
+	so->mss = 536; /* RFC 1122 default */
+	so->wscale = COOKIE_TS_NO_WSCALE;
+
+	for (i = 0; i < len;) {
+		opt = tcpopt[i++];
+		if (opt == TCP_OPT_END)
+			break;
+		if (opt == TCP_OPT_NOP)
+			continue;
+		if (i >= len)
+			break;
+		optlen = tcpopt[i++];
+		if (optlen < 2 || i + optlen - 2 > len)
+			break;
+
+		if (opt == TCP_OPT_MSS && optlen == TCP_OPT_MSS_LEN) {
+			so->mss = (tcpopt[i] << 8) | tcpopt[i + 1];
+		} else if (opt == TCP_OPT_WSCALE && optlen == TCP_OPT_WSCALE_LEN) {
+			so->wscale = MIN(tcpopt[i], TCP_MAX_WSCALE);
+		} else if (opt == TCP_OPT_SACK_PERMIT && optlen == TCP_OPT_SACK_PERMIT_LEN) {
+			so->sack = TRUE;
+		} else if (opt == TCP_OPT_TIMESTAMP && optlen == TCP_OPT_TIMESTAMP_LEN) {
+			so->has_ts = TRUE;
+			so->ts_val = ntohl(*(const uint32_t *)(tcpopt + i));
+		}
+		i += optlen - 2;
+	}
+}
+/*----------------------------------------------------------------------------*/
+int SendSYNCookie(mtcp_manager_t mtcp, uint32_t cur_ts, const struct iphdr *iph, const struct tcphdr *tcph)
+{
+	struct syn_opts so;
+	uint32_t irs = ntohl(tcph->seq);
+	uint32_t count = CookieCount(cur_ts);
+	uint32_t cookie, ts_val = cur_ts;
+	int ext_opts = FALSE;
+	int mss_idx;
+	int ret;
+
+	ParseSYNOptions(tcph, &so);
+
+	for (mss_idx = (int)(sizeof(cookie_mss) / sizeof(cookie_mss[0])) - 1; mss_idx > 0; mss_idx--) {
+		if (cookie_mss[mss_idx] <= so.mss)
+			break;
+	}
+
+	cookie = ((count & ((1 << COOKIE_COUNT_BITS) - 1)) << 27) | (mss_idx << 24) |
+		 CookieMAC(iph->saddr, iph->daddr, tcph->source, tcph->dest, irs, count, mss_idx);
+
+#if TCP_OPT_TIMESTAMP_ENABLED
+	/* wscale and SACK are only remembered through the echoed timestamp,
+	   so like Linux offer none of them to a peer without timestamps */
+	ext_opts = so.has_ts;
+	if (so.has_ts) {
+		/* never ahead of the timestamps the stream sends later */
+		ts_val = (cur_ts & ~COOKIE_TS_MASK) | COOKIE_TS_VALID | (so.sack ? COOKIE_TS_SACK : 0) | so.wscale;
+		if (TCP_SEQ_GT(ts_val, cur_ts))
+			ts_val -= 1 << COOKIE_TS_BITS;
+	}
+#endif
+
+	ret = SendTCPSynAckStandalone(mtcp, iph->daddr, tcph->dest, iph->saddr, tcph->source, cookie, irs + 1, TCP_DEFAULT_MSS, ext_opts,
+				      ts_val, so.ts_val);
+#ifdef NETSTAT
+	if (ret > 0)
+		mtcp->nstat.tx_syncookies++;
+#endif
+
+	return ret;
+}
+/*----------------------------------------------------------------------------*/
+static inline int ParseTimestampOption(const struct tcphdr *tcph, uint32_t *ts_val, uint32_t *ts_ecr)
+{
+	struct tcp_timestamp ts;
+
+	if (!ParseTCPTimestamp(NULL, &ts, (uint8_t *)(uintptr_t)tcph + TCP_HEADER_LEN, (tcph->doff << 2) - TCP_HEADER_LEN))
+		return FALSE;
+
+	*ts_val = ts.ts_val;
+	*ts_ecr = ts.ts_ref;
+	return TRUE;
+}
+/*----------------------------------------------------------------------------*/
+tcp_stream *CheckSYNCookie(mtcp_manager_t mtcp, uint32_t cur_ts, const struct iphdr *iph, const struct tcphdr *tcph)
+{
+	tcp_stream *cur_stream;
+	uint32_t cookie = ntohl(tcph->ack_seq) - 1;
+	uint32_t irs = ntohl(tcph->seq) - 1;
+	uint32_t count = CookieCount(cur_ts);
+	uint32_t age, ts_val, ts_ecr;
+	uint8_t opts = 0;
+	int mss_idx;
+
+	age = (count - (cookie >> 27)) & ((1 << COOKIE_COUNT_BITS) - 1);
+	if (age > COOKIE_MAX_AGE)
+		return NULL;
+	count -= age;
+	mss_idx = (cookie >> 24) & 0x7;
+
+	if ((cookie & COOKIE_MAC_MASK) != CookieMAC(iph->saddr, iph->daddr, tcph->source, tcph->dest, irs, count, mss_idx))
+		return NULL;
+
+	cur_stream = CreateTCPStream(mtcp, NULL, MTCP_SOCK_STREAM, iph->daddr, tcph->dest, iph->saddr, tcph->source);
+	if (!cur_stream) {
+		TRACE_ERROR("INFO: Could not allocate tcp_stream!\n");
+		return NULL;
+	}
+
+	/* as if the SYN/ACK had been sent from this stream */
+	cur_stream->rcvvar->irs = irs;
+	cur_stream->rcv_nxt = irs + 1;
+	cur_stream->sndvar->iss = cookie;
+	cur_stream->sndvar->snd_una = cookie;
+	cur_stream->snd_nxt = cookie + 1;
+	cur_stream->sndvar->cwnd = 1;
+
+	cur_stream->sndvar->mss = cookie_mss[mss_idx];
+	cur_stream->sndvar->eff_mss = cur_stream->sndvar->mss;
+#if TCP_OPT_TIMESTAMP_ENABLED
+	if (ParseTimestampOption(tcph, &ts_val, &ts_ecr)) {
+		cur_stream->saw_timestamp = TRUE;
+		cur_stream->rcvvar->ts_recent = ts_val;
+		cur_stream->rcvvar->ts_last_ts_upd = cur_ts;
+		cur_stream->sndvar->eff_mss -= (TCP_OPT_TIMESTAMP_LEN + 2);
+		opts = ts_ecr & COOKIE_TS_MASK;
+	}
+#else
+	UNUSED(ts_val);
+	UNUSED(ts_ecr);
+#endif
+	/* without an echoed timestamp neither window scaling nor SACK is on,
+	   and scaling is only on when both sides sent a wscale */
+	cur_stream->sndvar->wscale_mine = 0;
+	if (opts & COOKIE_TS_VALID) {
+		cur_stream->sack_permit = !!(opts & COOKIE_TS_SACK);
+		if ((opts & COOKIE_TS_NO_WSCALE) != COOKIE_TS_NO_WSCALE) {
+			cur_stream->sndvar->wscale_peer = opts & COOKIE_TS_NO_WSCALE;
+			cur_stream->sndvar->wscale_mine = TCP_DEFAULT_WSCALE;
+		}
+	}
+
+	cur_stream->state = TCP_ST_SYN_RCVD;
+	TRACE_STATE("Stream %d: TCP_ST_SYN_RCVD (SYN cookie)\n", cur_stream->id);
+#ifdef NETSTAT
+	mtcp->nstat.rx_syncookies++;
+#endif
+
+	return cur_stream;
+}
+/*----------------------------------------------------------------------------*/
@@ -121,91 +121,70 @@ inline int ParseTCPTimestamp(tcp_stream *cur_stream, struct tcp_timestamp *ts, u
 /*----------------------------------------------------------------------------*/
 int SeqIsSacked(tcp_stream *cur_stream, uint32_t seq)
 {
-	uint8_t i;
-	uint32_t left, right;
-	for (i = 0; i < MAX_SACK_ENTRY; i++) {
-		left = cur_stream->rcvvar->sack_table[i].left_edge;
-		right = cur_stream->rcvvar->sack_table[i].right_edge;
-		if (seq >= left && seq < right) {
-			//fprintf(stderr, "Found seq=%u in (%u,%u)\n", seq - cur_stream->sndvar->iss, left - cur_stream->sndvar->iss, right - cur_stream->sndvar->iss);
-			return TRUE;
-		}
-	}
-	return FALSE;
+	struct tcp_recv_vars *rcvvar = cur_stream->rcvvar;
+
+	return SeqIntervalFind(rcvvar->sack_table, rcvvar->sacks, rcvvar->sack_base, seq) >= 0;
 }
 /*----------------------------------------------------------------------------*/
-static void _update_sack_table(tcp_stream *cur_stream, uint32_t left_edge, uint32_t right_edge)
+/* first SACKed range holding seq or starting after it, FALSE if none */
+int NextSACKedRange(tcp_stream *cur_stream, uint32_t seq, struct seq_interval *range)
 {
-	uint8_t i, j;
-	uint32_t newly_sacked = 0;
-	long int ld, rd, lrd, rld;
-	for (i = 0; i < MAX_SACK_ENTRY; i++) {
-		ld = (long int)left_edge - cur_stream->rcvvar->sack_table[i].left_edge;
-		rd = (long int)right_edge - cur_stream->rcvvar->sack_table[i].right_edge;
-		// if block already in table, don't need to do anything
-		if (ld == 0 && rd == 0) {
-			return;
-		}
-
-		lrd = (long int)left_edge - cur_stream->rcvvar->sack_table[i].right_edge;
-		rld = (long int)right_edge - cur_stream->rcvvar->sack_table[i].left_edge;
+	struct tcp_recv_vars *rcvvar = cur_stream->rcvvar;
+	int i;
 
-		// if block does not overlap i at all, skip
-		if (lrd > 0 || rld < 0) {
-			continue;
-		}
+	i = SeqIntervalLowerBound(rcvvar->sack_table, rcvvar->sacks, rcvvar->sack_base, seq + 1);
+	if (i >= rcvvar->sacks)
+		return FALSE;
 
-		// left_edge is further left than i.left_edge
-		if (ld < 0) {
-			newly_sacked += (-ld);
-			// expand i to account for this extra space, and merge with any
-			// blocks whose right_edge = i.left (i.e. blocks are touching)
-			cur_stream->rcvvar->sack_table[i].left_edge = left_edge;
-			for (j = 0; j < MAX_SACK_ENTRY; j++) {
-				if (cur_stream->rcvvar->sack_table[j].right_edge == left_edge) {
-					cur_stream->rcvvar->sack_table[i].left_edge = cur_stream->rcvvar->sack_table[j].right_edge;
-					cur_stream->rcvvar->sack_table[j].left_edge = 0;
-					cur_stream->rcvvar->sack_table[j].right_edge = 0;
-					break;
-				}
-			}
-		}
-		// right edge is further right than i.right_edge
-		if (rd > 0) {
-			newly_sacked += rd;
-			// expand i to account for this extra space, and merge with any
-			// blocks whose left_edge = i.right (i.e. blocks are touching)
-			cur_stream->rcvvar->sack_table[i].right_edge = right_edge;
-			for (j = 0; j < MAX_SACK_ENTRY; j++) {
-				if (cur_stream->rcvvar->sack_table[j].left_edge == right_edge) {
-					cur_stream->rcvvar->sack_table[i].right_edge = cur_stream->rcvvar->sack_table[j].left_edge;
-					cur_stream->rcvvar->sack_table[j].left_edge = 0;
-					cur_stream->rcvvar->sack_table[j].right_edge = 0;
-					break;
-				}
-			}
-		}
-	}
-	if (newly_sacked == 0) {
-		cur_stream->rcvvar->sack_table[cur_stream->rcvvar->sacks].left_edge = left_edge;
-		cur_stream->rcvvar->sack_table[cur_stream->rcvvar->sacks].right_edge = right_edge;
-		cur_stream->rcvvar->sacks++;
-		newly_sacked = (right_edge - left_edge);
+	*range = rcvvar->sack_table[i];
+	return TRUE;
+}
+/*----------------------------------------------------------------------------*/
+static void _update_sack_table(tcp_stream *cur_stream, uint32_t left_edge, uint32_t right_edge)
+{
+	struct tcp_recv_vars *rcvvar = cur_stream->rcvvar;
+	uint32_t snd_una = cur_stream->sndvar->snd_una;
+	uint32_t newly_sacked;
+
+	/* whatever is below snd_una got cumulatively acked meanwhile */
+	if (rcvvar->sack_base != snd_una) {
+		SeqIntervalTrim(rcvvar->sack_table, &rcvvar->sacks, snd_una, rcvvar->sack_base);
+		rcvvar->sack_base = snd_una;
 	}
 
-	//fprintf(stderr, "SACK (%u,%u)->%u/%u\n", left_edge, right_edge, newly_sacked, newly_sacked / 1448);
-	cur_stream->rcvvar->sacked_pkts += (newly_sacked / cur_stream->sndvar->mss);
+	/* D-SACK or a stale block */
+	if (TCP_SEQ_LEQ(right_edge, snd_una))
+		return;
+	if (TCP_SEQ_LT(left_edge, snd_una))
+		left_edge = snd_una;
+
+	if (SeqIntervalInsert(rcvvar->sack_table, &rcvvar->sacks, MAX_SACK_ENTRY, snd_una, left_edge, right_edge, &newly_sacked) < 0)
+		return;
 
-	return;
+	//fprintf(stderr, "SACK (%u,%u)->%u/%u\n", left_edge, right_edge, newly_sacked, newly_sacked / 1448);
+	rcvvar->sacked_pkts += (newly_sacked / cur_stream->sndvar->mss);
 }
 /*----------------------------------------------------------------------------*/
-// static int GenerateSACKOption(tcp_stream *cur_stream, uint8_t *tcpopt)
-// {
-// 	(void)cur_stream;
-// 	(void)tcpopt;
-// 	// TODO
-// 	return 0;
-// }
+int GenerateSACKOption(const struct seq_interval *blocks, int nblocks, uint8_t *tcpopt)
+{
+	uint32_t edge;
+	int i = 0, j;
+
+	tcpopt[i++] = TCP_OPT_NOP;
+	tcpopt[i++] = TCP_OPT_NOP;
+	tcpopt[i++] = TCP_OPT_SACK;
+	tcpopt[i++] = 2 + nblocks * TCP_OPT_SACK_BLOCK_LEN;
+
+	for (j = 0; j < nblocks; j++) {
+		edge = htonl(blocks[j].left_edge);
+		memcpy(tcpopt + i, &edge, sizeof(edge));
+		edge = htonl(blocks[j].right_edge);
+		memcpy(tcpopt + i + 4, &edge, sizeof(edge));
+		i += TCP_OPT_SACK_BLOCK_LEN;
+	}
+
+	return i;
+}
 /*----------------------------------------------------------------------------*/
 void ParseSACKOption(tcp_stream *cur_stream, uint32_t ack_seq, uint8_t *tcpopt, int len)
 {
@@ -296,6 +275,73 @@ uint16_t TCPCalcChecksum(uint16_t *buf, uint16_t len, uint32_t saddr, uint32_t d
 	return (uint16_t)sum;
 }
 /*---------------------------------------------------------------------------*/
+/* Copy len bytes and return their one's complement sum (folded, not
+ * complemented) so the payload is read only once on the send path.
+ * 8-byte words are summed as two 32-bit halves into a 64-bit accumulator,
+ * which is equivalent to summing the 16-bit words and keeps the loop free
+ * of carry handling. dst must start at an even offset of the segment. */
+uint32_t TCPCopyAndSum(uint8_t *dst, const uint8_t *src, uint16_t len)
+{
+	uint64_t sum = 0, w;
+	uint32_t w32;
+	uint16_t w16 = 0;
+
+	while (len >= 8) {
+		memcpy(&w, src, 8);
+		memcpy(dst, &w, 8);
+		sum += (w & 0xFFFFFFFF) + (w >> 32);
+		src += 8;
+		dst += 8;
+		len -= 8;
+	}
+	if (len >= 4) {
+		memcpy(&w32, src, 4);
+		memcpy(dst, &w32, 4);
+		sum += w32;
+		src += 4;
+		dst += 4;
+		len -= 4;
+	}
+	if (len >= 2) {
+		memcpy(&w16, src, 2);
+		memcpy(dst, &w16, 2);
+		sum += w16;
+		src += 2;
+		dst += 2;
+		len -= 2;
+	}
+	if (len) {
+		/* pad the odd byte as TCPCalcChecksum() does */
+		w16 = 0;
+		*dst = *src;
+		memcpy(&w16, src, 1);
+		sum += w16;
+	}
+
+	sum = (sum >> 32) + (sum & 0xFFFFFFFF);
+	sum = (sum >> 32) + (sum & 0xFFFFFFFF);
+	sum = (sum >> 16) + (sum & 0xFFFF);
+	sum = (sum >> 16) + (sum & 0xFFFF);
+
+	return (uint32_t)sum;
+}
+/*---------------------------------------------------------------------------*/
+/* checksum of a segment whose payload sum came from TCPCopyAndSum();
+ * pseudo_sum is the cached tcp_hdr_template.pseudo_sum */
+uint16_t TCPCalcChecksumPartial(uint16_t *hdr, uint16_t hdrlen, uint16_t seglen, uint32_t pseudo_sum, uint32_t payload_sum)
+{
+	uint32_t sum = pseudo_sum + payload_sum + htons(seglen);
+	int i;
+
+	for (i = 0; i < hdrlen / 2; i++)
+		sum += hdr[i];
+
+	sum = (sum >> 16) + (sum & 0xFFFF);
+	sum += (sum >> 16);
+
+	return (uint16_t)~sum;
+}
+/*---------------------------------------------------------------------------*/
 void PrintTCPOptions(uint8_t *tcpopt, int len)
 {
 	int i;
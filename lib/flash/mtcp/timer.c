@@ -32,6 +32,7 @@
 #include "timer.h"
 #include "tcp_in.h"
 #include "tcp_out.h"
+#include "tcp_cc.h"
 #include "stat.h"
 #include "debug.h"
 #if USE_CCP
@@ -261,11 +262,7 @@ static int HandleRTO(mtcp_manager_t mtcp, uint32_t cur_ts, tcp_stream *cur_strea
 	//cur_stream->sndvar->ts_rto = cur_ts + cur_stream->sndvar->rto;
 
 	/* reduce congestion window and ssthresh */
-	cur_stream->sndvar->ssthresh = MIN(cur_stream->sndvar->cwnd, cur_stream->sndvar->peer_wnd) / 2;
-	if (cur_stream->sndvar->ssthresh < (2 * cur_stream->sndvar->mss)) {
-		cur_stream->sndvar->ssthresh = cur_stream->sndvar->mss * 2;
-	}
-	cur_stream->sndvar->cwnd = cur_stream->sndvar->mss;
+	cur_stream->sndvar->cc_ops->on_timer(cur_stream, mtcp->cur_tsc);
 	TRACE_CONG("Stream %d Timeout. cwnd: %u, ssthresh: %u\n", cur_stream->id, cur_stream->sndvar->cwnd,
 		   cur_stream->sndvar->ssthresh);
 
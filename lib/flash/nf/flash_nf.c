@@ -4,17 +4,22 @@
 
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <stdlib.h>
 #include <fcntl.h>
 
 #include <flash_uds.h>
 #include <flash_common.h>
 #include <flash_pool.h>
+#include <flash_telemetry.h>
 #include <log.h>
 
 #include "flash_nf.h"
 
-static int set_nonblocking(int sockfd)
+/* time for the datapath threads to see done and leave the rings alone */
+#define FLASH__HANDOVER_GRACE_US 10000
+
+static int set_nonblocking(int sockfd, bool on)
 {
 	int flags = fcntl(sockfd, F_GETFL, 0);
 	if (flags == -1) {
@@ -22,7 +27,10 @@ static int set_nonblocking(int sockfd)
 		return -1;
 	}
 
-	flags |= O_NONBLOCK; // Add the O_NONBLOCK flag
+	if (on)
+		flags |= O_NONBLOCK; // Add the O_NONBLOCK flag
+	else
+		flags &= ~O_NONBLOCK;
 	if (fcntl(sockfd, F_SETFL, flags) == -1) {
 		log_error("fcntl F_SETFL");
 		return -1;
@@ -31,33 +39,6 @@ static int set_nonblocking(int sockfd)
 	return 0;
 }
 
-void flash__wait(struct config *cfg)
-{
-	int cmd;
-
-	if (set_nonblocking(cfg->uds_sockfd) < 0)
-		log_warn("Failed to set UDS socket to non-blocking mode");
-
-	while (!*cfg->done) {
-		int bytes_received = read(cfg->uds_sockfd, &cmd, sizeof(int));
-		if (bytes_received < 0) {
-			if (errno == EAGAIN || errno == EWOULDBLOCK) {
-				usleep(500000);
-			} else {
-				log_error("recv failed");
-				break;
-			}
-		} else if (bytes_received == 0) {
-			log_info("Server closed the connection");
-			*cfg->done = true;
-			break;
-		} else {
-			log_info("Received signal from server");
-			*cfg->done = true;
-		}
-	}
-}
-
 static void close_uds_conn(struct config *cfg)
 {
 	flash__send_cmd(cfg->uds_sockfd, FLASH__CLOSE_CONN);
@@ -65,206 +46,330 @@ static void close_uds_conn(struct config *cfg)
 	return;
 }
 
-static int __configure(struct config *cfg, struct nf *nf, int **received_fd)
+static int boot_int(struct flash_tlv *tlv, int *val)
 {
-	int uds_sockfd, i;
-	struct nf_data data;
+	if (tlv->len != sizeof(int))
+		return -1;
+	memcpy(val, tlv->val, sizeof(int));
+	return 0;
+}
 
-	uds_sockfd = flash__start_uds_client();
-	if (uds_sockfd < 0) {
-		log_error("Failed to start UDS client");
+static int boot_u64(struct flash_tlv *tlv, uint64_t *val)
+{
+	if (tlv->len != sizeof(uint64_t))
 		return -1;
-	}
+	memcpy(val, tlv->val, sizeof(uint64_t));
+	return 0;
+}
 
-	cfg->uds_sockfd = uds_sockfd;
+static int *boot_int_array(struct flash_tlv *tlv, int *count, int capacity)
+{
+	int *arr;
+
+	*count = tlv->len / sizeof(int);
+	if (capacity < *count)
+		capacity = *count;
+	arr = (int *)calloc(capacity ? capacity : 1, sizeof(int));
+	if (arr)
+		memcpy(arr, tlv->val, *count * sizeof(int));
+	return arr;
+}
 
-	data.nf_id = cfg->nf_id;
-	data.umem_id = cfg->umem_id;
+static int boot_apply(struct config *cfg, struct nf *nf, struct flash_msg_hdr *hdr)
+{
+	struct flash_tlv *tlv = NULL;
+	int n = 0, ret = 0;
 
-	if (flash__send_cmd(uds_sockfd, FLASH__GET_UMEM) < 0) {
-		log_error("Failed to send command to get UMEM");
-		goto close_uds;
+	while ((tlv = flash__msg_next(hdr, tlv)) && ret == 0) {
+		switch (tlv->type) {
+		case FLASH__BOOT_TOTAL_SOCKETS:
+			ret = boot_int(tlv, &cfg->total_sockets);
+			break;
+		case FLASH__BOOT_UMEM_SIZE:
+			ret = boot_u64(tlv, &cfg->umem->size);
+			break;
+		case FLASH__BOOT_UMEM_SCALE:
+			ret = boot_int(tlv, &cfg->umem_scale);
+			break;
+		case FLASH__BOOT_UMEM_OFFSET:
+			ret = boot_int(tlv, &cfg->umem_offset);
+			break;
+		case FLASH__BOOT_IFQUEUE:
+			free(cfg->ifqueue);
+			cfg->ifqueue = boot_int_array(tlv, &n, 0);
+			ret = cfg->ifqueue ? 0 : -1;
+			break;
+		case FLASH__BOOT_NEXT_SIZE:
+			ret = boot_int(tlv, &nf->next_size);
+			if (!ret && (nf->next_size < 0 || nf->next_size > FLASH_MAX_EDGES))
+				ret = -1;
+			cfg->next_size = nf->next_size;
+			break;
+		case FLASH__BOOT_BIND_FLAGS:
+			ret = boot_int(tlv, (int *)&cfg->xsk->bind_flags);
+			break;
+		case FLASH__BOOT_XDP_FLAGS:
+			ret = boot_int(tlv, (int *)&cfg->xsk->xdp_flags);
+			break;
+		case FLASH__BOOT_MODE:
+			ret = boot_int(tlv, (int *)&cfg->xsk->mode);
+			break;
+		case FLASH__BOOT_POLL_TIMEOUT:
+			ret = boot_int(tlv, &cfg->xsk->poll_timeout);
+			break;
+		case FLASH__BOOT_FRAGS_ENABLED:
+			cfg->frags_enabled = tlv->len && tlv->val[0];
+			break;
+		case FLASH__BOOT_IFNAME:
+			n = tlv->len < IF_NAMESIZE ? tlv->len : IF_NAMESIZE - 1;
+			memcpy(cfg->ifname, tlv->val, n);
+			cfg->ifname[n] = '\0';
+			break;
+		case FLASH__BOOT_POLLOUT_SIZE:
+			ret = boot_int(tlv, &cfg->nf_pollout_status_size);
+			break;
+		case FLASH__BOOT_PREV_NF:
+			free(cfg->prev);
+			/* room for route updates, see __route_update() */
+			cfg->prev = boot_int_array(tlv, &cfg->prev_size, FLASH_MAX_NF);
+			ret = cfg->prev ? 0 : -1;
+			break;
+		case FLASH__BOOT_TAKEOVER:
+			ret = boot_int(tlv, &n);
+			cfg->takeover = n;
+			break;
+		case FLASH__BOOT_ACTIVE_SOCKETS:
+			ret = boot_int(tlv, &cfg->active_sockets);
+			break;
+		default:
+			log_debug("Skipping unknown bootstrap TLV %d", tlv->type);
+			break;
+		}
 	}
 
-	if (flash__send_data(uds_sockfd, &data, sizeof(struct nf_data)) < 0) {
-		log_error("Failed to send NF data to UDS server");
-		goto close_uds;
-	}
+	return ret;
+}
 
-	if (flash__recv_fd(uds_sockfd, &cfg->umem_fd) < 0) {
-		log_error("Failed to receive UMEM FD from UDS server");
-		goto close_uds;
+/*
+ * New edges from the monitor. The datapath threads read next_size and the
+ * prev list without locks, so the prev array is updated in place (it is
+ * sized for FLASH_MAX_NF) and only ever holds valid NF IDs; each thread
+ * resets its per-edge budget when it sees the new route_gen.
+ */
+static void __route_update(struct config *cfg)
+{
+	union {
+		struct flash_msg_hdr hdr;
+		uint8_t buf[FLASH__MSG_MAX_LEN];
+	} msg;
+	struct flash_tlv *tlv = NULL, *prev = NULL;
+	int next_size = cfg->next_size, prev_size, ret;
+
+	/* the message follows the command, wait for all of it */
+	set_nonblocking(cfg->uds_sockfd, false);
+	ret = flash__recv_msg(cfg->uds_sockfd, &msg.hdr, sizeof(msg), NULL, 0);
+	set_nonblocking(cfg->uds_sockfd, true);
+	if (ret < 0) {
+		log_error("Failed to receive route update");
+		return;
 	}
 
-	log_debug("RECEIVED EXISTING UMEM FD");
-
-	if (flash__recv_data(uds_sockfd, &cfg->total_sockets, sizeof(int)) < 0) {
-		log_error("Failed to receive total sockets from UDS server");
-		goto close_uds;
+	while ((tlv = flash__msg_next(&msg.hdr, tlv))) {
+		if (tlv->type == FLASH__BOOT_NEXT_SIZE)
+			boot_int(tlv, &next_size);
+		else if (tlv->type == FLASH__BOOT_PREV_NF)
+			prev = tlv;
 	}
-
-	log_debug("TOTAL SOCKETS: %d", cfg->total_sockets);
-
-	if (flash__recv_data(uds_sockfd, &cfg->umem->size, sizeof(int)) < 0) {
-		log_error("Failed to receive UMEM size from UDS server");
-		goto close_uds;
+	prev_size = prev ? (int)(prev->len / sizeof(int)) : cfg->prev_size;
+	if (next_size < 0 || next_size > FLASH_MAX_EDGES || prev_size > FLASH_MAX_NF || !cfg->prev) {
+		log_error("Malformed route update");
+		return;
 	}
 
-	log_debug("UMEM SIZE: %d", cfg->umem->size);
-
-	if (flash__recv_data(uds_sockfd, &cfg->umem_scale, sizeof(int)) < 0) {
-		log_error("Failed to receive UMEM scale from UDS server");
-		goto close_uds;
+	if (prev) {
+		/* shrink before and grow after the copy */
+		if (prev_size < cfg->prev_size)
+			__atomic_store_n(&cfg->prev_size, prev_size, __ATOMIC_RELEASE);
+		memcpy(cfg->prev, prev->val, prev_size * sizeof(int));
+		__atomic_store_n(&cfg->prev_size, prev_size, __ATOMIC_RELEASE);
 	}
 
-	log_debug("UMEM SCALE: %d", cfg->umem_scale);
+	__atomic_store_n(&cfg->next_size, next_size, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&cfg->route_gen, 1, __ATOMIC_RELEASE);
+	log_info("Route update: %d next, %d previous NFs", next_size, cfg->prev_size);
+}
 
-	if (flash__send_cmd(uds_sockfd, FLASH__GET_UMEM_OFFSET) < 0) {
-		log_error("Failed to send command to get UMEM offset");
-		goto close_uds;
-	}
+/* The autoscaler moved the NIC's traffic to the first n sockets. */
+static void __scale_update(struct config *cfg)
+{
+	int n, ret;
 
-	if (flash__recv_data(uds_sockfd, &cfg->umem_offset, sizeof(int)) < 0) {
-		log_error("Failed to receive UMEM offset from UDS server");
-		goto close_uds;
+	set_nonblocking(cfg->uds_sockfd, false);
+	ret = flash__recv_data(cfg->uds_sockfd, &n, sizeof(int));
+	set_nonblocking(cfg->uds_sockfd, true);
+	if (ret != sizeof(int) || n < 1 || n > cfg->total_sockets) {
+		log_error("Malformed scale update");
+		return;
 	}
 
-	log_debug("RECEIVED umem_offset: %d", cfg->umem_offset);
+	__atomic_store_n(&cfg->active_sockets, n, __ATOMIC_RELEASE);
+	log_info("Scale update: traffic on %d of %d sockets", n, cfg->total_sockets);
+}
 
-	*received_fd = (int *)calloc(cfg->total_sockets, sizeof(int));
-	cfg->ifqueue = (int *)calloc(cfg->total_sockets, sizeof(int));
-	for (i = 0; i < cfg->total_sockets; i++) {
-		if (flash__send_cmd(uds_sockfd, FLASH__CREATE_SOCKET) < 0) {
-			log_error("Failed to send command to create socket");
-			goto clean_rcv_fd;
-		}
-		if (flash__recv_fd(uds_sockfd, &(*received_fd)[i]) < 0) {
-			log_error("Failed to receive socket FD from UDS server");
-			goto clean_rcv_fd;
-		}
+/*
+ * Handle one command from the monitor, if it sent one.
+ *
+ * @return 1 if a command was handled, 0 if there was none, -1 once the NF
+ *         is to stop.
+ */
+static int __wait_cmd(struct config *cfg)
+{
+	int cmd;
+	int bytes_received = read(cfg->uds_sockfd, &cmd, sizeof(int));
 
-		if (flash__recv_data(uds_sockfd, &cfg->ifqueue[i], sizeof(int)) < 0) {
-			log_error("Failed to receive ifqueue for socket %d", i);
-			goto clean_rcv_fd;
-		}
-		log_debug("RECEIVED SOCKET-%d FD-%d, bound to Queue-%d", i, (*received_fd)[i], cfg->ifqueue[i]);
-	}
+	if (bytes_received < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+		log_error("recv failed");
+		return -1;
+	} else if (bytes_received == 0) {
+		log_info("Server closed the connection");
+		*cfg->done = true;
+		return -1;
+	} else if (cmd == FLASH__ROUTE_UPDATE) {
+		__route_update(cfg);
+	} else if (cmd == FLASH__SCALE) {
+		__scale_update(cfg);
+	} else if (cmd == FLASH__HANDOVER) {
+		log_info("Handing over to a new instance");
+		*cfg->done = true;
+		usleep(FLASH__HANDOVER_GRACE_US);
+	} else {
+		log_info("Received signal from server");
+		*cfg->done = true;
+	}
+	return 1;
+}
 
-	if (flash__send_cmd(uds_sockfd, FLASH__GET_ROUTE_INFO) < 0) {
-		log_error("Failed to send command to get route info");
-		goto clean_rcv_fd;
-	}
+void flash__wait(struct config *cfg)
+{
+	flash__wait_all(&cfg, 1);
+}
 
-	if (flash__recv_data(uds_sockfd, &nf->next_size, sizeof(int)) < 0) {
-		log_error("Failed to receive route size from UDS server");
-		goto clean_rcv_fd;
+void flash__wait_all(struct config **cfgs, int n)
+{
+	int ret, handled;
+
+	for (int i = 0; i < n; i++) {
+		if (set_nonblocking(cfgs[i]->uds_sockfd, true) < 0)
+			log_warn("Failed to set UDS socket to non-blocking mode");
+	}
+
+	for (;;) {
+		handled = 0;
+		for (int i = 0; i < n; i++) {
+			if (*cfgs[i]->done)
+				return;
+			ret = __wait_cmd(cfgs[i]);
+			if (ret < 0)
+				return;
+			handled += ret;
+		}
+		if (!handled)
+			usleep(500000);
 	}
-	log_debug("ROUTE SIZE: %d", nf->next_size);
-	cfg->next_size = nf->next_size;
+}
 
-	if (flash__send_cmd(uds_sockfd, FLASH__GET_BIND_FLAGS) < 0) {
-		log_error("Failed to send command to get bind flags");
-		goto clean_rcv_fd;
-	}
-	if (flash__recv_data(uds_sockfd, &cfg->xsk->bind_flags, sizeof(uint32_t)) < 0) {
-		log_error("Failed to receive bind flags from UDS server");
-		goto clean_rcv_fd;
+static int __configure(struct config *cfg, struct nf *nf, int **received_fd)
+{
+	union {
+		struct flash_msg_hdr hdr;
+		uint8_t buf[FLASH__MSG_MAX_LEN];
+	} msg;
+	int fds[FLASH__MSG_MAX_FDS];
+	int uds_sockfd, i, takeover = cfg->takeover;
+
+	uds_sockfd = flash__start_uds_client();
+	if (uds_sockfd < 0) {
+		log_error("Failed to start UDS client");
+		return -1;
 	}
 
-	log_debug("BIND_FLAGS: %d", cfg->xsk->bind_flags);
+	cfg->uds_sockfd = uds_sockfd;
+	cfg->prev_size = 0;
+	cfg->ifqueue = NULL;
+	cfg->prev = NULL;
+
+	/* one request, one reply: the whole setup and every fd in one batch */
+	flash__msg_init(&msg.hdr, 0);
+	if (flash__msg_put(&msg.hdr, sizeof(msg), FLASH__BOOT_UMEM_ID, &cfg->umem_id, sizeof(int)) < 0 ||
+	    flash__msg_put(&msg.hdr, sizeof(msg), FLASH__BOOT_NF_ID, &cfg->nf_id, sizeof(int)) < 0 ||
+	    flash__msg_put(&msg.hdr, sizeof(msg), FLASH__BOOT_TAKEOVER, &takeover, sizeof(int)) < 0)
+		goto close_uds;
 
-	if (flash__send_cmd(uds_sockfd, FLASH__GET_XDP_FLAGS) < 0) {
-		log_error("Failed to send command to get XDP flags");
-		goto clean_rcv_fd;
-	}
-	if (flash__recv_data(uds_sockfd, &cfg->xsk->xdp_flags, sizeof(uint32_t)) < 0) {
-		log_error("Failed to receive XDP flags from UDS server");
-		goto clean_rcv_fd;
+	if (flash__send_cmd(uds_sockfd, FLASH__BOOTSTRAP) < 0 || flash__send_msg(uds_sockfd, &msg.hdr, NULL) < 0) {
+		log_error("Failed to send bootstrap request");
+		goto close_uds;
 	}
-	log_debug("XDP_FLAGS: %d", cfg->xsk->xdp_flags);
 
-	if (flash__send_cmd(uds_sockfd, FLASH__GET_MODE) < 0) {
-		log_error("Failed to send command to get mode");
-		goto clean_rcv_fd;
-	}
-	if (flash__recv_data(uds_sockfd, &cfg->xsk->mode, sizeof(uint32_t)) < 0) {
-		log_error("Failed to receive mode from UDS server");
-		goto clean_rcv_fd;
+	if (flash__recv_msg(uds_sockfd, &msg.hdr, sizeof(msg), fds, FLASH__MSG_MAX_FDS) < 0) {
+		log_error("Failed to receive bootstrap reply from UDS server");
+		goto close_uds;
 	}
-	log_debug("MODE: %d", cfg->xsk->mode);
 
-	if (cfg->xsk->mode & FLASH__POLL) {
-		if (flash__send_cmd(uds_sockfd, FLASH__GET_POLL_TIMEOUT) < 0) {
-			log_error("Failed to send command to get poll timeout");
-			goto clean_rcv_fd;
-		}
-		if (flash__recv_data(uds_sockfd, &cfg->xsk->poll_timeout, sizeof(int)) < 0) {
-			log_error("Failed to receive poll timeout from UDS server");
-			goto clean_rcv_fd;
-		}
-		log_debug("POLL_TIMEOUT: %d", cfg->xsk->poll_timeout);
+	if (msg.hdr.status) {
+		log_error("Monitor refused bootstrap: %s", strerror(-msg.hdr.status));
+		goto close_uds;
 	}
 
-	if (flash__send_cmd(uds_sockfd, FLASH__GET_FRAGS_ENABLED) < 0) {
-		log_error("Failed to send command to get frags enabled");
-		goto clean_rcv_fd;
-	}
-	if (flash__recv_data(uds_sockfd, &cfg->frags_enabled, sizeof(bool)) < 0) {
-		log_error("Failed to receive frags enabled from UDS server");
-		goto clean_rcv_fd;
+	if (msg.hdr.version != FLASH__BOOT_VERSION) {
+		log_error("Monitor speaks bootstrap version %d, NF %d", msg.hdr.version, FLASH__BOOT_VERSION);
+		goto close_fds;
 	}
-	log_debug("FRAGS_ENABLED: %d", cfg->frags_enabled);
 
-	if (flash__send_cmd(uds_sockfd, FLASH__GET_IFNAME) < 0) {
-		log_error("Failed to send command to get ifname");
-		goto clean_rcv_fd;
+	/* only set again if there is a running instance to take over from */
+	cfg->takeover = false;
+	cfg->active_sockets = 0;
+	cfg->telemetry_fd = -1;
+	if (boot_apply(cfg, nf, &msg.hdr) < 0) {
+		log_error("Malformed bootstrap reply");
+		goto clean_cfg;
 	}
-	if (flash__recv_data(uds_sockfd, cfg->ifname, IF_NAMESIZE) < 0) {
-		log_error("Failed to receive ifname from UDS server");
-		goto clean_rcv_fd;
-	}
-	log_debug("IFNAME: %s", cfg->ifname);
 
-	if (flash__send_cmd(uds_sockfd, FLASH__GET_POLLOUT_STATUS) < 0) {
-		log_error("Failed to send command to get pollout status fd, size, shared memory");
-		goto clean_rcv_fd;
-	}
-	if (flash__recv_fd(uds_sockfd, &cfg->nf_pollout_status_fd) < 0) {
-		log_error("Failed to receive pollout status fd from UDS server");
-		goto clean_rcv_fd;
+	if (cfg->total_sockets <= 0 || msg.hdr.nr_fds < (uint32_t)(FLASH__BOOT_FD_SOCKET + cfg->total_sockets) ||
+	    msg.hdr.nr_fds > (uint32_t)(FLASH__BOOT_FD_SOCKET + cfg->total_sockets + 1) || !cfg->ifqueue) {
+		log_error("Bootstrap reply has %u fds for %d sockets", msg.hdr.nr_fds, cfg->total_sockets);
+		goto clean_cfg;
 	}
-	log_debug("RECEIVED POLLOUT STATUS FD: %d", cfg->nf_pollout_status_fd);
-	if (flash__recv_data(uds_sockfd, &cfg->nf_pollout_status_size, sizeof(int)) < 0) {
-		log_error("Failed to receive pollout_status array size from UDS server");
-		goto clean_rcv_fd;
-	}
-	log_debug("RECEIVED POLLOUT_STATUS SIZE: %d", cfg->nf_pollout_status_size);
 
-	if (flash__send_cmd(uds_sockfd, FLASH__GET_PREV_NF) < 0) {
-		log_error("Failed to send command to get previous NFs");
-		goto clean_rcv_fd;
-	}
-	if (flash__recv_data(uds_sockfd, &cfg->prev_size, sizeof(int)) < 0) {
-		log_error("Failed to receive number of previous NFs from UDS server");
-		goto clean_rcv_fd;
-	}
-	log_debug("NUMBER OF PREVIOUS NFs: %d", cfg->prev_size);
-	cfg->prev = (int *)calloc(cfg->prev_size, sizeof(int));
-	for (i = 0; i < cfg->prev_size; i++) {
-		int prev_nf_id;
-		if (flash__recv_data(uds_sockfd, &prev_nf_id, sizeof(int)) < 0) {
-			log_error("Failed to receive previous NF id from UDS server");
-			free(cfg->prev);
-			goto clean_rcv_fd;
-		}
-		cfg->prev[i] = prev_nf_id;
-		log_debug("RECEIVED PREVIOUS NF ID: %d", prev_nf_id);
-	}
+	/* an older monitor does not autoscale */
+	if (cfg->active_sockets <= 0 || cfg->active_sockets > cfg->total_sockets)
+		cfg->active_sockets = cfg->total_sockets;
+
+	cfg->umem_fd = fds[FLASH__BOOT_FD_UMEM];
+	cfg->nf_pollout_status_fd = fds[FLASH__BOOT_FD_POLLOUT];
+	*received_fd = (int *)calloc(cfg->total_sockets, sizeof(int));
+	if (!*received_fd)
+		goto clean_cfg;
+	for (i = 0; i < cfg->total_sockets; i++)
+		(*received_fd)[i] = fds[FLASH__BOOT_FD_SOCKET + i];
+	if (msg.hdr.nr_fds > (uint32_t)(FLASH__BOOT_FD_SOCKET + cfg->total_sockets))
+		cfg->telemetry_fd = fds[FLASH__BOOT_FD_SOCKET + cfg->total_sockets];
+
+	log_debug("BOOTSTRAP: %d sockets, UMEM size %lu, scale %d, offset %d, ifname %s, %d next, %d previous NFs",
+		  cfg->total_sockets, cfg->umem->size, cfg->umem_scale, cfg->umem_offset, cfg->ifname, cfg->next_size,
+		  cfg->prev_size);
+
 	return 0;
 
-clean_rcv_fd:
-	free(*received_fd);
+clean_cfg:
 	free(cfg->ifqueue);
+	cfg->ifqueue = NULL;
+	free(cfg->prev);
+	cfg->prev = NULL;
+close_fds:
+	for (i = 0; i < (int)msg.hdr.nr_fds; i++)
+		close(fds[i]);
 close_uds:
 	close_uds_conn(cfg);
 	return -1;
@@ -304,7 +409,9 @@ static int xsk_mmap_umem_rings(struct socket *socket, struct xsk_umem_config ume
 		fill->consumer = fill_map + off.fr.consumer;
 		fill->flags = fill_map + off.fr.flags;
 		fill->ring = fill_map + off.fr.desc;
-		fill->cached_cons = umem_config.fill_size;
+		/* a socket from the monitor's warm pool resumes at its previous indices */
+		fill->cached_prod = *fill->producer;
+		fill->cached_cons = *fill->consumer + umem_config.fill_size;
 	}
 
 	if (comp) {
@@ -321,6 +428,8 @@ static int xsk_mmap_umem_rings(struct socket *socket, struct xsk_umem_config ume
 		comp->consumer = comp_map + off.cr.consumer;
 		comp->flags = comp_map + off.cr.flags;
 		comp->ring = comp_map + off.cr.desc;
+		comp->cached_prod = *comp->producer;
+		comp->cached_cons = *comp->consumer;
 	}
 
 	if (rx) {
@@ -375,9 +484,10 @@ out_mmap_comp:
 
 void flash__populate_fill_ring(struct thread **thread, int frame_size, int total_sockets, int umem_offset, int umem_scale)
 {
-	int ret, i;
+	int ret;
 	int nr_frames = (size_t)XSK_RING_PROD__DEFAULT_NUM_DESCS * (size_t)2 * (size_t)umem_scale;
 	uint32_t idx = 0;
+	uint64_t i;
 
 	for (int t = 0; t < total_sockets; t++) {
 		ret = xsk_ring_prod__reserve(&thread[t]->socket->fill, nr_frames, &idx);
@@ -385,7 +495,7 @@ void flash__populate_fill_ring(struct thread **thread, int frame_size, int total
 			log_error("errno: %d/\"%s\"\n", errno, strerror(errno));
 			exit(EXIT_FAILURE);
 		}
-		for (i = (t + umem_offset) * nr_frames; i < nr_frames * (t + umem_offset + 1); i++) {
+		for (i = (uint64_t)(t + umem_offset) * nr_frames; i < (uint64_t)nr_frames * (t + umem_offset + 1); i++) {
 			*xsk_ring_prod__fill_addr(&thread[t]->socket->fill, idx++) = i * frame_size;
 		}
 		log_info("THREAD: %d, umem_offset: %d", t, t + umem_offset);
@@ -393,10 +503,81 @@ void flash__populate_fill_ring(struct thread **thread, int frame_size, int total
 	}
 }
 
-static int __populate_fill_ring(struct thread *thread, bool full, int umem_scale)
+static void __mark_frame(uint8_t *posted, uint64_t addr, uint64_t first, uint32_t size, int frame_size)
+{
+	uint64_t frame = addr / frame_size - first;
+
+	if (frame < size)
+		posted[frame] = 1;
+}
+
+/*
+ * A recycled or taken over socket still has the previous instance's frames
+ * in its rings. Fill entries are the kernel's until they show up on RX, RX
+ * entries are processed here, and TX and completion entries come back
+ * through the completion ring, so take all of them out of the fresh pool
+ * instead of handing them out twice. The previous instance may have moved
+ * the rings since they were mapped, so resume at the current indices.
+ *
+ * @return the number of frames in the fill ring, -1 on error.
+ */
+static int __reclaim_rings(struct socket *socket, int frame_size)
+{
+	struct flash_pool *pool = socket->flash_pool;
+	struct xsk_ring_prod *fill = &socket->fill, *tx = &socket->tx;
+	struct xsk_ring_cons *rx = &socket->rx, *comp = &socket->comp;
+	uint64_t first = pool->desc[pool->head & (pool->size - 1)] / frame_size;
+	uint32_t outstanding, in_flight, kept = 0;
+	uint8_t *posted;
+
+	fill->cached_prod = *fill->producer;
+	fill->cached_cons = __atomic_load_n(fill->consumer, __ATOMIC_ACQUIRE) + fill->size;
+	rx->cached_cons = *rx->consumer;
+	rx->cached_prod = __atomic_load_n(rx->producer, __ATOMIC_ACQUIRE);
+	tx->cached_prod = *tx->producer;
+	tx->cached_cons = __atomic_load_n(tx->consumer, __ATOMIC_ACQUIRE) + tx->size;
+	comp->cached_cons = *comp->consumer;
+	comp->cached_prod = __atomic_load_n(comp->producer, __ATOMIC_ACQUIRE);
+
+	outstanding = fill->cached_prod - (fill->cached_cons - fill->size);
+	in_flight = (tx->cached_prod - (tx->cached_cons - tx->size)) + (comp->cached_prod - comp->cached_cons);
+	if (!outstanding && !in_flight && rx->cached_prod == rx->cached_cons)
+		return 0;
+
+	posted = calloc(pool->size, sizeof(uint8_t));
+	if (!posted)
+		return -1;
+
+	for (uint32_t i = fill->cached_cons - fill->size; i != fill->cached_prod; i++)
+		__mark_frame(posted, *xsk_ring_prod__fill_addr(fill, i), first, pool->size, frame_size);
+	for (uint32_t i = rx->cached_cons; i != rx->cached_prod; i++)
+		__mark_frame(posted, xsk_ring_cons__rx_desc(rx, i)->addr, first, pool->size, frame_size);
+	for (uint32_t i = tx->cached_cons - tx->size; i != tx->cached_prod; i++)
+		__mark_frame(posted, xsk_ring_prod__tx_desc(tx, i)->addr, first, pool->size, frame_size);
+	for (uint32_t i = comp->cached_cons; i != comp->cached_prod; i++)
+		__mark_frame(posted, *xsk_ring_cons__comp_addr(comp, i), first, pool->size, frame_size);
+
+	for (uint32_t i = 0; i < pool->size; i++) {
+		if (!posted[i])
+			pool->desc[kept++] = (first + i) * frame_size;
+	}
+	pool->head = 0;
+	pool->tail = kept;
+	free(posted);
+
+	/* completions are only reaped while TX is outstanding */
+	socket->outstanding_tx = in_flight;
+
+	log_info("Socket %d resumes with %u frames in its fill ring, %u on RX, %u in TX", socket->fd, outstanding,
+		 rx->cached_prod - rx->cached_cons, in_flight);
+	return outstanding;
+}
+
+static int __populate_fill_ring(struct thread *thread, bool full, int umem_scale, int frame_size)
 {
 	int ret, i;
-	int nr_frames;
+	int nr_frames, outstanding;
+	struct flash_pool *pool;
 	uint32_t idx = 0;
 	uint64_t fill_addr;
 
@@ -405,6 +586,17 @@ static int __populate_fill_ring(struct thread *thread, bool full, int umem_scale
 	else
 		nr_frames = (size_t)XSK_RING_PROD__DEFAULT_NUM_DESCS * (size_t)umem_scale;
 
+	outstanding = __reclaim_rings(thread->socket, frame_size);
+	if (outstanding < 0)
+		return -1;
+	nr_frames -= outstanding;
+	/* frames on RX and TX are in use, they reach the fill ring later */
+	pool = thread->socket->flash_pool;
+	if (nr_frames > (int)(pool->tail - pool->head))
+		nr_frames = pool->tail - pool->head;
+	if (nr_frames <= 0)
+		return 0;
+
 	ret = xsk_ring_prod__reserve(&thread->socket->fill, nr_frames, &idx);
 	if (ret != nr_frames) {
 		log_error("errno: %d/\"%s\"", errno, strerror(errno));
@@ -425,6 +617,70 @@ static int __populate_fill_ring(struct thread *thread, bool full, int umem_scale
 	return 0;
 }
 
+/* Block until the monitor says the running instance has stopped. */
+static int __await_takeover(struct config *cfg)
+{
+	int status;
+
+	log_info("Taking over NF %d of UMEM %d", cfg->nf_id, cfg->umem_id);
+	if (flash__send_cmd(cfg->uds_sockfd, FLASH__TAKEOVER) < 0 ||
+	    flash__recv_data(cfg->uds_sockfd, &status, sizeof(int)) != sizeof(int)) {
+		log_error("ERROR: Lost the monitor during takeover");
+		return -1;
+	}
+
+	if (status < 0) {
+		log_error("ERROR: Takeover failed: %s", strerror(-status));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Point each socket at its slot of the monitor's telemetry region, if it sent one. */
+static void __map_telemetry(struct config *cfg, struct nf *nf)
+{
+	size_t size = flash_telemetry_size(cfg->total_sockets, 0);
+	struct flash_telemetry *tm;
+	struct stat st;
+
+	cfg->telemetry = NULL;
+	if (cfg->telemetry_fd < 0)
+		return;
+
+	if (fstat(cfg->telemetry_fd, &st) < 0 || (size_t)st.st_size < size) {
+		log_warn("Telemetry region is too small, not publishing counters");
+		goto out;
+	}
+
+	/* the edge counters after the sockets are sized by the monitor */
+	tm = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, cfg->telemetry_fd, 0);
+	if (tm == MAP_FAILED) {
+		log_warn("Telemetry region mmap failed: %s", strerror(errno));
+		goto out;
+	}
+	if (tm->magic != FLASH_TELEMETRY_MAGIC || tm->version != FLASH_TELEMETRY_VERSION ||
+	    tm->nr_sockets != (uint32_t)cfg->total_sockets ||
+	    flash_telemetry_size(tm->nr_sockets, tm->nr_edges) > (size_t)st.st_size) {
+		log_warn("Telemetry region version %u for %u sockets, not publishing counters", tm->version, tm->nr_sockets);
+		munmap(tm, st.st_size);
+		goto out;
+	}
+
+	tm->pid = getpid();
+	for (int i = 0; i < cfg->total_sockets; i++) {
+		tm->socket[i].ifqueue = cfg->ifqueue[i];
+		nf->thread[i]->socket->telemetry = &tm->socket[i];
+		nf->thread[i]->socket->telemetry_edge_tx = flash_telemetry_edge_tx(tm, i);
+		nf->thread[i]->socket->telemetry_nr_edges = tm->nr_edges;
+	}
+	cfg->telemetry = tm;
+
+out:
+	close(cfg->telemetry_fd);
+	cfg->telemetry_fd = -1;
+}
+
 void flash__xsk_close(struct config *cfg, struct nf *nf)
 {
 	struct xdp_mmap_offsets off;
@@ -460,6 +716,8 @@ void flash__xsk_close(struct config *cfg, struct nf *nf)
 		cfg->nf_pollout_status = NULL;
 		cfg->nf_pollout_status_size = 0;
 
+		free(nf->thread[i]->socket->edge);
+		free(nf->thread[i]->socket->completed_tx_descs);
 		free(nf->thread[i]->socket);
 		free(nf->thread[i]);
 	}
@@ -467,9 +725,17 @@ void flash__xsk_close(struct config *cfg, struct nf *nf)
 	free(nf->thread);
 	free(nf);
 
+	free(cfg->frame_edge);
+	cfg->frame_edge = NULL;
+
+	if (cfg->telemetry) {
+		munmap(cfg->telemetry, flash_telemetry_size(cfg->telemetry->nr_sockets, cfg->telemetry->nr_edges));
+		cfg->telemetry = NULL;
+	}
+
 	if (cfg->umem) {
 		if (cfg->umem->buffer)
-			munmap(cfg->umem->buffer, NUM_FRAMES * cfg->umem->frame_size * cfg->total_sockets);
+			munmap(cfg->umem->buffer, cfg->umem->size);
 
 		free(cfg->umem);
 	}
@@ -495,9 +761,10 @@ static bool xsk_page_aligned(void *buffer)
 
 int flash__configure_nf(struct nf **_nf, struct config *cfg)
 {
-	int i, size;
 	int *sockfd = NULL;
+	uint64_t size;
 	struct nf *nf;
+	int i;
 
 	if (!cfg || !_nf) {
 		log_error("ERROR: NULL pointer as arguments");
@@ -523,6 +790,15 @@ int flash__configure_nf(struct nf **_nf, struct config *cfg)
 		goto out_error;
 	}
 
+	if (cfg->track_tx_budget) {
+		cfg->frame_shift = __builtin_ctz(cfg->umem->frame_size);
+		cfg->frame_edge = calloc(size >> cfg->frame_shift, sizeof(uint16_t));
+		if (!cfg->frame_edge) {
+			log_error("ERROR: Memory allocation failed for the frame edge table");
+			goto out_error;
+		}
+	}
+
 	void *shm_ptr = mmap(NULL, cfg->nf_pollout_status_size, PROT_READ | PROT_WRITE, MAP_SHARED, cfg->nf_pollout_status_fd, 0);
 	if (shm_ptr == MAP_FAILED) {
 		log_error("ERROR: mmap failed: %s", strerror(errno));
@@ -577,25 +853,35 @@ int flash__configure_nf(struct nf **_nf, struct config *cfg)
 		nf->thread[i]->socket->backpressure_fd.fd = sockfd[i];
 		nf->thread[i]->socket->backpressure_fd.events = POLLOUT;
 
-		if (nf->next_size != 0) {
-			for (int j = 0; j < nf->next_size; j++) {
-				nf->thread[i]->socket->per_edge_max_outstanding_tx[j] = 1;
-			}
-		} else {
-			nf->thread[i]->socket->per_edge_max_outstanding_tx[0] = 1;
-		}
+		nf->thread[i]->socket->nr_edges = nf->next_size ?: 1;
+		nf->thread[i]->socket->edge = calloc(nf->thread[i]->socket->nr_edges, sizeof(struct flash_edge));
 		nf->thread[i]->socket->completed_tx_descs = (int *)calloc(cfg->max_outstanding_tx, sizeof(int));
+		if (!nf->thread[i]->socket->edge || !nf->thread[i]->socket->completed_tx_descs) {
+			log_error("ERROR: Memory allocation failed for the edges of socket %d", i);
+			goto out_error;
+		}
+		for (int j = 0; j < nf->thread[i]->socket->nr_edges; j++)
+			nf->thread[i]->socket->edge[j].max_outstanding_tx = 1;
 		memset(nf->thread[i]->socket->completed_tx_descs, -1, sizeof(int) * cfg->max_outstanding_tx);
-		for (int j = 0; j < nf->next_size; j++) {
+		for (int j = 0; j < nf->next_size && j < cfg->max_outstanding_tx; j++) {
 			nf->thread[i]->socket->completed_tx_descs[nf->thread[i]->socket->completed_idx++] = j;
 		}
+		nf->thread[i]->socket->completed_idx &= cfg->max_outstanding_tx - 1;
 
 		if (xsk_mmap_umem_rings(nf->thread[i]->socket, *cfg->umem_config, *cfg->xsk_config) < 0) {
 			log_error("ERROR: (Ring setup) mmap failed \"%s\"", strerror(errno));
 			goto out_error;
 		}
+	}
+
+	__map_telemetry(cfg, nf);
 
-		if (__populate_fill_ring(nf->thread[i], cfg->rx_first, cfg->umem_scale) < 0) {
+	/* everything is mapped, the running instance can stop now */
+	if (cfg->takeover && __await_takeover(cfg) < 0)
+		goto out_error;
+
+	for (i = 0; i < cfg->total_sockets; i++) {
+		if (__populate_fill_ring(nf->thread[i], cfg->rx_first, cfg->umem_scale, cfg->umem->frame_size) < 0) {
 			log_error("ERROR: (Fill ring setup) __populate_fill_ring failed \"%s\"", strerror(errno));
 			goto out_error;
 		}
@@ -51,11 +51,26 @@ int flash__configure_nf(struct nf **_nf, struct config *cfg);
  * Wait for a signal from the server to indicate that server wants to close the nf.
  * This function sets the UDS socket to non-blocking mode and checks
  * for incoming signals until it receives one or the connection is closed.
+ * Route updates from the monitor are applied to cfg->next_size and cfg->prev
+ * while waiting; datapath threads should read cfg->next_size per batch.
+ * When the monitor autoscales the NF, cfg->active_sockets is the number of
+ * sockets, from the first, that the NIC currently steers traffic to.
  *
  * @param cfg Pointer to the configuration structure.
  */
 void flash__wait(struct config *cfg);
 
+/**
+ * flash__wait() for an NF attached to several UMEMs, with one configuration
+ * per UMEM, each configured with flash__configure_nf(). Commands from the
+ * monitor are applied to the configuration of the UMEM they came for, and
+ * it returns once any of them is to stop.
+ *
+ * @param cfgs Configurations of the NF, one per UMEM.
+ * @param n Number of configurations.
+ */
+void flash__wait_all(struct config **cfgs, int n);
+
 /**
  * Close the NF and clean up resources.
  * This function unmaps memory regions, frees allocated structures,
@@ -147,6 +162,19 @@ size_t flash__dropmsg(struct config *cfg, struct socket *xsk, struct xskvec *xsk
  */
 size_t flash__allocmsg(struct config *cfg, struct socket *xsk, struct xskvec *xskvecs, uint32_t nalloc);
 
+/**
+ * Allocate up to nalloc messages from the frames the pool holds right now.
+ * Unlike flash__allocmsg() this never waits for tx completions to return frames.
+ * 
+ * @param cfg: Pointer to the configuration structure.
+ * @param xsk: Pointer to the socket structure.
+ * @param xskvecs: Pointer to the array of xskvec structures to allocate memory for.
+ * @param nalloc: Maximum number of messages to allocate memory for.
+ * 
+ * @return Number of messages allocated, 0 if the pool is empty.
+ */
+size_t flash__tryallocmsg(struct config *cfg, struct socket *xsk, struct xskvec *xskvecs, uint32_t nalloc);
+
 /* Helper APIs */
 
 /**
@@ -155,7 +183,8 @@ size_t flash__allocmsg(struct config *cfg, struct socket *xsk, struct xskvec *xs
  * @param conf: Pointer to the stats_conf structure containing NF and config.
  * 
  * This routine should be invoked via threads, and it will periodically clear the terminal
- * and dump statistics for each socket in the NF.
+ * and dump statistics for each socket in the NF. Every stats_interval it also publishes
+ * the counters to the monitor's telemetry region, even when not verbose.
  */
 void *flash__stats_thread(void *conf);
 
@@ -191,6 +220,15 @@ void flash__populate_fill_ring(struct thread **thread, int frame_size, int total
  */
 unsigned long flash__get_nsecs(struct config *cfg);
 
+/**
+ * Get the frequency of the timer the datapath reads, as used for the
+ * batch latency histogram of the telemetry region.
+ * @param cfg: Pointer to the configuration structure.
+ *
+ * Returns cycles per second; the first call calibrates on x86.
+ */
+uint64_t flash__timer_hz(struct config *cfg);
+
 /**
  * Dump statistics for the given socket.
  * @param cfg: Pointer to the configuration structure.
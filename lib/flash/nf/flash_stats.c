@@ -11,6 +11,8 @@
 #include <stdio.h>
 #include <linux/limits.h>
 
+#include <flash_telemetry.h>
+
 #include "flash_nf.h"
 
 char spinner[] = { '/', '-', '\\', '|' };
@@ -229,13 +231,64 @@ void flash__dump_stats(struct config *cfg, struct socket *xsk)
 	}
 }
 
+/* Copy each socket's counters into the telemetry region the monitor reads. */
+static void __publish_telemetry(struct config *cfg, struct nf *nf)
+{
+	struct flash_telemetry *tm = cfg->telemetry;
+	struct timespec ts;
+
+	if (!tm->timer_hz)
+		tm->timer_hz = flash__timer_hz(cfg);
+
+	for (int i = 0; i < cfg->total_sockets; i++) {
+		struct socket *xsk = nf->thread[i]->socket;
+		struct flash_telemetry_socket *t = xsk->telemetry;
+
+		if (!t)
+			continue;
+		__xsk_get_xdp_stats(xsk->fd, xsk);
+
+		__atomic_store_n(&t->seq, t->seq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		t->rx_npkts = xsk->ring_stats.rx_npkts;
+		t->rx_frags = xsk->ring_stats.rx_frags;
+		t->tx_npkts = xsk->ring_stats.tx_npkts;
+		t->tx_frags = xsk->ring_stats.tx_frags;
+		t->drop_npkts = xsk->ring_stats.drop_npkts;
+		t->rx_dropped = xsk->ring_stats.rx_dropped_npkts;
+		t->rx_invalid_descs = xsk->ring_stats.rx_invalid_npkts;
+		t->tx_invalid_descs = xsk->ring_stats.tx_invalid_npkts;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+		t->rx_ring_full = xsk->ring_stats.rx_full_npkts;
+		t->rx_fill_ring_empty_descs = xsk->ring_stats.rx_fill_empty_npkts;
+		t->tx_ring_empty_descs = xsk->ring_stats.tx_empty_npkts;
+#endif
+		t->rx_empty_polls = xsk->app_stats.rx_empty_polls;
+		t->fill_fail_polls = xsk->app_stats.fill_fail_polls;
+		t->copy_tx_sendtos = xsk->app_stats.copy_tx_sendtos;
+		t->tx_wakeup_sendtos = xsk->app_stats.tx_wakeup_sendtos;
+		t->backpressure = xsk->app_stats.backpressure;
+		t->opt_polls = xsk->app_stats.opt_polls;
+		t->rx_ring_used = __atomic_load_n(xsk->rx.producer, __ATOMIC_ACQUIRE) -
+				  __atomic_load_n(xsk->rx.consumer, __ATOMIC_RELAXED);
+		t->rx_ring_size = xsk->rx.size;
+		t->tx_ring_used = __atomic_load_n(xsk->tx.producer, __ATOMIC_RELAXED) -
+				  __atomic_load_n(xsk->tx.consumer, __ATOMIC_ACQUIRE);
+		t->tx_ring_size = xsk->tx.size;
+		__atomic_store_n(&t->seq, t->seq + 1, __ATOMIC_RELEASE);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	__atomic_store_n(&tm->published_ns, ts.tv_sec * 1000000000UL + ts.tv_nsec, __ATOMIC_RELEASE);
+}
+
 void *flash__stats_thread(void *conf)
 {
 	struct stats_conf *arg = (struct stats_conf *)conf;
 	struct nf *nf = arg->nf;
 	struct config *cfg = arg->cfg;
 
-	if (cfg->verbose) {
+	if (cfg->verbose || cfg->telemetry) {
 		unsigned int interval = cfg->stats_interval;
 		setlocale(LC_ALL, "");
 
@@ -244,6 +297,10 @@ void *flash__stats_thread(void *conf)
 
 		while (!*cfg->done) {
 			sleep(interval);
+			if (cfg->telemetry)
+				__publish_telemetry(cfg, nf);
+			if (!cfg->verbose)
+				continue;
 			if (system("clear") != 0)
 				log_error("Terminal clear error");
 			for (int i = 0; i < cfg->total_sockets; i++) {
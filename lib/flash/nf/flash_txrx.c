@@ -7,6 +7,7 @@
 #include <unistd.h>
 
 #include <flash_pool.h>
+#include <flash_telemetry.h>
 
 #include "flash_nf.h"
 
@@ -90,6 +91,44 @@ static inline uint64_t get_timer_hz(struct config *cfg)
 	return __hz;
 }
 
+uint64_t flash__timer_hz(struct config *cfg)
+{
+	return get_timer_hz(cfg);
+}
+
+#ifdef STATS
+/* Cycles from a batch leaving flash__recvmsg() to its first send or drop. */
+static inline void __record_batch(struct socket *xsk)
+{
+	struct flash_telemetry_socket *t = xsk->telemetry;
+	uint64_t cycles;
+	int bucket;
+
+	if (!xsk->batch_tsc)
+		return;
+
+	cycles = rdtsc() - xsk->batch_tsc;
+	xsk->batch_tsc = 0;
+	bucket = cycles > 1 ? 63 - __builtin_clzll(cycles) : 0;
+	if (bucket >= FLASH_TELEMETRY_HIST_BUCKETS)
+		bucket = FLASH_TELEMETRY_HIST_BUCKETS - 1;
+
+	/* single writer, the stores only keep the monitor from seeing torn values */
+	__atomic_store_n(&t->batch_cycles[bucket], t->batch_cycles[bucket] + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&t->batch_cycles_sum, t->batch_cycles_sum + cycles, __ATOMIC_RELAXED);
+}
+
+static inline void __count_edge(struct socket *xsk, uint32_t edge)
+{
+	struct flash_telemetry_socket *t = xsk->telemetry;
+
+	if (edge < xsk->telemetry_nr_edges)
+		__atomic_store_n(&xsk->telemetry_edge_tx[edge], xsk->telemetry_edge_tx[edge] + 1, __ATOMIC_RELAXED);
+	else
+		__atomic_store_n(&t->edge_tx_other, t->edge_tx_other + 1, __ATOMIC_RELAXED);
+}
+#endif
+
 static inline int __poll(struct socket *xsk, struct pollfd *fds, nfds_t nfds, int timeout)
 {
 #ifdef STATS
@@ -157,12 +196,34 @@ static inline void __try_kick_rx(struct config *cfg, struct socket *xsk)
 	}
 }
 
+/*
+ * A frame sent on an edge came back. Its budget moves to that edge from the
+ * edge that completed max_outstanding_tx frames ago, so the edges that drain
+ * fastest hold most of it. The edge was noted in frame_edge when the frame
+ * was sent, not in the frame, so the packet is left as the next NF wrote it.
+ */
+static inline void __complete_edge(struct config *cfg, struct socket *xsk, uint64_t addr)
+{
+	uint16_t edge = cfg->frame_edge[addr >> cfg->frame_shift];
+	int old;
+
+	if (edge >= xsk->nr_edges)
+		return;
+
+	xsk->edge[edge].outstanding--;
+	old = xsk->completed_tx_descs[xsk->completed_idx];
+	if (old != -1)
+		xsk->edge[old].max_outstanding_tx--;
+	xsk->edge[edge].max_outstanding_tx++;
+	xsk->completed_tx_descs[xsk->completed_idx] = edge;
+	xsk->completed_idx = (xsk->completed_idx + 1) & (cfg->max_outstanding_tx - 1);
+}
+
 static inline void __complete_tx_completions(struct config *cfg, struct socket *xsk)
 {
 	uint32_t idx_cq = 0, idx_fq = 0;
 	uint32_t completed, num_outstanding, i, ret;
 	uint64_t addr;
-	int temp;
 
 	if (!xsk->outstanding_tx)
 		return;
@@ -201,19 +262,8 @@ static inline void __complete_tx_completions(struct config *cfg, struct socket *
 
 		for (i = 0; i < completed; i++) {
 			addr = *xsk_ring_cons__comp_addr(&xsk->comp, idx_cq++);
-			if (cfg->track_tx_budget && cfg->next_size != 0) {
-				uint8_t *data_ptr = (uint8_t *)(cfg->umem->buffer + addr); // edge_id
-				xsk->per_edge_outstanding[*data_ptr]--;
-				temp = xsk->completed_tx_descs[xsk->completed_idx];
-				if (temp != -1) {
-					xsk->per_edge_max_outstanding_tx[temp]--;
-				}
-				xsk->per_edge_max_outstanding_tx[*data_ptr]++;
-				xsk->completed_tx_descs[xsk->completed_idx] = *data_ptr;
-				xsk->completed_idx = (xsk->completed_idx + 1) & (cfg->max_outstanding_tx - 1);
-
-				*data_ptr = 0;
-			}
+			if (cfg->track_tx_budget && cfg->next_size != 0)
+				__complete_edge(cfg, xsk, addr);
 			*xsk_ring_prod__fill_addr(&xsk->fill, idx_fq++) = addr;
 		}
 
@@ -222,20 +272,8 @@ static inline void __complete_tx_completions(struct config *cfg, struct socket *
 	} else {
 		for (i = 0; i < completed; i++) {
 			addr = *xsk_ring_cons__comp_addr(&xsk->comp, idx_cq++);
-			if (cfg->track_tx_budget && cfg->next_size != 0) {
-				uint8_t *data_ptr = (uint8_t *)(cfg->umem->buffer + addr); // edge_id
-				xsk->per_edge_outstanding[*data_ptr]--;
-
-				temp = xsk->completed_tx_descs[xsk->completed_idx];
-				if (temp != -1) {
-					xsk->per_edge_max_outstanding_tx[temp]--;
-				}
-				xsk->per_edge_max_outstanding_tx[*data_ptr]++;
-				xsk->completed_tx_descs[xsk->completed_idx] = *data_ptr;
-				xsk->completed_idx = (xsk->completed_idx + 1) & (cfg->max_outstanding_tx - 1);
-
-				*data_ptr = 0;
-			}
+			if (cfg->track_tx_budget && cfg->next_size != 0)
+				__complete_edge(cfg, xsk, addr);
 			flash_pool__put(xsk->flash_pool, addr);
 		}
 	}
@@ -449,6 +487,8 @@ size_t flash__recvmsg(struct config *cfg, struct socket *xsk, struct xskvec *xsk
 #ifdef STATS
 	xsk->ring_stats.rx_npkts += eop_cnt;
 	xsk->ring_stats.rx_frags += rcvd;
+	if (xsk->telemetry)
+		xsk->batch_tsc = rdtsc();
 #endif
 	return rcvd;
 }
@@ -464,6 +504,9 @@ size_t flash__sendmsg(struct config *cfg, struct socket *xsk, struct xskvec *xsk
 	if (!nsend)
 		return 0;
 
+#ifdef STATS
+	__record_batch(xsk);
+#endif
 	idx_tx = __reserve_tx(cfg, xsk, nsend);
 
 	for (i = 0; i < nsend; i++) {
@@ -479,6 +522,8 @@ size_t flash__sendmsg(struct config *cfg, struct socket *xsk, struct xskvec *xsk
 		tx_desc->options |= (xv->options & 0xFFFF0000);
 		tx_desc->addr = addr;
 		tx_desc->len = len;
+		if (cfg->frame_edge)
+			cfg->frame_edge[addr >> cfg->frame_shift] = xv->options >> 16;
 
 		__hex_dump(xv->data, len, addr);
 
@@ -486,6 +531,10 @@ size_t flash__sendmsg(struct config *cfg, struct socket *xsk, struct xskvec *xsk
 			frags_done += nb_frags;
 			nb_frags = 0;
 			eop_cnt++;
+#ifdef STATS
+			if (xsk->telemetry)
+				__count_edge(xsk, xv->options >> 16);
+#endif
 		}
 	}
 	xsk_ring_prod__submit(&xsk->tx, frags_done);
@@ -500,10 +549,51 @@ size_t flash__sendmsg(struct config *cfg, struct socket *xsk, struct xskvec *xsk
 	return nsend;
 }
 
+/*
+ * The monitor changed this NF's edges. Edge indices may have shifted, so
+ * every edge starts over with a budget of one, as after flash__configure_nf().
+ * The edge array only grows; if it cannot, packets on the edges past it are
+ * dropped.
+ */
+static void __reset_edges(struct config *cfg, struct socket *xsk, uint32_t gen)
+{
+	int next_size = __atomic_load_n(&cfg->next_size, __ATOMIC_RELAXED);
+	struct flash_edge *edge;
+
+	if (next_size > xsk->nr_edges) {
+		edge = realloc(xsk->edge, next_size * sizeof(struct flash_edge));
+		if (edge) {
+			xsk->edge = edge;
+			xsk->nr_edges = next_size;
+		} else {
+			log_warn("Unable to track %d edges, dropping packets past edge %d", next_size, xsk->nr_edges - 1);
+		}
+	}
+
+	for (int j = 0; j < xsk->nr_edges; j++) {
+		xsk->edge[j].max_outstanding_tx = j < next_size || j == 0;
+		xsk->edge[j].outstanding = 0;
+	}
+	memset(xsk->completed_tx_descs, -1, sizeof(int) * cfg->max_outstanding_tx);
+	xsk->completed_idx = 0;
+	for (int j = 0; j < next_size && j < xsk->nr_edges && j < cfg->max_outstanding_tx; j++)
+		xsk->completed_tx_descs[xsk->completed_idx++] = j;
+	xsk->completed_idx &= cfg->max_outstanding_tx - 1;
+
+	xsk->route_gen = gen;
+}
+
 void flash__track_tx_and_drop(struct config *cfg, struct socket *xsk, struct xskvec *xskvecs, uint32_t nrecv, struct xskvec *sendvecs,
 			      uint32_t *nsend, struct xskvec *dropvecs, uint32_t *ndrop)
 {
-	uint32_t i, next_size = cfg->next_size, wsend = 0, wdrop = 0, edge;
+	uint32_t i, next_size, nr_edges, wsend = 0, wdrop = 0, edge;
+	uint32_t gen = __atomic_load_n(&cfg->route_gen, __ATOMIC_ACQUIRE);
+
+	if (xsk->route_gen != gen)
+		__reset_edges(cfg, xsk, gen);
+	next_size = __atomic_load_n(&cfg->next_size, __ATOMIC_RELAXED);
+	nr_edges = next_size < (uint32_t)xsk->nr_edges ? next_size : (uint32_t)xsk->nr_edges;
+
 	for (i = 0; i < nrecv; i++) {
 		if (next_size == 0 || !cfg->track_tx_budget) {
 			sendvecs[wsend++] = xskvecs[i];
@@ -511,8 +601,13 @@ void flash__track_tx_and_drop(struct config *cfg, struct socket *xsk, struct xsk
 		}
 
 		edge = (xskvecs[i].options >> 16) & 0xFFFF;
-		if (xsk->per_edge_max_outstanding_tx[edge] > xsk->per_edge_outstanding[edge]) {
-			xsk->per_edge_outstanding[edge]++;
+		/* an edge the monitor has just removed, or one there was no room for */
+		if (edge >= nr_edges) {
+			dropvecs[wdrop++] = xskvecs[i];
+			continue;
+		}
+		if (xsk->edge[edge].max_outstanding_tx > xsk->edge[edge].outstanding) {
+			xsk->edge[edge].outstanding++;
 			sendvecs[wsend++] = xskvecs[i];
 		} else {
 			dropvecs[wdrop++] = xskvecs[i];
@@ -530,6 +625,9 @@ size_t flash__dropmsg(struct config *cfg, struct socket *xsk, struct xskvec *xsk
 	if (!ndrop)
 		return 0;
 
+#ifdef STATS
+	__record_batch(xsk);
+#endif
 	if (cfg->rx_first) {
 		idx_fq = __reserve_fq(cfg, xsk, ndrop);
 
@@ -585,3 +683,32 @@ size_t flash__allocmsg(struct config *cfg, struct socket *xsk, struct xskvec *xs
 
 	return nalloc;
 }
+
+size_t flash__tryallocmsg(struct config *cfg, struct socket *xsk, struct xskvec *xskvecs, uint32_t nalloc)
+{
+	uint32_t i;
+	uint64_t addr;
+
+	if (!nalloc || !xsk || !xskvecs || !cfg || !xsk->flash_pool)
+		return 0;
+
+	if (cfg->rx_first) {
+		log_error("Cannot allocate xskvecs in rx_first mode");
+		return 0;
+	}
+
+	/* reap whatever tx finished so far, but do not wait for more */
+	__complete_tx_completions(cfg, xsk);
+
+	for (i = 0; i < nalloc; i++) {
+		if (!flash_pool__get(xsk->flash_pool, &addr))
+			break;
+
+		xskvecs[i].data = xsk_umem__get_data(cfg->umem->buffer, addr);
+		xskvecs[i].addr = addr;
+		xskvecs[i].len = cfg->umem->frame_size;
+		xskvecs[i].options = 0;
+	}
+
+	return i;
+}
@@ -56,6 +56,10 @@ const struct option_wrapper long_options[] = {
 	  "<num>",
 	  false },
 
+	{ { "takeover", no_argument, NULL, 'T' },
+	  "Take over the sockets of a running instance of this NF without dropping packets [default: disabled]",
+	  false },
+
 	{ { 0, 0, NULL, 0 }, NULL, false }
 };
 
@@ -164,7 +168,7 @@ static int parse_cmdline_args(int argc, char **argv, const struct option_wrapper
 	}
 
 	/* Parse commands line args */
-	while ((opt = getopt_long(argc, argv, "u:f:taxn:Qpsi:I:b:B:Fw:hoO:", long_options, &longindex)) != -1) {
+	while ((opt = getopt_long(argc, argv, "u:f:taxn:Qpsi:I:b:B:Fw:hoO:T", long_options, &longindex)) != -1) {
 		switch (opt) {
 		case 'u':
 			cfg->umem_id = atoi(optarg);
@@ -228,6 +232,9 @@ static int parse_cmdline_args(int argc, char **argv, const struct option_wrapper
 				cfg->max_outstanding_tx = power;
 			}
 			break;
+		case 'T':
+			cfg->takeover = true;
+			break;
 		case 'h':
 			full_help = true;
 			/* fall-through */
@@ -291,6 +298,7 @@ int flash__parse_cmdline_args(int argc, char **argv, struct config *cfg)
 	cfg->xsk->bp_timeout = 1000;
 	cfg->xsk->bp_thres = (__u32)(XSK_RING_PROD__DEFAULT_NUM_DESCS);
 	cfg->track_tx_budget = false;
+	cfg->takeover = false;
 	cfg->max_outstanding_tx = 256;
 
 	ret = parse_cmdline_args(argc, argv, long_options, cfg);
@@ -309,3 +317,36 @@ cleanup:
 	free(cfg->xsk);
 	return -1;
 }
+
+struct config *flash__clone_config(struct config *cfg, int umem_id)
+{
+	struct config *clone;
+
+	if (!cfg || !cfg->umem || !cfg->xsk) {
+		log_error("ERROR: clone of a config flash__parse_cmdline_args() did not fill");
+		return NULL;
+	}
+
+	clone = calloc(1, sizeof(struct config));
+	if (!clone)
+		goto err;
+
+	*clone = *cfg;
+	clone->umem = calloc(1, sizeof(struct umem_config));
+	clone->xsk = calloc(1, sizeof(struct xsk_config));
+	if (!clone->umem || !clone->xsk)
+		goto err_free;
+
+	*clone->umem = *cfg->umem;
+	*clone->xsk = *cfg->xsk;
+	clone->umem_id = umem_id;
+	return clone;
+
+err_free:
+	free(clone->umem);
+	free(clone->xsk);
+	free(clone);
+err:
+	log_error("ERROR: Memory allocation failed");
+	return NULL;
+}
@@ -27,4 +27,15 @@ struct option_wrapper {
  */
 int flash__parse_cmdline_args(int argc, char **argv, struct config *cfg);
 
+/**
+ * Copy the options of a parsed configuration for another UMEM, for an NF
+ * attached to several UMEMs. The copy has its own umem and xsk
+ * configurations and is configured on its own with flash__configure_nf().
+ *
+ * @param cfg Configuration filled by flash__parse_cmdline_args(), not yet configured
+ * @param umem_id UMEM the copy connects to
+ * @return the copy, to be freed by the caller after flash__xsk_close(), or NULL on failure
+ */
+struct config *flash__clone_config(struct config *cfg, int umem_id);
+
 #endif
@@ -26,7 +26,7 @@ struct flash_pool *flash_pool__create(int frame_size, int umem_th_offset, int um
 	pool->tail = 0;
 	pool->size = nr_frames;
 
-	for (uint32_t i = umem_th_offset * nr_frames; i < nr_frames * (umem_th_offset + 1); i++)
+	for (uint64_t i = (uint64_t)umem_th_offset * nr_frames; i < (uint64_t)nr_frames * (umem_th_offset + 1); i++)
 		pool->desc[pool->tail++] = i * frame_size;
 
 	return pool;
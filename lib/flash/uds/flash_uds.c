@@ -9,6 +9,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <string.h>
 
 #include <log.h>
 
@@ -211,3 +212,196 @@ int flash__start_uds_client(void)
 
 	return sockfd;
 }
+
+#define MSG_TLV_ALIGN(len) (((len) + 3) & ~3)
+
+static int recv_full(int sockfd, void *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < len) {
+		n = recv(sockfd, (char *)buf + done, len - done, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		done += n;
+	}
+
+	return 0;
+}
+
+void flash__msg_init(struct flash_msg_hdr *hdr, int status)
+{
+	hdr->magic = FLASH__MSG_MAGIC;
+	hdr->version = FLASH__BOOT_VERSION;
+	hdr->status = status;
+	hdr->len = 0;
+	hdr->nr_fds = 0;
+}
+
+int flash__msg_put(struct flash_msg_hdr *hdr, int size, uint16_t type, const void *val, uint16_t len)
+{
+	struct flash_tlv *tlv = (struct flash_tlv *)((char *)(hdr + 1) + hdr->len);
+	size_t need = sizeof(struct flash_tlv) + MSG_TLV_ALIGN(len);
+
+	if (sizeof(*hdr) + hdr->len + need > (size_t)size) {
+		log_error("Message full, dropping TLV %d", type);
+		return -1;
+	}
+
+	tlv->type = type;
+	tlv->len = len;
+	memcpy(tlv->val, val, len);
+	memset(tlv->val + len, 0, MSG_TLV_ALIGN(len) - len);
+	hdr->len += need;
+
+	return 0;
+}
+
+struct flash_tlv *flash__msg_next(struct flash_msg_hdr *hdr, struct flash_tlv *tlv)
+{
+	char *start = (char *)(hdr + 1);
+	char *end = start + hdr->len;
+	char *next;
+
+	next = tlv ? (char *)tlv + sizeof(struct flash_tlv) + MSG_TLV_ALIGN(tlv->len) : start;
+	if (next + sizeof(struct flash_tlv) > end)
+		return NULL;
+
+	tlv = (struct flash_tlv *)next;
+	if ((char *)tlv->val + tlv->len > end) {
+		log_error("Truncated TLV %d in message", tlv->type);
+		return NULL;
+	}
+
+	return tlv;
+}
+
+int flash__send_msg(int sockfd, struct flash_msg_hdr *hdr, const int *fds)
+{
+	char cms[CMSG_SPACE(sizeof(int) * FLASH__MSG_MAX_FDS)];
+	size_t len = sizeof(*hdr) + hdr->len;
+	struct msghdr msgh = { 0 };
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	size_t sent = 0;
+	ssize_t n;
+
+	if (hdr->nr_fds > FLASH__MSG_MAX_FDS) {
+		log_error("Too many fds for one message: %u", hdr->nr_fds);
+		return -1;
+	}
+
+	iov.iov_base = hdr;
+	iov.iov_len = len;
+	msgh.msg_iov = &iov;
+	msgh.msg_iovlen = 1;
+
+	if (hdr->nr_fds) {
+		memset(cms, 0, sizeof(cms));
+		msgh.msg_control = cms;
+		msgh.msg_controllen = CMSG_SPACE(sizeof(int) * hdr->nr_fds);
+		cmsg = CMSG_FIRSTHDR(&msgh);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * hdr->nr_fds);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * hdr->nr_fds);
+	}
+
+	do {
+		n = sendmsg(sockfd, &msgh, MSG_NOSIGNAL);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0) {
+		log_error("Sendmsg failed with %s", strerror(errno));
+		return -1;
+	}
+
+	/* the fds went with the first byte, the rest is plain data */
+	for (sent = n; sent < len; sent += n) {
+		n = send(sockfd, (char *)hdr + sent, len - sent, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) {
+			n = 0;
+			continue;
+		}
+		if (n < 0) {
+			log_error("Send failed with %s", strerror(errno));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int flash__recv_msg(int sockfd, struct flash_msg_hdr *hdr, int size, int *fds, int max_fds)
+{
+	char cms[CMSG_SPACE(sizeof(int) * FLASH__MSG_MAX_FDS)];
+	struct msghdr msgh = { 0 };
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	int nr_fds = 0;
+	ssize_t n;
+
+	/* only the header first, so nothing past this message is consumed */
+	iov.iov_base = hdr;
+	iov.iov_len = sizeof(*hdr);
+	msgh.msg_iov = &iov;
+	msgh.msg_iovlen = 1;
+	msgh.msg_control = cms;
+	msgh.msg_controllen = sizeof(cms);
+
+	do {
+		n = recvmsg(sockfd, &msgh, MSG_CMSG_CLOEXEC);
+	} while (n < 0 && errno == EINTR);
+	if (n <= 0) {
+		log_error("Recvmsg failed: %s", n < 0 ? strerror(errno) : "connection closed");
+		return -1;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(&msgh); cmsg; cmsg = CMSG_NXTHDR(&msgh, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		int cnt = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (int i = 0; i < cnt; i++) {
+			int fd;
+			memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+			if (nr_fds < max_fds)
+				fds[nr_fds++] = fd;
+			else
+				close(fd);
+		}
+	}
+
+	if (msgh.msg_flags & MSG_CTRUNC) {
+		log_error("Received fds truncated");
+		goto err;
+	}
+
+	if ((size_t)n < sizeof(*hdr) && recv_full(sockfd, (char *)hdr + n, sizeof(*hdr) - n) < 0) {
+		log_error("Short message header");
+		goto err;
+	}
+
+	if (hdr->magic != FLASH__MSG_MAGIC || hdr->len > size - sizeof(*hdr)) {
+		log_error("Malformed message: magic 0x%x len %u", hdr->magic, hdr->len);
+		goto err;
+	}
+
+	if (hdr->nr_fds != (uint32_t)nr_fds) {
+		log_error("Expected %u fds, received %d", hdr->nr_fds, nr_fds);
+		goto err;
+	}
+
+	if (recv_full(sockfd, hdr + 1, hdr->len) < 0) {
+		log_error("Short message body");
+		goto err;
+	}
+
+	return 0;
+
+err:
+	for (int i = 0; i < nr_fds; i++)
+		close(fds[i]);
+	return -1;
+}
@@ -9,7 +9,7 @@
 
 #define UNIX_SOCKET_DIR "/tmp/flash"
 #define UNIX_SOCKET_NAME "/tmp/flash/uds.sock"
-#define MAX_NUM_OF_CLIENTS 20
+#define MAX_NUM_OF_CLIENTS 512
 #define FLASH__CREATE_UMEM 1
 #define FLASH__GET_UMEM 2
 #define FLASH__CREATE_SOCKET 3
@@ -27,6 +27,90 @@
 #define FLASH__GET_DST_IP_ADDR 15
 #define FLASH__GET_POLLOUT_STATUS 16
 #define FLASH__GET_PREV_NF 17
+#define FLASH__BOOTSTRAP 18
+#define FLASH__TAKEOVER 19
+#define FLASH__HANDOVER 20
+#define FLASH__ROUTE_UPDATE 21
+#define FLASH__SCALE 22
+
+/*
+ * Bootstrap: the NF sends FLASH__BOOTSTRAP followed by one message with its
+ * UMEM and NF id, and the monitor answers with one message carrying the
+ * whole NF configuration as TLVs and every fd in a single SCM_RIGHTS batch.
+ * A message is a struct flash_msg_hdr followed by hdr.len bytes of TLVs,
+ * each padded to 4 bytes. Readers skip TLV types they do not know; the
+ * version changes only when a TLV changes meaning.
+ */
+#define FLASH__MSG_MAGIC 0x464c5348 /* "FLSH" */
+#define FLASH__BOOT_VERSION 1
+#define FLASH__MSG_MAX_LEN 16384
+#define FLASH__BOOT_MAX_REQ 256
+#define FLASH__MSG_MAX_FDS (FLASH_MAX_SOCKETS + 3)
+
+/*
+ * fds of a bootstrap reply, the AF_XDP sockets follow in thread order; one
+ * more fd after them is the NF's telemetry memfd, see flash_telemetry.h
+ */
+#define FLASH__BOOT_FD_UMEM 0
+#define FLASH__BOOT_FD_POLLOUT 1
+#define FLASH__BOOT_FD_SOCKET 2
+
+enum flash_boot_tlv {
+	FLASH__BOOT_UMEM_ID = 1, /* int, request */
+	FLASH__BOOT_NF_ID, /* int, request */
+	FLASH__BOOT_TOTAL_SOCKETS, /* int */
+	FLASH__BOOT_UMEM_SIZE, /* uint64_t */
+	FLASH__BOOT_UMEM_SCALE, /* int */
+	FLASH__BOOT_UMEM_OFFSET, /* int */
+	FLASH__BOOT_IFQUEUE, /* int per socket */
+	FLASH__BOOT_NEXT_SIZE, /* int */
+	FLASH__BOOT_BIND_FLAGS, /* __u32 */
+	FLASH__BOOT_XDP_FLAGS, /* __u32 */
+	FLASH__BOOT_MODE, /* __u32 */
+	FLASH__BOOT_POLL_TIMEOUT, /* int */
+	FLASH__BOOT_FRAGS_ENABLED, /* bool */
+	FLASH__BOOT_IFNAME, /* char[IF_NAMESIZE] */
+	FLASH__BOOT_POLLOUT_SIZE, /* int */
+	FLASH__BOOT_PREV_NF, /* int per previous NF */
+	FLASH__BOOT_TAKEOVER, /* int, see below */
+	FLASH__BOOT_ACTIVE_SOCKETS, /* int, sockets the autoscaler steers traffic to */
+};
+
+/*
+ * Hot upgrade: a new instance of a running NF bootstraps with
+ * FLASH__BOOT_TAKEOVER set and gets the running instance's sockets; the
+ * reply has FLASH__BOOT_TAKEOVER set when there is an instance to take
+ * over from. The new instance maps everything, then sends FLASH__TAKEOVER
+ * and blocks. The monitor sends FLASH__HANDOVER to the old instance, which
+ * stops its datapath and closes its connection, and then answers the new
+ * instance's FLASH__TAKEOVER with an int: 0 to start on the rings where
+ * the old instance stopped, or a negative errno.
+ */
+
+/*
+ * Route update: when the monitor changes the edges into or out of a running
+ * NF, it sends FLASH__ROUTE_UPDATE followed by a message without fds that
+ * holds the new FLASH__BOOT_NEXT_SIZE and FLASH__BOOT_PREV_NF.
+ */
+
+/*
+ * Autoscaling: FLASH__SCALE followed by an int, the number of the NF's
+ * sockets that now get traffic from the NIC. The others drain and idle.
+ */
+
+struct flash_msg_hdr {
+	uint32_t magic;
+	uint16_t version;
+	int16_t status; /* 0, or a negative errno in a reply */
+	uint32_t len; /* bytes of TLVs after the header */
+	uint32_t nr_fds; /* fds passed along with the message */
+};
+
+struct flash_tlv {
+	uint16_t type;
+	uint16_t len; /* bytes of val, without padding */
+	uint8_t val[];
+};
 
 /* UDS Control path APIs*/
 
@@ -107,4 +191,61 @@ int flash__recv_fd(int sockfd, int *_fd);
  */
 int flash__send_fd(int sockfd, int fd);
 
+/* UDS message APIs */
+
+/**
+ * Initialise a message header in front of an empty TLV area
+ *
+ * @param hdr The header at the start of the message buffer
+ * @param status 0, or a negative errno for an error reply
+ */
+void flash__msg_init(struct flash_msg_hdr *hdr, int status);
+
+/**
+ * Append a TLV to a message
+ *
+ * @param hdr The header at the start of the message buffer
+ * @param size Size of the whole message buffer in bytes
+ * @param type The TLV type
+ * @param val Pointer to the value
+ * @param len Size of the value in bytes
+ *
+ * @return 0 on success, -1 if the message buffer is full
+ */
+int flash__msg_put(struct flash_msg_hdr *hdr, int size, uint16_t type, const void *val, uint16_t len);
+
+/**
+ * Walk the TLVs of a received message
+ *
+ * @param hdr The header at the start of the message buffer
+ * @param tlv The previous TLV, or NULL for the first one
+ *
+ * @return The next TLV, or NULL at the end of the message
+ */
+struct flash_tlv *flash__msg_next(struct flash_msg_hdr *hdr, struct flash_tlv *tlv);
+
+/**
+ * Send a message and its file descriptors in a single sendmsg()
+ *
+ * @param sockfd The socket file descriptor
+ * @param hdr The header at the start of the message buffer
+ * @param fds The file descriptors to pass, hdr->nr_fds of them
+ *
+ * @return 0 on success, -1 on error
+ */
+int flash__send_msg(int sockfd, struct flash_msg_hdr *hdr, const int *fds);
+
+/**
+ * Receive a message and the file descriptors passed with it
+ *
+ * @param sockfd The socket file descriptor
+ * @param hdr The header at the start of the message buffer
+ * @param size Size of the whole message buffer in bytes
+ * @param fds Array where the received file descriptors will be stored
+ * @param max_fds Number of entries in fds
+ *
+ * @return 0 on success, -1 on error; no fds are left open on error
+ */
+int flash__recv_msg(int sockfd, struct flash_msg_hdr *hdr, int size, int *fds, int max_fds);
+
 #endif /* __FLASH_UDS_H */
@@ -30,7 +30,19 @@
 
 #define MS_PER_S 1000
 
-#define FLASH_MAX_XSK 64
+/*
+ * NF IDs are below FLASH_MAX_NF, which sizes the pollout status map shared
+ * by the NFs of a UMEM. An NF has at most FLASH_MAX_SOCKETS sockets, as the
+ * monitor hands them over in one SCM_RIGHTS message together with three
+ * more fds and the kernel takes at most 253. Edges are numbered in 16 bits
+ * of the descriptor options, so an NF has fewer than 65536.
+ */
+#define FLASH_MAX_NF 1024
+#define FLASH_MAX_SOCKETS 250
+#define FLASH_MAX_EDGES FLASH_MAX_NF
+
+struct flash_telemetry;
+struct flash_telemetry_socket;
 
 struct xsk_config {
 	uint32_t bind_flags;
@@ -46,7 +58,7 @@ struct xsk_config {
 
 struct umem_config {
 	void *buffer;
-	int size;
+	uint64_t size;
 	int frame_size;
 	int flags;
 };
@@ -82,6 +94,11 @@ struct config {
 	int prev_size;
 	bool track_tx_budget;
 	int max_outstanding_tx;
+	uint16_t *frame_edge; /* edge each frame in flight was sent on, by frame number */
+	uint32_t frame_shift;
+	bool takeover;
+	uint32_t route_gen;
+	int active_sockets;
 #ifdef STATS
 	clockid_t clock;
 	int verbose;
@@ -90,6 +107,8 @@ struct config {
 	uint32_t irq_no;
 	bool app_stats;
 	bool extra_stats;
+	int telemetry_fd;
+	struct flash_telemetry *telemetry;
 #endif
 };
 
@@ -175,6 +194,12 @@ struct xsk_app_stats {
 };
 #endif
 
+/* Tx budget of an edge, both counters together so a packet touches one cache line. */
+struct flash_edge {
+	int max_outstanding_tx;
+	int outstanding;
+};
+
 struct socket {
 	int fd;
 	uint8_t ifqueue;
@@ -187,9 +212,10 @@ struct socket {
 	bool idle;
 	void *flash_pool;
 	uint32_t outstanding_tx;
+	uint32_t route_gen;
 	uint64_t idle_timestamp;
-	int per_edge_max_outstanding_tx[FLASH_MAX_XSK];
-	int per_edge_outstanding[FLASH_MAX_XSK];
+	struct flash_edge *edge;
+	int nr_edges;
 	int* completed_tx_descs;
 	int completed_idx;
 #ifdef STATS
@@ -200,6 +226,10 @@ struct socket {
 	struct xsk_app_stats app_stats_prev;
 	struct xsk_driver_stats drv_stats_prev;
 	size_t timestamp;
+	struct flash_telemetry_socket *telemetry;
+	uint64_t *telemetry_edge_tx;
+	uint32_t telemetry_nr_edges;
+	uint64_t batch_tsc;
 #endif
 };
 
@@ -211,6 +241,8 @@ struct thread {
 	struct xsk_socket *xsk;
 };
 
+struct autoscale_state;
+
 struct nf {
 	int id;
 	char ip[INET_ADDRSTRLEN];
@@ -219,10 +251,15 @@ struct nf {
 	int next_size;
 	int *prev;
 	int prev_size;
+	unsigned int route_gen;
 	struct thread **thread;
 	bool is_up;
 	int thread_count;
 	int current_thread_count;
+	int min_threads;
+	int active_threads;
+	unsigned int scale_gen;
+	struct autoscale_state *autoscale;
 };
 
 struct umem {
@@ -230,6 +267,7 @@ struct umem {
 	struct nf **nf;
 	int nf_count;
 	int current_nf_count;
+	bool warm_pool;
 	struct xsk_umem_info *umem_info;
 	struct config *cfg;
 };
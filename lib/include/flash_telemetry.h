@@ -0,0 +1,87 @@
+/* SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) 2025 Debojeet Das
+ *
+ * Telemetry region: one memfd per NF instance, created by the monitor and
+ * handed to the NF in its bootstrap reply. The NF publishes the counters of
+ * each socket into it and the monitor reads them without asking the NF.
+ */
+#ifndef __FLASH_TELEMETRY_H
+#define __FLASH_TELEMETRY_H
+
+#include <stdint.h>
+
+#define FLASH_TELEMETRY_MAGIC 0x464c5354 /* "FLST" */
+#define FLASH_TELEMETRY_VERSION 3
+/* bucket i counts batches that took [2^i, 2^(i+1)) timer cycles */
+#define FLASH_TELEMETRY_HIST_BUCKETS 32
+
+/*
+ * The NF's stats thread copies the counters in under seq, odd while it
+ * writes; readers retry until they see the same even seq before and after.
+ * The batch histogram and the edge counters are written by the datapath
+ * thread directly and only ever grow, so they are read without seq.
+ */
+struct flash_telemetry_socket {
+	uint32_t seq;
+	uint32_t ifqueue;
+	/* ring_stats */
+	uint64_t rx_npkts;
+	uint64_t rx_frags;
+	uint64_t tx_npkts;
+	uint64_t tx_frags;
+	uint64_t drop_npkts;
+	/* XDP_STATISTICS */
+	uint64_t rx_dropped;
+	uint64_t rx_invalid_descs;
+	uint64_t tx_invalid_descs;
+	uint64_t rx_ring_full;
+	uint64_t rx_fill_ring_empty_descs;
+	uint64_t tx_ring_empty_descs;
+	/* app_stats */
+	uint64_t rx_empty_polls;
+	uint64_t fill_fail_polls;
+	uint64_t copy_tx_sendtos;
+	uint64_t tx_wakeup_sendtos;
+	uint64_t backpressure;
+	uint64_t opt_polls;
+	/* ring occupancy when published */
+	uint32_t rx_ring_used;
+	uint32_t rx_ring_size;
+	uint32_t tx_ring_used;
+	uint32_t tx_ring_size;
+	/* packets sent on edges past nr_edges, added to the route later */
+	uint64_t edge_tx_other;
+	/* from flash__recvmsg() returning a batch to it being sent or dropped */
+	uint64_t batch_cycles_sum;
+	uint64_t batch_cycles[FLASH_TELEMETRY_HIST_BUCKETS];
+} __attribute__((aligned(64)));
+
+struct flash_telemetry {
+	uint32_t magic;
+	uint32_t version;
+	int32_t umem_id; /* set by the monitor */
+	int32_t nf_id;
+	uint32_t nr_sockets;
+	uint32_t nr_edges; /* edge counters per socket, the NF's next list when created */
+	int32_t pid; /* set by the NF */
+	uint64_t timer_hz; /* cycles per second of the batch histogram */
+	uint64_t published_ns; /* CLOCK_MONOTONIC of the last publish, 0 before */
+	struct flash_telemetry_socket socket[];
+} __attribute__((aligned(64)));
+
+/*
+ * The edge counters follow the sockets, nr_edges per socket in socket order:
+ * packets sent on each edge, by index into the NF's next list.
+ */
+static inline uint64_t flash_telemetry_size(uint32_t nr_sockets, uint32_t nr_edges)
+{
+	return sizeof(struct flash_telemetry) + nr_sockets * sizeof(struct flash_telemetry_socket) +
+	       (uint64_t)nr_sockets * nr_edges * sizeof(uint64_t);
+}
+
+static inline uint64_t *flash_telemetry_edge_tx(struct flash_telemetry *tm, uint32_t socket)
+{
+	return (uint64_t *)&tm->socket[tm->nr_sockets] + (uint64_t)socket * tm->nr_edges;
+}
+
+#endif /* __FLASH_TELEMETRY_H */
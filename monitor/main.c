@@ -7,7 +7,12 @@
 #include <bpf/libbpf.h>
 #include <linux/if_link.h>
 #include <stdlib.h>
-#include <poll.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <flash_monitor.h>
 #include <flash_uds.h>
@@ -25,160 +30,870 @@ static void int_exit(int sig)
 	done = true;
 }
 
-static void *handle_nf(void *arg)
+/*
+ * NF control connections are served from one epoll loop instead of a
+ * thread per NF. Each connection is a small state machine fed by
+ * non-blocking reads: a command word, then the nf_data payload for
+ * FLASH__GET_UMEM or a message for FLASH__BOOTSTRAP. Replies go to a
+ * per-connection out-queue that is written without blocking and drained on
+ * EPOLLOUT, so an NF that stops reading cannot stall the others; once it
+ * has CTRL_MAX_OUT_BYTES unread, its connection is dropped. Serving every
+ * NF from one thread also serialises configure_umem() and
+ * create_new_socket(), which update the shared UMEM bookkeeping.
+ */
+#define CTRL_MAX_EVENTS 64
+#define CTRL_TIMEOUT_MS 100
+/* warm pool sockets bound per idle tick, small enough not to delay an NF */
+#define CTRL_PREWARM_BUDGET 4
+/* how long the running instance of an NF has to stop for its successor */
+#define CTRL_TAKEOVER_TIMEOUT_MS 5000
+/* reply bytes an NF may leave unread before it is disconnected */
+#define CTRL_MAX_OUT_BYTES (256 * 1024)
+
+enum nf_conn_state {
+	NF_CONN_CMD,
+	NF_CONN_PAYLOAD,
+	NF_CONN_MSG_HDR,
+	NF_CONN_MSG_BODY,
+};
+
+/* queued reply bytes; the fds travel with the first byte */
+struct out_chunk {
+	struct list_head list;
+	int fds[FLASH__MSG_MAX_FDS];
+	int nr_fds;
+	size_t len;
+	size_t off;
+	uint8_t buf[];
+};
+
+struct nf_conn {
+	int fd;
+	enum nf_conn_state state;
+	int cmd;
+	union {
+		int cmd;
+		struct nf_data data;
+		struct flash_msg_hdr msg;
+		uint8_t buf[sizeof(struct flash_msg_hdr) + FLASH__BOOT_MAX_REQ];
+	} in;
+	int in_len;
+	int in_need;
+	struct nf_data data;
+	struct umem *umem;
+	struct list_head list;
+	/* the running instance of its NF, the one holding the sockets */
+	bool owner;
+	/* hot upgrade in progress: the owner and the instance taking over */
+	struct nf_conn *successor;
+	struct nf_conn *predecessor;
+	bool takeover_wait;
+	uint64_t takeover_deadline;
+	/* route and scale generations of the NF the instance last heard of */
+	unsigned int route_gen;
+	unsigned int scale_gen;
+	/* replies not yet taken by the NF */
+	struct list_head out;
+	size_t out_bytes;
+	bool out_polled;
+	/* failed or stalled, closed once the current events are handled */
+	bool broken;
+};
+
+static LIST_HEAD(conns);
+static int nr_conns;
+static int nr_takeovers;
+static int ctrl_epfd = -1;
+
+static uint64_t now_ms(void)
 {
-	int msgsock = *(int *)arg;
-	free(arg);
-	struct nf_data *data = calloc(1, sizeof(struct nf_data));
-	struct umem *umem = NULL;
-	int cmd = -1;
+	struct timespec ts;
 
-	do {
-		log_info("Waiting for command...");
-		cmd = flash__recv_cmd(msgsock);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * MS_PER_S + ts.tv_nsec / 1000000;
+}
 
-		switch (cmd) {
-		case FLASH__GET_UMEM:
-			flash__recv_data(msgsock, data, sizeof(struct nf_data));
-			if (configure_umem(data, &umem) == -1) {
+static struct nf_conn *find_owner(struct nf_data *data)
+{
+	struct nf_conn *conn;
+
+	list_for_each_entry(conn, &conns, list) {
+		if (conn->owner && conn->data.umem_id == data->umem_id && conn->data.nf_id == data->nf_id)
+			return conn;
+	}
+	return NULL;
+}
+
+static void out_chunk_free(struct out_chunk *chunk)
+{
+	for (int i = 0; i < chunk->nr_fds; i++)
+		close(chunk->fds[i]);
+	list_del(&chunk->list);
+	free(chunk);
+}
+
+static void conn_break(struct nf_conn *conn, const char *why)
+{
+	if (conn->broken)
+		return;
+	log_error("Dropping NF %d of UMEM %d: %s", conn->data.nf_id, conn->data.umem_id, why);
+	conn->broken = true;
+}
+
+/* Watch for EPOLLOUT only while replies are waiting. */
+static void conn_poll_out(struct nf_conn *conn)
+{
+	struct epoll_event ev;
+	bool want = !list_empty(&conn->out);
+
+	if (want == conn->out_polled || conn->broken)
+		return;
+
+	ev.events = EPOLLIN | EPOLLRDHUP | (want ? EPOLLOUT : 0);
+	ev.data.ptr = conn;
+	if (epoll_ctl(ctrl_epfd, EPOLL_CTL_MOD, conn->fd, &ev) < 0) {
+		conn_break(conn, strerror(errno));
+		return;
+	}
+	conn->out_polled = want;
+}
+
+/* Write as much of the out-queue as the socket takes now. */
+static void conn_flush(struct nf_conn *conn)
+{
+	char cms[CMSG_SPACE(sizeof(int) * FLASH__MSG_MAX_FDS)];
+	struct msghdr msgh;
+	struct out_chunk *chunk;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	ssize_t n;
+
+	while (!conn->broken && !list_empty(&conn->out)) {
+		chunk = list_first_entry(&conn->out, struct out_chunk, list);
+
+		memset(&msgh, 0, sizeof(msgh));
+		iov.iov_base = chunk->buf + chunk->off;
+		iov.iov_len = chunk->len - chunk->off;
+		msgh.msg_iov = &iov;
+		msgh.msg_iovlen = 1;
+		if (chunk->nr_fds) {
+			memset(cms, 0, sizeof(cms));
+			msgh.msg_control = cms;
+			msgh.msg_controllen = CMSG_SPACE(sizeof(int) * chunk->nr_fds);
+			cmsg = CMSG_FIRSTHDR(&msgh);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int) * chunk->nr_fds);
+			memcpy(CMSG_DATA(cmsg), chunk->fds, sizeof(int) * chunk->nr_fds);
+		}
+
+		n = sendmsg(conn->fd, &msgh, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
 				continue;
-			}
-			flash__send_fd(msgsock, umem->cfg->umem_fd);
-			flash__send_data(msgsock, &umem->nf[data->nf_id]->thread_count, sizeof(int));
-			flash__send_data(msgsock, &umem->cfg->umem->size, sizeof(int));
-			flash__send_data(msgsock, &umem->cfg->umem_scale, sizeof(int));
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				conn_break(conn, strerror(errno));
 			break;
+		}
 
-		case FLASH__CREATE_SOCKET:
-			if (umem != NULL) {
-				struct socket *sock = create_new_socket(umem, data->nf_id);
-				flash__send_fd(msgsock, sock->fd);
-				flash__send_data(msgsock, &sock->ifqueue, sizeof(int));
-			}
-			break;
+		/* the NF holds its own references once the first byte is out */
+		for (int i = 0; i < chunk->nr_fds; i++)
+			close(chunk->fds[i]);
+		chunk->nr_fds = 0;
 
-		case FLASH__GET_UMEM_OFFSET:
-			int offset = data->nf_id * umem->nf[data->nf_id]->thread_count + umem->nf[data->nf_id]->current_thread_count;
-			flash__send_data(msgsock, &offset, sizeof(int));
-			break;
+		chunk->off += n;
+		conn->out_bytes -= n;
+		if (chunk->off == chunk->len)
+			out_chunk_free(chunk);
+	}
 
-		case FLASH__GET_ROUTE_INFO:
-			flash__send_data(msgsock, &umem->nf[data->nf_id]->next_size, sizeof(int));
-			break;
+	conn_poll_out(conn);
+}
 
-		case FLASH__GET_BIND_FLAGS:
-			flash__send_data(msgsock, &umem->cfg->xsk->bind_flags, sizeof(__u32));
-			break;
+/**
+ * Queue a reply for the NF and write what the socket takes now.
+ *
+ * @return 0 once queued, -1 if the connection is being dropped.
+ */
+static int conn_send(struct nf_conn *conn, const void *buf, size_t len, const int *fds, int nr_fds)
+{
+	struct out_chunk *chunk;
 
-		case FLASH__GET_XDP_FLAGS:
-			flash__send_data(msgsock, &umem->cfg->xsk->xdp_flags, sizeof(__u32));
-			break;
+	if (conn->broken)
+		return -1;
 
-		case FLASH__GET_MODE:
-			flash__send_data(msgsock, &umem->cfg->xsk->mode, sizeof(__u32));
-			break;
+	if (conn->out_bytes + len > CTRL_MAX_OUT_BYTES) {
+		conn_break(conn, "stopped reading its replies");
+		return -1;
+	}
 
-		case FLASH__GET_POLL_TIMEOUT:
-			flash__send_data(msgsock, &umem->cfg->xsk->poll_timeout, sizeof(int));
-			break;
+	chunk = calloc(1, sizeof(*chunk) + len);
+	if (!chunk) {
+		conn_break(conn, "out of memory for its replies");
+		return -1;
+	}
+	memcpy(chunk->buf, buf, len);
+	chunk->len = len;
+	/* the caller may close its fds before they are sent */
+	for (; chunk->nr_fds < nr_fds; chunk->nr_fds++) {
+		chunk->fds[chunk->nr_fds] = fcntl(fds[chunk->nr_fds], F_DUPFD_CLOEXEC, 0);
+		if (chunk->fds[chunk->nr_fds] < 0) {
+			INIT_LIST_HEAD(&chunk->list);
+			out_chunk_free(chunk);
+			conn_break(conn, strerror(errno));
+			return -1;
+		}
+	}
 
-		case FLASH__GET_FRAGS_ENABLED:
-			flash__send_data(msgsock, &umem->cfg->frags_enabled, sizeof(bool));
-			break;
+	list_add_tail(&chunk->list, &conn->out);
+	conn->out_bytes += len;
+	conn_flush(conn);
 
-		case FLASH__GET_IFNAME:
-			flash__send_data(msgsock, &umem->cfg->ifname, IF_NAMESIZE);
-			break;
+	return conn->broken ? -1 : 0;
+}
 
-		case FLASH__GET_IP_ADDR:
-			flash__send_data(msgsock, umem->nf[data->nf_id]->ip, INET_ADDRSTRLEN);
-			log_info("NF IP: %s", umem->nf[data->nf_id]->ip);
-			break;
+static int conn_send_cmd(struct nf_conn *conn, int cmd)
+{
+	return conn_send(conn, &cmd, sizeof(int), NULL, 0);
+}
 
-		case FLASH__GET_DST_IP_ADDR:
-			flash__send_data(msgsock, &umem->nf[data->nf_id]->next_size, sizeof(int));
-			log_info("Number of Backends: %d", umem->nf[data->nf_id]->next_size);
-			for (int i = 0; i < umem->nf[data->nf_id]->next_size; i++) {
-				log_info("Sending IP %s", umem->nf[umem->nf[data->nf_id]->next[i]]->ip);
-				log_info("Next NF: %d", umem->nf[data->nf_id]->next[i]);
-				flash__send_data(msgsock, umem->nf[umem->nf[data->nf_id]->next[i]]->ip, INET_ADDRSTRLEN);
-			}
+static int conn_send_data(struct nf_conn *conn, const void *data, size_t size)
+{
+	return conn_send(conn, data, size, NULL, 0);
+}
+
+/* same wire format as flash__send_fd(): 'y' with the fd, or 'n' for -1 */
+static int conn_send_fd(struct nf_conn *conn, int fd)
+{
+	return conn_send(conn, fd == -1 ? "n" : "y", 1, &fd, fd != -1);
+}
+
+static int conn_send_msg(struct nf_conn *conn, struct flash_msg_hdr *hdr, const int *fds)
+{
+	if (hdr->nr_fds > FLASH__MSG_MAX_FDS) {
+		log_error("Too many fds for one message: %u", hdr->nr_fds);
+		return -1;
+	}
+	return conn_send(conn, hdr, sizeof(*hdr) + hdr->len, fds, hdr->nr_fds);
+}
+
+static int route_msg(struct nf *nf, struct flash_msg_hdr *hdr, size_t size)
+{
+	int err = 0;
+
+	err |= flash__msg_put(hdr, size, FLASH__BOOT_NEXT_SIZE, &nf->next_size, sizeof(int));
+	err |= flash__msg_put(hdr, size, FLASH__BOOT_PREV_NF, nf->prev, nf->prev_size * sizeof(int));
+	return err;
+}
+
+/* Tell every running instance whose edges or active sockets changed since it last heard. */
+static void notify_nfs(void)
+{
+	union {
+		struct flash_msg_hdr hdr;
+		uint8_t buf[FLASH__MSG_MAX_LEN];
+	} out;
+	struct nf_conn *conn;
+	unsigned int gen;
+	struct nf *nf;
+
+	list_for_each_entry(conn, &conns, list) {
+		if (!conn->owner || !conn->umem)
+			continue;
+		nf = find_nf(conn->umem, conn->data.nf_id);
+
+		gen = __atomic_load_n(&nf->scale_gen, __ATOMIC_ACQUIRE);
+		if (gen != conn->scale_gen) {
+			if (conn_send_cmd(conn, FLASH__SCALE) < 0 ||
+			    conn_send_data(conn, &nf->active_threads, sizeof(int)) < 0)
+				log_warn("Could not send active sockets to NF %d", conn->data.nf_id);
+			else
+				conn->scale_gen = gen;
+		}
+
+		gen = __atomic_load_n(&nf->route_gen, __ATOMIC_ACQUIRE);
+		if (gen == conn->route_gen)
+			continue;
+
+		flash__msg_init(&out.hdr, 0);
+		if (route_msg(nf, &out.hdr, sizeof(out)) < 0)
+			continue;
+		if (conn_send_cmd(conn, FLASH__ROUTE_UPDATE) < 0 || conn_send_msg(conn, &out.hdr, NULL) < 0) {
+			log_warn("Could not send route update to NF %d", conn->data.nf_id);
+			continue;
+		}
+		conn->route_gen = gen;
+		log_info("NF %d of UMEM %d: %d next, %d previous NFs", conn->data.nf_id, conn->data.umem_id, nf->next_size,
+			 nf->prev_size);
+	}
+}
+
+static void takeover_reply(struct nf_conn *conn, int status)
+{
+	conn->takeover_wait = false;
+	nr_takeovers--;
+	conn_send_data(conn, &status, sizeof(int));
+}
+
+/*
+ * The NF is done with its UMEM. An owner with a successor waiting hands
+ * its sockets over instead of parking or deleting them, and a successor
+ * that never took over holds nothing but its UMEM reference.
+ */
+static void conn_release(struct nf_conn *conn)
+{
+	struct nf_conn *next = conn->successor;
+
+	telemetry_destroy(conn);
+	if (!conn->umem)
+		return;
+
+	if (conn->owner && next) {
+		handover_nf(conn->umem, conn->data.nf_id);
+		next->predecessor = NULL;
+		next->owner = true;
+		if (next->takeover_wait)
+			takeover_reply(next, 0);
+		/* routes may have changed while the successor waited */
+		notify_nfs();
+		log_info("NF %d of UMEM %d taken over", conn->data.nf_id, conn->data.umem_id);
+	} else if (conn->owner) {
+		close_nf(conn->umem, conn->data.umem_id, conn->data.nf_id);
+	} else {
+		if (conn->predecessor)
+			conn->predecessor->successor = NULL;
+		if (conn->takeover_wait) {
+			conn->takeover_wait = false;
+			nr_takeovers--;
+		}
+		if (conn->umem->current_nf_count > 0)
+			conn->umem->current_nf_count--;
+	}
+
+	conn->owner = false;
+	conn->successor = NULL;
+	conn->predecessor = NULL;
+	conn->umem = NULL;
+}
+
+/* A running instance that does not stop in time keeps its NF. */
+static void expire_takeovers(void)
+{
+	uint64_t now = now_ms();
+	struct nf_conn *conn;
+
+	list_for_each_entry(conn, &conns, list) {
+		if (!conn->takeover_wait || now < conn->takeover_deadline)
+			continue;
+		log_error("NF %d of UMEM %d did not hand over in %d ms", conn->data.nf_id, conn->data.umem_id,
+			  CTRL_TAKEOVER_TIMEOUT_MS);
+		conn->predecessor->successor = NULL;
+		conn->predecessor = NULL;
+		takeover_reply(conn, -ETIMEDOUT);
+	}
+}
+
+static void conn_expect(struct nf_conn *conn, enum nf_conn_state state, int need)
+{
+	conn->state = state;
+	conn->in_len = 0;
+	conn->in_need = need;
+}
+
+static void conn_close(int epfd, struct nf_conn *conn, bool release)
+{
+	/* an NF that went away without FLASH__CLOSE_CONN still holds sockets */
+	if (release && conn->umem) {
+		log_warn("NF %d of UMEM %d disconnected without closing", conn->data.nf_id, conn->data.umem_id);
+		conn_release(conn);
+	}
+
+	while (!list_empty(&conn->out))
+		out_chunk_free(list_first_entry(&conn->out, struct out_chunk, list));
+
+	list_del(&conn->list);
+	epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	close(conn->fd);
+	log_info("Closing NF %d...", conn->data.nf_id);
+	free(conn);
+	nr_conns--;
+}
+
+static int boot_reply_error(struct nf_conn *conn, int status)
+{
+	struct flash_msg_hdr hdr;
+
+	flash__msg_init(&hdr, status);
+	conn_send_msg(conn, &hdr, NULL);
+	return -1;
+}
+
+/* The whole of flash__configure_nf()'s setup in one reply. */
+static int handle_bootstrap(struct nf_conn *conn)
+{
+	union {
+		struct flash_msg_hdr hdr;
+		uint8_t buf[FLASH__MSG_MAX_LEN];
+	} out;
+	struct flash_msg_hdr *req = &conn->in.msg;
+	struct nf_data *data = &conn->data;
+	int fds[FLASH__MSG_MAX_FDS], ifqueue[FLASH_MAX_SOCKETS];
+	struct flash_tlv *tlv = NULL;
+	struct nf_conn *owner;
+	struct umem *umem = NULL;
+	struct nf *nf;
+	int offset, tfd, ret, takeover = 0, err = 0;
+
+	if (req->version != FLASH__BOOT_VERSION) {
+		log_error("NF speaks bootstrap version %d, monitor %d", req->version, FLASH__BOOT_VERSION);
+		return boot_reply_error(conn, -EPROTO);
+	}
+
+	data->umem_id = -1;
+	data->nf_id = -1;
+	while ((tlv = flash__msg_next(req, tlv))) {
+		if (tlv->type == FLASH__BOOT_UMEM_ID && tlv->len == sizeof(int))
+			memcpy(&data->umem_id, tlv->val, sizeof(int));
+		else if (tlv->type == FLASH__BOOT_NF_ID && tlv->len == sizeof(int))
+			memcpy(&data->nf_id, tlv->val, sizeof(int));
+		else if (tlv->type == FLASH__BOOT_TAKEOVER && tlv->len == sizeof(int))
+			memcpy(&takeover, tlv->val, sizeof(int));
+	}
+
+	owner = find_owner(data);
+	if (owner && (!takeover || owner->successor)) {
+		log_error("NF %d of UMEM %d is already running", data->nf_id, data->umem_id);
+		return boot_reply_error(conn, -EBUSY);
+	}
+
+	if (conn->umem != NULL || configure_umem(data, &umem) == -1)
+		return boot_reply_error(conn, -ENOENT);
+	conn->umem = umem;
+	conn->owner = !owner;
+	nf = find_nf(umem, data->nf_id);
+	conn->route_gen = __atomic_load_n(&nf->route_gen, __ATOMIC_ACQUIRE);
+	conn->scale_gen = __atomic_load_n(&nf->scale_gen, __ATOMIC_ACQUIRE);
+
+	if (nf->thread_count > FLASH_MAX_SOCKETS) {
+		log_error("NF %d has %d threads, more than %d", data->nf_id, nf->thread_count, FLASH_MAX_SOCKETS);
+		return boot_reply_error(conn, -E2BIG);
+	}
+
+	/* the NF's frame range in this UMEM, same for every instance of it */
+	offset = nf->thread[0]->umem_offset;
+
+	fds[FLASH__BOOT_FD_UMEM] = umem->cfg->umem_fd;
+	fds[FLASH__BOOT_FD_POLLOUT] = umem->cfg->nf_pollout_status_fd;
+	for (int i = 0; i < nf->thread_count; i++) {
+		/* a successor gets the running instance's sockets as they are */
+		struct socket *sock = owner ? nf->thread[i]->socket : create_new_socket(umem, data->nf_id);
+		if (!sock)
+			return boot_reply_error(conn, -EIO);
+		fds[FLASH__BOOT_FD_SOCKET + i] = sock->fd;
+		ifqueue[i] = sock->ifqueue;
+	}
+
+	if (owner) {
+		owner->successor = conn;
+		conn->predecessor = owner;
+	}
+	takeover = owner != NULL;
+
+	/* this instance's counters, unmapped with its connection */
+	tfd = telemetry_create(conn, data->umem_id, data->nf_id, nf->thread_count, nf->next_size);
+	fds[FLASH__BOOT_FD_SOCKET + nf->thread_count] = tfd;
+
+	flash__msg_init(&out.hdr, 0);
+	out.hdr.nr_fds = FLASH__BOOT_FD_SOCKET + nf->thread_count + (tfd >= 0);
+	err |= flash__msg_put(&out.hdr, sizeof(out), FLASH__BOOT_TOTAL_SOCKETS, &nf->thread_count, sizeof(int));
+	err |= flash__msg_put(&out.hdr, sizeof(out), FLASH__BOOT_UMEM_SIZE, &umem->cfg->umem->size, sizeof(uint64_t));
+	err |= flash__msg_put(&out.hdr, sizeof(out), FLASH__BOOT_UMEM_SCALE, &umem->cfg->umem_scale, sizeof(int));
+	err |= flash__msg_put(&out.hdr, sizeof(out), FLASH__BOOT_UMEM_OFFSET, &offset, sizeof(int));
+	err |= flash__msg_put(&out.hdr, sizeof(out), FLASH__BOOT_IFQUEUE, ifqueue, nf->thread_count * sizeof(int));
+	err |= flash__msg_put(&out.hdr, sizeof(out), FLASH__BOOT_BIND_FLAGS, &umem->cfg->xsk->bind_flags, sizeof(__u32));
+	err |= flash__msg_put(&out.hdr, sizeof(out), FLASH__BOOT_XDP_FLAGS, &umem->cfg->xsk->xdp_flags, sizeof(__u32));
+	err |= flash__msg_put(&out.hdr, sizeof(out), FLASH__BOOT_MODE, &umem->cfg->xsk->mode, sizeof(__u32));
+	err |= flash__msg_put(&out.hdr, sizeof(out), FLASH__BOOT_POLL_TIMEOUT, &umem->cfg->xsk->poll_timeout, sizeof(int));
+	err |= flash__msg_put(&out.hdr, sizeof(out), FLASH__BOOT_FRAGS_ENABLED, &umem->cfg->frags_enabled, sizeof(bool));
+	err |= flash__msg_put(&out.hdr, sizeof(out), FLASH__BOOT_IFNAME, umem->cfg->ifname, IF_NAMESIZE);
+	err |= flash__msg_put(&out.hdr, sizeof(out), FLASH__BOOT_POLLOUT_SIZE, &umem->cfg->nf_pollout_status_size,
+			      sizeof(int));
+	err |= route_msg(nf, &out.hdr, sizeof(out));
+	err |= flash__msg_put(&out.hdr, sizeof(out), FLASH__BOOT_ACTIVE_SOCKETS, &nf->active_threads, sizeof(int));
+	err |= flash__msg_put(&out.hdr, sizeof(out), FLASH__BOOT_TAKEOVER, &takeover, sizeof(int));
+	if (err) {
+		if (tfd >= 0)
+			close(tfd);
+		return boot_reply_error(conn, -EMSGSIZE);
+	}
+
+	log_info("Bootstrapped NF %d of UMEM %d: %d sockets%s, %u bytes", data->nf_id, data->umem_id, nf->thread_count,
+		 owner ? " to take over" : "", out.hdr.len);
+
+	ret = conn_send_msg(conn, &out.hdr, fds);
+	if (tfd >= 0)
+		close(tfd);
+	return ret;
+}
+
+/**
+ * Run one command for an NF.
+ *
+ * @return 0 to keep the connection, 1 once the NF has closed it, -1 on a
+ *         protocol error.
+ */
+static int handle_cmd(struct nf_conn *conn)
+{
+	struct umem *umem = conn->umem;
+	struct nf_data *data = &conn->data;
+	int cmd = conn->cmd;
+
+	struct nf *nf;
+
+	if (cmd == FLASH__GET_UMEM) {
+		*data = conn->in.data;
+		if (configure_umem(data, &umem) == -1)
+			return -1;
+		nf = find_nf(umem, data->nf_id);
+		conn->umem = umem;
+		conn->owner = !find_owner(data);
+		conn->route_gen = __atomic_load_n(&nf->route_gen, __ATOMIC_ACQUIRE);
+		conn->scale_gen = __atomic_load_n(&nf->scale_gen, __ATOMIC_ACQUIRE);
+		conn_send_fd(conn, umem->cfg->umem_fd);
+		conn_send_data(conn, &nf->thread_count, sizeof(int));
+		conn_send_data(conn, &umem->cfg->umem->size, sizeof(uint64_t));
+		conn_send_data(conn, &umem->cfg->umem_scale, sizeof(int));
+		return 0;
+	}
+
+	if (cmd == FLASH__BOOTSTRAP)
+		return handle_bootstrap(conn);
+
+	if (umem == NULL) {
+		log_error("Command %d before FLASH__GET_UMEM", cmd);
+		return -1;
+	}
+	nf = find_nf(umem, data->nf_id);
+
+	switch (cmd) {
+	case FLASH__CREATE_SOCKET: {
+		struct socket *sock = create_new_socket(umem, data->nf_id);
+		if (!sock) {
+			conn_send_fd(conn, -1);
+			return -1;
+		}
+		conn_send_fd(conn, sock->fd);
+		conn_send_data(conn, &sock->ifqueue, sizeof(int));
+		break;
+	}
+
+	case FLASH__GET_UMEM_OFFSET: {
+		int offset = nf->thread[0]->umem_offset + nf->current_thread_count;
+		conn_send_data(conn, &offset, sizeof(int));
+		break;
+	}
+
+	case FLASH__GET_ROUTE_INFO:
+		conn_send_data(conn, &nf->next_size, sizeof(int));
+		break;
+
+	case FLASH__GET_BIND_FLAGS:
+		conn_send_data(conn, &umem->cfg->xsk->bind_flags, sizeof(__u32));
+		break;
+
+	case FLASH__GET_XDP_FLAGS:
+		conn_send_data(conn, &umem->cfg->xsk->xdp_flags, sizeof(__u32));
+		break;
+
+	case FLASH__GET_MODE:
+		conn_send_data(conn, &umem->cfg->xsk->mode, sizeof(__u32));
+		break;
+
+	case FLASH__GET_POLL_TIMEOUT:
+		conn_send_data(conn, &umem->cfg->xsk->poll_timeout, sizeof(int));
+		break;
+
+	case FLASH__GET_FRAGS_ENABLED:
+		conn_send_data(conn, &umem->cfg->frags_enabled, sizeof(bool));
+		break;
+
+	case FLASH__GET_IFNAME:
+		conn_send_data(conn, &umem->cfg->ifname, IF_NAMESIZE);
+		break;
+
+	case FLASH__GET_IP_ADDR:
+		conn_send_data(conn, nf->ip, INET_ADDRSTRLEN);
+		log_info("NF IP: %s", nf->ip);
+		break;
+
+	case FLASH__GET_DST_IP_ADDR:
+		conn_send_data(conn, &nf->next_size, sizeof(int));
+		log_info("Number of Backends: %d", nf->next_size);
+		for (int i = 0; i < nf->next_size; i++) {
+			/* a next NF run by hand is in no UMEM and has no address */
+			struct nf *next = find_nf(umem, nf->next[i]) ?: find_nf(NULL, nf->next[i]);
+			char ip[INET_ADDRSTRLEN] = "0.0.0.0";
+
+			if (next)
+				memcpy(ip, next->ip, INET_ADDRSTRLEN);
+			log_info("Sending IP %s", ip);
+			log_info("Next NF: %d", nf->next[i]);
+			conn_send_data(conn, ip, INET_ADDRSTRLEN);
+		}
+		break;
+
+	case FLASH__GET_POLLOUT_STATUS:
+		conn_send_fd(conn, umem->cfg->nf_pollout_status_fd);
+		conn_send_data(conn, &umem->cfg->nf_pollout_status_size, sizeof(int));
+		log_info("SENT POLLOUT STATUS MEM_FD: %d", umem->cfg->nf_pollout_status_fd);
+		log_info("SENT POLLOUT STATUS MEM_SIZE: %d", umem->cfg->nf_pollout_status_size);
+		break;
+
+	case FLASH__GET_PREV_NF:
+		conn_send_data(conn, &nf->prev_size, sizeof(int));
+		log_info("Number of Previous NFs: %d", nf->prev_size);
+		for (int i = 0; i < nf->prev_size; i++) {
+			int prev_nf_id = nf->prev[i];
+			log_info("Sending Previous NF: %d", prev_nf_id);
+			conn_send_data(conn, &prev_nf_id, sizeof(int));
+		}
+		break;
+
+	case FLASH__TAKEOVER: {
+		int status = 0;
+
+		if (conn->takeover_wait)
+			return -1;
+		/* the running instance already left, or there was none */
+		if (conn->owner || !conn->predecessor) {
+			if (!conn->owner)
+				status = -ESRCH;
+			conn_send_data(conn, &status, sizeof(int));
 			break;
-		case FLASH__GET_POLLOUT_STATUS:
-			flash__send_fd(msgsock, umem->cfg->nf_pollout_status_fd);
-			flash__send_data(msgsock, &umem->cfg->nf_pollout_status_size, sizeof(int));
-			log_info("SENT POLLOUT STATUS MEM_FD: %d", umem->cfg->nf_pollout_status_fd);
-			log_info("SENT POLLOUT STATUS MEM_SIZE: %d", umem->cfg->nf_pollout_status_size);
+		}
+		log_info("NF %d of UMEM %d: asking the running instance to hand over", data->nf_id, data->umem_id);
+		if (conn_send_cmd(conn->predecessor, FLASH__HANDOVER) < 0) {
+			status = -EPIPE;
+			conn_send_data(conn, &status, sizeof(int));
 			break;
+		}
+		conn->takeover_wait = true;
+		conn->takeover_deadline = now_ms() + CTRL_TAKEOVER_TIMEOUT_MS;
+		nr_takeovers++;
+		break;
+	}
+
+	case FLASH__CLOSE_CONN:
+		conn_release(conn);
+		return 1;
+
+	default:
+		log_error("Received unknown command: %d", cmd);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Drain what the NF has sent; NFs wait for each reply, so this is rarely more than one command. */
+static void handle_conn(int epfd, struct nf_conn *conn)
+{
+	ssize_t n;
+	int ret;
+
+	while (!conn->broken) {
+		n = recv(conn->fd, (char *)&conn->in + conn->in_len, conn->in_need - conn->in_len, MSG_DONTWAIT);
+		if (n == 0) {
+			conn_close(epfd, conn, true);
+			return;
+		}
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			log_error("Error reading from NF %d: %s", conn->data.nf_id, strerror(errno));
+			conn_close(epfd, conn, true);
+			return;
+		}
 
-		case FLASH__GET_PREV_NF:
-			flash__send_data(msgsock, &umem->nf[data->nf_id]->prev_size, sizeof(int));
-			log_info("Number of Previous NFs: %d", umem->nf[data->nf_id]->prev_size);
-			for (int i = 0; i < umem->nf[data->nf_id]->prev_size; i++) {
-				int prev_nf_id = umem->nf[data->nf_id]->prev[i];
-				log_info("Sending Previous NF: %d", prev_nf_id);
-				flash__send_data(msgsock, &prev_nf_id, sizeof(int));
+		conn->in_len += n;
+		if (conn->in_len < conn->in_need)
+			continue;
+
+		if (conn->state == NF_CONN_CMD) {
+			conn->cmd = conn->in.cmd;
+			if (conn->cmd == FLASH__GET_UMEM) {
+				conn_expect(conn, NF_CONN_PAYLOAD, sizeof(struct nf_data));
+				continue;
 			}
-			break;
+			if (conn->cmd == FLASH__BOOTSTRAP) {
+				conn_expect(conn, NF_CONN_MSG_HDR, sizeof(struct flash_msg_hdr));
+				continue;
+			}
+		} else if (conn->state == NF_CONN_MSG_HDR) {
+			if (conn->in.msg.magic != FLASH__MSG_MAGIC || conn->in.msg.len > FLASH__BOOT_MAX_REQ) {
+				log_error("Malformed bootstrap request");
+				conn_close(epfd, conn, true);
+				return;
+			}
+			/* the TLVs land right after the header */
+			conn->state = NF_CONN_MSG_BODY;
+			conn->in_need += conn->in.msg.len;
+			if (conn->in_len < conn->in_need)
+				continue;
+		}
 
-		case FLASH__CLOSE_CONN:
-			close_nf(umem, data->umem_id, data->nf_id);
-			goto exit;
+		ret = handle_cmd(conn);
+		if (ret != 0) {
+			conn_close(epfd, conn, ret < 0);
+			return;
+		}
+		conn_expect(conn, NF_CONN_CMD, sizeof(int));
+	}
+}
 
-		default:
-			log_error("Received unknown command: %d\n", cmd);
-			exit(EXIT_FAILURE);
-			break;
+/* Connections that failed a write or stopped reading, closed outside the event loop. */
+static void reap_broken_conns(int epfd)
+{
+	struct nf_conn *conn, *tmp;
+
+	list_for_each_entry_safe(conn, tmp, &conns, list) {
+		if (conn->broken)
+			conn_close(epfd, conn, true);
+	}
+}
+
+static void accept_conns(int epfd)
+{
+	struct epoll_event ev;
+	struct nf_conn *conn;
+	int msgsock;
+
+	for (;;) {
+		msgsock = accept4(unix_socket_server, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (msgsock == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				log_error("Error accepting connection: %s", strerror(errno));
+			return;
 		}
-	} while (!done);
 
-exit:
-	close(msgsock);
-	log_info("Closing NF %d...", data->nf_id);
-	free(data);
-	return NULL;
+		conn = calloc(1, sizeof(struct nf_conn));
+		if (!conn) {
+			log_error("Memory allocation failed");
+			close(msgsock);
+			continue;
+		}
+		conn->fd = msgsock;
+		conn->data.nf_id = -1;
+		INIT_LIST_HEAD(&conn->out);
+		conn_expect(conn, NF_CONN_CMD, sizeof(int));
+		list_add(&conn->list, &conns);
+
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.ptr = conn;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, msgsock, &ev) < 0) {
+			log_error("Error adding NF connection to epoll: %s", strerror(errno));
+			list_del(&conn->list);
+			close(msgsock);
+			free(conn);
+			continue;
+		}
+		nr_conns++;
+	}
 }
 
 static void *worker__uds_server(void *arg)
 {
 	(void)arg;
+	struct epoll_event ev, events[CTRL_MAX_EVENTS];
+	bool prewarming = false;
+	uint64_t routes;
+	int epfd, n;
 
 	unix_socket_server = flash__start_uds_server();
-	struct pollfd fds[1] = {};
-	fds[0].fd = unix_socket_server;
-	fds[0].events = POLLIN;
-	int timeout = 100, ret;
+	if (unix_socket_server < 0)
+		return NULL;
+
+	if (fcntl(unix_socket_server, F_SETFL, fcntl(unix_socket_server, F_GETFL, 0) | O_NONBLOCK) < 0) {
+		log_error("Error setting UDS server non-blocking: %s", strerror(errno));
+		return NULL;
+	}
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		log_error("Error creating epoll instance: %s", strerror(errno));
+		return NULL;
+	}
+	ctrl_epfd = epfd;
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, unix_socket_server, &ev) < 0) {
+		log_error("Error adding UDS server to epoll: %s", strerror(errno));
+		close(epfd);
+		return NULL;
+	}
+
+	/* the prompt changes routes, this thread owns the NF connections */
+	route_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	ev.data.ptr = &route_event_fd;
+	if (route_event_fd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, route_event_fd, &ev) < 0)
+		log_warn("Route changes will not reach running NFs: %s", strerror(errno));
+
 	listen(unix_socket_server, MAX_NUM_OF_CLIENTS);
 	log_info("Waiting for NFs to connect...");
 
 	while (!done) {
-		ret = poll(fds, 1, timeout);
-		if (ret != 1 || !(fds[0].revents & POLLIN))
-			continue;
-
-		int *msgsock = malloc(sizeof(int));
-		if (!msgsock) {
-			log_error("Memory allocation failed");
-			continue;
+		n = epoll_wait(epfd, events, CTRL_MAX_EVENTS, prewarming ? 0 : CTRL_TIMEOUT_MS);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			log_error("epoll_wait failed: %s", strerror(errno));
+			break;
 		}
 
-		*msgsock = accept(unix_socket_server, NULL, NULL);
-		if (*msgsock == -1) {
-			log_error("Error accepting connection: %s", strerror(errno));
-			free(msgsock);
+		/* the prompt may not change routes while NFs are served from them */
+		pthread_mutex_lock(&route_lock);
+
+		if (nr_takeovers)
+			expire_takeovers();
+
+		if (autoscale(now_ms()) > 0)
+			notify_nfs();
+
+		telemetry_export(now_ms());
+		reap_broken_conns(epfd);
+
+		/* fill the warm socket pool only while no NF is waiting */
+		if (n == 0) {
+			pthread_mutex_unlock(&route_lock);
+			prewarming = prewarm_sockets(CTRL_PREWARM_BUDGET) > 0;
 			continue;
 		}
 
-		pthread_t thread;
-		if (pthread_create(&thread, NULL, handle_nf, msgsock)) {
-			log_error("Error creating UDS thread");
-			free(msgsock);
-			continue;
+		for (int i = 0; i < n; i++) {
+			if (events[i].data.ptr == NULL) {
+				accept_conns(epfd);
+			} else if (events[i].data.ptr == &route_event_fd) {
+				if (read(route_event_fd, &routes, sizeof(routes)) == sizeof(routes))
+					notify_nfs();
+			} else {
+				struct nf_conn *conn = events[i].data.ptr;
+
+				if (events[i].events & EPOLLOUT)
+					conn_flush(conn);
+				if (events[i].events & ~EPOLLOUT)
+					handle_conn(epfd, conn);
+			}
 		}
 
-		pthread_detach(thread);
+		reap_broken_conns(epfd);
+		pthread_mutex_unlock(&route_lock);
 	}
 
+	log_info("Control plane stopped with %d NF connections open", nr_conns);
+	close(epfd);
 	close(unix_socket_server);
 	return NULL;
 }
@@ -193,6 +908,10 @@ int main(int argc, char **argv)
 	signal(SIGINT, int_exit);
 	signal(SIGTERM, int_exit);
 	signal(SIGABRT, int_exit);
+	/* an NF exiting mid-reply must not take the monitor down */
+	signal(SIGPIPE, SIG_IGN);
+
+	telemetry_set_export(getenv("FLASH_TELEMETRY_FILE"));
 
 	pthread_t uds_thread;
 	if (pthread_create(&uds_thread, NULL, worker__uds_server, NULL)) {